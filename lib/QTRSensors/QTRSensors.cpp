@@ -1,6 +1,12 @@
 #include "QTRSensors.h"
 #include <Arduino.h>
 
+// The RC polling loop runs from tightly-coupled instruction memory on cores
+// that have it.
+#ifndef FASTRUN
+#define FASTRUN
+#endif
+
 void QTRSensors::setTypeRC()
 {
   _type = QTRType::RC;
@@ -34,10 +40,36 @@ void QTRSensors::setSensorPins(const uint8_t * pins, uint8_t sensorCount)
 
   _sensorCount = sensorCount;
 
+#if defined(__IMXRT1062__)
+  // Note which GPIO port holds each pin, so an RC read can charge, release
+  // and sample every sensor with one access per port. The pins are set up as
+  // GPIO inputs once here, after that only their direction bits change.
+  _portCount = 0;
+  for (uint8_t i = 0; i < sensorCount; i++)
+  {
+    pinMode(pins[i], INPUT);
+    volatile uint32_t * port = portInputRegister(pins[i]);
+    uint8_t p = 0;
+    while (p < _portCount && _ports[p] != port) { p++; }
+    if (p == _portCount)
+    {
+      _ports[_portCount] = port;
+      _portModes[_portCount] = portModeRegister(pins[i]);
+      _portSets[_portCount] = portSetRegister(pins[i]);
+      _portCount++;
+    }
+    _sensorPort[i] = p;
+    _sensorMask[i] = digitalPinToBitMask(pins[i]);
+  }
+#endif
+
   // Any previous calibration values are no longer valid, and the calibration
   // arrays might need to be reallocated if the sensor count was changed.
   calibrationOn.initialized = false;
   calibrationOff.initialized = false;
+
+  // The last known line position was measured with the old sensor set.
+  _lastPosition = 0;
 }
 
 void QTRSensors::setTimeout(uint16_t timeout)
@@ -554,21 +586,39 @@ void QTRSensors::readCalibrated(uint16_t * sensorValues, QTRReadMode mode)
 // start = 0 means start with the first sensor).
 // For example, step = 2, start = 1 means read the *even-numbered* sensors.
 // start defaults to 0, step defaults to 1
-void QTRSensors::readPrivate(uint16_t * sensorValues, uint8_t start, uint8_t step)
+FASTRUN void QTRSensors::readPrivate(uint16_t * sensorValues, uint8_t start, uint8_t step)
 {
   if (_sensorPins == nullptr) { return; }
 
   switch (_type)
   {
     case QTRType::RC:
+    {
+#if defined(__IMXRT1062__)
+      uint32_t masks[QTRMaxPorts];
+      selectPortMasks(start, step, masks);
+#endif
       for (uint8_t i = start; i < _sensorCount; i += step)
       {
         sensorValues[i] = _maxValue;
+#if !defined(__IMXRT1062__)
         // make sensor line an output (drives low briefly, but doesn't matter)
         pinMode(_sensorPins[i], OUTPUT);
         // drive sensor line high
         digitalWrite(_sensorPins[i], HIGH);
+#endif
+      }
+#if defined(__IMXRT1062__)
+      // set the lines' outputs high before making them outputs, a port at a
+      // time, so they never drive low
+      noInterrupts();
+      for (uint8_t p = 0; p < _portCount; p++)
+      {
+        *_portSets[p] = masks[p];
+        *_portModes[p] |= masks[p];
       }
+      interrupts();
+#endif
 
       delayMicroseconds(10); // charge lines for 10 us
 
@@ -581,38 +631,81 @@ void QTRSensors::readPrivate(uint16_t * sensorValues, uint8_t start, uint8_t ste
         // (similarly, time is checked before the first sensor is read in the
         // loop below)
         uint32_t startTime = micros();
-        uint16_t time = 0;
 
+#if defined(__IMXRT1062__)
+        for (uint8_t p = 0; p < _portCount; p++)
+        {
+          *_portModes[p] &= ~masks[p];
+        }
+#else
         for (uint8_t i = start; i < _sensorCount; i += step)
         {
           // make sensor line an input (should also ensure pull-up is disabled)
           pinMode(_sensorPins[i], INPUT);
         }
+#endif
 
         interrupts(); // re-enable
 
-        while (time < _maxValue)
+        // sensors whose line has not read low yet, bit i for sensor i
+        uint32_t pending = 0;
+        for (uint8_t i = start; i < _sensorCount; i += step)
+        {
+          pending |= (uint32_t)1 << i;
+        }
+
+        // stop as soon as every line has read low rather than waiting out the
+        // timeout
+        while (pending != 0)
         {
           // disable interrupts so we can read all the pins as close to the same
           // time as possible
           noInterrupts();
 
-          time = micros() - startTime;
-          for (uint8_t i = start; i < _sensorCount; i += step)
-          {
-            if ((digitalRead(_sensorPins[i]) == LOW) && (time < sensorValues[i]))
-            {
-              // record the first time the line reads low
-              sensorValues[i] = time;
-            }
-          }
+          uint16_t time = micros() - startTime;
+          uint32_t high = readSensorLevels(pending);
 
           interrupts(); // re-enable
+
+          // lines still high at the timeout keep the maximum value
+          if (time >= _maxValue) { break; }
+
+          // record the first time each line reads low
+          uint32_t fell = pending & ~high;
+          pending &= high;
+          while (fell != 0)
+          {
+            uint8_t i = __builtin_ctz(fell);
+            sensorValues[i] = time;
+            fell &= fell - 1;
+          }
         }
       }
       return;
+    }
 
     case QTRType::Analog:
+      if (_analogScan != nullptr)
+      {
+        uint8_t pins[QTRMaxSensors];
+        uint16_t values[QTRMaxSensors];
+        uint8_t count = 0;
+        for (uint8_t i = start; i < _sensorCount; i += step)
+        {
+          pins[count++] = _sensorPins[i];
+        }
+
+        if (_analogScan(pins, count, _samplesPerSensor, values))
+        {
+          count = 0;
+          for (uint8_t i = start; i < _sensorCount; i += step)
+          {
+            sensorValues[i] = values[count++];
+          }
+          return;
+        }
+      }
+
       // reset the values
       for (uint8_t i = start; i < _sensorCount; i += step)
       {
@@ -641,6 +734,47 @@ void QTRSensors::readPrivate(uint16_t * sensorValues, uint8_t start, uint8_t ste
   }
 }
 
+// Returns which of the given sensors (bit i for sensor i) read high. On the
+// Teensy 4 each GPIO port holding a sensor is loaded once, so the time this
+// takes hardly grows with the number of sensors.
+FASTRUN uint32_t QTRSensors::readSensorLevels(uint32_t sensors)
+{
+#if defined(__IMXRT1062__)
+  uint32_t levels[QTRMaxPorts];
+  for (uint8_t p = 0; p < _portCount; p++)
+  {
+    levels[p] = *_ports[p];
+  }
+  return levelsFromPorts(levels, _sensorPort, _sensorMask, sensors);
+#else
+  uint32_t high = 0;
+  while (sensors != 0)
+  {
+    uint8_t i = __builtin_ctz(sensors);
+    if (digitalRead(_sensorPins[i]) == HIGH) { high |= (uint32_t)1 << i; }
+    sensors &= sensors - 1;
+  }
+  return high;
+#endif
+}
+
+// The bits of the sensors read from start in steps of step, in each port
+// (Teensy 4 only).
+void QTRSensors::selectPortMasks(uint8_t start, uint8_t step, uint32_t * masks)
+{
+#if defined(__IMXRT1062__)
+  for (uint8_t p = 0; p < _portCount; p++) { masks[p] = 0; }
+  for (uint8_t i = start; i < _sensorCount; i += step)
+  {
+    masks[_sensorPort[i]] |= _sensorMask[i];
+  }
+#else
+  (void)start;
+  (void)step;
+  (void)masks;
+#endif
+}
+
 uint16_t QTRSensors::readLinePrivate(uint16_t * sensorValues, QTRReadMode mode,
                          bool invertReadings)
 {
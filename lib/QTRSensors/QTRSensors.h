@@ -67,9 +67,21 @@ const uint8_t QTRNoEmitterPin = 255;
 /// Default timeout for RC sensors (in microseconds).
 const uint16_t QTRRCDefaultTimeout = 2500;
 
+/// \brief Function that converts analog sensor pins in place of analogRead().
+///
+/// It converts each of the \p count pins \p samples times and stores the
+/// rounded average for each pin in \p values. It returns false if it cannot
+/// convert these pins, in which case they are read with analogRead().
+typedef bool (*QTRAnalogScan)(const uint8_t * pins, uint8_t count,
+                              uint8_t samples, uint16_t * values);
+
 /// The maximum number of sensors supported by an instance of this class.
 const uint8_t QTRMaxSensors = 31;
 
+/// The most GPIO ports the sensor pins can be spread over (GPIO6 to GPIO9 on
+/// the Teensy 4).
+const uint8_t QTRMaxPorts = 4;
+
 /// \brief Represents a QTR sensor array.
 ///
 /// An instance of this class represents a QTR sensor array, consisting of one
@@ -169,6 +181,18 @@ class QTRSensors
     /// The samples per sensor setting only applies to analog sensors.
     void setSamplesPerSensor(uint8_t samples);
 
+    /// \brief Sets a function that converts the analog sensors in place of
+    /// analogRead().
+    ///
+    /// \param scan The function, or nullptr to go back to analogRead().
+    ///
+    /// This lets a platform with more than one ADC convert several sensors
+    /// at once. It is called with the sensors read in one go, and with
+    /// setSamplesPerSensor() samples each.
+    ///
+    /// The scan function only applies to analog sensors.
+    void setAnalogScan(QTRAnalogScan scan) { _analogScan = scan; }
+
     /// \brief Returns the number of analog readings to average per analog
     /// sensor.
     ///
@@ -516,6 +540,28 @@ class QTRSensors
       return readLinePrivate(sensorValues, mode, true);
     }
 
+    /// \brief Picks the sensors that read high out of a load of each GPIO
+    /// port, as an RC read polls them on the Teensy 4.
+    ///
+    /// \param portLevels The input register of each port, loaded once.
+    /// \param sensorPort The index into portLevels of each sensor's port.
+    /// \param sensorMask Each sensor's bit in its port.
+    /// \param sensors The sensors to look at, bit i for sensor i.
+    ///
+    /// \return Which of the given sensors read high, bit i for sensor i.
+    static uint32_t levelsFromPorts(const uint32_t * portLevels,
+      const uint8_t * sensorPort, const uint32_t * sensorMask, uint32_t sensors)
+    {
+      uint32_t high = 0;
+      while (sensors != 0)
+      {
+        uint8_t i = __builtin_ctz(sensors);
+        if (portLevels[sensorPort[i]] & sensorMask[i]) { high |= (uint32_t)1 << i; }
+        sensors &= sensors - 1;
+      }
+      return high;
+    }
+
 
     /// \brief Stores sensor calibration data.
     ///
@@ -557,6 +603,10 @@ class QTRSensors
 
     void readPrivate(uint16_t * sensorValues, uint8_t start = 0, uint8_t step = 1);
 
+    uint32_t readSensorLevels(uint32_t sensors);
+
+    void selectPortMasks(uint8_t start, uint8_t step, uint32_t * masks);
+
     uint16_t readLinePrivate(uint16_t * sensorValues, QTRReadMode mode, bool invertReadings);
 
     QTRType _type = QTRType::Undefined;
@@ -567,6 +617,7 @@ class QTRSensors
     uint16_t _timeout = QTRRCDefaultTimeout; // only used for RC sensors
     uint16_t _maxValue = QTRRCDefaultTimeout; // the maximum value returned by readPrivate()
     uint8_t _samplesPerSensor = 4; // only used for analog sensors
+    QTRAnalogScan _analogScan = nullptr; // only used for analog sensors
 
     uint8_t _oddEmitterPin = QTRNoEmitterPin; // also used for single emitter pin
     uint8_t _evenEmitterPin = QTRNoEmitterPin;
@@ -576,4 +627,13 @@ class QTRSensors
     uint8_t _dimmingLevel = 0;
 
     uint16_t _lastPosition = 0;
+
+#if defined(__IMXRT1062__)
+    volatile uint32_t * _ports[QTRMaxPorts]; // input registers of the ports holding sensor pins
+    volatile uint32_t * _portModes[QTRMaxPorts]; // and their direction registers, a bit set drives the pin
+    volatile uint32_t * _portSets[QTRMaxPorts]; // and the registers that set output bits high
+    uint8_t _portCount = 0;
+    uint8_t _sensorPort[QTRMaxSensors]; // index into _ports for each sensor
+    uint32_t _sensorMask[QTRMaxSensors];
+#endif
 };
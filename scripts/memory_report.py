@@ -0,0 +1,54 @@
+"""
+PlatformIO post-build report of what the firmware puts in each memory region of the Teensy 4.
+
+RAM1 is 512 KB of tightly-coupled memory shared between ITCM, code that runs without the cache
+(everything but FLASHMEM, handed out in 32 KB banks), and DTCM, the variables not in DMAMEM. the
+stack grows down from the top of DTCM into what is left. RAM2 holds DMAMEM and the heap, flash
+the FLASHMEM code and a copy of the rest to load at startup. the report is taken from the section
+sizes of the linked ELF, laid out by the core's imxrt1062.ld.
+
+usage: extra_scripts = post:scripts/memory_report.py
+"""
+import subprocess
+
+Import("env")  # noqa: F821, provided by PlatformIO
+
+RAM1 = 512*1024
+RAM2 = 512*1024
+FLASH = 1984*1024  # Teensy 4.0, the last 64 KB hold the EEPROM emulation and the recovery image
+ITCM_BANK = 32*1024
+STACK_BUDGET = 32*1024  # warn when less than this is left in RAM1 for the stack
+
+def section_sizes(elf):
+    output = subprocess.run([env.subst("$SIZETOOL"), "-A", elf], check=True,  # noqa: F821
+                            capture_output=True, text=True).stdout
+    sizes = {}
+    for line in output.splitlines():
+        fields = line.split()
+        if len(fields) >= 2 and fields[0].startswith(".") and fields[1].isdigit():
+            sizes[fields[0]] = int(fields[1])
+    return sizes
+
+def kb(size):
+    return "%7.1f KB" % (size/1024)
+
+def report(source, target, env):
+    sizes = section_sizes(str(target[0]))
+    get = lambda *names: sum(sizes.get(name, 0) for name in names)
+
+    itcm = get(".text.itcm", ".ARM.exidx")
+    itcm_banks = (itcm + ITCM_BANK - 1)//ITCM_BANK
+    dtcm = get(".data", ".bss")
+    stack = RAM1 - itcm_banks*ITCM_BANK - dtcm
+    dma = get(".bss.dma")
+    flash = get(".text.headers", ".text.code", ".text.progmem", ".text.csf") + itcm + get(".data")
+
+    print("memory budget")
+    print("  ITCM   %s of %s code, %d banks of 32 KB" % (kb(itcm), kb(itcm_banks*ITCM_BANK), itcm_banks))
+    print("  DTCM   %s variables, %s left for the stack" % (kb(dtcm), kb(stack)))
+    print("  RAM2   %s DMAMEM of %s, the rest is the heap" % (kb(dma), kb(RAM2)))
+    print("  flash  %s of %s, FLASHMEM code %s" % (kb(flash), kb(FLASH), kb(get(".text.code"))))
+    if stack < STACK_BUDGET:
+        print("warning: only %s of RAM1 left for the stack, move cold code to FLASHMEM or buffers to DMAMEM" % kb(stack))
+
+env.AddPostAction("$BUILD_DIR/${PROGNAME}.elf", report)  # noqa: F821
@@ -0,0 +1,111 @@
+/**
+ * host stand-in for the Teensy Arduino core.
+ * only the subset of the core used by src/ and lib/ is provided. every call is routed to the
+ * simulated hardware owned by the calling thread (see SimHardware.h), which also charges a
+ * small amount of virtual time per call so that busy-wait loops in the control code terminate.
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdarg.h>
+#include <type_traits>
+
+#define HIGH 1
+#define LOW 0
+
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+#define INPUT_PULLDOWN 3
+
+//memory placement on the Teensy 4, everything is in ordinary memory here
+#define FASTRUN
+#define FLASHMEM
+#define DMAMEM
+
+#define RISING 2
+#define FALLING 3
+#define CHANGE 4
+
+//the core's helpers; min and max accept mixed argument types like the Teensy ones do
+template<class A, class B>
+constexpr typename std::common_type<A, B>::type min(const A & a, const B & b) { return b < a ? b : a; }
+template<class A, class B>
+constexpr typename std::common_type<A, B>::type max(const A & a, const B & b) { return a < b ? b : a; }
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+uint8_t digitalRead(uint8_t pin);
+int analogRead(uint8_t pin);
+void analogReadAveraging(unsigned int num);
+void analogWrite(uint8_t pin, int value);
+void analogWriteResolution(unsigned int bits);
+void analogWriteFrequency(uint8_t pin, float frequency);
+
+uint32_t micros();
+uint32_t millis();
+void delay(uint32_t ms);
+void delayMicroseconds(uint32_t us);
+uint32_t pulseIn(uint8_t pin, uint8_t state, uint32_t timeout = 1000000);
+
+void attachInterrupt(uint8_t pin, void (*function)(void), int mode);
+void detachInterrupt(uint8_t pin);
+#define digitalPinToInterrupt(p) (p)
+
+void simNoInterrupts();
+void simInterrupts();
+#define noInterrupts() simNoInterrupts()
+#define interrupts() simInterrupts()
+
+/**
+ * teensy periodic timer stand-in. the simulated hardware runs the function every period between
+ * the control code's own calls, charging what the function spends to the code it interrupted
+ */
+class IntervalTimer
+{
+  public:
+    bool begin(void (*function)(void), uint32_t periodUs);
+    void end();
+    void priority(uint8_t level) { (void)level; }
+};
+
+/**
+ * usb serial stand-in. output goes to the owning simulation's console sink, which is muted
+ * unless the simulation was started verbose
+ */
+class SimSerial
+{
+  public:
+    void begin(uint32_t baud) { (void)baud; }
+    int available();
+    int read();
+    size_t write(uint8_t b);
+    size_t write(const uint8_t * buffer, size_t size);
+
+    size_t print(const char * s);
+    size_t print(char c);
+    size_t print(int value);
+    size_t print(unsigned int value);
+    size_t print(long value);
+    size_t print(unsigned long value);
+    size_t print(double value, int digits = 2);
+
+    size_t println();
+    size_t println(const char * s);
+    size_t println(char c);
+    size_t println(int value);
+    size_t println(unsigned int value);
+    size_t println(long value);
+    size_t println(unsigned long value);
+    size_t println(double value, int digits = 2);
+
+    size_t printf(const char * format, ...) __attribute__((format(printf, 2, 3)));
+
+    explicit operator bool() { return true; }
+};
+
+extern SimSerial Serial;
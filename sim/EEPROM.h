@@ -0,0 +1,18 @@
+/**
+ * host stand-in for the Teensy EEPROM library, the bytes live in the calling thread's SimHardware
+ * (see SimHardware::eeprom()). only the byte access the control code uses is provided
+ */
+#pragma once
+
+#include <stdint.h>
+
+class EEPROMClass
+{
+  public:
+    uint8_t read(int index);
+    void write(int index, uint8_t value);
+    void update(int index, uint8_t value); // writes only a byte that differs, as the Teensy one does
+    int length() { return 1080; } // SIM_EEPROM_SIZE
+};
+
+extern EEPROMClass EEPROM;
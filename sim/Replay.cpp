@@ -0,0 +1,287 @@
+#include "Arduino.h"
+#include "Replay.h"
+
+#include <chrono>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#define MAX_MISSES_PER_TICK 10000 // a revision polling a sensor this often in one tick has diverged
+
+//the control code under test, from src/main.cpp
+void setup();
+void loop();
+
+/**
+ * reader
+ */
+SensorLogReader::~SensorLogReader(){
+    if(_mapping){
+        munmap(_mapping, _mappingLength);
+    }
+}
+
+bool SensorLogReader::open(const std::string & path, std::string * error){
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if(fd < 0){
+        *error = "cannot open " + path;
+        return false;
+    }
+    struct stat info;
+    if(fstat(fd, &info) != 0 || !S_ISREG(info.st_mode) || (size_t)info.st_size < sizeof(SensorLogHeader)){
+        ::close(fd);
+        *error = path + " is not a sensor log file";
+        return false;
+    }
+    _mappingLength = (size_t)info.st_size;
+    _mapping = mmap(nullptr, _mappingLength, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if(_mapping == MAP_FAILED){
+        _mapping = nullptr;
+        *error = "cannot map " + path;
+        return false;
+    }
+    madvise(_mapping, _mappingLength, MADV_SEQUENTIAL);
+
+    const SensorLogHeader * header = (const SensorLogHeader *)_mapping;
+    if(header->magic != SENSOR_LOG_MAGIC || header->version != SENSOR_LOG_VERSION
+        || header->recordSize != sizeof(SensorLogRecord)){
+        *error = path + " has an unsupported log header";
+        return false;
+    }
+    _records = (const SensorLogRecord *)((const char *)_mapping + sizeof(SensorLogHeader));
+    // a log cut off mid-record (robot reset while recording) is replayed up to the last whole record
+    _count = (_mappingLength - sizeof(SensorLogHeader))/sizeof(SensorLogRecord);
+    return true;
+}
+
+/**
+ * recording
+ */
+static thread_local FILE * logFile = nullptr;
+
+static void fileSink(const SensorLogRecord & record){
+    fwrite(&record, sizeof(record), 1, logFile);
+    SimHardware::current().noteLogRecord();
+}
+
+static bool writeHeader(FILE * file){
+    SensorLogHeader header = {SENSOR_LOG_MAGIC, SENSOR_LOG_VERSION, sizeof(SensorLogRecord)};
+    return fwrite(&header, sizeof(header), 1, file) == 1;
+}
+
+bool startSensorLogFile(const std::string & path){
+    stopSensorLogFile();
+    logFile = fopen(path.c_str(), "wb");
+    if(logFile == nullptr || !writeHeader(logFile)){
+        return false;
+    }
+    setSensorLogSink(fileSink);
+    return true;
+}
+
+void stopSensorLogFile(){
+    setSensorLogSink(nullptr);
+    if(logFile){
+        fclose(logFile);
+        logFile = nullptr;
+    }
+}
+
+long extractSensorLog(const std::string & capturePath, const std::string & logPath){
+    FILE * in = fopen(capturePath.c_str(), "rb");
+    if(in == nullptr){
+        return -1;
+    }
+    FILE * out = fopen(logPath.c_str(), "wb");
+    if(out == nullptr || !writeHeader(out)){
+        fclose(in);
+        if(out){
+            fclose(out);
+        }
+        return -1;
+    }
+
+    // scan for sync bytes; a frame whose checksum fails is text that happened to contain them
+    std::vector<uint8_t> window;
+    const size_t frameLength = 2 + sizeof(SensorLogRecord) + 1;
+    long records = 0;
+    int c;
+    while((c = fgetc(in)) != EOF){
+        window.push_back((uint8_t)c);
+        if(window.size() < frameLength){
+            continue;
+        }
+        if(window[0] == SENSOR_LOG_SYNC_0 && window[1] == SENSOR_LOG_SYNC_1){
+            uint8_t checksum = 0;
+            for(size_t i = 2; i < 2 + sizeof(SensorLogRecord); i++){
+                checksum += window[i];
+            }
+            if(checksum == window[frameLength - 1]){
+                fwrite(&window[2], sizeof(SensorLogRecord), 1, out);
+                records++;
+                window.clear();
+                continue;
+            }
+        }
+        window.erase(window.begin());
+    }
+    fclose(in);
+    fclose(out);
+    return records;
+}
+
+/**
+ * replay
+ */
+static thread_local ReplaySession * currentSession = nullptr;
+
+ReplaySession::ReplaySession(const SensorLogReader & log, FILE * trace)
+    : _log(log), _trace(trace){
+    // the track only backs the unused physics; every sensing call is answered from the log
+    _track.load("oval");
+    _config.duration = 0;
+    for(int i = 0; i < SIM_PIN_COUNT; i++){
+        _motorState[i] = -1;
+    }
+}
+
+const SensorLogRecord * ReplaySession::serve(uint8_t kind){
+    return currentSession->next(kind);
+}
+
+void ReplaySession::capture(const SensorLogRecord & record){
+    ReplaySession & session = *currentSession;
+    if(record.kind != LOG_STATE){
+        return;
+    }
+    session._stats.stateChanges++;
+    if(session._trace){
+        uint32_t tickTime = session._tickBegin > 0 ? session._log[session._tickBegin - 1].timeUs : 0;
+        fprintf(session._trace, "%10u state %d (from %d)\n", tickTime, (int)record.values[0], (int)record.values[1]);
+    }
+}
+
+void ReplaySession::onMotorOutput(const SimHardware & hardware, uint8_t pin, int value){
+    (void)hardware;
+    if(_motorState[pin] == value){
+        return;
+    }
+    _motorState[pin] = value;
+    _stats.motorCommands++;
+    if(_trace){
+        const char * name = pin == SIM_MOTOR_RIGHT_PWM_PIN ? "right pwm"
+            : pin == SIM_MOTOR_LEFT_PWM_PIN ? "left pwm"
+            : pin == SIM_MOTOR_RIGHT_DIR_PIN ? "right dir" : "left dir";
+        uint32_t tickTime = _tickBegin > 0 ? _log[_tickBegin - 1].timeUs : 0;
+        fprintf(_trace, "%10u %s %d\n", tickTime, name, value);
+    }
+}
+
+void ReplaySession::beginTick(size_t first, size_t end){
+    _tickBegin = first;
+    _tickEnd = end;
+    _tickMisses = 0;
+    for(int kind = 0; kind < LOG_KIND_COUNT; kind++){
+        _cursor[kind] = first;
+    }
+    //what the console read in this tick arrives on Serial again, rather than being served, so that
+    //the console goes through the same reads as when it was recorded
+    for(size_t i = first; i < end; i++){
+        const SensorLogRecord & record = _log[i];
+        if(record.kind != LOG_SERIAL_INPUT){
+            continue;
+        }
+        std::string bytes;
+        for(int b = 0; b < record.values[0] && b < 8; b++){
+            bytes += (char)((uint32_t)record.values[1 + b/4] >> (8*(b % 4)));
+        }
+        _hardware->queueSerialInput(0, bytes);
+    }
+}
+
+/**
+ * next unserved record of a kind in the current tick. a revision that reads a sensor more often
+ * than the recorded one gets the last value again, which is counted as a miss
+ */
+const SensorLogRecord * ReplaySession::next(uint8_t kind){
+    if(kind >= LOG_KIND_COUNT){
+        return nullptr;
+    }
+    for(size_t i = _cursor[kind]; i < _tickEnd; i++){
+        if(_log[i].kind == kind){
+            _cursor[kind] = i + 1;
+            _last[kind] = &_log[i];
+            _stats.recordsServed++;
+            _hardware->syncClock((uint64_t)_log[i].timeUs*1000);
+            return &_log[i];
+        }
+    }
+    _cursor[kind] = _tickEnd;
+    _stats.misses++;
+    if(++_tickMisses > MAX_MISSES_PER_TICK){
+        // e.g. waiting on an encoder count the recording never reached
+        throw std::runtime_error("replay diverged from the recording");
+    }
+    return _last[kind];
+}
+
+ReplayStats ReplaySession::run(){
+    auto hostStart = std::chrono::steady_clock::now();
+    SimHardware hardware(_track, _config);
+    _hardware = &hardware;
+    hardware.setObserver(this);
+    for(int kind = 0; kind < LOG_KIND_COUNT; kind++){
+        _last[kind] = nullptr;
+    }
+
+    currentSession = this;
+    hardware.makeCurrent();
+    setSensorReplaySource(serve);
+    setSensorLogSink(capture);
+
+    size_t index = 0;
+    size_t count = _log.size();
+    auto nextTick = [&](size_t from){
+        while(from < count && _log[from].kind != LOG_TICK){
+            from++;
+        }
+        return from;
+    };
+
+    size_t tick = nextTick(0);
+    try{
+        beginTick(0, tick);
+        setup();
+
+        while(tick < count){
+            index = nextTick(tick + 1);
+            hardware.syncClock((uint64_t)_log[tick].timeUs*1000);
+            beginTick(tick + 1, index);
+            if(_trace){
+                fprintf(_trace, "%10u tick %zu\n", _log[tick].timeUs, _stats.ticks);
+            }
+            loop();
+            _stats.ticks++;
+            tick = index;
+        }
+    }
+    catch(const std::runtime_error &){
+        _stats.diverged = true;
+        if(_trace){
+            fprintf(_trace, "# diverged in tick %zu\n", _stats.ticks);
+        }
+    }
+
+    setSensorReplaySource(nullptr);
+    setSensorLogSink(nullptr);
+    SimHardware::releaseCurrent();
+    currentSession = nullptr;
+
+    _stats.simulatedSeconds = hardware.seconds();
+    _stats.hostSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - hostStart).count();
+    return _stats;
+}
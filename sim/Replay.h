@@ -0,0 +1,93 @@
+/**
+ * recording and deterministic replay of sensor logs (src/SensorLog.h) on the host.
+ *
+ * a replay feeds the recorded values back through the unmodified sensing API one loop() at a
+ * time, on a virtual clock that follows the recorded timestamps, and writes a text trace of the
+ * resulting motor commands and state transitions. two traces of the same log from different
+ * controller revisions can be compared with diff.
+ */
+#pragma once
+
+#include "SensorLog.h"
+#include "SimHardware.h"
+
+#include <stdio.h>
+#include <string>
+
+/**
+ * read-only view of a log file. regular files are memory mapped, so a multi-minute log is paged
+ * in as the replay walks it rather than loaded up front
+ */
+class SensorLogReader
+{
+  public:
+    ~SensorLogReader();
+
+    bool open(const std::string & path, std::string * error);
+
+    size_t size() const { return _count; }
+    const SensorLogRecord & operator[](size_t index) const { return _records[index]; }
+
+  private:
+    void * _mapping = nullptr;
+    size_t _mappingLength = 0;
+    const SensorLogRecord * _records = nullptr;
+    size_t _count = 0;
+};
+
+/**
+ * append records logged by the calling thread's robot to a log file until stopped
+ */
+bool startSensorLogFile(const std::string & path);
+void stopSensorLogFile();
+
+/**
+ * split a raw Serial capture from a SENSOR_LOG_SERIAL build into a log file.
+ * returns the number of records written, or -1 on an I/O error
+ */
+long extractSensorLog(const std::string & capturePath, const std::string & logPath);
+
+struct ReplayStats {
+    size_t ticks = 0;
+    size_t recordsServed = 0;
+    size_t misses = 0;       // sensing calls with no matching record in their tick
+    size_t stateChanges = 0;
+    size_t motorCommands = 0;
+    bool diverged = false;   // the replayed code waited on values the recording never produced
+    double hostSeconds = 0;
+    double simulatedSeconds = 0;
+};
+
+class ReplaySession : private SimObserver
+{
+  public:
+    ReplaySession(const SensorLogReader & log, FILE * trace);
+
+    /**
+     * run setup() over the records before the first tick marker, then one loop() per marker
+     */
+    ReplayStats run();
+
+  private:
+    static const SensorLogRecord * serve(uint8_t kind);
+    static void capture(const SensorLogRecord & record);
+
+    void onPhysicsStep(const SimHardware & hardware) override { (void)hardware; }
+    void onMotorOutput(const SimHardware & hardware, uint8_t pin, int value) override;
+    void beginTick(size_t first, size_t end);
+    const SensorLogRecord * next(uint8_t kind);
+
+    const SensorLogReader & _log;
+    FILE * _trace;
+    Track _track;
+    SimConfig _config;
+    SimHardware * _hardware = nullptr;
+    ReplayStats _stats;
+
+    size_t _tickBegin = 0;
+    size_t _tickEnd = 0;
+    size_t _tickMisses = 0;
+    size_t _cursor[LOG_KIND_COUNT];
+    const SensorLogRecord * _last[LOG_KIND_COUNT];
+    int _motorState[SIM_PIN_COUNT];
+};
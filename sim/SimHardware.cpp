@@ -0,0 +1,720 @@
+#include "Arduino.h"
+#include "SimHardware.h"
+#include "EEPROM.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <stdexcept>
+
+//virtual cost of core calls on the Teensy 4.0 at 600 MHz, in nanoseconds
+#define COST_MICROS 20
+#define COST_DIGITAL_IO 40
+#define COST_PIN_MODE 120
+#define COST_ANALOG_CONVERSION 1250 // analogRead takes this times the averaging, 4 by default
+#define COST_ANALOG_WRITE 300
+#define COST_SERIAL 1500
+#define COST_SERIAL_POLL 60 // Serial.available() or read() of a byte the USB stack already holds
+#define COST_LOOP_OVERHEAD 500
+#define COST_EEPROM_READ 100
+#define COST_EEPROM_WRITE 40000 // a byte written to the flash the EEPROM is emulated in, erases left out
+#define GRAVITY 9810 // mm/s^2
+#define ULTRASONIC_NO_ECHO_US 38000 // HC-SR04 echo pulse when nothing is in range
+
+static thread_local SimHardware * currentHardware = nullptr;
+
+SimSerial Serial;
+
+SimHardware::SimHardware(const Track & track, const SimConfig & config)
+    : _track(track), _config(config), _rng(config.seed){
+    _physicsStepNs = (uint64_t)(config.physicsStep*1e9);
+    _nextPhysicsNs = _physicsStepNs;
+
+    // start with the QTR bar centred over the start of the line, facing along it
+    double heading;
+    Vec2 start = track.pointAt(0, &heading);
+    _pose.heading = heading;
+    _pose.x = start.x - config.robot.sensorOffset*cos(heading);
+    _pose.y = start.y - config.robot.sensorOffset*sin(heading);
+
+    for(SimObstacle & obstacle : _config.obstacles){
+        if(obstacle.trackPosition >= 0){
+            Vec2 at = track.pointAt(obstacle.trackPosition, nullptr);
+            obstacle.x = at.x;
+            obstacle.y = at.y;
+        }
+    }
+    for(const auto & line : _config.serialInput){
+        queueSerialInput((uint64_t)(line.first*1e9), line.second + "\n");
+    }
+}
+
+void SimHardware::makeCurrent(){
+    currentHardware = this;
+}
+
+void SimHardware::releaseCurrent(){
+    currentHardware = nullptr;
+}
+
+bool SimHardware::bound(){
+    return currentHardware != nullptr;
+}
+
+SimHardware & SimHardware::current(){
+    if(currentHardware == nullptr){
+        throw std::logic_error("Arduino call made on a thread with no simulated hardware bound");
+    }
+    return *currentHardware;
+}
+
+/**
+ * the QTR bar is perpendicular to the heading; sensor 0 is on the left
+ */
+Vec2 SimHardware::sensorPosition(int index) const{
+    const SimRobotParams & robot = _config.robot;
+    double lateral = (robot.qtrCount - 1)/2.0*robot.sensorSpacing - index*robot.sensorSpacing;
+    double c = cos(_pose.heading);
+    double s = sin(_pose.heading);
+    return {_pose.x + robot.sensorOffset*c - lateral*s, _pose.y + robot.sensorOffset*s + lateral*c};
+}
+
+Vec2 SimHardware::sensorBarCentre() const{
+    double c = cos(_pose.heading);
+    double s = sin(_pose.heading);
+    return {_pose.x + _config.robot.sensorOffset*c, _pose.y + _config.robot.sensorOffset*s};
+}
+
+double SimHardware::gaussian(double sigma){
+    return _normal(_rng)*sigma;
+}
+
+double SimHardware::uniform(){
+    return _uniform(_rng);
+}
+
+/**
+ * clock
+ */
+void SimHardware::charge(uint64_t ns){
+    advanceTo(_nowNs + ns);
+}
+
+/**
+ * run the physics and any timers up to targetNs. time spent in the timers pushes the target back
+ * as it would delay the interrupted code, unless the target is a recorded time that already includes it
+ */
+void SimHardware::advanceTo(uint64_t targetNs, bool delayedByTimers){
+    if(_inTimer){
+        //the clock stands still inside a timer interrupt, the interrupted code pays for it afterwards
+        _timerCostNs += targetNs > _nowNs ? targetNs - _nowNs : 0;
+        return;
+    }
+    for(;;){
+        Timer * due = nullptr;
+        for(Timer & timer : _timers){
+            if(due == nullptr || timer.nextNs < due->nextNs){
+                due = &timer;
+            }
+        }
+        if(due != nullptr && due->nextNs < _nextPhysicsNs){
+            if(due->nextNs > targetNs){
+                break;
+            }
+            _nowNs = due->nextNs;
+            uint64_t spent = fireTimer(*due);
+            if(delayedByTimers){
+                targetNs += spent;
+            }
+        }
+        else{
+            if(_nextPhysicsNs > targetNs){
+                break;
+            }
+            _nowNs = _nextPhysicsNs;
+            stepPhysics(_physicsStepNs*1e-9);
+            _nextPhysicsNs += _physicsStepNs;
+        }
+    }
+    if(targetNs > _nowNs){
+        _nowNs = targetNs;
+    }
+}
+
+/**
+ * earliest future time at which anything observable by the control code changes
+ */
+uint64_t SimHardware::nextEventNs() const{
+    uint64_t next = _nextPhysicsNs;
+    for(int i = 0; i < _config.robot.qtrCount; i++){
+        const Pin & pin = _pins[SIM_IR_PIN_FIRST + i];
+        if(pin.mode == INPUT_MODE && pin.charged && pin.dischargeAt > _nowNs){
+            next = std::min(next, pin.dischargeAt);
+        }
+    }
+    for(const Timer & timer : _timers){
+        next = std::min(next, timer.nextNs);
+    }
+    return next;
+}
+
+void SimHardware::chargeLoopOverhead(){
+    _sideEffects++;
+    charge(COST_LOOP_OVERHEAD);
+}
+
+uint32_t SimHardware::micros(){
+    if(!_inTimer){
+        _quietMicros = _sideEffects == _sideEffectsAtLastMicros ? _quietMicros + 1 : 0;
+    }
+    if(_quietMicros >= 2 && !_inTimer){
+        // nothing but pin reads before this call and the last: the caller is polling, so skip
+        // straight to the next moment a pin or the physics can change instead of spinning through
+        // each cycle. one quiet call alone is as likely two functions that each read the clock once,
+        // where a skip to a pin's change would not come out the same in a replay without the pins
+        uint64_t next = nextEventNs();
+        advanceTo(next > _nowNs ? next : _nowNs + COST_MICROS);
+    }
+    else if(_inTimer){
+        //an interrupt's read of the clock tells nothing about whether the code it interrupted polls
+        charge(COST_MICROS);
+        return (uint32_t)(_nowNs/1000);
+    }
+    else{
+        charge(COST_MICROS);
+    }
+    _sideEffectsAtLastMicros = _sideEffects;
+    return (uint32_t)(_nowNs/1000);
+}
+
+uint32_t SimHardware::millis(){
+    _sideEffects++;
+    charge(COST_MICROS);
+    return (uint32_t)(_nowNs/1000000);
+}
+
+void SimHardware::delayMicroseconds(uint64_t us){
+    _sideEffects++;
+    charge(us*1000);
+}
+
+/**
+ * pins
+ */
+int SimHardware::qtrIndex(uint8_t pin) const{
+    if(pin >= SIM_IR_PIN_FIRST && pin < SIM_IR_PIN_FIRST + _config.robot.qtrCount){
+        return pin - SIM_IR_PIN_FIRST;
+    }
+    return -1;
+}
+
+void SimHardware::pinMode(uint8_t pin, uint8_t mode){
+    _sideEffects++;
+    charge(COST_PIN_MODE);
+    if(pin >= SIM_PIN_COUNT){
+        return;
+    }
+    Pin & p = _pins[pin];
+    uint8_t newMode = mode == OUTPUT ? OUTPUT_MODE : INPUT_MODE;
+
+    int sensor = qtrIndex(pin);
+    if(sensor >= 0 && p.mode == OUTPUT_MODE && newMode == INPUT_MODE && p.charged){
+        // releasing a charged RC line starts the discharge through the phototransistor
+        p.dischargeAt = _nowNs + (uint64_t)(dischargeTimeUs(sensor)*1000);
+    }
+    p.mode = newMode;
+}
+
+bool SimHardware::isMotorPin(uint8_t pin) const{
+    return pin == SIM_MOTOR_LEFT_PWM_PIN || pin == SIM_MOTOR_RIGHT_PWM_PIN
+        || pin == SIM_MOTOR_LEFT_DIR_PIN || pin == SIM_MOTOR_RIGHT_DIR_PIN;
+}
+
+void SimHardware::digitalWrite(uint8_t pin, uint8_t value){
+    _sideEffects++;
+    charge(COST_DIGITAL_IO);
+    if(pin >= SIM_PIN_COUNT){
+        return;
+    }
+    Pin & p = _pins[pin];
+    p.level = value ? 1 : 0;
+    if(p.mode == OUTPUT_MODE){
+        p.charged = p.level;
+    }
+    if(pin == SIM_MOTOR_LEFT_PWM_PIN || pin == SIM_MOTOR_RIGHT_PWM_PIN){
+        p.analogValue = value ? _analogWriteMax : 0;
+    }
+    if(_observer && isMotorPin(pin)){
+        _observer->onMotorOutput(*this, pin, pin == SIM_MOTOR_LEFT_PWM_PIN || pin == SIM_MOTOR_RIGHT_PWM_PIN ? p.analogValue : p.level);
+    }
+}
+
+uint8_t SimHardware::digitalRead(uint8_t pin){
+    charge(COST_DIGITAL_IO);
+    if(pin >= SIM_PIN_COUNT){
+        return 0;
+    }
+    Pin & p = _pins[pin];
+    if(p.mode == OUTPUT_MODE){
+        return p.level;
+    }
+    if(qtrIndex(pin) >= 0){
+        return (p.charged && _nowNs < p.dischargeAt) ? HIGH : LOW;
+    }
+    return p.level;
+}
+
+int SimHardware::analogRead(uint8_t pin){
+    _sideEffects++;
+    charge(COST_ANALOG_CONVERSION*_analogAveraging);
+    double value = 0;
+    if(pin == SIM_MIC_PIN_0){
+        value = micSample(0);
+    }
+    else if(pin == SIM_MIC_PIN_1){
+        value = micSample(1);
+    }
+    else if(pin == SIM_MIC_PIN_2){
+        value = micSample(2);
+    }
+    return std::max(0, std::min(1023, (int)lround(value)));
+}
+
+void SimHardware::analogReadAveraging(unsigned int num){
+    _sideEffects++;
+    _analogAveraging = std::max(1u, num);
+}
+
+void SimHardware::analogWrite(uint8_t pin, int value){
+    _sideEffects++;
+    charge(COST_ANALOG_WRITE);
+    if(pin < SIM_PIN_COUNT){
+        _pins[pin].analogValue = std::max(0, std::min(_analogWriteMax, value));
+        if(_observer && isMotorPin(pin)){
+            _observer->onMotorOutput(*this, pin, _pins[pin].analogValue);
+        }
+    }
+}
+
+void SimHardware::analogWriteResolution(unsigned int bits){
+    _sideEffects++;
+    _analogWriteMax = (1 << std::max(1u, std::min(16u, bits))) - 1;
+}
+
+void SimHardware::analogWriteFrequency(uint8_t pin, float frequency){
+    //the motors are simulated by their mean duty, the PWM frequency changes nothing
+    (void)pin;
+    (void)frequency;
+    _sideEffects++;
+}
+
+void SimHardware::attachInterrupt(uint8_t pin, void (*function)(void), int mode){
+    _sideEffects++;
+    if(pin < SIM_PIN_COUNT && mode == RISING){
+        _pins[pin].isr = function;
+    }
+}
+
+void SimHardware::detachInterrupt(uint8_t pin){
+    _sideEffects++;
+    if(pin < SIM_PIN_COUNT){
+        _pins[pin].isr = nullptr;
+    }
+}
+
+void SimHardware::setInterruptsEnabled(bool enabled){
+    _interruptsEnabled = enabled;
+    if(enabled && !_pendingInterrupts.empty()){
+        std::vector<PendingInterrupt> pending;
+        pending.swap(_pendingInterrupts);
+        //run as fireTimer() would have, so that a held interrupt is not itself interrupted by the next
+        for(const PendingInterrupt & held : pending){
+            //a held edge reads the clock at the edge: the wait of a poll with interrupts off is
+            //skipped in one go, where the hardware would take the edge between two of its reads
+            uint64_t nowNs = _nowNs;
+            _nowNs = std::min(held.atNs, nowNs);
+            _inInterrupt = true;
+            _inTimer = true;
+            _timerCostNs = 0;
+            held.isr();
+            _inTimer = false;
+            _inInterrupt = false;
+            _nowNs = nowNs;
+            charge(_timerCostNs);
+        }
+    }
+}
+
+/**
+ * run a pin's interrupt at atNs, a moment of the physics step that just ran. the clock stands still
+ * inside as in a timer and what the function spends is left out, a few micros() at most
+ */
+void SimHardware::fireInterrupt(uint8_t pin, uint64_t atNs){
+    void (*isr)(void) = _pins[pin].isr;
+    if(isr == nullptr){
+        return;
+    }
+    if(_interruptsEnabled && !_inInterrupt){
+        uint64_t nowNs = _nowNs;
+        _nowNs = std::min(atNs, nowNs);
+        _inInterrupt = true;
+        _inTimer = true;
+        isr();
+        _inTimer = false;
+        _inInterrupt = false;
+        _nowNs = nowNs;
+    }
+    else{
+        _pendingInterrupts.push_back({isr, atNs});
+    }
+}
+
+void SimHardware::beginTimer(const void * owner, void (*function)(void), uint32_t periodUs){
+    _sideEffects++;
+    endTimer(owner);
+    uint64_t periodNs = (uint64_t)std::max(1u, periodUs)*1000;
+    //on a grid from time zero like the physics, so a replay runs the timer at the recorded moments
+    //even if setup() took a different time
+    _timers.push_back({owner, function, periodNs, (_nowNs/periodNs + 1)*periodNs});
+}
+
+void SimHardware::endTimer(const void * owner){
+    _timers.erase(std::remove_if(_timers.begin(), _timers.end(),
+        [owner](const Timer & timer){ return timer.owner == owner; }), _timers.end());
+}
+
+/**
+ * run a timer's function at its due time and schedule the next. returns the time it took
+ */
+uint64_t SimHardware::fireTimer(Timer & timer){
+    timer.nextNs += timer.periodNs;
+    void (*isr)(void) = timer.isr;
+    if(!_interruptsEnabled || _inInterrupt){
+        //held like the interrupt controller would, a timer that is already pending is not queued twice
+        if(std::find_if(_pendingInterrupts.begin(), _pendingInterrupts.end(),
+                [isr](const PendingInterrupt & held){ return held.isr == isr; }) == _pendingInterrupts.end()){
+            _pendingInterrupts.push_back({isr, UINT64_MAX});
+        }
+        return 0;
+    }
+    _inInterrupt = true;
+    _inTimer = true;
+    _timerCostNs = 0;
+    isr();
+    _inTimer = false;
+    _inInterrupt = false;
+    return _timerCostNs;
+}
+
+uint8_t SimHardware::eepromRead(int index){
+    charge(COST_EEPROM_READ);
+    return index >= 0 && index < SIM_EEPROM_SIZE ? _eeprom[index] : 0xff;
+}
+
+void SimHardware::eepromWrite(int index, uint8_t value){
+    _sideEffects++;
+    charge(COST_EEPROM_WRITE);
+    if(index >= 0 && index < SIM_EEPROM_SIZE){
+        _eeprom[index] = value;
+        _eepromWrites++;
+    }
+}
+
+void SimHardware::serialWrite(const char * text, size_t length){
+    _sideEffects++;
+    charge(COST_SERIAL);
+    if(_config.verbose){
+        fwrite(text, 1, length, stdout);
+    }
+    if(_serialCapture){
+        _serialCapture->append(text, length);
+    }
+}
+
+void SimHardware::queueSerialInput(uint64_t atNs, const std::string & text){
+    //kept in order of arrival, text queued for earlier than what is pending arrives after it
+    if(!_serialInput.empty()){
+        atNs = std::max(atNs, _serialInput.back().first);
+    }
+    for(char c : text){
+        _serialInput.emplace_back(atNs, c);
+    }
+}
+
+int SimHardware::serialAvailable(){
+    charge(COST_SERIAL_POLL);
+    int available = 0;
+    for(const auto & pending : _serialInput){
+        if(pending.first > _nowNs){
+            break;
+        }
+        available++;
+    }
+    return available;
+}
+
+int SimHardware::serialRead(){
+    charge(COST_SERIAL_POLL);
+    if(_serialInput.empty() || _serialInput.front().first > _nowNs){
+        return -1;
+    }
+    _sideEffects++;
+    char c = _serialInput.front().second;
+    _serialInput.pop_front();
+    return (uint8_t)c;
+}
+
+/**
+ * sensors
+ */
+double SimHardware::dischargeTimeUs(int sensor){
+    const SimRobotParams & robot = _config.robot;
+    Vec2 p = sensorPosition(sensor);
+    // the phototransistor sees roughly a 3 mm spot
+    double darkness = 0;
+    for(int dy = -1; dy <= 1; dy++){
+        for(int dx = -1; dx <= 1; dx++){
+            darkness += _track.darknessAt(p.x + dx, p.y + dy);
+        }
+    }
+    darkness /= 9*255.0;
+    double t = std::max(10.0, robot.qtrWhiteUs + (robot.qtrBlackUs - robot.qtrWhiteUs)*darkness + gaussian(robot.qtrNoiseUs));
+    const Pin & emitter = _pins[SIM_IR_EMITTER_PIN];
+    return qtrResponse(robot, t, emitter.mode != OUTPUT_MODE || emitter.level, seconds());
+}
+
+/**
+ * RC discharge time of a QTR channel that discharges in emitterUs on the emitters' light alone,
+ * at seconds into the run. the phototransistor current, and so the discharge rate, follows the
+ * light from the emitters, when lit, and the ambient light together
+ */
+double SimHardware::qtrResponse(const SimRobotParams & robot, double emitterUs, bool lit, double seconds){
+    double ambient = robot.ambientLight*(1 + robot.ambientDrift*sin(2*M_PI*seconds/robot.ambientDriftPeriod)
+        + robot.ambientFlicker*sin(2*M_PI*robot.ambientFlickerHz*seconds));
+    if(ambient <= 0){
+        return lit ? emitterUs : 1e6;//nothing discharges the line, the read times out
+    }
+    return std::max(10.0, 1/((lit ? 1/emitterUs : 0) + ambient/robot.qtrWhiteUs));
+}
+
+/**
+ * a bump produces a decaying impulse on each mic, strongest on the mic facing the impact
+ */
+double SimHardware::micResponse(const SimRobotParams & robot, int mic, double bearing, double strength, double sinceBump){
+    static const double micBearings[3] = {-45, 180, 45};
+    double impact = bearing*M_PI/180;
+    double at = micBearings[mic]*M_PI/180;
+    double dx = robot.bodyRadius*cos(impact) - robot.micRadius*cos(at);
+    double dy = robot.bodyRadius*sin(impact) - robot.micRadius*sin(at);
+    double t = sinceBump - sqrt(dx*dx + dy*dy)/robot.soundSpeed;
+    if(t < 0 || t > 10*robot.micDecay){
+        return 0;
+    }
+    double facing = cos(impact - at);
+    double coupling = 0.25 + 0.75*std::max(0.0, facing);
+    return strength*coupling*exp(-t/robot.micDecay);
+}
+
+double SimHardware::micSample(int mic){
+    const SimRobotParams & robot = _config.robot;
+    double value = robot.micBaseline + gaussian(robot.micNoise);
+    for(const SimBump & bump : _config.bumps){
+        value += micResponse(robot, mic, bump.bearing, bump.strength, seconds() - bump.time);
+    }
+    return value;
+}
+
+/**
+ * distance in metres from the transducer to the nearest obstacle surface inside the beam,
+ * or a negative value when nothing echoes
+ */
+double SimHardware::ultrasonicRange(){
+    const SimRobotParams & robot = _config.robot;
+    double c = cos(_pose.heading);
+    double s = sin(_pose.heading);
+    Vec2 origin = {_pose.x + robot.ultrasonicOffset*c, _pose.y + robot.ultrasonicOffset*s};
+
+    double best = -1;
+    for(const SimObstacle & obstacle : _config.obstacles){
+        if(!obstacle.presentAt(seconds())){
+            continue;
+        }
+        double dx = obstacle.x - origin.x;
+        double dy = obstacle.y - origin.y;
+        double centre = std::hypot(dx, dy);
+        double bearing = atan2(dy, dx) - _pose.heading;
+        bearing = atan2(sin(bearing), cos(bearing));
+        double halfWidth = centre > obstacle.radius ? asin(obstacle.radius/centre) : M_PI;
+        if(fabs(bearing) - halfWidth > robot.ultrasonicCone*M_PI/180){
+            continue;
+        }
+        double range = std::max(0.0, centre - obstacle.radius)/1000;
+        if(best < 0 || range < best){
+            best = range;
+        }
+    }
+    return best;
+}
+
+uint32_t SimHardware::pulseIn(uint8_t pin, uint8_t state, uint32_t timeout){
+    _sideEffects++;
+    if(pin != SIM_ECHO_PIN || state != HIGH){
+        charge((uint64_t)timeout*1000);
+        return 0;
+    }
+    const SimRobotParams & robot = _config.robot;
+    double range = ultrasonicRange();
+    // the random draws are only made when enabled, so the other noise streams stay as they were
+    if(robot.ultrasonicDropout > 0 && uniform() < robot.ultrasonicDropout){
+        range = -1;
+    }
+    else if(robot.ultrasonicSpurious > 0 && uniform() < robot.ultrasonicSpurious){
+        range = 0.03 + 0.77*uniform();
+    }
+    else if(range >= 0 && robot.ultrasonicNoise > 0){
+        range = std::max(0.0, range + gaussian(robot.ultrasonicNoise));
+    }
+    // inverse of the conversion in getDistanceValue(), so that the robot measures true range
+    double echoUs = range < 0 ? ULTRASONIC_NO_ECHO_US : std::max(0.0, (range - 0.0069)/0.0002);
+    if(echoUs > timeout){
+        charge((uint64_t)timeout*1000);
+        return 0;
+    }
+    // the echo line rises ~450 us after the trigger burst and stays high for the flight time
+    charge(450000 + (uint64_t)(echoUs*1000));
+    return (uint32_t)echoUs;
+}
+
+/**
+ * physics
+ */
+double SimHardware::wheelTarget(uint8_t dirPin, uint8_t pwmPin, double gain) const{
+    const SimRobotParams & robot = _config.robot;
+    double duty = (double)_pins[pwmPin].analogValue/_analogWriteMax;
+    if(duty <= robot.deadband){
+        return 0;
+    }
+    double speed = (duty - robot.deadband)/(1 - robot.deadband)*robot.maxWheelSpeed*gain;
+    return _pins[dirPin].level ? speed : -speed;
+}
+
+void SimHardware::emitEncoderEdges(double & accumulator, double omega, double dt, uint8_t pinA, uint8_t pinB, bool & nextIsB){
+    // the counters only count up, so direction does not matter
+    double counts = fabs(omega)*dt/(2*M_PI)*_config.robot.countsPerWheelRev;
+    double start = accumulator;
+    accumulator += counts;
+    for(int edge = 1; accumulator >= 1; edge++){
+        accumulator -= 1;
+        // each edge at the moment within the step the wheel reached it, for the interrupt's micros()
+        uint64_t stepNs = (uint64_t)(dt*1e9);
+        uint64_t edgeNs = _nowNs - stepNs + (uint64_t)((edge - start)/counts*stepNs);
+        fireInterrupt(nextIsB ? pinB : pinA, edgeNs);
+        nextIsB = !nextIsB;
+    }
+}
+
+/**
+ * one wheel over a step. a gripping tyre carries its share of the robot, so the wheel answers its
+ * target with the motor time constant and the floor moves with it. the floor can change that speed
+ * by at most the traction times g, past which the tyre spins or skids: the wheel answers with the
+ * free time constant and the floor drags the robot towards the tyre's speed, until the two meet.
+ * the encoders count the wheel, the pose follows the floor
+ */
+void SimHardware::stepWheel(double target, bool jammed, double dt, double & omega, double & ground){
+    const SimRobotParams & robot = _config.robot;
+    double tau = target == 0 ? robot.brakeTimeConstant : robot.motorTimeConstant;
+    double loaded = jammed ? 0 : omega + (target - omega)*std::min(1.0, dt/tau);
+    double grip = robot.traction*GRAVITY*dt;
+    if(robot.traction <= 0 || fabs(robot.wheelRadius*loaded - ground) <= grip){
+        omega = loaded;
+        ground = robot.wheelRadius*omega;
+        return;
+    }
+    double freeTau = std::min(tau, robot.freeTimeConstant);
+    omega = jammed ? 0 : omega + (target - omega)*std::min(1.0, dt/freeTau);
+    ground += std::max(-grip, std::min(grip, robot.wheelRadius*omega - ground));
+}
+
+void SimHardware::stepPhysics(double dt){
+    const SimRobotParams & robot = _config.robot;
+
+    //the motors answer the duty written a dead time ago
+    _wheelTargets.emplace_back(wheelTarget(SIM_MOTOR_LEFT_DIR_PIN, SIM_MOTOR_LEFT_PWM_PIN, robot.leftGain),
+        wheelTarget(SIM_MOTOR_RIGHT_DIR_PIN, SIM_MOTOR_RIGHT_PWM_PIN, robot.rightGain));
+    while(_wheelTargets.size() > 1 + (size_t)(robot.motorDeadTime/dt + 0.5)){
+        _wheelTargets.pop_front();
+    }
+    stepWheel(_wheelTargets.front().first, _leftJammed, dt, _leftOmega, _leftGround);
+    stepWheel(_wheelTargets.front().second, _rightJammed, dt, _rightOmega, _rightGround);
+    _wheelSlip += (fabs(robot.wheelRadius*_leftOmega - _leftGround) + fabs(robot.wheelRadius*_rightOmega - _rightGround))*dt;
+
+    double v = (_leftGround + _rightGround)/2;
+    double yawRate = (_rightGround - _leftGround)/(robot.axleWidth*(1 + robot.turnSlip));
+    double midHeading = _pose.heading + yawRate*dt/2;
+    _pose.x += v*cos(midHeading)*dt;
+    _pose.y += v*sin(midHeading)*dt;
+    _pose.heading += yawRate*dt;
+
+    // a bump also shoves the robot a little away from the impact
+    double t = seconds();
+    for(const SimBump & bump : _config.bumps){
+        if(t >= bump.time && t < bump.time + dt){
+            double away = _pose.heading + bump.bearing*M_PI/180 + M_PI;
+            double shove = bump.strength*0.05;
+            _pose.x += shove*cos(away);
+            _pose.y += shove*sin(away);
+            _pose.heading += -sin(bump.bearing*M_PI/180)*bump.strength*0.0004;
+        }
+    }
+
+    emitEncoderEdges(_leftEdgeAccumulator, _leftOmega, dt, SIM_ENCODER_LEFT_A, SIM_ENCODER_LEFT_B, _leftNextIsB);
+    emitEncoderEdges(_rightEdgeAccumulator, _rightOmega, dt, SIM_ENCODER_RIGHT_A, SIM_ENCODER_RIGHT_B, _rightNextIsB);
+
+    if(_observer){
+        _observer->onPhysicsStep(*this);
+    }
+}
+
+/**
+ * Arduino core entry points, forwarded to the hardware bound to this thread
+ */
+void pinMode(uint8_t pin, uint8_t mode){
+    //QTRSensors releases its emitter pin when the thread-local instance is destroyed at thread exit,
+    //long after the run let go of the hardware
+    if(SimHardware::bound()){
+        SimHardware::current().pinMode(pin, mode);
+    }
+}
+void digitalWrite(uint8_t pin, uint8_t value){ SimHardware::current().digitalWrite(pin, value); }
+uint8_t digitalRead(uint8_t pin){ return SimHardware::current().digitalRead(pin); }
+int analogRead(uint8_t pin){ return SimHardware::current().analogRead(pin); }
+void analogReadAveraging(unsigned int num){ SimHardware::current().analogReadAveraging(num); }
+void analogWrite(uint8_t pin, int value){ SimHardware::current().analogWrite(pin, value); }
+void analogWriteResolution(unsigned int bits){ SimHardware::current().analogWriteResolution(bits); }
+void analogWriteFrequency(uint8_t pin, float frequency){ SimHardware::current().analogWriteFrequency(pin, frequency); }
+uint32_t micros(){ return SimHardware::current().micros(); }
+uint32_t millis(){ return SimHardware::current().millis(); }
+void delay(uint32_t ms){ SimHardware::current().delayMicroseconds((uint64_t)ms*1000); }
+void delayMicroseconds(uint32_t us){ SimHardware::current().delayMicroseconds(us); }
+uint32_t pulseIn(uint8_t pin, uint8_t state, uint32_t timeout){ return SimHardware::current().pulseIn(pin, state, timeout); }
+void attachInterrupt(uint8_t pin, void (*function)(void), int mode){ SimHardware::current().attachInterrupt(pin, function, mode); }
+void detachInterrupt(uint8_t pin){ SimHardware::current().detachInterrupt(pin); }
+uint8_t EEPROMClass::read(int index){ return SimHardware::current().eepromRead(index); }
+void EEPROMClass::write(int index, uint8_t value){ SimHardware::current().eepromWrite(index, value); }
+void EEPROMClass::update(int index, uint8_t value){
+    if(read(index) != value){
+        write(index, value);
+    }
+}
+EEPROMClass EEPROM;
+void simNoInterrupts(){ SimHardware::current().setInterruptsEnabled(false); }
+void simInterrupts(){ SimHardware::current().setInterruptsEnabled(true); }
+bool IntervalTimer::begin(void (*function)(void), uint32_t periodUs){
+    SimHardware::current().beginTimer(this, function, periodUs);
+    return true;
+}
+void IntervalTimer::end(){
+    if(SimHardware::bound()){
+        SimHardware::current().endTimer(this);
+    }
+}
@@ -0,0 +1,328 @@
+/**
+ * simulated robot hardware behind the host Arduino core.
+ * owns the virtual clock, pin states, differential drive physics, encoder edge generation,
+ * QTR RC discharge timing over the track raster, microphone bump impulses and ultrasonic ranging.
+ * one instance is bound to the calling thread at a time, so independent simulations can run on
+ * different threads.
+ */
+#pragma once
+
+#include "Track.h"
+
+#include <stdint.h>
+#include <deque>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+//wiring mirrored from src/, see the PINS comment in main.cpp
+#define SIM_MOTOR_RIGHT_DIR_PIN 10 // MotorA
+#define SIM_MOTOR_RIGHT_PWM_PIN 11
+#define SIM_MOTOR_LEFT_DIR_PIN 9 // MotorB
+#define SIM_MOTOR_LEFT_PWM_PIN 8
+#define SIM_TRIGGER_PIN 13
+#define SIM_ECHO_PIN 14
+#define SIM_MIC_PIN_0 15 // front right
+#define SIM_MIC_PIN_1 16 // rear
+#define SIM_MIC_PIN_2 17 // front left
+#define SIM_IR_PIN_FIRST 18 // IR_PIN_1, 3 and 5 are wired to 18, 19, 20, left to right, larger arrays carry on from there
+#define SIM_IR_EMITTER_PIN 12 // the emitters are lit unless the pin is driven low
+#define SIM_ENCODER_LEFT_A 1
+#define SIM_ENCODER_LEFT_B 2
+#define SIM_ENCODER_RIGHT_A 4
+#define SIM_ENCODER_RIGHT_B 5
+
+#define SIM_PIN_COUNT 64
+#define SIM_EEPROM_SIZE 1080 // bytes the Teensy 4.0 core emulates in flash
+
+struct SimObstacle {
+    double x = 0; // mm
+    double y = 0;
+    double radius = 0;
+    double trackPosition = -1; // mm along the centre line, placed there instead of at x,y when set
+    double until = 0;          // s at which the obstacle is taken away, 0 = never
+
+    bool presentAt(double seconds) const { return until <= 0 || seconds < until; }
+};
+
+struct SimBump {
+    double time;     // s
+    double bearing;  // degrees in the robot frame, 0 = straight ahead, counter-clockwise positive
+    double strength; // peak ADC counts above the mic baseline
+};
+
+/**
+ * physical constants of the robot. defaults match the values the control code was tuned against
+ */
+struct SimRobotParams {
+    double axleWidth = 160;        // mm
+    double wheelRadius = 40;       // mm
+    double sensorOffset = 70;      // mm from axle to QTR bar
+    double sensorSpacing = 19.05;  // mm between the used QTR channels (every other sensor)
+    int qtrCount = 3;              // QTR channels wired up, on pins from SIM_IR_PIN_FIRST
+    double ultrasonicOffset = 80;  // mm from axle to ultrasonic transducer
+    double ultrasonicCone = 15;    // degrees half-angle
+    double ultrasonicNoise = 0;    // m, 1 sigma on every echo
+    double ultrasonicDropout = 0;  // chance that a ping gets no echo back
+    double ultrasonicSpurious = 0; // chance that a ping returns a stray echo at a random range
+    double bodyRadius = 100;       // mm, footprint around the axle centre used for obstacle contact and bump impacts
+
+    double maxWheelSpeed = 15.0;     // rad/s at full duty
+    double motorTimeConstant = 0.06; // s
+    double brakeTimeConstant = 0.03; // s, duty 0 shorts the motor on this driver
+    double deadband = 0.06;          // fraction of full duty needed to move
+    double motorDeadTime = 0;        // s from a duty written to the motor answering it
+    double leftGain = 1.0;           // per-side scale on motor gain, models mismatch
+    double rightGain = 1.0;
+    double turnSlip = 0;             // the wheels scrub sideways when they turn the robot, which turns as if its axle were 1 + turnSlip times as wide
+    double traction = 0;             // friction coefficient of the tyres on the floor, 0 = they never spin or skid
+    double freeTimeConstant = 0.012; // s, of a wheel spinning free of the floor, without the robot to carry
+    double countsPerWheelRev = 24*74.83; // 12 CPR, rising edges on both channels, 74.83:1 gearbox
+
+    double qtrWhiteUs = 180;   // RC discharge time over white floor
+    double qtrBlackUs = 3000;  // RC discharge time over tape
+    double qtrNoiseUs = 25;    // 1 sigma
+    double ambientLight = 0;        // ambient light on the QTR phototransistors, as a fraction of what the emitters get back from white floor
+    double ambientFlicker = 0;      // fraction of the ambient light that flickers at ambientFlickerHz
+    double ambientFlickerHz = 100;  // mains lighting, twice the line frequency
+    double ambientDrift = 0;        // fraction by which the ambient light wanders over ambientDriftPeriod, e.g. passing shadows
+    double ambientDriftPeriod = 2;  // s
+
+    double micBaseline = 200;
+    double micNoise = 3;
+    double micDecay = 0.004;      // s
+    double micRadius = 80;        // mm from the axle centre to each mic
+    double soundSpeed = 343000;   // mm/s
+};
+
+struct SimConfig {
+    double duration = 60;  // simulated seconds
+    int stopAfterLaps = 0; // end the run early once this many laps are complete, 0 = never
+    uint32_t seed = 1;
+    bool verbose = false;  // echo Serial output to stdout
+    double physicsStep = 250e-6;
+    std::vector<SimObstacle> obstacles;
+    std::vector<SimBump> bumps;
+    std::vector<std::pair<std::string, double>> tunables; // applied over the defaults before setup()
+    std::vector<std::pair<double, std::string>> serialInput; // lines typed at the robot's Serial, by seconds into the run
+    SimRobotParams robot;
+};
+
+struct SimPose {
+    double x;       // mm, axle centre
+    double y;
+    double heading; // radians
+};
+
+class SimHardware;
+
+/**
+ * notified after every physics step, used by the simulator to accumulate metrics
+ */
+class SimObserver
+{
+  public:
+    virtual ~SimObserver() = default;
+    virtual void onPhysicsStep(const SimHardware & hardware) = 0;
+
+    /**
+     * a motor direction or PWM pin was written. value is the level or the duty
+     */
+    virtual void onMotorOutput(const SimHardware & hardware, uint8_t pin, int value){
+        (void)hardware;
+        (void)pin;
+        (void)value;
+    }
+};
+
+class SimHardware
+{
+  public:
+    SimHardware(const Track & track, const SimConfig & config);
+
+    /**
+     * bind this instance to the calling thread; all Arduino calls from that thread act on it
+     */
+    void makeCurrent();
+    static void releaseCurrent();
+    static SimHardware & current();
+    static bool bound();
+
+    /**
+     * counts above the baseline one bump puts on a mic, sinceBump seconds after the impact. the
+     * sound reaches each mic late by its distance from the impact point on the body outline
+     */
+    static double micResponse(const SimRobotParams & robot, int mic, double bearing, double strength, double sinceBump);
+
+    /**
+     * RC discharge time of a QTR channel under the ambient light of robot, seconds into the run
+     */
+    static double qtrResponse(const SimRobotParams & robot, double emitterUs, bool lit, double seconds);
+
+    void setObserver(SimObserver * observer) { _observer = observer; }
+
+    // Arduino core
+    void pinMode(uint8_t pin, uint8_t mode);
+    void digitalWrite(uint8_t pin, uint8_t value);
+    uint8_t digitalRead(uint8_t pin);
+    int analogRead(uint8_t pin);
+    void analogReadAveraging(unsigned int num);
+    void analogWrite(uint8_t pin, int value);
+    void analogWriteResolution(unsigned int bits);
+    void analogWriteFrequency(uint8_t pin, float frequency);
+    uint32_t micros();
+    uint32_t millis();
+    void delayMicroseconds(uint64_t us);
+    uint32_t pulseIn(uint8_t pin, uint8_t state, uint32_t timeout);
+    void attachInterrupt(uint8_t pin, void (*function)(void), int mode);
+    void detachInterrupt(uint8_t pin);
+    void setInterruptsEnabled(bool enabled);
+    void beginTimer(const void * owner, void (*function)(void), uint32_t periodUs);
+    void endTimer(const void * owner);
+    void serialWrite(const char * text, size_t length);
+    int serialAvailable();
+    int serialRead();
+    uint8_t eepromRead(int index);
+    void eepromWrite(int index, uint8_t value);
+
+    /**
+     * charge the cost of one loop() iteration outside the measured calls
+     */
+    void chargeLoopOverhead();
+
+    /**
+     * move the clock forward to an externally supplied time (used by log replay). never goes back
+     */
+    void syncClock(uint64_t ns){
+        if(ns > _nowNs) advanceTo(ns, false);
+        noteLogRecord();
+    }
+
+    /**
+     * a sensor log record was written or replayed. the micros() that timestamped it is not the
+     * robot polling, so the next micros() is charged as usual instead of skipping to the next event,
+     * which replay could not reproduce without the pins the recording read
+     */
+    void noteLogRecord(){ _sideEffects++; }
+
+    uint64_t nowNs() const { return _nowNs; }
+    double seconds() const { return _nowNs*1e-9; }
+
+    const SimPose & pose() const { return _pose; }
+    void setPose(const SimPose & pose) { _pose = pose; }
+    Vec2 sensorPosition(int index) const;
+    Vec2 sensorBarCentre() const;
+    double wheelSpeed(bool left) const { return left ? _leftOmega : _rightOmega; } // rad/s
+    double groundSpeed(bool left) const { return left ? _leftGround : _rightGround; } // mm/s the robot moves over the floor at each wheel
+    double wheelSlip() const { return _wheelSlip; } // mm the tyres' surfaces ran past the floor so far, both wheels
+
+    /**
+     * hold a wheel stock still, as something caught in it would, or let it go again
+     */
+    void jamWheel(bool left, bool jammed) { (left ? _leftJammed : _rightJammed) = jammed; }
+    const Track & track() const { return _track; }
+    const SimConfig & config() const { return _config; }
+
+    /**
+     * queue text to arrive on Serial once the clock reaches atNs, all of it at once as from a host
+     * terminal. SimConfig::serialInput is queued this way at construction
+     */
+    void queueSerialInput(uint64_t atNs, const std::string & text);
+
+    /**
+     * append everything written to Serial from now on to capture, nullptr to stop
+     */
+    void setSerialCapture(std::string * capture) { _serialCapture = capture; }
+
+    /**
+     * the EEPROM contents, erased to 0xff at first. copied from one instance to the next they
+     * survive a simulated reset
+     */
+    std::vector<uint8_t> & eeprom() { return _eeprom; }
+    int eepromWrites() const { return _eepromWrites; }
+
+  private:
+    static const uint8_t INPUT_MODE = 0;
+    static const uint8_t OUTPUT_MODE = 1;
+
+    struct Pin {
+        uint8_t mode = INPUT_MODE;
+        uint8_t level = 0;
+        bool charged = false;       // RC sensor capacitor charged by driving the pin high
+        uint64_t dischargeAt = 0;   // time the RC line reads low
+        int analogValue = 0;        // PWM duty for outputs
+        void (*isr)(void) = nullptr;
+    };
+
+    struct Timer {
+        const void * owner;      // the IntervalTimer that started it
+        void (*isr)(void);
+        uint64_t periodNs;
+        uint64_t nextNs;
+    };
+
+    void charge(uint64_t ns);
+    void advanceTo(uint64_t targetNs, bool delayedByTimers = true);
+    uint64_t nextEventNs() const;
+    void stepPhysics(double dt);
+    void emitEncoderEdges(double & accumulator, double omega, double dt, uint8_t pinA, uint8_t pinB, bool & nextIsB);
+    void fireInterrupt(uint8_t pin, uint64_t atNs);
+    uint64_t fireTimer(Timer & timer);
+    int qtrIndex(uint8_t pin) const;
+    double dischargeTimeUs(int sensor);
+    double micSample(int mic);
+    double ultrasonicRange();
+    double wheelTarget(uint8_t dirPin, uint8_t pwmPin, double gain) const;
+    void stepWheel(double target, bool jammed, double dt, double & omega, double & ground);
+    double gaussian(double sigma);
+    double uniform();
+    bool isMotorPin(uint8_t pin) const;
+
+    const Track & _track;
+    SimConfig _config;
+    SimObserver * _observer = nullptr;
+
+    uint64_t _nowNs = 0;
+    uint64_t _nextPhysicsNs = 0;
+    uint64_t _physicsStepNs;
+    uint32_t _sideEffects = 0;
+    uint32_t _sideEffectsAtLastMicros = ~0u;
+    int _quietMicros = 0;  // micros() in a row with nothing but pin reads before each
+
+    Pin _pins[SIM_PIN_COUNT];
+    bool _interruptsEnabled = true;
+    struct PendingInterrupt {
+        void (*isr)(void);
+        uint64_t atNs;  // the pin's edge, the clock the interrupt reads. UINT64_MAX for a timer, which reads the time it is taken
+    };
+    std::vector<PendingInterrupt> _pendingInterrupts;
+    bool _inInterrupt = false;
+    std::vector<Timer> _timers;
+    bool _inTimer = false;
+    uint64_t _timerCostNs = 0;  // time charged by the running timer interrupt
+    unsigned int _analogAveraging = 4;
+    int _analogWriteMax = 255;  // full duty at the resolution set, 8 bits until set otherwise
+    std::vector<uint8_t> _eeprom = std::vector<uint8_t>(SIM_EEPROM_SIZE, 0xff);
+    int _eepromWrites = 0;
+    std::deque<std::pair<uint64_t, char>> _serialInput; // by the time each byte arrives
+    std::string * _serialCapture = nullptr;
+
+    SimPose _pose;
+    double _leftOmega = 0;
+    double _rightOmega = 0;
+    double _leftGround = 0;  // mm/s, the wheel's speed while the tyre grips
+    double _rightGround = 0;
+    double _wheelSlip = 0;
+    bool _leftJammed = false;
+    bool _rightJammed = false;
+    std::deque<std::pair<double, double>> _wheelTargets; // left and right, of the physics steps within the dead time
+    double _leftEdgeAccumulator = 0;
+    double _rightEdgeAccumulator = 0;
+    bool _leftNextIsB = false;
+    bool _rightNextIsB = false;
+
+    std::mt19937 _rng;
+    std::normal_distribution<double> _normal{0.0, 1.0};
+    std::uniform_real_distribution<double> _uniform{0.0, 1.0};
+};
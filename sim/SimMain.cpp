@@ -0,0 +1,3030 @@
+/**
+ * command line front end for the host simulator.
+ *
+ *   sim run [--track oval|wavy|kidney|<file>] [--duration s] [--seed n] [--verbose]
+ *           [--obstacle x,y,r[,until]]... [--obstacle-at s,r[,until]]... [--bump t,bearing,strength]...
+ *           [--range-noise m] [--range-dropout p] [--range-spurious p] [--mic-noise counts]
+ *           [--ambient level[,flicker[,drift]]] [--slip fraction] [--traction mu] [--set NAME=VALUE]...
+ *           [--motor-model gainL,gainR,tau,deadtime,deadband] [--serial-script file] [--record file.slog]
+ *   sim replay file.slog [--trace file]
+ *   sim logextract capture.bin file.slog
+ *   sim states [EVENT...]
+ *   sim range [--seed n] [--range-noise m] [--range-dropout p] [--range-spurious p]
+ *   sim bumps [--seed n] [--mic-noise counts]
+ *   sim adc
+ *   sim lockin [--seed n] [--ambient level[,flicker[,drift]]]
+ *   sim bench [--seed n]
+ *   sim junctions [--seed n] [--set NAME=VALUE]...
+ *   sim heading [--seed n] [--slip fraction] [--set NAME=VALUE]...
+ *   sim motors
+ *   sim latency
+ *   sim spsc
+ *   sim boot
+ *   sim tuning
+ *   sim autotune
+ *   sim fit [file.slog]
+ *   sim traction
+ *   sim straight
+ *   sim evasion
+ *   sim sweep --param NAME=LOW:HIGH[:STEPS]... [--sampling grid|random|lhs] [--samples n]
+ *           [--seeds n] [--tracks a,b,...] [--laps n] [--threads n] [--top n] [--csv file]
+ */
+#include "Replay.h"
+#include "Simulator.h"
+#include "Sweep.h"
+#include "StateMachine.h"
+#include "RangeTracker.h"
+#include "BumpLocator.h"
+#include "MicWakeup.h"
+#include "LockIn.h"
+#include "LineFit.h"
+#include "JunctionDetector.h"
+#include "Odometry.h"
+#include "HeadingEstimator.h"
+#include "Driving.h"
+#include "EvasionPlanner.h"
+#include "MotorDriver.h"
+#include "LatencyProbe.h"
+#include "Persist.h"
+#include "TuningConsole.h"
+#include "AutoTune.h"
+#include "WheelSpeed.h"
+#include "MotorModel.h"
+#include "TractionMonitor.h"
+#include "SimHardware.h"
+#include "AdcSampler.h"
+#include <QTRSensors.h>
+#include "Sensing.h"
+#include "SpscQueue.h"
+#include "Tuning.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+static void usage(){
+    fprintf(stderr,
+        "usage: sim run [options]\n"
+        "       sim sweep --param NAME=LOW:HIGH[:STEPS]... [sweep options] [options]\n"
+        "       sim replay FILE.slog [--trace FILE]   re-run a sensor log, tracing motor commands and states\n"
+        "       sim logextract CAPTURE FILE.slog     pull log records out of a raw Serial capture\n"
+        "       sim states [EVENT...]                check the state machine tables, or trace a sequence of events\n"
+        "       sim range [options]                  run the range tracker over synthetic ultrasonic sequences\n"
+        "       sim bumps [options]                  locate synthetic bumps from every direction with the mics\n"
+        "       sim adc                              check the order and averaging of dual ADC scans\n"
+        "       sim lockin [options]                 demodulate synthetic line sensor readings under ambient light\n"
+        "       sim bench [options]                  time and score line sensor reads for QTR arrays of 3 to 31 sensors\n"
+        "       sim junctions [options]              classify synthetic junctions and check the branch each policy takes\n"
+        "       sim heading [options]                scan and turn on the spot with wheel slip, by ticks and by the heading estimator\n"
+        "       sim motors                           check the slew, reversal and braking of the motor outputs\n"
+        "       sim latency                          how late the latency probe's interrupt runs, idle and under line sensor reads\n"
+        "       sim boot                             check the stored calibration format and time boots with and without it\n"
+        "       sim spsc                             stress and time the interrupt to loop() queue, and the encoder edges it carries\n"
+        "       sim tuning                           check the tunables' ranges and the Serial tuning console, and time its polls\n"
+        "       sim autotune                         check the relay experiments and the wheel speed loop, and lap with the gains found\n"
+        "       sim fit [FILE.slog]                  fit the drivetrain model from the steps in a log, or check the fit on the robot\n"
+        "       sim traction                         check wheel slip and stall detection and the command limit on a slippery floor\n"
+        "       sim straight                         measure where straight drives end and how detours pass with mismatched wheels\n"
+        "       sim evasion                          stand obstacles all round the oval, in the bends too, and check none is touched\n"
+        "  --track NAME       oval, wavy, kidney or a file of closed 'x y' waypoints in mm (default oval)\n"
+        "  --duration S       simulated seconds (default 60)\n"
+        "  --seed N           noise seed (default 1)\n"
+        "  --obstacle X,Y,R[,UNTIL]  cylindrical obstacle in mm, removed at UNTIL s if given, may be repeated\n"
+        "  --obstacle-at S,R[,UNTIL] obstacle on the line S mm from the start\n"
+        "  --bump T,DEG,AMP   bump at T s from bearing DEG (0 = front, ccw) with mic amplitude AMP\n"
+        "  --range-noise M    ultrasonic noise, 1 sigma in metres (default 0)\n"
+        "  --range-dropout P  chance of an ultrasonic ping without echo (default 0)\n"
+        "  --range-spurious P chance of a stray echo at a random range (default 0)\n"
+        "  --mic-noise N      mic noise, 1 sigma in ADC counts (default 3)\n"
+        "  --ambient A[,F[,D]] ambient light on the line sensors as a fraction of the emitters' return\n"
+        "                     from white floor, with a fraction F flickering at 100 Hz and D drifting (default 0)\n"
+        "  --slip F           the robot turns as if its axle were 1 + F times as wide, from the wheels scrubbing (default 0)\n"
+        "  --traction MU      friction coefficient of the tyres on the floor, past which the wheels spin (default 0, they never do)\n"
+        "  --laps N           stop each run after N laps (default: run for the full duration)\n"
+        "  --set NAME=VALUE   override a tunable for every run, may be repeated\n"
+        "  --motor-model GL,GR,TAU,DEAD,DB  drivetrain as fitted by fit motors: gain of each wheel in ticks/s per\n"
+        "                     command, time constant and dead time in s, deadband in command (see src/MotorModel.h)\n"
+        "  --serial-script FILE  lines of 'SECONDS COMMAND' typed at the robot's tuning console, e.g. '20 set BASE_PWM 140'\n"
+        "  --verbose          echo the robot's Serial output\n"
+        "  --record FILE      (run only) write a sensor log of the run for replay\n"
+        "sweep options:\n"
+        "  --param NAME=LOW:HIGH[:STEPS]  tunable to vary, may be repeated\n"
+        "  --sampling MODE    grid (default), random or lhs (latin hypercube)\n"
+        "  --samples N        configurations for random and lhs sampling (default 64)\n"
+        "  --seeds N          noise seeds per configuration and track (default 3)\n"
+        "  --tracks A,B       comma separated tracks (default oval)\n"
+        "  --threads N        worker threads (default all cores)\n"
+        "  --top N            ranked configurations to print (default 10)\n"
+        "  --csv FILE         write every ranked configuration to FILE\n");
+}
+
+/**
+ * queue the lines of a serial script, 'SECONDS COMMAND' each, blank lines and those starting with #
+ * skipped
+ */
+static bool loadSerialScript(const char * path, SimConfig & config){
+    FILE * file = fopen(path, "r");
+    if(file == nullptr){
+        fprintf(stderr, "could not read serial script '%s'\n", path);
+        return false;
+    }
+    char line[256];
+    bool ok = true;
+    while(fgets(line, sizeof(line), file)){
+        line[strcspn(line, "\r\n")] = '\0';
+        double seconds;
+        int offset = 0;
+        if(line[strspn(line, " \t")] == '\0' || line[strspn(line, " \t")] == '#'){
+            continue;
+        }
+        if(sscanf(line, "%lf %n", &seconds, &offset) < 1 || offset == 0){
+            fprintf(stderr, "bad serial script line '%s' (expected SECONDS COMMAND)\n", line);
+            ok = false;
+            break;
+        }
+        config.serialInput.emplace_back(seconds, std::string(line + offset));
+    }
+    fclose(file);
+    return ok;
+}
+
+/**
+ * parse the options shared by every simulator command. returns the index of the first
+ * unrecognised argument, or -1 on a malformed option
+ */
+/**
+ * the simulated drivetrain that behaves as a fitted model of each wheel. the simulator has one time
+ * constant, dead time and deadband for both, which take the mean of the two
+ */
+static void applyMotorModels(SimRobotParams & robot, const MotorModel & left, const MotorModel & right){
+    double ticksPerRadian = robot.countsPerWheelRev/(2*M_PI);
+    double deadband = (left.deadband + right.deadband)/2;
+    robot.deadband = deadband/MOTOR_FULL_SCALE;
+    robot.maxWheelSpeed = left.gain*(MOTOR_FULL_SCALE - deadband)/ticksPerRadian;
+    robot.leftGain = 1;
+    robot.rightGain = right.gain/left.gain;
+    robot.motorTimeConstant = (left.timeConstant + right.timeConstant)/2;
+    robot.motorDeadTime = (left.deadTime + right.deadTime)/2;
+}
+
+/**
+ * and the model of a wheel of the simulated drivetrain, the inverse of applyMotorModels()
+ */
+static MotorModel simulatedMotorModel(const SimRobotParams & robot, bool left){
+    double ticksPerRadian = robot.countsPerWheelRev/(2*M_PI);
+    double gain = robot.maxWheelSpeed*(left ? robot.leftGain : robot.rightGain)/((1 - robot.deadband)*MOTOR_FULL_SCALE);
+    return {gain*ticksPerRadian, robot.motorTimeConstant, robot.motorDeadTime, robot.deadband*MOTOR_FULL_SCALE};
+}
+
+static int parseSimOptions(int argc, char ** argv, int first, std::string & trackName, SimConfig & config){
+    int i = first;
+    for(; i < argc; i++){
+        const char * arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if(strcmp(arg, "--track") == 0 && hasValue){
+            trackName = argv[++i];
+        }
+        else if(strcmp(arg, "--duration") == 0 && hasValue){
+            config.duration = atof(argv[++i]);
+        }
+        else if(strcmp(arg, "--seed") == 0 && hasValue){
+            config.seed = (uint32_t)strtoul(argv[++i], nullptr, 10);
+        }
+        else if(strcmp(arg, "--obstacle") == 0 && hasValue){
+            SimObstacle obstacle;
+            if(sscanf(argv[++i], "%lf,%lf,%lf,%lf", &obstacle.x, &obstacle.y, &obstacle.radius, &obstacle.until) < 3){
+                return -1;
+            }
+            config.obstacles.push_back(obstacle);
+        }
+        else if(strcmp(arg, "--obstacle-at") == 0 && hasValue){
+            SimObstacle obstacle;
+            if(sscanf(argv[++i], "%lf,%lf,%lf", &obstacle.trackPosition, &obstacle.radius, &obstacle.until) < 2
+                || obstacle.trackPosition < 0){
+                return -1;
+            }
+            config.obstacles.push_back(obstacle);
+        }
+        else if(strcmp(arg, "--bump") == 0 && hasValue){
+            SimBump bump;
+            if(sscanf(argv[++i], "%lf,%lf,%lf", &bump.time, &bump.bearing, &bump.strength) != 3){
+                return -1;
+            }
+            config.bumps.push_back(bump);
+        }
+        else if(strcmp(arg, "--range-noise") == 0 && hasValue){
+            config.robot.ultrasonicNoise = atof(argv[++i]);
+        }
+        else if(strcmp(arg, "--range-dropout") == 0 && hasValue){
+            config.robot.ultrasonicDropout = atof(argv[++i]);
+        }
+        else if(strcmp(arg, "--range-spurious") == 0 && hasValue){
+            config.robot.ultrasonicSpurious = atof(argv[++i]);
+        }
+        else if(strcmp(arg, "--mic-noise") == 0 && hasValue){
+            config.robot.micNoise = atof(argv[++i]);
+        }
+        else if(strcmp(arg, "--ambient") == 0 && hasValue){
+            SimRobotParams & robot = config.robot;
+            if(sscanf(argv[++i], "%lf,%lf,%lf", &robot.ambientLight, &robot.ambientFlicker, &robot.ambientDrift) < 1){
+                return -1;
+            }
+        }
+        else if(strcmp(arg, "--slip") == 0 && hasValue){
+            config.robot.turnSlip = atof(argv[++i]);
+        }
+        else if(strcmp(arg, "--traction") == 0 && hasValue){
+            config.robot.traction = atof(argv[++i]);
+        }
+        else if(strcmp(arg, "--laps") == 0 && hasValue){
+            config.stopAfterLaps = atoi(argv[++i]);
+        }
+        else if(strcmp(arg, "--set") == 0 && hasValue){
+            const char * text = argv[++i];
+            const char * equals = strchr(text, '=');
+            double least, most;
+            if(equals == nullptr || !getTunableRange(std::string(text, equals - text).c_str(), &least, &most)){
+                fprintf(stderr, "unknown tunable in '%s'\n", text);
+                return -1;
+            }
+            double value = atof(equals + 1);
+            if(!(value >= least && value <= most)){
+                fprintf(stderr, "'%s' is outside %g..%g\n", text, least, most);
+                return -1;
+            }
+            config.tunables.emplace_back(std::string(text, equals - text), value);
+        }
+        else if(strcmp(arg, "--motor-model") == 0 && hasValue){
+            MotorModel left, right;
+            if(sscanf(argv[++i], "%lf,%lf,%lf,%lf,%lf", &left.gain, &right.gain, &left.timeConstant, &left.deadTime, &left.deadband) != 5
+                || !(left.gain > 0 && right.gain > 0 && left.timeConstant > 0 && left.deadTime >= 0)
+                || !(left.deadband >= 0 && left.deadband < MOTOR_FULL_SCALE)){
+                fprintf(stderr, "expected --motor-model GAIN_LEFT,GAIN_RIGHT,TIME_CONSTANT,DEAD_TIME,DEADBAND, got '%s'\n", argv[i]);
+                return -1;
+            }
+            right.timeConstant = left.timeConstant;
+            right.deadTime = left.deadTime;
+            right.deadband = left.deadband;
+            applyMotorModels(config.robot, left, right);
+        }
+        else if(strcmp(arg, "--serial-script") == 0 && hasValue){
+            if(!loadSerialScript(argv[++i], config)){
+                return -1;
+            }
+        }
+        else if(strcmp(arg, "--verbose") == 0){
+            config.verbose = true;
+        }
+        else{
+            break;
+        }
+    }
+    return i;
+}
+
+static void printReport(const SimReport & report){
+    printf("simulated %.1f s in %.3f s host time (%.0fx real time)%s\n",
+        report.simulatedSeconds, report.hostSeconds, report.speedup(),
+        report.derailed ? ", DERAILED" : "");
+    printf("laps completed:   %zu\n", report.lapTimes.size());
+    for(size_t i = 0; i < report.lapTimes.size(); i++){
+        printf("  lap %zu:         %.3f s, %d line losses\n", i + 1, report.lapTimes[i], report.lapLineLosses[i]);
+    }
+    if(!report.lapTimes.empty()){
+        printf("mean lap time:    %.3f s\n", report.meanLapTime());
+    }
+    printf("distance:         %.0f mm\n", report.distance);
+    printf("cross-track rms:  %.1f mm (max %.1f mm)\n", report.crossTrackRms, report.crossTrackMax);
+    printf("line losses:      %d (%.2f s off line)\n", report.lineLosses, report.timeOffLine);
+    if(report.wheelSlip > 0){
+        printf("wheel slip:       %.0f mm\n", report.wheelSlip);
+    }
+    if(!report.stopSpeeds.empty() || report.obstacleContacts > 0){
+        printf("obstacle stops:   %zu back on the line, %d failed, %d contacts, %d false\n",
+            report.evasionTimes.size(), report.evasionsFailed, report.obstacleContacts, report.falseStops);
+        for(double speed : report.stopSpeeds){
+            printf("  stopped from:   %.0f mm/s\n", speed);
+        }
+        for(size_t i = 0; i < report.evasionTimes.size(); i++){
+            printf("  time to rejoin: %.3f s\n", report.evasionTimes[i]);
+        }
+    }
+}
+
+static int runCommand(int argc, char ** argv){
+    std::string trackName = "oval";
+    std::string recordPath;
+    SimConfig config;
+    for(int i = 2; i < argc;){
+        int next = parseSimOptions(argc, argv, i, trackName, config);
+        if(next == argc){
+            break;
+        }
+        if(next < 0 || strcmp(argv[next], "--record") != 0 || next + 1 >= argc){
+            usage();
+            return 2;
+        }
+        recordPath = argv[next + 1];
+        i = next + 2;
+    }
+
+    Track track;
+    if(!track.load(trackName)){
+        fprintf(stderr, "could not load track '%s'\n", trackName.c_str());
+        return 1;
+    }
+
+    Simulator simulator(track, config);
+    if(!recordPath.empty() && !startSensorLogFile(recordPath)){
+        fprintf(stderr, "could not write '%s'\n", recordPath.c_str());
+        return 1;
+    }
+    SimReport report = simulator.run();
+    stopSensorLogFile();
+    printReport(report);
+    return 0;
+}
+
+static int replayCommand(int argc, char ** argv){
+    if(argc != 3 && !(argc == 5 && strcmp(argv[3], "--trace") == 0)){
+        usage();
+        return 2;
+    }
+    SensorLogReader log;
+    std::string error;
+    if(!log.open(argv[2], &error)){
+        fprintf(stderr, "%s\n", error.c_str());
+        return 1;
+    }
+    FILE * trace = nullptr;
+    if(argc == 5){
+        trace = strcmp(argv[4], "-") == 0 ? stdout : fopen(argv[4], "w");
+        if(trace == nullptr){
+            fprintf(stderr, "could not write '%s'\n", argv[4]);
+            return 1;
+        }
+    }
+
+    ReplaySession session(log, trace);
+    ReplayStats stats = session.run();
+    if(trace && trace != stdout){
+        fclose(trace);
+    }
+    FILE * summary = trace == stdout ? stderr : stdout;
+    fprintf(summary, "replayed %zu records, %zu ticks (%.1f s recorded) in %.3f s host time%s\n",
+        log.size(), stats.ticks, stats.simulatedSeconds, stats.hostSeconds,
+        stats.diverged ? ", DIVERGED" : "");
+    fprintf(summary, "records served %zu, misses %zu, motor commands %zu, state changes %zu\n",
+        stats.recordsServed, stats.misses, stats.motorCommands, stats.stateChanges);
+    return stats.diverged ? 3 : 0;
+}
+
+static int logExtractCommand(int argc, char ** argv){
+    if(argc != 4){
+        usage();
+        return 2;
+    }
+    long records = extractSensorLog(argv[2], argv[3]);
+    if(records < 0){
+        fprintf(stderr, "could not convert '%s'\n", argv[2]);
+        return 1;
+    }
+    printf("%ld records written to %s\n", records, argv[3]);
+    return 0;
+}
+
+static void printStateStack(){
+    for(int i = 0; i < getStateDepth(); i++){
+        printf("%s%s", i > 0 ? " > " : "", getStateName(getStackedState(i)));
+    }
+    printf("\n");
+}
+
+/**
+ * drive the bare tables through every sequence of events up to the given length, checking that
+ * the stack stays within bounds, only leaf states become active and a pop returns to the state
+ * that was pushed over
+ */
+static bool checkEventSequences(int length, std::vector<RobotEvent> & sequence, int & failures){
+    if((int)sequence.size() == length){
+        return true;
+    }
+    for(int event = EVENT_NONE + 1; event < EVENT_COUNT; event++){
+        sequence.push_back((RobotEvent)event);
+        initStateMachine(nullptr);
+        std::vector<RobotState> expected = {getInitialState()};
+        for(RobotEvent step : sequence){
+            Transition transition = getTransition(expected.back(), step);
+            if(transition.kind == TRANSITION_GOTO){
+                expected.back() = transition.target;
+            }
+            else if(transition.kind == TRANSITION_PUSH){
+                expected.push_back(transition.target);
+            }
+            else if(transition.kind == TRANSITION_POP){
+                expected.pop_back();
+                if(transition.target != STATE_NONE && !expected.empty()){
+                    expected.back() = transition.target;
+                }
+            }
+            bool taken = dispatchEvent(step);
+            bool consistent = taken == (transition.kind != TRANSITION_NONE) && !expected.empty()
+                && (int)expected.size() == getStateDepth() && getStateDepth() <= STATE_STACK_DEPTH;
+            for(int i = 0; consistent && i < getStateDepth(); i++){
+                RobotState state = getStackedState(i);
+                consistent = state == expected[i] && state != STATE_ON_COURSE;
+            }
+            if(!consistent){
+                if(failures++ < 10){
+                    printf("FAILED after");
+                    for(RobotEvent failed : sequence){
+                        printf(" %s", getEventName(failed));
+                    }
+                    printf(": ");
+                    printStateStack();
+                }
+                break;
+            }
+        }
+        checkEventSequences(length, sequence, failures);
+        sequence.pop_back();
+    }
+    return failures == 0;
+}
+
+static int statesCommand(int argc, char ** argv){
+    if(argc > 2){
+        initStateMachine(nullptr);
+        printf("%-14s", "start");
+        printStateStack();
+        for(int i = 2; i < argc; i++){
+            int event = EVENT_NONE + 1;
+            while(event < EVENT_COUNT && strcmp(argv[i], getEventName((RobotEvent)event)) != 0){
+                event++;
+            }
+            if(event == EVENT_COUNT){
+                fprintf(stderr, "unknown event '%s'\n", argv[i]);
+                return 2;
+            }
+            bool taken = dispatchEvent((RobotEvent)event);
+            printf("%-14s", argv[i]);
+            if(!taken){
+                printf("(ignored) ");
+            }
+            printStateStack();
+        }
+        return 0;
+    }
+
+    static const char * const kinds[] = {"-", "goto", "push", "pop"};
+    printf("%-10s %-10s", "state", "parent");
+    for(int event = EVENT_NONE + 1; event < EVENT_COUNT; event++){
+        printf(" %-18s", getEventName((RobotEvent)event));
+    }
+    printf("\n");
+    for(int state = STATE_NONE + 1; state < STATE_COUNT; state++){
+        printf("%-10s %-10s", getStateName((RobotState)state), getStateName(getParentState((RobotState)state)));
+        for(int event = EVENT_NONE + 1; event < EVENT_COUNT; event++){
+            Transition transition = getTransition((RobotState)state, (RobotEvent)event);
+            std::string cell = kinds[transition.kind];
+            if(transition.target != STATE_NONE){
+                cell += std::string(" ") + getStateName(transition.target);
+            }
+            printf(" %-18s", cell.c_str());
+        }
+        printf("\n");
+    }
+
+    const int length = 8;
+    int failures = 0;
+    std::vector<RobotEvent> sequence;
+    checkEventSequences(length, sequence, failures);
+    printf("event sequences up to %d events from %s: %s\n", length, getStateName(getInitialState()),
+        failures == 0 ? "ok" : "FAILED");
+    return failures == 0 ? 0 : 1;
+}
+
+/**
+ * one synthetic ultrasonic reading of the true range in metres (negative for nothing in range),
+ * with the same noise, dropout and stray echo model as SimHardware
+ */
+static double syntheticReading(double range, const SimRobotParams & robot, std::mt19937 & rng){
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    std::normal_distribution<double> normal(0.0, 1.0);
+    if(robot.ultrasonicDropout > 0 && uniform(rng) < robot.ultrasonicDropout){
+        range = -1;
+    }
+    else if(robot.ultrasonicSpurious > 0 && uniform(rng) < robot.ultrasonicSpurious){
+        range = 0.03 + 0.77*uniform(rng);
+    }
+    else if(range >= 0 && robot.ultrasonicNoise > 0){
+        range = std::max(0.0, range + normal(rng)*robot.ultrasonicNoise);
+    }
+    return range < 0 || range >= NO_ECHO_DISTANCE ? NO_ECHO_DISTANCE + 0.0069 : range;
+}
+
+/**
+ * feed the range tracker scripted scenes, polled every 50 ms like NORMAL does, and score it
+ * against the true range: a steady approach, an obstacle that appears and is taken away again,
+ * and a long empty stretch where every track is a false one
+ */
+static int rangeCommand(int argc, char ** argv){
+    std::string unusedTrack;
+    SimConfig config;
+    if(parseSimOptions(argc, argv, 2, unusedTrack, config) != argc){
+        usage();
+        return 2;
+    }
+    const SimRobotParams & robot = config.robot;
+    const uint32_t pollMs = 50;
+    const int trials = 200;
+    std::mt19937 rng(config.seed);
+
+    //approach from out of range at a steady speed, stopping at BLOCKAGE_TOLERANCE
+    const double approachSpeed = 0.4; // m/s
+    double errorSquares = 0;
+    long errorSamples = 0;
+    double speedError = 0;
+    double stopLate = 0;
+    double stopLateMax = 0;
+    int missedStops = 0;
+    for(int trial = 0; trial < trials; trial++){
+        initRangeTracker();
+        double start = 1.0 + 0.05*(trial % 20)/20;
+        bool stopped = false;
+        double truth = start;
+        for(uint32_t now = 0; truth > 0.05; now += pollMs){
+            truth = start - approachSpeed*now*1e-3;
+            updateRangeTracker(syntheticReading(truth, robot, rng), now);
+            //the robot checks the extrapolated range every iteration, sample it between readings
+            for(uint32_t t = now; t < now + pollMs; t += 5){
+                double actual = start - approachSpeed*t*1e-3;
+                if(rangeTracked()){
+                    double error = predictRange(t) - actual;
+                    errorSquares += error*error;
+                    errorSamples++;
+                }
+                if(!stopped && rangeTracked() && predictRange(t) < BLOCKAGE_TOLERANCE){
+                    stopped = true;
+                    double late = BLOCKAGE_TOLERANCE - actual;
+                    stopLate += late;
+                    stopLateMax = std::max(stopLateMax, late);
+                    speedError += fabs(getClosingSpeed() - approachSpeed);
+                }
+            }
+            if(stopped){
+                break;
+            }
+        }
+        if(!stopped){
+            missedStops++;
+        }
+    }
+    int stops = trials - missedStops;
+    printf("approach at %.1f m/s: range rms %.1f mm, stopped %.1f mm past the tolerance on average (worst %.1f mm), "
+        "closing speed off by %.3f m/s, %d of %d missed\n", approachSpeed,
+        errorSamples > 0 ? sqrt(errorSquares/errorSamples)*1000 : 0.0, stops > 0 ? stopLate/stops*1000 : 0.0,
+        stopLateMax*1000, stops > 0 ? speedError/stops : 0.0, missedStops, trials);
+
+    //an obstacle steps into the path at 0.4 m and is taken away a second later
+    double appearDelay = 0;
+    double goneDelay = 0;
+    int appearMissed = 0;
+    int goneMissed = 0;
+    for(int trial = 0; trial < trials; trial++){
+        initRangeTracker();
+        const uint32_t appearMs = 1000 + 7*(trial % 7);
+        const uint32_t goneMs = appearMs + 1000;
+        int appeared = -1;
+        int gone = -1;
+        for(uint32_t now = 0; now < goneMs + 1000; now += pollMs){
+            bool present = now >= appearMs && now < goneMs;
+            updateRangeTracker(syntheticReading(present ? 0.4 : -1, robot, rng), now);
+            if(appeared < 0 && present && rangeTracked()){
+                appeared = now - appearMs;
+            }
+            if(gone < 0 && now >= goneMs && !rangeTracked()){
+                gone = now - goneMs;
+            }
+        }
+        if(appeared < 0){
+            appearMissed++;
+        }
+        else{
+            appearDelay += appeared;
+        }
+        if(gone < 0){
+            goneMissed++;
+        }
+        else{
+            goneDelay += gone;
+        }
+    }
+    printf("obstacle appearing: tracked after %.0f ms (%d missed), taken away: dropped after %.0f ms (%d missed)\n",
+        trials > appearMissed ? appearDelay/(trials - appearMissed) : 0.0, appearMissed,
+        trials > goneMissed ? goneDelay/(trials - goneMissed) : 0.0, goneMissed);
+
+    //nothing in range at all: any track is false, and any stop for one a false stop
+    const double emptySeconds = 600;
+    int falseTracks = 0;
+    int falseStops = 0;
+    int readingStops = 0; // what comparing each reading against the tolerance would have done
+    bool tracked = false;
+    bool blocked = false;
+    initRangeTracker();
+    for(uint32_t now = 0; now < emptySeconds*1000; now += pollMs){
+        double reading = syntheticReading(-1, robot, rng);
+        updateRangeTracker(reading, now);
+        if(reading < BLOCKAGE_TOLERANCE){
+            readingStops++;
+        }
+        if(rangeTracked() && !tracked){
+            falseTracks++;
+        }
+        tracked = rangeTracked();
+        bool stop = tracked && predictRange(now) < BLOCKAGE_TOLERANCE;
+        if(stop && !blocked){
+            falseStops++;
+        }
+        blocked = stop;
+    }
+    printf("empty path for %.0f s: %d false tracks, %d false stops (%d readings under the tolerance)\n",
+        emptySeconds, falseTracks, falseStops, readingStops);
+    return missedStops == 0 && falseStops == 0 ? 0 : 1;
+}
+
+/**
+ * signed difference between two bearings in degrees, within +-180
+ */
+static double bearingDifference(double a, double b){
+    double difference = fmod(a - b, 360);
+    if(difference > 180){
+        difference -= 360;
+    }
+    else if(difference < -180){
+        difference += 360;
+    }
+    return difference;
+}
+
+/**
+ * feed the bump locator the mic samples of bumps from every 15 degrees at a few strengths, each
+ * landing at a random moment between samples, and score the bearings it reports. the same
+ * samples are scored for the mic that first crosses MIC_BUMP_THRESHOLD, which is all the line
+ * follower went by before. then a minute of quiet counts the wake-ups noise alone causes, and ten
+ * seconds of it from a stale stored baseline the bumps that takes to recover from
+ */
+static int bumpsCommand(int argc, char ** argv){
+    std::string unusedTrack;
+    SimConfig config;
+    if(parseSimOptions(argc, argv, 2, unusedTrack, config) != argc){
+        usage();
+        return 2;
+    }
+    const SimRobotParams & robot = config.robot;
+    const double sampleSeconds = 100e-6; // the locator's sampling period
+    const int quietSamples = 600;        // lets the baselines settle and any holdoff run out
+    const int bumpSamples = 100;
+    const int trials = 20;
+    const double strengths[] = {40, 100, 300};
+    static const double firstMicBearings[3] = {-45, 180, 45};
+    std::mt19937 rng(config.seed);
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    std::normal_distribution<double> normal(0.0, 1.0);
+    auto sample = [&](int mic, double bearing, double strength, double sinceBump){
+        double value = robot.micBaseline + normal(rng)*robot.micNoise;
+        if(strength > 0){
+            value += SimHardware::micResponse(robot, mic, bearing, strength, sinceBump);
+        }
+        return std::max(0, std::min(1023, (int)lround(value)));
+    };
+
+    int missed = 0;
+    printf("strength  located  bearing error  side right  first mic: bearing error  side right\n");
+    for(double strength : strengths){
+        int bumps = 0;
+        int located = 0;
+        int sided = 0;       // bumps far enough off the centre line to have a side
+        int sideRight = 0;
+        int firstSideRight = 0;
+        double error = 0;
+        double firstError = 0;
+        int firstHeard = 0;
+        for(int bearing = -165; bearing <= 180; bearing += 15){
+            for(int trial = 0; trial < trials; trial++){
+                resetBumpLocator();
+                for(int i = 0; i < quietSamples; i++){
+                    pushMicSamples(sample(0, 0, 0, 0), sample(1, 0, 0, 0), sample(2, 0, 0, 0));
+                }
+                double onset = uniform(rng)*sampleSeconds;
+                int firstMic = -1;
+                for(int i = 0; i < bumpSamples; i++){
+                    double since = i*sampleSeconds - onset;
+                    int values[3];
+                    for(int mic = 0; mic < 3; mic++){
+                        values[mic] = sample(mic, bearing, strength, since);
+                        if(firstMic < 0 && values[mic] > robot.micBaseline + MIC_BUMP_THRESHOLD){
+                            firstMic = mic;
+                        }
+                    }
+                    pushMicSamples(values[0], values[1], values[2]);
+                }
+                bumps++;
+                bool hasSide = fabs(sin(bearing*M_PI/180)) > 0.26;
+                sided += hasSide;
+                BumpEvent bump;
+                if(locateBump(&bump)){
+                    located++;
+                    error += fabs(bearingDifference(bump.bearing, bearing));
+                    sideRight += hasSide && (bump.bearing > 0) == (bearing > 0) && abs(bump.bearing) != 180;
+                }
+                if(firstMic >= 0){
+                    firstHeard++;
+                    firstError += fabs(bearingDifference(firstMicBearings[firstMic], bearing));
+                    firstSideRight += hasSide && firstMic != 1 && (firstMicBearings[firstMic] > 0) == (bearing > 0);
+                }
+            }
+        }
+        if(strength >= 100){
+            missed += bumps - located;
+        }
+        printf("%8.0f  %3d/%-3d  %9.1f deg  %8.0f%%  %20.1f deg  %8.0f%%\n", strength, located, bumps,
+            located > 0 ? error/located : 0.0, sided > 0 ? 100.0*sideRight/sided : 0.0,
+            firstHeard > 0 ? firstError/firstHeard : 0.0, sided > 0 ? 100.0*firstSideRight/sided : 0.0);
+    }
+
+    //nothing but noise: every wake-up is a false one
+    const double quietSeconds = 60;
+    int falseWakes = 0;
+    initMicWakeup();
+    for(long i = 0; i < quietSeconds/sampleSeconds; i++){
+        const int values[3] = {sample(0, 0, 0, 0), sample(1, 0, 0, 0), sample(2, 0, 0, 0)};
+        falseWakes += micWakeSample(values);
+    }
+    printf("quiet for %.0f s: %d false wake-ups, thresholds %d %d %d\n", quietSeconds, falseWakes,
+        getMicThreshold(0), getMicThreshold(1), getMicThreshold(2));
+
+    //the same quiet through the whole locator, from stored baselines well under the quiet level:
+    //the locator must not keep waking after the holdoffs
+    const double staleBaseline = 40;
+    const double staleSeconds = 10;
+    const int maxStaleBumps = 10;
+    const float stored[3] = {(float)(robot.micBaseline - staleBaseline), (float)(robot.micBaseline - staleBaseline),
+        (float)(robot.micBaseline - staleBaseline)};
+    resetBumpLocator();
+    restoreMicBaselines(stored);
+    int staleBumps = 0;
+    BumpEvent bump;
+    for(long i = 0; i < staleSeconds/sampleSeconds; i++){
+        pushMicSamples(sample(0, 0, 0, 0), sample(1, 0, 0, 0), sample(2, 0, 0, 0));
+        if(i % 10 == 0){
+            staleBumps += locateBump(&bump);//once a millisecond, like loop()
+        }
+    }
+    bool recovered = staleBumps <= maxStaleBumps && fabs(getMicBaseline(0) - robot.micBaseline) < MIC_BUMP_THRESHOLD/2;
+    printf("quiet for %.0f s from baselines %.0f low: %d false bumps, baseline %.1f: %s\n", staleSeconds,
+        staleBaseline, staleBumps, getMicBaseline(0), recovered ? "ok" : "FAILED");
+    return missed == 0 && falseWakes == 0 && recovered ? 0 : 1;
+}
+
+/**
+ * every conversion a scan asks for, with a reading that differs per pin, per conversion and per ADC
+ */
+struct FakeConversion {
+    uint8_t adc;
+    uint8_t pin;
+    int value;
+};
+static std::vector<FakeConversion> fakeConversions;
+
+static int fakeConvert(uint8_t adc, uint8_t pin){
+    int value = 100 + pin*10 + (int)(fakeConversions.size()*7 % 23) + adc*3;
+    fakeConversions.push_back({adc, pin, value});
+    return value;
+}
+
+/**
+ * run scans of every size through a fake converter and check that the conversions come in the
+ * order analogRead would take them, alternate between the ADCs, and average to what the
+ * conversions read. then the same through QTRSensors in analog mode
+ */
+static int adcCommand(int argc, char ** argv){
+    (void)argv;
+    if(argc != 2){
+        usage();
+        return 2;
+    }
+    static const uint8_t scannable[8] = {14, 15, 16, 17, 18, 19, 20, 21};
+    setAdcConverter(fakeConvert);
+    int failures = 0;
+    int scans = 0;
+    long steps = 0;
+    long conversions = 0;
+    for(int count = 1; count <= 8; count++){
+        for(int samples = 1; samples <= 8; samples++){
+            AdcStep plan[ADC_MAX_STEPS];
+            int planned = planAdcScan(scannable, count, samples, plan);
+            uint16_t values[ADC_MAX_PINS];
+            fakeConversions.clear();
+            bool ok = planned == (count*samples + 1)/2 && adcScan(scannable, count, samples, values)
+                && (int)fakeConversions.size() == count*samples;
+            uint32_t sums[ADC_MAX_PINS] = {};
+            for(size_t k = 0; ok && k < fakeConversions.size(); k++){
+                ok = fakeConversions[k].pin == scannable[k % count] && fakeConversions[k].adc == k % 2;
+                sums[k % count] += fakeConversions[k].value;
+            }
+            for(int i = 0; ok && i < count; i++){
+                ok = values[i] == (sums[i] + samples/2)/samples;
+            }
+            if(!ok){
+                printf("scan of %d pins x %d samples: FAILED\n", count, samples);
+                failures++;
+            }
+            scans++;
+            steps += planned;
+            conversions += count*samples;
+        }
+    }
+    printf("%d scans of 1-8 pins x 1-8 samples: %s, %ld pairs for %ld conversions\n", scans,
+        failures == 0 ? "ok" : "FAILED", steps, conversions);
+
+    //pins on only one ADC, or none, are left to analogRead
+    static const uint8_t unscannable[5] = {13, 24, 25, 26, 27};
+    uint16_t values[ADC_MAX_PINS];
+    bool rejected = true;
+    for(uint8_t pin : unscannable){
+        uint8_t pins[2] = {18, pin};
+        rejected = rejected && !adcScan(pins, 2, 4, values);
+    }
+    printf("pins not on both ADCs: %s\n", rejected ? "rejected" : "FAILED, scanned");
+    failures += !rejected;
+
+    //the QTR library in analog mode, reading through the scan
+    QTRSensors qtr;
+    qtr.setTypeAnalog();
+    qtr.setSensorPins((const uint8_t[]){18, 19, 20}, 3);
+    qtr.setSamplesPerSensor(4);
+    qtr.setAnalogScan(adcScan);
+    uint16_t readings[3];
+    fakeConversions.clear();
+    qtr.read(readings, QTRReadMode::Manual);
+    uint32_t sums[3] = {};
+    for(size_t k = 0; k < fakeConversions.size(); k++){
+        sums[k % 3] += fakeConversions[k].value;
+    }
+    bool qtrOk = fakeConversions.size() == 12;
+    for(int i = 0; i < 3; i++){
+        qtrOk = qtrOk && readings[i] == (sums[i] + 2)/4;
+    }
+    printf("QTR analog read of 3 sensors x 4 samples: %s, %zu conversions in %d pairs\n",
+        qtrOk ? "ok" : "FAILED", fakeConversions.size(), (int)(fakeConversions.size() + 1)/2);
+    failures += !qtrOk;
+    setAdcConverter(nullptr);
+    return failures == 0 ? 0 : 1;
+}
+
+/**
+ * sweep a synthetic QTR channel back and forth across the tape under ambient light and compare
+ * what the line follower gets to see: readings with the emitters on, QTR's on-and-off reads (on
+ * plus the timeout minus off, two reads per tick) and the lock-in demodulation of one read per
+ * tick. each is scored against what the sensor reads in the dark, at the time of the reading
+ */
+static int lockInCommand(int argc, char ** argv){
+    std::string unusedTrack;
+    SimConfig config;
+    if(parseSimOptions(argc, argv, 2, unusedTrack, config) != argc){
+        usage();
+        return 2;
+    }
+    struct Scenario {
+        const char * name;
+        double light;
+        double flicker;
+        double drift;
+    };
+    //flicker between the readings is not cancelled, it is shown for what it does but not scored
+    std::vector<Scenario> scenarios = {
+        {"dark room", 0, 0, 0},
+        {"steady", 1.5, 0, 0},
+        {"drifting", 1.5, 0, 0.6},
+        {"flickering", 0.5, 0.3, 0},
+    };
+    if(config.robot.ambientLight > 0){
+        scenarios.push_back({"--ambient", config.robot.ambientLight, config.robot.ambientFlicker, config.robot.ambientDrift});
+    }
+    const double duration = 20;        // s per scenario
+    const double tickSeconds = 4e-3;   // one loop() iteration, give or take a quarter
+    const double sweepHz = 1.5;        // crossings of the tape back and forth
+    const uint16_t timeout = 2500;     // QTRSensors' default RC timeout
+    resetTunables();
+    for(const auto & tunable : config.tunables){
+        setTunable(tunable.first.c_str(), tunable.second);
+    }
+    std::mt19937 rng(config.seed);
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    std::normal_distribution<double> normal(0.0, 1.0);
+
+    int failures = 0;
+    printf("ambient          emitters on: rms  wrong   on and off: rms  wrong      lock-in: rms  wrong\n");
+    for(const Scenario & scenario : scenarios){
+        SimRobotParams robot = config.robot;
+        robot.ambientLight = scenario.light;
+        robot.ambientFlicker = scenario.flicker;
+        robot.ambientDrift = scenario.drift;
+        //what the channel reads at seconds with the emitters lit or not, and in the dark
+        auto emitterUs = [&](double seconds){
+            double darkness = std::max(0.0, std::min(1.0, 0.5 + 0.8*sin(2*M_PI*sweepHz*seconds)));
+            return robot.qtrWhiteUs + (robot.qtrBlackUs - robot.qtrWhiteUs)*darkness;
+        };
+        auto read = [&](double seconds, bool lit){
+            double t = std::max(10.0, emitterUs(seconds) + normal(rng)*robot.qtrNoiseUs);
+            return (uint16_t)std::min((double)timeout, SimHardware::qtrResponse(robot, t, lit, seconds));
+        };
+
+        double squares[3] = {0, 0, 0};
+        int wrong[3] = {0, 0, 0};
+        int readings = 0;
+        initLockIn(1, timeout);
+        for(double now = 0; now < duration; now += tickSeconds*(0.75 + 0.5*uniform(rng))){
+            uint16_t truth = (uint16_t)std::min((double)timeout, emitterUs(now));
+            uint16_t on = read(now, true);
+            uint16_t onAndOff = (uint16_t)std::min((int)timeout, on + timeout - read(now + on*1e-6, false));
+            bool emitterOn = lockInEmitterOn((uint32_t)(now*1e6));
+            uint16_t raw[1] = {read(now, emitterOn)};
+            pushLockInReading(raw, emitterOn, (uint32_t)(now*1e6));
+            uint16_t demodulated[1];
+            getLockInValues(demodulated);
+            const uint16_t seen[3] = {on, onAndOff, demodulated[0]};
+            for(int k = 0; k < 3; k++){
+                double error = (double)seen[k] - truth;
+                squares[k] += error*error;
+                wrong[k] += (seen[k] > IR_LOWER_THRESHOLD) != (truth > IR_LOWER_THRESHOLD);
+            }
+            readings++;
+        }
+        double wrongPercent[3];
+        for(int k = 0; k < 3; k++){
+            wrongPercent[k] = 100.0*wrong[k]/readings;
+        }
+        printf("%-16s %13.0f us %5.1f%% %16.0f us %5.1f%% %16.0f us %5.1f%%\n", scenario.name,
+            sqrt(squares[0]/readings), wrongPercent[0], sqrt(squares[1]/readings), wrongPercent[1],
+            sqrt(squares[2]/readings), wrongPercent[2]);
+        failures += scenario.flicker == 0 && wrongPercent[2] > 2;
+    }
+    printf("RC reads per tick: emitters on 1, on and off 2, lock-in 1\n");
+    return failures == 0 ? 0 : 1;
+}
+
+/**
+ * read QTR arrays of every size across a straight piece of the oval at random offsets. for each
+ * size: the time a read blocks for, all sensors timed together and one after the other, the host
+ * time to find the line in a reading, and how far from the true offset QTRSensors' weighted average
+ * and LineFit.h put the line. then the same with a second line alongside, which LineFit.h should
+ * report as a fork when both are under the array, and never does on the single line. 3 sensors are
+ * the robot's, at every other channel, larger arrays at the boards' full 9.525 mm pitch. last, the
+ * cost of one poll of the sensor pins while an RC read waits on them
+ */
+static int benchCommand(int argc, char ** argv){
+    std::string unusedTrack;
+    SimConfig config;
+    if(parseSimOptions(argc, argv, 2, unusedTrack, config) != argc){
+        usage();
+        return 2;
+    }
+    Track track;
+    track.load("oval");
+    //the oval starts along +x at y = -400, the branch runs alongside it on the left
+    const double forkGap = 45;
+    Track forked;
+    forked.load("oval");
+    forked.addBranch({{-800, -400 + forkGap}, {-400, -400 + forkGap}});
+    const int sizes[] = {3, 4, 8, 12, 16, 24, 31};
+    const int trials = 300;
+    const int fitRepeats = 200; // host timing is taken over every reading this many times
+    std::mt19937 rng(config.seed);
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+
+    int failures = 0;
+    printf("sensors  pitch  read: together  one at a time   fit: average  quadratic   error rms: average  quadratic   forks: found  false\n");
+    for(int count : sizes){
+        SimConfig benchConfig = config;
+        benchConfig.robot.qtrCount = count;
+        benchConfig.robot.sensorSpacing = count == 3 ? config.robot.sensorSpacing : 9.525;
+        double pitch = benchConfig.robot.sensorSpacing;
+        SimHardware hardware(track, benchConfig);
+        hardware.makeCurrent();
+
+        uint8_t pins[QTRMaxSensors];
+        for(int i = 0; i < count; i++){
+            pins[i] = SIM_IR_PIN_FIRST + i;
+        }
+        QTRSensors array;
+        array.setTypeRC();
+        array.setSensorPins(pins, count);
+        QTRSensors single;
+        single.setTypeRC();
+        initLineFit(count, array.getTimeout());
+
+        std::vector<std::array<uint16_t, QTRMaxSensors>> readings;
+        std::vector<double> truth; // the line's position in sensor pitches from the first sensor
+        double together = 0;
+        double oneAtATime = 0;
+        double averageSquares = 0;
+        double quadraticSquares = 0;
+        int falseForks = 0;
+        for(int trial = 0; trial < trials; trial++){
+            //bar centre to the left of the line by offset, so the line sits offset right of it
+            double heading;
+            Vec2 at = track.pointAt(uniform(rng)*50, &heading);
+            double offset = (uniform(rng) - 0.5)*(count - 1)*pitch;
+            Vec2 centre = {at.x - offset*sin(heading), at.y + offset*cos(heading)};
+            double reach = benchConfig.robot.sensorOffset;
+            hardware.setPose({centre.x - reach*cos(heading), centre.y - reach*sin(heading), heading});
+
+            std::array<uint16_t, QTRMaxSensors> values;
+            uint64_t start = hardware.nowNs();
+            array.read(values.data());
+            together += (hardware.nowNs() - start)*1e-3;
+            start = hardware.nowNs();
+            for(int i = 0; i < count; i++){
+                uint16_t value;
+                single.setSensorPins(&pins[i], 1);
+                single.read(&value);
+            }
+            oneAtATime += (hardware.nowNs() - start)*1e-3;
+            readings.push_back(values);
+            truth.push_back((count - 1)/2.0 + offset/pitch);
+
+            uint16_t copy[QTRMaxSensors];
+            std::copy(values.begin(), values.end(), copy);
+            double average = array.readLineBlack(copy)/1000.0;//without calibration it averages the raw readings
+            LineReading line;
+            fitLine(values.data(), &line);
+            averageSquares += pow((average - truth.back())*pitch, 2);
+            quadraticSquares += pow((line.position/1000.0 - truth.back())*pitch, 2);
+            falseForks += line.lineCount > 1;
+        }
+        SimHardware::releaseCurrent();
+
+        //both lines under the array, away from its ends, wherever it fits them
+        int forkTrials = 0;
+        int forksFound = 0;
+        double slack = (count - 1)*pitch - forkGap - track.lineWidth();
+        if(slack > 0){
+            SimHardware forkHardware(forked, benchConfig);
+            forkHardware.makeCurrent();
+            initLineFit(count, array.getTimeout());
+            for(int trial = 0; trial < trials; trial++){
+                double offset = forkGap/2 + (uniform(rng) - 0.5)*slack;
+                double x = -700 + uniform(rng)*50;
+                forkHardware.setPose({x - benchConfig.robot.sensorOffset, -400 + offset, 0});
+                std::array<uint16_t, QTRMaxSensors> values;
+                array.read(values.data());
+                LineReading line;
+                fitLine(values.data(), &line);
+                forkTrials++;
+                forksFound += line.lineCount == 2;
+            }
+            SimHardware::releaseCurrent();
+        }
+
+        //host time per reading, readLineBlack makes no Arduino calls without calibration
+        auto hostStart = std::chrono::steady_clock::now();
+        volatile long sink = 0;
+        for(int repeat = 0; repeat < fitRepeats; repeat++){
+            for(auto & values : readings){
+                sink += array.readLineBlack(values.data());
+            }
+        }
+        double averageNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - hostStart).count()/(fitRepeats*trials);
+        hostStart = std::chrono::steady_clock::now();
+        for(int repeat = 0; repeat < fitRepeats; repeat++){
+            for(auto & values : readings){
+                LineReading line;
+                fitLine(values.data(), &line);
+                sink += line.position;
+            }
+        }
+        double quadraticNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - hostStart).count()/(fitRepeats*trials);
+        char found[16] = "-";
+        if(forkTrials > 0){
+            snprintf(found, sizeof(found), "%.0f%%", 100.0*forksFound/forkTrials);
+        }
+        printf("%7d  %5.2f  %10.0f us  %10.0f us  %9.0f ns  %6.0f ns  %14.1f mm  %6.1f mm  %11s  %4.0f%%\n", count, pitch,
+            together/trials, oneAtATime/trials, averageNs, quadraticNs,
+            sqrt(averageSquares/trials), sqrt(quadraticSquares/trials), found, 100.0*falseForks/trials);
+        failures += sqrt(quadraticSquares/trials) > pitch/2 || falseForks > 0 || (forkTrials > 0 && forksFound < forkTrials);
+    }
+
+    //one iteration of the RC polling loop against stub GPIO ports, 16 sensors to a port: every
+    //pending pin looked up in a pin table and loaded as the Teensy core's digitalRead() does, or
+    //each port loaded once as QTRSensors does on the Teensy 4. the stubs are plain memory, so the
+    //host times differ little: on the Teensy each load of a port is a bus access to the GPIO block
+    //that takes several cycles, and those are counted too
+    struct StubPin {
+        volatile uint32_t * reg;
+        uint32_t mask;
+    };
+    static volatile uint32_t stubPorts[QTRMaxPorts];
+    const int polls = 2000000;
+    printf("sensors  poll: pin by pin  port by port   port loads: pin by pin  port by port\n");
+    for(int count : sizes){
+        StubPin stubPins[QTRMaxSensors];
+        uint8_t sensorPort[QTRMaxSensors];
+        uint32_t sensorMask[QTRMaxSensors];
+        int ports = (count + 15)/16;
+        for(int i = 0; i < count; i++){
+            sensorPort[i] = i/16;
+            sensorMask[i] = 1u << (i % 16*2);
+            stubPins[i] = {&stubPorts[sensorPort[i]], sensorMask[i]};
+        }
+        uint32_t all = count == 32 ? ~0u : (1u << count) - 1;
+        volatile uint32_t sink = 0;
+        long pinLoads = 0;
+        long portLoads = 0;
+        auto hostStart = std::chrono::steady_clock::now();
+        for(int poll = 0; poll < polls; poll++){
+            stubPorts[0] = poll*2654435761u;
+            uint32_t pending = all;
+            uint32_t high = 0;
+            while(pending != 0){
+                uint8_t i = __builtin_ctz(pending);
+                if(i < QTRMaxSensors && (*stubPins[i].reg & stubPins[i].mask)){
+                    high |= 1u << i;
+                }
+                pinLoads++;
+                pending &= pending - 1;
+            }
+            sink = sink + high;
+        }
+        double pinNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - hostStart).count()/polls;
+        hostStart = std::chrono::steady_clock::now();
+        for(int poll = 0; poll < polls; poll++){
+            stubPorts[0] = poll*2654435761u;
+            uint32_t levels[QTRMaxPorts];
+            for(int p = 0; p < ports; p++){
+                levels[p] = stubPorts[p];
+                portLoads++;
+            }
+            sink = sink + QTRSensors::levelsFromPorts(levels, sensorPort, sensorMask, all);
+        }
+        double portNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - hostStart).count()/polls;
+        printf("%7d  %13.1f ns  %9.1f ns  %22.0f  %12.0f\n", count, pinNs, portNs,
+            (double)pinLoads/polls, (double)portLoads/polls);
+    }
+    return failures > 0 ? 1 : 0;
+}
+
+/**
+ * a junction laid out for sim junctions: arms in degrees clockwise from the way on, the robot
+ * always comes in from behind. the kind a scan should report, and the one reported while driving
+ * through it with the 3 sensor bar. the bar sees a single arm leaving to one side no wider than
+ * the line on a curve, so only junctions with tape across the whole bar or a split into two lines
+ * are decided while driving, the rest are followed as QTRSensors sees them. the bar is about 40
+ * degrees wide seen from the middle of the robot, so a scan cannot tell arms much closer than 60
+ * degrees apart
+ */
+struct JunctionLayout {
+    const char * name;
+    std::vector<int> arms;
+    JunctionKind scanKind;
+    JunctionKind liveKind;
+    bool liveChoice; // driving through, the detector has to pick a branch, not just follow the line
+};
+
+/**
+ * the middle of the oval with the arms of a junction painted in, coming in along +x
+ */
+static void paintJunction(Track & track, const JunctionLayout & layout){
+    const double armLength = 250;
+    track.load("oval");
+    track.addBranch({{-armLength, 0}, {0, 0}});
+    for(int arm : layout.arms){
+        double heading = -arm*M_PI/180;
+        track.addBranch({{0, 0}, {armLength*cos(heading), armLength*sin(heading)}});
+    }
+}
+
+/**
+ * the arm a policy should take: leftmost, rightmost, or straight on if there is one, else leftmost
+ */
+static int expectedArm(const std::vector<int> & arms, int policy){
+    int leftmost = *std::min_element(arms.begin(), arms.end());
+    if(arms.size() == 1 || policy == POLICY_LEFT){
+        return leftmost;
+    }
+    if(policy == POLICY_RIGHT){
+        return *std::max_element(arms.begin(), arms.end());
+    }
+    return std::find(arms.begin(), arms.end(), 0) != arms.end() ? 0 : leftmost;
+}
+
+static int sign(int value){
+    return (value > 0) - (value < 0);
+}
+
+/**
+ * drive the bar straight through a junction from 150 mm before its middle, reading the line as
+ * the NORMAL state does. true if the detector then steered towards the expected arm: to its side
+ * of the array, or no further than a quarter of the array off the middle for straight on
+ */
+static bool driveThrough(SimHardware & hardware, QTRSensors & array, const SimConfig & config,
+    double lateral, double heading, int expected){
+    const double stepMm = 0.5; // travel between readings, about a loop() at BASE_PWM
+    int count = config.robot.qtrCount;
+    int span = (count - 1)*1000;
+    double reach = config.robot.sensorOffset;
+    double travelled = 0;
+    bool towards = false;
+    bool away = false;
+    for(double x = -150; x < 60; x += stepMm){
+        hardware.setPose({x - reach*cos(heading), lateral - reach*sin(heading), heading});
+        std::array<uint16_t, QTRMaxSensors> values;
+        array.read(values.data());
+        LineReading line;
+        fitLine(values.data(), &line);
+        if(!LINE_INTERPOLATION){
+            uint16_t copy[QTRMaxSensors];
+            std::copy(values.begin(), values.end(), copy);
+            line.position = array.readLineBlack(copy);
+        }
+        travelled += stepMm;
+        int ticks = (int)(travelled/MM_PER_TICK);
+        int steer = followJunctions(line, ticks, ticks) - span/2;
+        Junction junction;
+        if(getLastJunction(&junction) && junction.chosen >= 0){
+            towards |= expected != 0 && sign(steer) == sign(expected) && abs(steer) >= span/4;
+            away |= expected == 0 && abs(steer) > span/4;
+        }
+    }
+    return expected == 0 ? !away : towards;
+}
+
+/**
+ * paint junctions of every kind inside the oval and put them through the junction detector the
+ * two ways the robot meets them. scan: the robot turns a full circle on the spot over the middle,
+ * reading the array each degree as the SENSING state does, and the branches are classified from
+ * the peaks. live: the robot drives straight through from the way in and the detector classifies
+ * the junction from the readings and picks a branch. every trial starts a little off the middle
+ * and off straight. each policy should take the arm it names, and a scripted run through a T twice
+ * and a crossing takes the digits of JUNCTION_SCRIPT in turn
+ */
+static int junctionsCommand(int argc, char ** argv){
+    std::string unusedTrack;
+    SimConfig config;
+    if(parseSimOptions(argc, argv, 2, unusedTrack, config) != argc){
+        usage();
+        return 2;
+    }
+    const std::vector<JunctionLayout> layouts = {
+        {"line", {0}, JUNCTION_NONE, JUNCTION_NONE, false},
+        {"bend", {-35}, JUNCTION_NONE, JUNCTION_NONE, false},
+        {"corner", {90}, JUNCTION_NONE, JUNCTION_NONE, false},
+        {"side", {-90, 0}, JUNCTION_SIDE, JUNCTION_NONE, false},
+        {"spur", {0, 60}, JUNCTION_SIDE, JUNCTION_NONE, false},
+        {"fork", {-35, 35}, JUNCTION_FORK, JUNCTION_FORK, true},
+        {"T", {-90, 90}, JUNCTION_T, JUNCTION_T, true},
+        {"crossing", {-90, 0, 90}, JUNCTION_CROSS, JUNCTION_CROSS, true},
+    };
+    const int policies[] = {POLICY_LEFT, POLICY_RIGHT, POLICY_STRAIGHT};
+    const int trials = 20;
+    const int armTolerance = 15; // degrees a scanned branch may be off its arm
+    std::mt19937 rng(config.seed);
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    int count = config.robot.qtrCount;
+    int span = (count - 1)*1000;
+    uint8_t pins[QTRMaxSensors];
+    for(int i = 0; i < count; i++){
+        pins[i] = SIM_IR_PIN_FIRST + i;
+    }
+
+    resetTunables();
+    //the simulated floor averages about 200 over the three sensors and a sensor on the tape
+    //about 2500, so one of them over it lifts the average well past this
+    setTunable("IR_PEAK_THRESHOLD", 600);
+    for(const auto & tunable : config.tunables){
+        setTunable(tunable.first.c_str(), tunable.second);
+    }
+    int failures = 0;
+    printf("junction   scan: kind   branches  error    live: kind   left   right  straight\n");
+    for(const JunctionLayout & layout : layouts){
+        Track track;
+        paintJunction(track, layout);
+        SimHardware hardware(track, config);
+        hardware.makeCurrent();
+        QTRSensors array;
+        array.setTypeRC();
+        array.setSensorPins(pins, count);
+
+        int scanKinds = 0;
+        int scanBranches = 0;
+        double scanError = 0;
+        int scanErrors = 0;
+        int liveKinds = 0;
+        int taken[3] = {0, 0, 0};
+        for(int trial = 0; trial < trials; trial++){
+            double jitterX = (uniform(rng) - 0.5)*10;
+            double jitterY = (uniform(rng) - 0.5)*10;
+            double jitterHeading = (uniform(rng) - 0.5)*10*M_PI/180;
+
+            //turning clockwise on the spot over the middle, one reading per degree
+            int scan[360];
+            for(int degree = 0; degree < 360; degree++){
+                hardware.setPose({jitterX, jitterY, jitterHeading - degree*M_PI/180});
+                std::array<uint16_t, QTRMaxSensors> values;
+                array.read(values.data());
+                int sum = 0;
+                for(int i = 0; i < count; i++){
+                    sum += values[i];
+                }
+                scan[degree] = sum/count;
+            }
+            Junction junction;
+            initJunctionDetector(span);
+            classifyScan(scan, &junction);
+            scanKinds += junction.kind == layout.scanKind;
+            bool matched = junction.branchCount == (int)layout.arms.size();
+            for(int k = 0; matched && k < junction.branchCount; k++){
+                int error = abs(junction.branches[k] - layout.arms[k]);
+                matched = error <= armTolerance;
+                scanError += error;
+                scanErrors++;
+            }
+            scanBranches += matched;
+
+            //driving through, once per policy
+            for(int p = 0; p < 3; p++){
+                setTunable("JUNCTION_POLICY", policies[p]);
+                initJunctionDetector(span);
+                initLineFit(count, array.getTimeout());
+                int expected = layout.liveChoice ? expectedArm(layout.arms, policies[p]) : 0;
+                bool steered = driveThrough(hardware, array, config, (uniform(rng) - 0.5)*6, jitterHeading*0.3, expected);
+                bool seen = getLastJunction(&junction) && junction.chosen >= 0;
+                JunctionKind kind = seen ? junction.kind : JUNCTION_NONE;
+                int choice = seen ? junction.branches[junction.chosen] : 0;
+                liveKinds += kind == layout.liveKind;
+                taken[p] += steered && sign(choice) == sign(expected) && seen == layout.liveChoice;
+            }
+        }
+        SimHardware::releaseCurrent();
+        failures += 2*trials - scanKinds - scanBranches + 3*trials - liveKinds + 3*trials - taken[0] - taken[1] - taken[2];
+        printf("%-9s  %9d/%-3d  %5d/%-3d  %3.0f deg  %7d/%-3d  %3d/%-3d  %3d/%-3d  %3d/%-3d\n", layout.name,
+            scanKinds, trials, scanBranches, trials, scanErrors > 0 ? scanError/scanErrors : 0.0,
+            liveKinds, 3*trials, taken[0], trials, taken[1], trials, taken[2], trials);
+    }
+
+    //the script 132 through a T, the T again and a crossing: left, right, then straight on
+    const JunctionLayout * scripted[] = {&layouts[6], &layouts[6], &layouts[7]};
+    const int scriptArms[] = {-90, 90, 0};
+    setTunable("JUNCTION_POLICY", POLICY_SCRIPTED);
+    setTunable("JUNCTION_SCRIPT", 132);
+    initJunctionDetector(span);
+    int scriptTaken = 0;
+    for(int pass = 0; pass < 3; pass++){
+        Track track;
+        paintJunction(track, *scripted[pass]);
+        SimHardware hardware(track, config);
+        hardware.makeCurrent();
+        QTRSensors array;
+        array.setTypeRC();
+        array.setSensorPins(pins, count);
+        resetJunctionDetector();
+        initLineFit(count, array.getTimeout());
+        bool steered = driveThrough(hardware, array, config, 0, 0, scriptArms[pass]);
+        Junction junction;
+        bool seen = getLastJunction(&junction) && junction.chosen >= 0;
+        scriptTaken += steered && seen && sign(junction.branches[junction.chosen]) == sign(scriptArms[pass]);
+        SimHardware::releaseCurrent();
+    }
+    printf("script 132 through T, T, crossing: %d/3 taken as scripted\n", scriptTaken);
+    failures += 3 - scriptTaken;
+    resetTunables();
+    return failures > 0 ? 1 : 0;
+}
+
+//the SENSING state under test, from src/main.cpp
+void enterSensing();
+RobotEvent tickSensing();
+
+/**
+ * angle from a to b folded into -180..180 degrees
+ */
+static double angleBetween(double a, double b){
+    return remainder(b - a, 2*M_PI)*180/M_PI;
+}
+
+/**
+ * the robot sits on a straight line at a random angle and runs the SENSING state: a full turn
+ * scanning, then a turn onto the line. then it turns a quarter turn on its own. done for a range
+ * of wheel slip in turns, with the heading from the encoder ticks alone and from the estimator,
+ * against the simulated heading. the estimator should head onto the line and turn the quarter
+ * within a few degrees however much the wheels slip
+ */
+static int headingCommand(int argc, char ** argv){
+    std::string unusedTrack;
+    SimConfig config;
+    if(parseSimOptions(argc, argv, 2, unusedTrack, config) != argc){
+        usage();
+        return 2;
+    }
+    std::vector<double> slips = {0, 0.05, 0.1, 0.15};
+    if(config.robot.turnSlip > 0){
+        slips.push_back(config.robot.turnSlip);
+    }
+    const int trials = 10;
+    const double toleranceDeg = 5; // the estimator should head onto the line and turn the quarter within this
+    std::mt19937 rng(config.seed);
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+
+    int failures = 0;
+    printf("slip   ticks: onto line  quarter turn   estimator: onto line  quarter turn  heading  scale\n");
+    for(double slip : slips){
+        double lineError[2] = {0, 0};
+        double quarterError[2] = {0, 0};
+        double headingError = 0;
+        double scale = 0;
+        for(int trial = 0; trial < trials; trial++){
+            double lineBearing = uniform(rng)*2*M_PI;
+            double startHeading = uniform(rng)*2*M_PI;
+            double lateral = (uniform(rng) - 0.5)*6;
+            for(int estimator = 0; estimator < 2; estimator++){
+                Track track;
+                track.load("oval");
+                Vec2 along = {cos(lineBearing), sin(lineBearing)};
+                track.addBranch({{-300*along.x, -300*along.y}, {300*along.x, 300*along.y}});
+                SimConfig trialConfig = config;
+                trialConfig.robot.turnSlip = slip;
+                SimHardware hardware(track, trialConfig);
+                hardware.makeCurrent();
+                hardware.setPose({-lateral*along.y, lateral*along.x, startHeading});
+                resetTunables();
+                //the simulated floor averages about 200 over the three sensors, see sim junctions
+                setTunable("IR_PEAK_THRESHOLD", 600);
+                for(const auto & tunable : config.tunables){
+                    setTunable(tunable.first.c_str(), tunable.second);
+                }
+                setTunable("HEADING_ESTIMATOR", estimator);
+                initSensing();
+                initDriving();
+
+                enterSensing();
+                while(tickSensing() == EVENT_NONE && hardware.seconds() < 30){
+                    updateTraction();
+                    hardware.chargeLoopOverhead();
+                }
+                if(estimator){
+                    //the estimated heading is clockwise, the simulated one anticlockwise
+                    headingError = std::max(headingError, fabs(getHeading()*180/M_PI + (hardware.pose().heading - startHeading)*180/M_PI));
+                    scale += getWheelBaseScale()/trials;
+                }
+                hardware.delayMicroseconds(500000);//let it come to rest
+                double facing = hardware.pose().heading;
+                double offLine = angleBetween(lineBearing, facing);
+                offLine = fabs(offLine) > 90 ? 180 - fabs(offLine) : fabs(offLine);
+                lineError[estimator] = std::max(lineError[estimator], offLine);
+
+                rotateToAngle(90);
+                while(!continueRotating(getEncoderData(LEFT), getEncoderData(RIGHT)) && hardware.seconds() < 40){
+                    hardware.delayMicroseconds(5000);
+                    updateTraction();
+                }
+                hardware.delayMicroseconds(500000);//let it come to rest
+                quarterError[estimator] = std::max(quarterError[estimator], fabs(angleBetween(facing, hardware.pose().heading) + 90));
+                SimHardware::releaseCurrent();
+            }
+        }
+        failures += lineError[1] > toleranceDeg || quarterError[1] > toleranceDeg || headingError > toleranceDeg;
+        printf("%4.2f  %14.1f deg  %8.1f deg  %17.1f deg  %8.1f deg  %3.1f deg  %5.3f\n", slip,
+            lineError[0], quarterError[0], lineError[1], quarterError[1], headingError, scale);
+    }
+
+    //cost of one update of each kind, e.g. to check it fits the loop on the Teensy
+    const int repeats = 200000;
+    initHeadingEstimator();
+    LineReading line;
+    line.lineCount = 1;
+    auto hostStart = std::chrono::steady_clock::now();
+    for(int i = 0; i < repeats; i++){
+        updateHeadingOdometry(i, i, 1, false, i*100);
+        line.position = 1000 + (i % 200) - 100;
+        observeLineUnderBar(line);
+    }
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - hostStart).count()/repeats;
+    printf("one odometry and one line update: %.0f ns host time\n", ns);
+    resetTunables();
+    return failures > 0 ? 1 : 0;
+}
+
+/**
+ * watches the motor pins for a direction written while that wheel's duty is not zero
+ */
+class ReversalWatch : public SimObserver
+{
+  public:
+    int glitches = 0;
+    int duty[SIM_PIN_COUNT] = {};
+    void onPhysicsStep(const SimHardware & hardware) override { (void)hardware; }
+    void onMotorOutput(const SimHardware & hardware, uint8_t pin, int value) override{
+        (void)hardware;
+        if(pin == SIM_MOTOR_LEFT_PWM_PIN || pin == SIM_MOTOR_RIGHT_PWM_PIN){
+            duty[pin] = value;
+            return;
+        }
+        uint8_t pwmPin = pin == SIM_MOTOR_LEFT_DIR_PIN ? SIM_MOTOR_LEFT_PWM_PIN : SIM_MOTOR_RIGHT_PWM_PIN;
+        glitches += duty[pwmPin] != 0;
+    }
+};
+
+/**
+ * the motor output stage against its promises: commands keep their fraction, the slew limits every
+ * step, a wheel only turns around from zero duty, and a brake is at once
+ */
+static int motorsCommand(int argc, char ** argv){
+    (void)argv;
+    if(argc != 2){
+        usage();
+        return 2;
+    }
+    Track track;
+    track.load("oval");
+    SimConfig config;
+    SimHardware hardware(track, config);
+    hardware.makeCurrent();
+    ReversalWatch watch;
+    hardware.setObserver(&watch);
+    resetTunables();
+    initMotorDriver();
+    int failures = 0;
+    MotorOutput left, right;
+
+    //resolution
+    setMotors(100, 100.25);
+    getMotorOutputs(&left, &right);
+    bool fine = left.duty != right.duty;
+    setMotors(MOTOR_FULL_SCALE + 10, -MOTOR_FULL_SCALE);
+    hardware.delayMicroseconds(1000);
+    setMotors(MOTOR_FULL_SCALE + 10, -MOTOR_FULL_SCALE);
+    getMotorOutputs(&left, &right);
+    fine = fine && left.duty == MOTOR_DUTY_MAX && left.forward && right.duty == MOTOR_DUTY_MAX && !right.forward;
+    printf("%d bit duty, quarter steps of 255 apart: %s\n", MOTOR_PWM_BITS, fine ? "ok" : "FAILED");
+    failures += !fine;
+
+    //a reversal passes one call at zero duty
+    brakeMotors();
+    setMotors(120, 120);
+    setMotors(-120, 120);
+    getMotorOutputs(&left, &right);
+    bool held = left.duty == 0 && left.forward && right.duty > 0;
+    setMotors(-120, 120);
+    getMotorOutputs(&left, &right);
+    held = held && left.duty > 0 && !left.forward;
+    printf("reversal through zero duty: %s\n", held ? "ok" : "FAILED");
+    failures += !held;
+
+    //slew from full backwards to full forwards, one call per ms
+    brakeMotors();
+    const double slew = 4;
+    setTunable("MOTOR_SLEW", slew);
+    int calls = 0;
+    double lastCommand = 0;
+    double largestStep = 0;
+    do{
+        hardware.delayMicroseconds(1000);
+        setMotors(calls < 100 ? -MOTOR_FULL_SCALE : MOTOR_FULL_SCALE, 0);
+        getMotorOutputs(&left, &right);
+        double command = (left.forward ? 1 : -1)*left.duty*MOTOR_FULL_SCALE/MOTOR_DUTY_MAX;
+        if(lastCommand != 0){//the call after the one held at zero catches up with the slew
+            largestStep = std::max(largestStep, fabs(command - lastCommand));
+        }
+        lastCommand = command;
+        calls++;
+    }while((left.duty != MOTOR_DUTY_MAX || !left.forward) && calls < 1000);
+    //a little over the slew for the rounding to whole duty steps and the time the calls take
+    bool slewed = largestStep <= slew*1.01 + MOTOR_FULL_SCALE/MOTOR_DUTY_MAX && calls < 1000;
+    printf("slew %.0f per ms: largest step %.2f, full backwards to full forwards in %d ms: %s\n",
+        slew, largestStep, calls - 100, slewed ? "ok" : "FAILED");
+    failures += !slewed;
+
+    //the brake does not wait on the slew
+    brakeMotors();
+    getMotorOutputs(&left, &right);
+    bool braked = left.duty == 0 && right.duty == 0;
+    printf("brake at once: %s\n", braked ? "ok" : "FAILED");
+    failures += !braked;
+
+    printf("direction written under a running duty: %d times\n", watch.glitches);
+    failures += watch.glitches > 0;
+    hardware.setObserver(nullptr);
+    resetTunables();
+    SimHardware::releaseCurrent();
+    return failures > 0 ? 1 : 0;
+}
+
+/**
+ * the latency probe run on the simulated clock, first with the robot idle and then reading the
+ * line sensors back to back, whose RC reads hold interrupts off while they switch and sample the
+ * pins. those windows are far below the simulator's 1 us micros(), so this checks that every run
+ * is taken and that no read holds interrupts off for whole microseconds, e.g. across its poll. the
+ * Teensy's own figures come from the teensy40_latency build
+ */
+static int latencyCommand(int argc, char ** argv){
+    (void)argv;
+    if(argc != 2){
+        usage();
+        return 2;
+    }
+    Track track;
+    track.load("oval");
+    SimConfig config;
+    SimHardware hardware(track, config);
+    hardware.makeCurrent();
+    resetTunables();
+    initSensing();
+    startLatencyProbe();
+    const uint64_t phaseUs = 1000000;
+    const double maxLatencyUs = 2;//a couple of micros() ticks
+
+    hardware.delayMicroseconds(phaseUs);
+    double idle = getWorstLatencyUs();
+    uint32_t idleRuns = getLatencyProbeRuns();
+
+    resetLatencyProbe();
+    int reads = 0;
+    uint64_t start = hardware.nowNs();
+    while(hardware.nowNs() - start < phaseUs*1000){
+        getIRValues();
+        getLinePosition();
+        hardware.chargeLoopOverhead();
+        reads++;
+    }
+    double reading = getWorstLatencyUs();
+    uint32_t readingRuns = getLatencyProbeRuns();
+    stopLatencyProbe();
+    SimHardware::releaseCurrent();
+
+    printf("idle:              worst %5.1f us over %u runs\n", idle, (unsigned)idleRuns);
+    printf("reading the line:  worst %5.1f us over %u runs, %d reads\n", reading, (unsigned)readingRuns, reads);
+    //the probe is due every 97 us, a run is only lost while something holds it off for longer
+    uint32_t dueRuns = phaseUs/97;
+    bool ok = idleRuns >= dueRuns && readingRuns >= dueRuns && idle <= maxLatencyUs && reading <= maxLatencyUs;
+    printf("%s\n", ok ? "ok" : "FAILED");
+    return ok ? 0 : 1;
+}
+
+/**
+ * an item the stress test can tell was torn: the check is derived from the sequence number
+ */
+struct StressItem {
+    uint32_t sequence;
+    uint32_t check;
+};
+
+static uint32_t stressCheck(uint32_t sequence){
+    return sequence*2654435761u ^ 0x5bd1e995u;
+}
+
+/**
+ * the SPSC queue between two threads, the producer standing in for an interrupt: every item has
+ * to come out once, in order and whole, however the threads interleave. then the host cost of a
+ * push and a pop, and the encoder edges it carries against the tick counts of a simulated run
+ */
+static int spscCommand(int argc, char ** argv){
+    (void)argv;
+    if(argc != 2){
+        usage();
+        return 2;
+    }
+    int failures = 0;
+
+    //small queues wrap and fill often, the larger one rarely does
+    const uint32_t items = 200000;
+    auto stress = [&](auto & queue, const char * name){
+        std::atomic<uint32_t> full{0};
+        auto start = std::chrono::steady_clock::now();
+        std::thread producer([&]{
+            for(uint32_t i = 0; i < items; i++){
+                while(!queue.push({i, stressCheck(i)})){
+                    full.fetch_add(1, std::memory_order_relaxed);
+                    std::this_thread::yield();
+                }
+            }
+        });
+        uint32_t expected = 0;
+        uint32_t wrong = 0;
+        StressItem item = {};
+        while(expected < items){
+            if(!queue.pop(&item)){
+                std::this_thread::yield();//on a single core the producer only runs when let
+                continue;
+            }
+            wrong += item.sequence != expected || item.check != stressCheck(expected);
+            expected = item.sequence + 1;
+        }
+        producer.join();
+        double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count()/items;
+        bool ok = wrong == 0 && queue.size() == 0;
+        printf("%-22s %u items across threads, %3.0f ns each, full %u times, %u out of order or torn: %s\n",
+            name, (unsigned)items, ns, (unsigned)full.load(), (unsigned)wrong, ok ? "ok" : "FAILED");
+        failures += !ok;
+    };
+    static SpscQueue<StressItem, 2> tiny;
+    static SpscQueue<StressItem, 16> small;
+    static SpscQueue<StressItem, 1024> large;
+    stress(tiny, "capacity 2:");
+    stress(small, "capacity 16:");
+    stress(large, "capacity 1024:");
+
+    //one thread, as an interrupt and loop() share a core
+    const int repeats = 20000000;
+    static SpscQueue<StressItem, 64> bench;
+    volatile uint32_t sink = 0;
+    StressItem item = {};
+    auto hostStart = std::chrono::steady_clock::now();
+    for(int i = 0; i < repeats; i++){
+        bench.push({(uint32_t)i, 0});
+        bench.pop(&item);
+        sink = sink + item.sequence;
+    }
+    double pairNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - hostStart).count()/repeats;
+    hostStart = std::chrono::steady_clock::now();
+    for(int i = 0; i < repeats/32; i++){
+        for(uint32_t j = 0; j < 32; j++){
+            bench.push({j, 0});
+        }
+        while(bench.pop(&item)){
+            sink = sink + item.sequence;
+        }
+    }
+    double burstNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - hostStart).count()/(repeats/32*32);
+    printf("push and pop, one thread: %.1f ns host time each pair, %.1f ns in bursts of 32\n", pairNs, burstNs);
+
+    //the encoder edges through the queue give the wheel speed the counts give over a longer window
+    Track track;
+    track.load("oval");
+    SimConfig config;
+    SimHardware hardware(track, config);
+    hardware.makeCurrent();
+    resetTunables();
+    initSensing();
+    initMotorDriver();
+    const double commands[][2] = {{150, 90}, {90, 150}, {200, 200}};
+    for(const auto & command : commands){
+        for(int ms = 0; ms < 600; ms++){//the wheels settle at the speed
+            setMotors(command[0], command[1]);
+            hardware.delayMicroseconds(1000);
+        }
+        int ticks[2] = {getEncoderData(LEFT), getEncoderData(RIGHT)};
+        uint64_t start = hardware.nowNs();
+        double rates[2] = {0, 0};
+        int samples = 0;
+        for(int ms = 0; ms < 400; ms++){
+            setMotors(command[0], command[1]);
+            hardware.delayMicroseconds(1000);
+            rates[0] += getWheelTickRate(LEFT);
+            rates[1] += getWheelTickRate(RIGHT);
+            samples++;
+        }
+        double seconds = (hardware.nowNs() - start)*1e-9;
+        bool ok = true;
+        printf("motors %3.0f %3.0f:", command[0], command[1]);
+        for(int wheel = 0; wheel < 2; wheel++){
+            double counted = (getEncoderData(wheel == 0 ? LEFT : RIGHT) - ticks[wheel])/seconds;
+            double edges = rates[wheel]/samples;
+            ok = ok && counted > 0 && fabs(edges - counted) < 0.03*counted;
+            printf("  %s %6.0f ticks/s counted, %6.0f from edge times", wheel == 0 ? "left" : "right", counted, edges);
+        }
+        printf(": %s\n", ok ? "ok" : "FAILED");
+        failures += !ok;
+    }
+    brakeMotors();
+    SimHardware::releaseCurrent();
+    (void)sink;
+    return failures > 0 ? 1 : 0;
+}
+
+void setup();
+void loop();
+
+/**
+ * what one simulated boot came to
+ */
+struct BootResult {
+    double firstTickMs;  // from reset to the first loop()
+    double drivingMs;    // and to the first tick following the line with the wheels turning, -1 if never
+    int eepromWrites;
+};
+
+/**
+ * reset the robot with the given EEPROM contents, the bar offset sideways from the line, and run
+ * it until it follows the line. the EEPROM is left as the robot left it
+ */
+static BootResult simulateBoot(std::vector<uint8_t> & eeprom, double offsetMm){
+    Track track;
+    track.load("oval");
+    SimConfig config;
+    SimHardware hardware(track, config);
+    hardware.eeprom() = eeprom;
+    SimPose pose = hardware.pose();
+    pose.x -= offsetMm*sin(pose.heading);
+    pose.y += offsetMm*cos(pose.heading);
+    hardware.setPose(pose);
+    hardware.makeCurrent();
+    BootResult result = {0, -1, 0};
+    setup();
+    result.firstTickMs = hardware.nowNs()*1e-6;
+    while(hardware.seconds() < 20){
+        loop();
+        hardware.chargeLoopOverhead();
+        MotorOutput left, right;
+        getMotorOutputs(&left, &right);
+        if(getCurrentState() == STATE_NORMAL && left.duty > 0 && right.duty > 0){
+            result.drivingMs = hardware.nowNs()*1e-6;
+            break;
+        }
+    }
+    brakeMotors();
+    result.eepromWrites = hardware.eepromWrites();
+    eeprom = hardware.eeprom();
+    SimHardware::releaseCurrent();
+    return result;
+}
+
+/**
+ * the persistence format on the host: an image restores what it was packed from, and no image
+ * that is erased, damaged, of another version or of other tunables restores anything. then
+ * boots from an empty EEPROM and from what the first boot stored, on and off the line, timed from
+ * reset to the first control tick and to following the line
+ */
+static int bootCommand(int argc, char ** argv){
+    (void)argv;
+    if(argc != 2){
+        usage();
+        return 2;
+    }
+    int failures = 0;
+    Track track;
+    track.load("oval");
+    SimConfig config;
+    SimHardware hardware(track, config);
+    hardware.makeCurrent();
+    resetTunables();
+    initHeadingEstimator();
+    initMicWakeup();
+
+    //round trip
+    uint8_t image[PERSIST_IMAGE_MAX];
+    setTunable("P_WEIGHT", 0.42);
+    setTunable("BASE_PWM", 133);
+    const float baselines[3] = {201.5f, 198.25f, 203};
+    restoreMicBaselines(baselines);
+    restoreWheelBaseScale(1.087, 1e-4);
+    const MotorModel models[2] = {{18.2, 0.07, 0.012, 19}, {16.7, 0.075, 0.013, 21}};
+    restoreMotorModels(models, true);
+    int length = packPersistedState(image, sizeof(image));
+    resetTunables();
+    initHeadingEstimator();
+    initMicWakeup();
+    initMotorModel();
+    PersistStatus status = unpackPersistedState(image, length);
+    bool restored = status == PERSIST_OK && P_WEIGHT == 0.42 && BASE_PWM == 133 && getWheelBaseScale() == 1.087
+        && getWheelBaseScaleVariance() == 1e-4 && getMicBaseline(1) == 198.25f
+        && motorModelFitted() && getMotorModel(RIGHT).gain == 16.7 && getMotorModel(LEFT).deadTime == 0.012;
+    printf("%d byte image, round trip: %s\n", length, restored ? "ok" : "FAILED");
+    failures += !restored;
+
+    //every single bit flipped, and the image cut short, is refused and restores nothing
+    resetTunables();
+    initHeadingEstimator();
+    initMotorModel();
+    int accepted = 0;
+    int missing = 0;
+    for(int bit = 0; bit < length*8; bit++){
+        image[bit/8] ^= 1 << (bit % 8);
+        PersistStatus damaged = unpackPersistedState(image, length);
+        image[bit/8] ^= 1 << (bit % 8);
+        accepted += damaged == PERSIST_OK;
+        missing += damaged == PERSIST_MISSING;
+    }
+    for(int size = 0; size < length; size++){
+        accepted += unpackPersistedState(image, size) == PERSIST_OK;
+    }
+    bool untouched = P_WEIGHT != 0.42 && getWheelBaseScale() == 1 && !motorModelFitted();
+    printf("%d single bit flips and %d cut lengths: %d accepted, %d taken for no image: %s\n",
+        length*8, length, accepted, missing, accepted == 0 && untouched ? "ok" : "FAILED");
+    failures += accepted > 0 || !untouched;
+
+    //erased, another version, another build's tunables
+    uint8_t erased[PERSIST_IMAGE_MAX];
+    memset(erased, 0xff, sizeof(erased));
+    bool erasedMissing = unpackPersistedState(erased, sizeof(erased)) == PERSIST_MISSING;
+    auto resealed = [&](int offset, uint8_t value){
+        uint8_t copy[PERSIST_IMAGE_MAX];
+        memcpy(copy, image, length);
+        copy[offset] = value;
+        uint32_t crc = persistCrc32(copy, length - 4);
+        memcpy(copy + length - 4, &crc, 4);
+        return unpackPersistedState(copy, length);
+    };
+    bool versionStale = resealed(4, PERSIST_VERSION + 1) == PERSIST_STALE;
+    bool layoutStale = resealed(8, image[8] ^ 1) == PERSIST_STALE;
+    bool unchanged = resealed(4, PERSIST_VERSION) == PERSIST_OK;
+    bool statuses = erasedMissing && versionStale && layoutStale && unchanged;
+    printf("erased %s, other version %s, other tunables %s: %s\n",
+        erasedMissing ? "missing" : "?", versionStale ? "stale" : "?", layoutStale ? "stale" : "?", statuses ? "ok" : "FAILED");
+    failures += !statuses;
+
+    //what the robot calibrated by itself is saved with the tunables as they were kept, not as set since
+    resetTunables();
+    initHeadingEstimator();
+    initMotorModel();
+    restorePersistedState();
+    double defaultPwm = BASE_PWM;
+    setTunable("BASE_PWM", 133);
+    restoreWheelBaseScale(1.087, 1e-4);
+    bool written = saveCalibration();
+    resetTunables();
+    initHeadingEstimator();
+    bool kept = restorePersistedState() == PERSIST_OK && BASE_PWM == defaultPwm && getWheelBaseScale() == 1.087;
+    printf("calibration saved over an unsaved BASE_PWM: %s\n", written && kept ? "ok" : "FAILED");
+    failures += !written || !kept;
+    resetTunables();
+    initHeadingEstimator();
+    SimHardware::releaseCurrent();
+
+    //boots in turn, each from what the one before left in the EEPROM
+    const double maxFirstTickMs = 300; // the robot looks for the line for up to 250 ms
+    for(int estimator = 0; estimator < 2; estimator++){
+        std::vector<uint8_t> eeprom(SIM_EEPROM_SIZE, 0xff);
+        for(double offset : {0.0, 0.0, 150.0}){
+            resetTunables();
+            setTunable("HEADING_ESTIMATOR", estimator);
+            bool stored = eeprom[0] != 0xff;
+            BootResult boot = simulateBoot(eeprom, offset);
+            //on the line the first tick drives, unless the estimator has no scale yet and learns it in a scan
+            bool scans = offset > 0 || (estimator && !stored);
+            bool ok = boot.firstTickMs < maxFirstTickMs && boot.drivingMs >= 0
+                && (scans || boot.drivingMs - boot.firstTickMs < 20);
+            printf("HEADING_ESTIMATOR %d, %-6s EEPROM, %3.0f mm off the line: first tick %5.1f ms, following the line %6.0f ms, %3d bytes stored: %s\n",
+                estimator, stored ? "stored" : "empty", offset, boot.firstTickMs, boot.drivingMs, boot.eepromWrites, ok ? "ok" : "FAILED");
+            failures += !ok;
+        }
+    }
+    resetTunables();
+    return failures > 0 ? 1 : 0;
+}
+
+static int tuningCommand(int argc, char ** argv){
+    (void)argv;
+    if(argc != 2){
+        usage();
+        return 2;
+    }
+    int failures = 0;
+    Track track;
+    track.load("oval");
+    resetTunables();
+
+    //every default within its range, and the ends of the range taken but not past them
+    int outside = 0;
+    for(int i = 0; i < getTunableCount(); i++){
+        const char * name = getTunableName(i);
+        double value, least, most;
+        getTunable(name, &value);
+        getTunableRange(name, &least, &most);
+        outside += !(least <= value && value <= most);
+        outside += !setTunable(name, least) || !setTunable(name, most);
+        outside += setTunable(name, most + 1) || setTunable(name, least - 1);
+    }
+    resetTunables();
+    printf("%d tunables, defaults and range ends: %s\n", getTunableCount(), outside == 0 ? "ok" : "FAILED");
+    failures += outside > 0;
+
+    //commands and their replies
+    struct Exchange {
+        const char * line;
+        const char * reply;  // expected reply
+        int listed;          // tunables listed after it
+    };
+    const int count = getTunableCount();
+    const Exchange exchanges[] = {
+        {"get BASE_PWM", "BASE_PWM = 120", 0},
+        {"  set   BASE_PWM   140 ", "BASE_PWM = 140", 0},
+        {"get BASE_PWM", "BASE_PWM = 140", 0},
+        {"set BASE_PWM 256", "error: BASE_PWM takes 0..255", 0},
+        {"set BASE_PWM 140.5", "error: BASE_PWM takes whole numbers", 0},
+        {"set BASE_PWM fast", "error: fast is not a number", 0},
+        {"set BASE_PWM 1e2", "BASE_PWM = 100", 0},
+        {"set P_WEIGHT 0.45", "P_WEIGHT = 0.45", 0},
+        {"set P_WEIGHT nan", "error: P_WEIGHT takes 0..5", 0},
+        {"set LINE_READING_TARGET 900", "LINE_READING_TARGET = 900", 0},
+        {"get NO_SUCH_TUNABLE", "error: no tunable NO_SUCH_TUNABLE", 0},
+        {"get", "error: expected get NAME, set NAME VALUE, list, save, tune line|wheels or fit motors", 0},
+        {"set BASE_PWM 120 now", "error: expected get NAME, set NAME VALUE, list, save, tune line|wheels or fit motors", 0},
+        {"list all", "error: expected get NAME, set NAME VALUE, list, save, tune line|wheels or fit motors", 0},
+        {"   ", "", 0},
+        {"list", nullptr, count},
+    };
+    int wrong = 0;
+    char reply[128];
+    for(const Exchange & exchange : exchanges){
+        int listed = runTuningCommand(exchange.line, reply, sizeof(reply));
+        std::string expected = exchange.reply ? exchange.reply : std::to_string(count) + " tunables";
+        if(reply != expected || listed != exchange.listed){
+            printf("  '%s' got '%s', %d listed\n", exchange.line, reply, listed);
+            wrong++;
+        }
+    }
+    bool unchanged = BASE_PWM == 100 && P_WEIGHT == 0.45;
+    printf("%zu commands: %s\n", sizeof(exchanges)/sizeof(exchanges[0]), wrong == 0 && unchanged ? "ok" : "FAILED");
+    failures += wrong > 0 || !unchanged;
+    resetTunables();
+
+    //typed at a running robot: every poll, and how long it holds up loop()
+    SimConfig config;
+    config.serialInput = {
+        {0.001, "set BASE_PWM 140"},
+        {0.001, "set MIC_BUMP_THRESHOLD 0"},
+        {0.002, std::string(CONSOLE_LINE_MAX + 10, 'x')},
+        {0.002, "get BASE_PWM\r"},
+        {0.003, "list"},
+        {0.004, "save"},
+        {0.1, "save"},
+    };
+    SimHardware hardware(track, config);
+    hardware.makeCurrent();
+    initHeadingEstimator();
+    initMicWakeup();
+    initTuningConsole();
+    std::string output;
+    hardware.setSerialCapture(&output);
+    const double maxPollUs = 50;
+    double worstUs = 0;
+    double saveMs = -1;
+    int polls = 0;
+    while(hardware.seconds() < 0.15){
+        hardware.delayMicroseconds(100);//the rest of a tick
+        uint64_t start = hardware.nowNs();
+        pollTuningConsole();
+        worstUs = std::max(worstUs, (hardware.nowNs() - start)*1e-3);
+        polls++;
+        if(saveMs < 0 && output.find("\nsaved") != std::string::npos){
+            saveMs = hardware.seconds()*1e3 - 4;
+        }
+    }
+    hardware.setSerialCapture(nullptr);
+    std::vector<uint8_t> eeprom = hardware.eeprom();
+    SimHardware::releaseCurrent();
+
+    auto lines = [&](const char * text){
+        int found = 0;
+        for(size_t at = output.find(text); at != std::string::npos; at = output.find(text, at + 1)){
+            found++;
+        }
+        return found;
+    };
+    int listLines = lines(" (");
+    bool replies = lines("BASE_PWM = 140\r\n") == 2 && lines("error: MIC_BUMP_THRESHOLD takes 1..4095") == 1
+        && lines("error: lines take at most") == 1 && listLines == count
+        && lines("saving") == 1 && lines("\nsaved\r\n") == 1 && lines("already saved") == 1;
+    printf("typed at the robot: %d polls, %d tunables listed, a save written over %.0f ms, worst poll %.1f us: %s\n",
+        polls, listLines, saveMs, worstUs, replies && worstUs < maxPollUs ? "ok" : "FAILED");
+    failures += !replies || worstUs >= maxPollUs;
+
+    //what was saved is what the next boot restores
+    resetTunables();
+    SimHardware next(track, SimConfig());
+    next.eeprom() = eeprom;
+    next.makeCurrent();
+    initHeadingEstimator();
+    initMicWakeup();
+    PersistStatus status = restorePersistedState();
+    SimHardware::releaseCurrent();
+    bool restored = status == PERSIST_OK && BASE_PWM == 140 && MIC_BUMP_THRESHOLD == 30;
+    printf("restored after a reset: BASE_PWM %d, MIC_BUMP_THRESHOLD %d: %s\n", BASE_PWM, MIC_BUMP_THRESHOLD, restored ? "ok" : "FAILED");
+    failures += !restored;
+    resetTunables();
+    return failures > 0 ? 1 : 0;
+}
+
+/**
+ * the relay and the tuning rules on a swing of known size, each wheel's speed loop with the gains in
+ * Tuning.h stepped on the simulated drivetrain, then both experiments typed at the robot following
+ * the oval and laps run with the line gains found
+ */
+static int autotuneCommand(int argc, char ** argv){
+    (void)argv;
+    if(argc != 2){
+        usage();
+        return 2;
+    }
+    int failures = 0;
+    Track track;
+    track.load("oval");
+    resetTunables();
+
+    //a relay watching a sine of amplitude 3 and period 0.2 s, with a hysteresis of 1
+    RelayTrace trace;
+    startRelay(&trace, 2, 1, 0);
+    for(uint32_t us = 0; us < 2000000 && !relayDone(&trace); us += 100){
+        stepRelay(&trace, -3*sin(2*M_PI*us*1e-6/0.2), us);
+    }
+    double ku = 0, tu = 0, duty = 0;
+    bool found = relayResult(&trace, &ku, &tu, &duty);
+    double expectedKu = 4*2/(M_PI*sqrt(3*3 - 1*1));
+    PidGains zn = gainsFromRelay(2, 0.5, RULE_ZIEGLER_NICHOLS, true);
+    PidGains znPi = gainsFromRelay(2, 0.5, RULE_ZIEGLER_NICHOLS, false);
+    PidGains tl = gainsFromRelay(2, 0.5, RULE_TYREUS_LUYBEN, true);
+    auto near = [](double value, double expected){ return fabs(value - expected) < 1e-3*fabs(expected) + 1e-9; };
+    bool relay = found && near(ku, expectedKu) && fabs(tu - 0.2) < 0.001 && fabs(duty - 0.5) < 0.01
+        && near(zn.kp, 1.2) && near(zn.ki, 4.8) && near(zn.kd, 0.075)
+        && near(znPi.kp, 0.9) && near(znPi.ki, 2.16) && znPi.kd == 0
+        && near(tl.kp, 2/2.2) && near(tl.ki, 2/2.2/1.1) && near(tl.kd, 2/2.2*0.5/6.3);
+    printf("relay on a known swing: Ku %.4f of %.4f, Tu %.4f s, duty %.2f, rules: %s\n", ku, expectedKu, tu, duty, relay ? "ok" : "FAILED");
+    failures += !relay;
+
+    //each wheel stepped from its rate at 120 to 20 % above, every 3 ms as in loop()
+    {
+        SimConfig config;
+        SimHardware hardware(track, config);
+        hardware.makeCurrent();
+        initSensing();
+        initMotorDriver();
+        const double feedforward = 120;
+        for(int ms = 0; ms < 600; ms++){
+            setMotors(feedforward, feedforward);
+            hardware.delayMicroseconds(1000);
+        }
+        double targets[2] = {0, 0};
+        for(int ms = 0; ms < 200; ms++){
+            setMotors(feedforward, feedforward);
+            hardware.delayMicroseconds(1000);
+            targets[0] += getWheelTickRate(LEFT)*1.2/200;
+            targets[1] += getWheelTickRate(RIGHT)*1.2/200;
+        }
+        WheelSpeedLoop loops[2];
+        resetWheelSpeedLoop(&loops[0]);
+        resetWheelSpeedLoop(&loops[1]);
+        double peak[2] = {0, 0}, settledAt[2] = {-1, -1}, tailError[2] = {0, 0};
+        int tailSamples = 0;
+        uint64_t start = hardware.nowNs();
+        for(double t = 0; t < 0.6; t = (hardware.nowNs() - start)*1e-9){
+            double command[2];
+            for(int wheel = 0; wheel < 2; wheel++){
+                int encoder = wheel == 0 ? LEFT : RIGHT;
+                double rate = getWheelTickRate(encoder);
+                command[wheel] = updateWheelSpeedLoop(&loops[wheel], encoder, targets[wheel], rate, feedforward, hardware.micros());
+                peak[wheel] = std::max(peak[wheel], rate);
+                bool within = fabs(rate - targets[wheel]) < 0.05*targets[wheel];
+                settledAt[wheel] = within ? (settledAt[wheel] < 0 ? t : settledAt[wheel]) : -1;
+                if(t > 0.4){
+                    tailError[wheel] += (rate - targets[wheel])/targets[wheel];
+                }
+            }
+            tailSamples += t > 0.4;
+            setMotors(command[0], command[1]);
+            hardware.delayMicroseconds(3000);
+        }
+        brakeMotors();
+        SimHardware::releaseCurrent();
+        for(int wheel = 0; wheel < 2; wheel++){
+            double overshoot = peak[wheel]/targets[wheel] - 1;
+            double offset = tailError[wheel]/std::max(tailSamples, 1);
+            bool ok = settledAt[wheel] >= 0 && settledAt[wheel] < 0.15 && overshoot < 0.15 && fabs(offset) < 0.01;
+            printf("%s wheel stepped to %.0f ticks/s: within 5 %% from %.0f ms, overshoot %.1f %%, offset %.2f %%: %s\n",
+                wheel == 0 ? "left" : "right", targets[wheel], settledAt[wheel]*1e3, overshoot*100, offset*100, ok ? "ok" : "FAILED");
+            failures += !ok;
+        }
+    }
+
+    //both experiments on the robot, the line one first on the straight after the start
+    const char * const experiments[] = {"tune line", "tune wheels"};
+    double lineGains[3] = {0, 0, 0};
+    for(const char * experiment : experiments){
+        resetTunables();
+        SimConfig config;
+        config.duration = 8;
+        config.serialInput = {{0.5, experiment}};
+        Simulator simulator(track, config);
+        std::string output;
+        simulator.hardware().setSerialCapture(&output);
+        SimReport report = simulator.run();
+        simulator.hardware().setSerialCapture(nullptr);
+        const AutoTuneReport & tuned = getAutoTuneReport();
+        bool line = tuned.loop == TUNE_LINE;
+        bool ok = tuned.status == AUTOTUNE_DONE && !report.derailed && output.find("tuned: Ku") != std::string::npos;
+        if(line){
+            lineGains[0] = P_WEIGHT;
+            lineGains[1] = I_WEIGHT;
+            lineGains[2] = D_WEIGHT;
+            ok = ok && P_WEIGHT > 0 && I_WEIGHT > 0 && D_WEIGHT > 0;
+            printf("%s: Ku %.4f, Tu %.3f s, P_WEIGHT %.4g, I_WEIGHT %.4g, D_WEIGHT %.4g: %s\n", experiment,
+                tuned.ultimateGain[0], tuned.ultimatePeriod[0], P_WEIGHT, I_WEIGHT, D_WEIGHT, ok ? "ok" : "FAILED");
+        }
+        else{
+            ok = ok && WHEEL_LEFT_KP > 0 && WHEEL_LEFT_KI > 0 && WHEEL_RIGHT_KP > 0 && WHEEL_RIGHT_KI > 0;
+            printf("%s: Ku %.4f and %.4f, Tu %.3f and %.3f s, left kp %.3g ki %.3g, right kp %.3g ki %.3g: %s\n", experiment,
+                tuned.ultimateGain[0], tuned.ultimateGain[1], tuned.ultimatePeriod[0], tuned.ultimatePeriod[1],
+                WHEEL_LEFT_KP, WHEEL_LEFT_KI, WHEEL_RIGHT_KP, WHEEL_RIGHT_KI, ok ? "ok" : "FAILED");
+        }
+        failures += !ok;
+    }
+
+    //laps with the line gains found
+    resetTunables();
+    SimConfig config;
+    config.stopAfterLaps = 2;
+    config.tunables = {{"P_WEIGHT", lineGains[0]}, {"I_WEIGHT", lineGains[1]}, {"D_WEIGHT", lineGains[2]}};
+    Simulator simulator(track, config);
+    SimReport report = simulator.run();
+    bool lapped = !report.derailed && report.lapTimes.size() == 2;
+    printf("2 laps with the line gains found: %.3f s a lap, cross-track rms %.1f mm, %d line losses: %s\n",
+        report.meanLapTime(), report.crossTrackRms, report.lineLosses, lapped ? "ok" : "FAILED");
+    failures += !lapped;
+    resetTunables();
+    return failures > 0 ? 1 : 0;
+}
+
+/**
+ * the drivetrain model from the steps of a fit in a log, as fit motors works it out on the robot.
+ * false when the log holds no fit that turned both wheels
+ */
+static bool fitLoggedSteps(const SensorLogReader & log, MotorModel models[2], int * steps){
+    StepResponse step;
+    WheelFit fits[2];
+    resetWheelFit(&fits[0]);
+    resetWheelFit(&fits[1]);
+    int wheel = -1;
+    *steps = 0;
+    for(size_t i = 0; i < log.size(); i++){
+        const SensorLogRecord & record = log[i];
+        if(record.kind == LOG_MOTOR_STEP){
+            if(wheel >= 0){
+                addStepToFit(&step, &fits[wheel]);
+            }
+            wheel = record.values[0] == 0 ? 0 : 1;
+            beginStepResponse(&step, record.values[1]*1e-3, record.timeUs);
+            (*steps)++;
+        }
+        else if(wheel >= 0 && record.kind == (wheel == 0 ? LOG_WHEEL_RATE_LEFT : LOG_WHEEL_RATE_RIGHT)){
+            addStepSample(&step, record.values[0]*1e-3, record.timeUs);
+        }
+    }
+    if(wheel >= 0){
+        addStepToFit(&step, &fits[wheel]);
+    }
+    return finishWheelFit(&fits[0], &models[0]) && finishWheelFit(&fits[1], &models[1]);
+}
+
+static void printMotorModels(const char * label, const MotorModel models[2]){
+    for(int wheel = 0; wheel < 2; wheel++){
+        printf("%s %-5s gain %6.3f ticks/s per command, time constant %.4f s, dead time %.4f s, deadband %5.1f\n", label,
+            wheel == 0 ? "left" : "right", models[wheel].gain, models[wheel].timeConstant, models[wheel].deadTime, models[wheel].deadband);
+    }
+}
+
+/**
+ * with a log, fit the drivetrain from the steps recorded in it. without one, fit motors run on a
+ * robot whose drivetrain is not the default, its fit against the drivetrain simulated, the fit of
+ * its log on the host against that on the robot, and the feedforward of the fit against the rate
+ * it holds
+ */
+static int fitCommand(int argc, char ** argv){
+    if(argc > 3){
+        usage();
+        return 2;
+    }
+    MotorModel logged[2];
+    int steps = 0;
+    if(argc == 3){
+        SensorLogReader log;
+        std::string error;
+        if(!log.open(argv[2], &error)){
+            fprintf(stderr, "%s\n", error.c_str());
+            return 1;
+        }
+        if(!fitLoggedSteps(log, logged, &steps)){
+            fprintf(stderr, "%s: %d steps of a drivetrain fit, not enough that turned each wheel\n", argv[2], steps);
+            return 1;
+        }
+        printf("%d steps\n", steps);
+        printMotorModels("fitted", logged);
+        printf("right to left gain %.3f\n", logged[1].gain/logged[0].gain);
+        printf("as sim options: --motor-model %.4g,%.4g,%.4g,%.4g,%.4g\n", logged[0].gain, logged[1].gain,
+            (logged[0].timeConstant + logged[1].timeConstant)/2, (logged[0].deadTime + logged[1].deadTime)/2,
+            (logged[0].deadband + logged[1].deadband)/2);
+        return 0;
+    }
+
+    int failures = 0;
+    Track track;
+    track.load("oval");
+    resetTunables();
+    SimConfig config;
+    config.duration = 8;
+    config.serialInput = {{0.3, "fit motors"}};
+    config.robot.rightGain = 0.92;
+    config.robot.motorTimeConstant = 0.08;
+    config.robot.motorDeadTime = 0.01;
+    config.robot.deadband = 0.08;
+    MotorModel truth[2] = {simulatedMotorModel(config.robot, true), simulatedMotorModel(config.robot, false)};
+    printMotorModels("simulated", truth);
+
+    char logPath[] = "/tmp/sim-fit-XXXXXX";
+    int fd = mkstemp(logPath);
+    if(fd < 0){
+        fprintf(stderr, "could not create a temporary log\n");
+        return 1;
+    }
+    close(fd);
+    Simulator simulator(track, config);
+    std::string output;
+    simulator.hardware().setSerialCapture(&output);
+    startSensorLogFile(logPath);
+    simulator.run();
+    stopSensorLogFile();
+    simulator.hardware().setSerialCapture(nullptr);
+    MotorModel fitted[2] = {getMotorModel(LEFT), getMotorModel(RIGHT)};
+    bool done = motorModelFitted() && output.find("save to keep the fit") != std::string::npos;
+    printMotorModels("fitted   ", fitted);
+    //the rate estimate trails the wheel by a fraction of the tick period, and a step starts within a sample
+    const double deadTimeSlack = 2*FIT_SAMPLE_US*1e-6;
+    bool matched = done;
+    for(int wheel = 0; wheel < 2; wheel++){
+        matched = matched && fabs(fitted[wheel].gain/truth[wheel].gain - 1) < 0.03
+            && fabs(fitted[wheel].timeConstant/truth[wheel].timeConstant - 1) < 0.15
+            && fabs(fitted[wheel].deadTime - truth[wheel].deadTime) < deadTimeSlack
+            && fabs(fitted[wheel].deadband - truth[wheel].deadband) < 3;
+    }
+    double asymmetry = fitted[1].gain/fitted[0].gain;
+    matched = matched && fabs(asymmetry - config.robot.rightGain) < 0.01;
+    printf("fit motors on the robot: right to left gain %.3f of %.3f, %zu bytes of fit state: %s\n", asymmetry, config.robot.rightGain,
+        sizeof(StepResponse) + 2*sizeof(WheelFit), matched ? "ok" : "FAILED");
+    failures += !matched;
+
+    //the log of the run fitted on the host comes to the fit on the robot
+    SensorLogReader log;
+    std::string error;
+    bool same = log.open(logPath, &error) && fitLoggedSteps(log, logged, &steps) && steps == 2*FIT_COMMAND_COUNT;
+    for(int wheel = 0; wheel < 2 && same; wheel++){
+        same = fabs(logged[wheel].gain/fitted[wheel].gain - 1) < 1e-4 && fabs(logged[wheel].timeConstant - fitted[wheel].timeConstant) < 1e-5
+            && fabs(logged[wheel].deadTime - fitted[wheel].deadTime) < 1e-5 && fabs(logged[wheel].deadband - fitted[wheel].deadband) < 0.01;
+    }
+    unlink(logPath);
+    printf("the recorded steps fitted on the host, %d steps: %s\n", steps, same ? "ok" : "FAILED");
+    failures += !same;
+
+    //the feedforward of the fit holds each wheel at the rate asked for
+    SimHardware hardware(track, config);
+    hardware.makeCurrent();
+    initSensing();
+    initMotorDriver();
+    restoreMotorModels(fitted, true);
+    for(double target : {800.0, 2000.0}){
+        double command[2] = {motorFeedforward(LEFT, target), motorFeedforward(RIGHT, target)};
+        double rates[2] = {0, 0};
+        for(int ms = 0; ms < 1000; ms++){
+            setMotors(command[0], command[1]);
+            hardware.delayMicroseconds(1000);
+            if(ms >= 600){
+                rates[0] += getWheelTickRate(LEFT)/400;
+                rates[1] += getWheelTickRate(RIGHT)/400;
+            }
+        }
+        bool held = fabs(rates[0]/target - 1) < 0.03 && fabs(rates[1]/target - 1) < 0.03;
+        printf("feedforward for %.0f ticks/s: commands %.1f and %.1f, %.0f and %.0f ticks/s: %s\n",
+            target, command[0], command[1], rates[0], rates[1], held ? "ok" : "FAILED");
+        failures += !held;
+    }
+    brakeMotors();
+    initMotorModel();
+    SimHardware::releaseCurrent();
+    resetTunables();
+    return failures > 0 ? 1 : 0;
+}
+
+/**
+ * what became of both wheels stepped from one command to another on a floor of some traction
+ */
+struct TractionStep {
+    double detectedMs = -1;  // from the step to the first wheel flagged, -1 for none
+    double regripMs = -1;    // and to both gripping again without a limit
+    double slipMm = 0;       // the tyres ran past the floor from the step on
+    double speed = 0;        // mm/s over the floor at the end
+    int flagged = 0;         // slips and stalls flagged before the step
+};
+
+/**
+ * the model of both wheels taken for fitted to the simulated drivetrain, as fit motors finds it
+ */
+static void fitSimulatedMotors(const SimRobotParams & robot){
+    const MotorModel models[2] = {simulatedMotorModel(robot, true), simulatedMotorModel(robot, false)};
+    restoreMotorModels(models, true);
+}
+
+/**
+ * an EEPROM holding the fitted model of the simulated drivetrain and the tunables of config, as
+ * save leaves it after fit motors, for runs with traction control
+ */
+static std::vector<uint8_t> fittedEeprom(const Track & track, const SimConfig & config){
+    SimHardware hardware(track, config);
+    hardware.makeCurrent();
+    resetTunables();
+    for(const auto & tunable : config.tunables){
+        setTunable(tunable.first.c_str(), tunable.second);
+    }
+    initHeadingEstimator();
+    initMicWakeup();
+    fitSimulatedMotors(config.robot);
+    std::vector<uint8_t> eeprom(SIM_EEPROM_SIZE, 0xff);
+    packPersistedState(eeprom.data(), PERSIST_IMAGE_MAX);
+    initMotorModel();
+    resetTunables();
+    SimHardware::releaseCurrent();
+    return eeprom;
+}
+
+/**
+ * both wheels brought up to from, then stepped to to for seconds, with setMotors() and
+ * updateTraction() every 3 ms as in loop(). the left wheel may be jammed over the step, and let go
+ * for its last third. with control the drivetrain model is fitted unless told otherwise
+ */
+static TractionStep stepOnFloor(const Track & track, double traction, bool control, double from, double to,
+        double seconds, bool jamLeft = false, bool fitted = true){
+    SimConfig config;
+    config.robot.traction = traction;
+    SimHardware hardware(track, config);
+    hardware.makeCurrent();
+    setTunable("TRACTION_CONTROL", control);
+    initSensing();
+    initMotorDriver();
+    initMotorModel();
+    if(control && fitted){
+        fitSimulatedMotors(config.robot);
+    }
+    initTractionMonitor();
+    TractionStep result;
+    for(int ms = 0; from > 0 && ms < 600; ms += 3){
+        double ramped = std::min(from, ms*0.4);//gently, for the floor to keep up
+        setMotors(ramped, ramped);
+        hardware.delayMicroseconds(3000);
+        updateTraction();
+    }
+    for(int wheel = 0; wheel < 2; wheel++){
+        const WheelTraction & held = getWheelTraction(wheel == 0 ? LEFT : RIGHT);
+        result.flagged += held.slips + held.stalls;
+    }
+    double slipBefore = hardware.wheelSlip();
+    uint64_t start = hardware.nowNs();
+    hardware.jamWheel(true, jamLeft);
+    for(double t = 0; t < seconds; t = (hardware.nowNs() - start)*1e-9){
+        if(jamLeft && t > seconds*2/3){
+            hardware.jamWheel(true, false);
+        }
+        setMotors(to, to);
+        hardware.delayMicroseconds(3000);
+        updateTraction();
+        bool limited = getWheelTraction(LEFT).limited || getWheelTraction(RIGHT).limited;
+        if(tractionLost() && result.detectedMs < 0){
+            result.detectedMs = t*1e3;
+        }
+        if(result.detectedMs >= 0 && (tractionLost() || limited)){
+            result.regripMs = -1;
+        }
+        else if(result.detectedMs >= 0 && result.regripMs < 0){
+            result.regripMs = t*1e3;
+        }
+    }
+    result.slipMm = hardware.wheelSlip() - slipBefore;
+    result.speed = (hardware.groundSpeed(true) + hardware.groundSpeed(false))/2;
+    brakeMotors();
+    SimHardware::releaseCurrent();
+    return result;
+}
+
+/**
+ * check the traction monitor: steps that spin the wheels on a slippery floor are caught and cut
+ * back, a jammed wheel is found stalled, and on a floor that grips nothing is flagged
+ */
+static int tractionCommand(int argc, char ** argv){
+    (void)argv;
+    if(argc != 2){
+        usage();
+        return 2;
+    }
+    int failures = 0;
+    Track track;
+    track.load("oval");
+    resetTunables();
+
+    struct { const char * name; double from, to; } steps[] = {
+        {"full duty from rest", 0, 255},
+        {"the nudge of a bump from behind", 120, 255},
+    };
+    for(auto & step : steps){
+        TractionStep off = stepOnFloor(track, 0.3, false, step.from, step.to, 0.5);
+        TractionStep on = stepOnFloor(track, 0.3, true, step.from, step.to, 0.5);
+        bool ok = on.flagged == 0 && on.detectedMs >= 0 && on.detectedMs < 20 && on.slipMm < off.slipMm/2
+            && on.speed > 0.95*off.speed && on.regripMs >= 0 && on.regripMs < 400;
+        printf("%s at traction 0.3: flagged after %.0f ms, %.0f mm of slip and %.0f mm/s without control, %.0f mm and %.0f mm/s with, grip back after %.0f ms: %s\n",
+            step.name, on.detectedMs, off.slipMm, off.speed, on.slipMm, on.speed, on.regripMs, ok ? "ok" : "FAILED");
+        failures += !ok;
+    }
+
+    //the default model is no measure of the drivetrain, without a fit the command is left alone
+    TractionStep unfittedOff = stepOnFloor(track, 0.3, false, 0, 255, 0.5);
+    TractionStep unfitted = stepOnFloor(track, 0.3, true, 0, 255, 0.5, false, false);
+    bool untouched = unfitted.detectedMs >= 0 && unfitted.slipMm == unfittedOff.slipMm;
+    printf("full duty from rest with control but no fitted model: flagged after %.0f ms, %.0f mm of slip as without control: %s\n",
+        unfitted.detectedMs, unfitted.slipMm, untouched ? "ok" : "FAILED");
+    failures += !untouched;
+
+    //the left wheel jammed while both drive, let go after a second
+    TractionStep jammed = stepOnFloor(track, 0, true, 150, 150, 1.5, true);
+    const WheelTraction & left = getWheelTraction(LEFT);
+    bool stalled = jammed.detectedMs >= 0 && jammed.detectedMs < 150 && left.stalls > 0 && left.slips == 0
+        && getWheelTraction(RIGHT).stalls == 0 && jammed.regripMs >= 1000 && jammed.regripMs < 1200;
+    printf("left wheel jammed: flagged after %.0f ms, %d stalls, grip back %.0f ms after it was let go: %s\n",
+        jammed.detectedMs, left.stalls, jammed.regripMs - 1000, stalled ? "ok" : "FAILED");
+    failures += !stalled;
+
+    //nothing flagged on a floor that grips, laps of every track
+    for(const char * name : {"oval", "wavy", "kidney"}){
+        Track lapped;
+        lapped.load(name);
+        SimConfig config;
+        config.stopAfterLaps = 2;
+        Simulator simulator(lapped, config);
+        SimReport report = simulator.run();
+        int flagged = getWheelTraction(LEFT).slips + getWheelTraction(LEFT).stalls + getWheelTraction(RIGHT).slips + getWheelTraction(RIGHT).stalls;
+        bool ok = !report.derailed && report.lapTimes.size() == 2 && flagged == 0;
+        printf("2 laps of %s with grip: %.3f s a lap, %d flagged: %s\n", name, report.meanLapTime(), flagged, ok ? "ok" : "FAILED");
+        failures += !ok;
+    }
+
+    //laps on a slippery floor, bumped from behind twice, by a robot that was fitted and saved
+    const double slipShare = 0.8; // control has to take off at least a fifth of the slip
+    double slipped[2] = {0, 0};
+    double lapTimes[2] = {0, 0};
+    for(int control = 0; control < 2; control++){
+        SimConfig config;
+        config.stopAfterLaps = 2;
+        config.robot.traction = 0.3;
+        config.bumps = {{6, 180, 300}, {25, 180, 300}};
+        config.tunables = {{"TRACTION_CONTROL", control}};
+        std::vector<uint8_t> eeprom = fittedEeprom(track, config);
+        Simulator simulator(track, config);
+        simulator.hardware().eeprom() = eeprom;
+        SimReport report = simulator.run();
+        int flagged = getWheelTraction(LEFT).slips + getWheelTraction(LEFT).stalls + getWheelTraction(RIGHT).slips + getWheelTraction(RIGHT).stalls;
+        slipped[control] = report.wheelSlip;
+        lapTimes[control] = report.meanLapTime();
+        bool ok = !report.derailed && report.lapTimes.size() == 2 && flagged > 0 && motorModelFitted();
+        printf("2 laps at traction 0.3 %s control: %.3f s a lap, %d flagged, %.0f mm of slip: %s\n",
+            control ? "with" : "without", report.meanLapTime(), flagged, report.wheelSlip, ok ? "ok" : "FAILED");
+        failures += !ok;
+        initMotorModel();
+        resetTunables();
+    }
+    bool improved = slipped[1] < slipShare*slipped[0];
+    printf("traction control on those laps: %.0f%% of the slip, %+.3f s a lap: %s\n",
+        100*slipped[1]/slipped[0], lapTimes[1] - lapTimes[0], improved ? "ok" : "FAILED");
+    failures += !improved;
+    resetTunables();
+    return failures > 0 ? 1 : 0;
+}
+
+/**
+ * where the robot ended up in the frame of a pose it started from: along the heading it started
+ * on, to the left of it, and turned anticlockwise
+ */
+struct DriveEnd {
+    double along;      // mm
+    double lateral;    // mm
+    double headingDeg;
+};
+
+static DriveEnd driveEnd(const SimPose & start, const SimPose & end){
+    double dx = end.x - start.x;
+    double dy = end.y - start.y;
+    return {dx*cos(start.heading) + dy*sin(start.heading), -dx*sin(start.heading) + dy*cos(start.heading),
+        angleBetween(start.heading, end.heading)};
+}
+
+/**
+ * how far to the side a detour passed its obstacle, in mm on the side it took, and the heading it
+ * crossed back over the course the line ran on at, in degrees towards the line
+ */
+struct DetourPass {
+    double lateral;
+    double crossingDeg;
+};
+
+/**
+ * a whole detour of the evasion planner off the line, so it never finds it again, to where it
+ * crosses back over the course the line ran on when the robot stopped. side is where the line sat
+ * under the bar, off centre by too little to count as a bend, which the detour takes, and the
+ * offset is taken passAlong mm ahead of where it stopped.
+ * the right wheel is weaker than the left by mismatch
+ */
+static DetourPass evadeOffLine(const Track & track, double mismatch, int side, double passAlong){
+    SimConfig config;
+    config.robot.rightGain = 1 - mismatch;
+    SimHardware hardware(track, config);
+    hardware.makeCurrent();
+    hardware.setPose({5000, 5000, 0.3});
+    resetTunables();
+    initSensing();
+    initDriving();
+    initEvasionPlanner();
+    for(int i = 0; i < 500; i++){
+        noteLinePosition(side > 0 ? 950 : 1050);
+    }
+    SimPose start = hardware.pose();
+    startEvasion(0.2, getEncoderData(LEFT), getEncoderData(RIGHT));
+    EvasionStatus status = EVASION_RUNNING;
+    DetourPass pass = {0, 0};
+    bool passed = false;
+    while(status == EVASION_RUNNING && hardware.seconds() < 30){
+        status = continueEvasion(getEncoderData(LEFT), getEncoderData(RIGHT), {0, 0, 0}, -1, -1);
+        updateTraction();
+        DriveEnd before = driveEnd(start, hardware.pose());
+        hardware.delayMicroseconds(3000);
+        DriveEnd after = driveEnd(start, hardware.pose());
+        if(!passed && after.along >= passAlong){
+            passed = true;
+            pass.lateral = after.lateral*side;
+        }
+        if(passed && after.lateral*side <= 0){
+            double fraction = before.lateral/(before.lateral - after.lateral);
+            pass.crossingDeg = -side*(before.headingDeg + (after.headingDeg - before.headingDeg)*fraction);
+            break;
+        }
+    }
+    SimHardware::releaseCurrent();
+    return pass;
+}
+
+/**
+ * a straight of distance mm from rest, by driveUnchecked() or the way it used to: both wheels at
+ * ROTATE_PWM until the left encoder counted the distance, then braked
+ */
+static DriveEnd driveStraight(const Track & track, double mismatch, int distance, bool synchronized){
+    SimConfig config;
+    config.robot.rightGain = 1 - mismatch;
+    SimHardware hardware(track, config);
+    hardware.makeCurrent();
+    hardware.setPose({5000, 5000, 0.3});
+    resetTunables();
+    initSensing();
+    initDriving();
+    SimPose start = hardware.pose();
+    if(synchronized){
+        driveUnchecked(distance);
+    }
+    else{
+        resetTickCounts();
+        int pwm = distance > 0 ? ROTATE_PWM : -ROTATE_PWM;
+        while(getEncoderData(LEFT) < abs(distance)/MM_PER_TICK){
+            setMotors(pwm, pwm);
+            hardware.delayMicroseconds(2000);
+        }
+        brakeMotors();
+    }
+    hardware.delayMicroseconds(500000);
+    DriveEnd end = driveEnd(start, hardware.pose());
+    end.along -= distance;
+    SimHardware::releaseCurrent();
+    return end;
+}
+
+static int straightCommand(int argc, char ** argv){
+    (void)argv;
+    if(argc != 2){
+        usage();
+        return 2;
+    }
+    const double straightMm = 2;    // a straight drive ends this close to its distance and its line
+    const double straightDeg = 0.5; // and its heading
+    const double detourMm = 10;     // a detour passes its obstacle this close to EVASION_OFFSET_MM
+    const double detourDeg = 1;     // and a weaker wheel changes the heading it crosses back at by less than this
+    int failures = 0;
+    Track track;
+    track.load("oval");
+    printf("straight drives, errors at rest against the distance asked for, open loop -> synchronized:\n");
+    for(double mismatch : {0.0, 0.1}){
+        for(int distance : {500, 150, -300}){
+            DriveEnd open = driveStraight(track, mismatch, distance, false);
+            DriveEnd synced = driveStraight(track, mismatch, distance, true);
+            bool ok = fabs(synced.along) < straightMm && fabs(synced.lateral) < straightMm && fabs(synced.headingDeg) < straightDeg;
+            failures += !ok;
+            printf("  %5d mm, right wheel %2.0f %% weaker: along %6.1f -> %5.1f mm, lateral %6.1f -> %5.1f mm, heading %6.2f -> %5.2f deg: %s\n",
+                distance, mismatch*100, open.along, synced.along, open.lateral, synced.lateral, open.headingDeg, synced.headingDeg, ok ? "ok" : "FAILED");
+        }
+    }
+    printf("evasion detours off the line, %.0f mm to the side past the obstacle planned:\n", EVASION_OFFSET_MM);
+    for(int side : {1, -1}){
+        DetourPass matched = evadeOffLine(track, 0, side, 400);
+        DetourPass weaker = evadeOffLine(track, 0.1, side, 400);
+        bool ok = fabs(matched.lateral - EVASION_OFFSET_MM) < detourMm && fabs(weaker.lateral - EVASION_OFFSET_MM) < detourMm
+            && fabs(weaker.crossingDeg - matched.crossingDeg) < detourDeg;
+        failures += !ok;
+        printf("  detour to the %5s: passed at %.1f mm and crossed back at %.2f deg, with the right wheel 10 %% weaker %.1f mm and %.2f deg: %s\n",
+            side > 0 ? "left" : "right", matched.lateral, matched.crossingDeg, weaker.lateral, weaker.crossingDeg, ok ? "ok" : "FAILED");
+    }
+    resetTunables();
+    return failures > 0 ? 1 : 0;
+}
+
+/**
+ * an obstacle on the line every 300 mm round the oval, on the straights and in the bends, one per
+ * run and taken away a while after the robot reaches it: wherever it stands the robot has to get
+ * past it, by a detour or by waiting it out, without touching it or leaving the track. then one
+ * left in a bend for good: the robot has to give up waiting and stand still in front of it
+ */
+static int evasionCommand(int argc, char ** argv){
+    (void)argv;
+    if(argc != 2){
+        usage();
+        return 2;
+    }
+    const double obstacleRadius = 60; // mm
+    const double spacing = 300;       // mm between the positions tried, the first this far from the start
+    const double lapSpeed = 250;      // mm/s, a little under the robot's mean, to time when it gets there
+    const double standSeconds = 4;    // the obstacle is taken away this long after the robot gets there
+    const double afterSeconds = 8;    // and the run goes on this long after that
+    int failures = 0;
+    Track track;
+    track.load("oval");
+    printf("%.0f mm obstacles on the oval, taken away %.0f s after the robot gets there:\n", obstacleRadius, standSeconds);
+    for(double position = spacing; position < track.length() - spacing; position += spacing){
+        resetTunables();
+        SimConfig config;
+        SimObstacle obstacle;
+        obstacle.trackPosition = position;
+        obstacle.radius = obstacleRadius;
+        obstacle.until = position/lapSpeed + standSeconds;
+        config.obstacles.push_back(obstacle);
+        config.duration = obstacle.until + afterSeconds;
+        Simulator simulator(track, config);
+        SimReport report = simulator.run();
+        bool past = report.distance > position + obstacleRadius;
+        bool ok = report.obstacleContacts == 0 && past && !report.derailed;
+        failures += !ok;
+        printf("  at %4.0f mm: %zu back on the line, %d failed, %d contacts, %s: %s\n", position,
+            report.evasionTimes.size(), report.evasionsFailed, report.obstacleContacts,
+            report.derailed ? "left the track" : (past ? "got past" : "stuck in front of it"), ok ? "ok" : "FAILED");
+    }
+    const double bendPosition = 1800; // mm, in a bend, where no detour is driven
+    resetTunables();
+    SimConfig config;
+    SimObstacle obstacle;
+    obstacle.trackPosition = bendPosition;
+    obstacle.radius = obstacleRadius;
+    config.obstacles.push_back(obstacle);
+    config.duration = bendPosition/lapSpeed + 30;
+    Simulator simulator(track, config);
+    SimReport report = simulator.run();
+    bool ok = report.obstacleContacts == 0 && !report.derailed && report.evasionsFailed == 0
+        && report.distance < bendPosition;
+    failures += !ok;
+    printf("left at %4.0f mm for good: %d failed, %d contacts, %s: %s\n", bendPosition, report.evasionsFailed,
+        report.obstacleContacts, report.derailed ? "left the track" : (report.distance < bendPosition ? "stopped in front of it" : "went on"),
+        ok ? "ok" : "FAILED");
+    resetTunables();
+    return failures > 0 ? 1 : 0;
+}
+
+static bool parseParameter(const char * text, SweepParameter & parameter){
+    const char * equals = strchr(text, '=');
+    if(equals == nullptr){
+        return false;
+    }
+    parameter.name.assign(text, equals - text);
+    parameter.steps = 5;
+    int fields = sscanf(equals + 1, "%lf:%lf:%d", &parameter.low, &parameter.high, &parameter.steps);
+    double least, most;
+    return fields >= 2 && getTunableRange(parameter.name.c_str(), &least, &most)
+        && parameter.low >= least && parameter.high <= most;
+}
+
+static int sweepCommand(int argc, char ** argv){
+    SweepOptions options;
+    options.base.duration = 120;
+    options.base.stopAfterLaps = 2;
+    std::string trackList = "oval";
+    std::string unusedTrack;
+    std::string csvPath;
+    size_t top = 10;
+
+    for(int i = 2; i < argc;){
+        int next = parseSimOptions(argc, argv, i, unusedTrack, options.base);
+        if(next < 0){
+            usage();
+            return 2;
+        }
+        if(next > i){
+            i = next;
+            continue;
+        }
+        const char * arg = argv[i];
+        if(i + 1 >= argc){
+            usage();
+            return 2;
+        }
+        const char * value = argv[i + 1];
+        if(strcmp(arg, "--param") == 0){
+            SweepParameter parameter;
+            if(!parseParameter(value, parameter)){
+                fprintf(stderr, "bad parameter '%s' (expected a tunable NAME=LOW:HIGH[:STEPS] within its range)\n", value);
+                return 2;
+            }
+            options.parameters.push_back(parameter);
+        }
+        else if(strcmp(arg, "--sampling") == 0){
+            if(strcmp(value, "grid") == 0){
+                options.sampling = SweepSampling::Grid;
+            }
+            else if(strcmp(value, "random") == 0){
+                options.sampling = SweepSampling::Random;
+            }
+            else if(strcmp(value, "lhs") == 0){
+                options.sampling = SweepSampling::LatinHypercube;
+            }
+            else{
+                usage();
+                return 2;
+            }
+        }
+        else if(strcmp(arg, "--samples") == 0){
+            options.samples = atoi(value);
+        }
+        else if(strcmp(arg, "--seeds") == 0){
+            options.seeds = atoi(value);
+        }
+        else if(strcmp(arg, "--tracks") == 0){
+            trackList = value;
+        }
+        else if(strcmp(arg, "--threads") == 0){
+            options.threads = (unsigned)atoi(value);
+        }
+        else if(strcmp(arg, "--top") == 0){
+            top = (size_t)atoi(value);
+        }
+        else if(strcmp(arg, "--csv") == 0){
+            csvPath = value;
+        }
+        else{
+            usage();
+            return 2;
+        }
+        i += 2;
+    }
+    if(options.parameters.empty()){
+        usage();
+        return 2;
+    }
+
+    std::vector<Track> trackStorage;
+    size_t start = 0;
+    while(start <= trackList.size()){
+        size_t comma = trackList.find(',', start);
+        std::string name = trackList.substr(start, comma == std::string::npos ? std::string::npos : comma - start);
+        trackStorage.emplace_back();
+        if(!trackStorage.back().load(name)){
+            fprintf(stderr, "could not load track '%s'\n", name.c_str());
+            return 1;
+        }
+        if(comma == std::string::npos){
+            break;
+        }
+        start = comma + 1;
+    }
+    std::vector<const Track *> tracks;
+    for(const Track & track : trackStorage){
+        tracks.push_back(&track);
+    }
+
+    auto hostStart = std::chrono::steady_clock::now();
+    std::vector<SweepResult> results = runSweep(options, tracks);
+    double hostSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - hostStart).count();
+    size_t runs = results.empty() ? 0 : results.size()*results[0].runs;
+    printf("%zu configurations, %zu runs in %.2f s\n", results.size(), runs, hostSeconds);
+
+    printf("rank");
+    for(const SweepParameter & parameter : options.parameters){
+        printf(" %18s", parameter.name.c_str());
+    }
+    printf("     score  robust  pace s/m  spread  loss/lap  xtrack mm\n");
+    for(size_t r = 0; r < results.size() && r < top; r++){
+        const SweepResult & result = results[r];
+        printf("%4zu", r + 1);
+        for(double value : result.values){
+            printf(" %18.4g", value);
+        }
+        printf("  %8.3f  %6.2f  %8.3f  %6.3f  %8.2f  %9.1f\n", result.score, result.robustness,
+            result.pace, result.paceSpread, result.lineLossesPerLap, result.crossTrackRms);
+    }
+
+    if(!csvPath.empty()){
+        FILE * csv = fopen(csvPath.c_str(), "w");
+        if(csv == nullptr){
+            fprintf(stderr, "could not write '%s'\n", csvPath.c_str());
+            return 1;
+        }
+        fprintf(csv, "rank");
+        for(const SweepParameter & parameter : options.parameters){
+            fprintf(csv, ",%s", parameter.name.c_str());
+        }
+        fprintf(csv, ",score,robustness,pace,pace_spread,line_losses_per_lap,cross_track_rms\n");
+        for(size_t r = 0; r < results.size(); r++){
+            const SweepResult & result = results[r];
+            fprintf(csv, "%zu", r + 1);
+            for(double value : result.values){
+                fprintf(csv, ",%g", value);
+            }
+            fprintf(csv, ",%g,%g,%g,%g,%g,%g\n", result.score, result.robustness, result.pace,
+                result.paceSpread, result.lineLossesPerLap, result.crossTrackRms);
+        }
+        fclose(csv);
+    }
+    return 0;
+}
+
+int main(int argc, char ** argv){
+    if(argc >= 2 && strcmp(argv[1], "run") == 0){
+        return runCommand(argc, argv);
+    }
+    if(argc >= 2 && strcmp(argv[1], "sweep") == 0){
+        return sweepCommand(argc, argv);
+    }
+    if(argc >= 2 && strcmp(argv[1], "replay") == 0){
+        return replayCommand(argc, argv);
+    }
+    if(argc >= 2 && strcmp(argv[1], "logextract") == 0){
+        return logExtractCommand(argc, argv);
+    }
+    if(argc >= 2 && strcmp(argv[1], "states") == 0){
+        return statesCommand(argc, argv);
+    }
+    if(argc >= 2 && strcmp(argv[1], "range") == 0){
+        return rangeCommand(argc, argv);
+    }
+    if(argc >= 2 && strcmp(argv[1], "bumps") == 0){
+        return bumpsCommand(argc, argv);
+    }
+    if(argc >= 2 && strcmp(argv[1], "adc") == 0){
+        return adcCommand(argc, argv);
+    }
+    if(argc >= 2 && strcmp(argv[1], "lockin") == 0){
+        return lockInCommand(argc, argv);
+    }
+    if(argc >= 2 && strcmp(argv[1], "bench") == 0){
+        return benchCommand(argc, argv);
+    }
+    if(argc >= 2 && strcmp(argv[1], "junctions") == 0){
+        return junctionsCommand(argc, argv);
+    }
+    if(argc >= 2 && strcmp(argv[1], "heading") == 0){
+        return headingCommand(argc, argv);
+    }
+    if(argc >= 2 && strcmp(argv[1], "motors") == 0){
+        return motorsCommand(argc, argv);
+    }
+    if(argc >= 2 && strcmp(argv[1], "latency") == 0){
+        return latencyCommand(argc, argv);
+    }
+    if(argc >= 2 && strcmp(argv[1], "spsc") == 0){
+        return spscCommand(argc, argv);
+    }
+    if(argc >= 2 && strcmp(argv[1], "boot") == 0){
+        return bootCommand(argc, argv);
+    }
+    if(argc >= 2 && strcmp(argv[1], "tuning") == 0){
+        return tuningCommand(argc, argv);
+    }
+    if(argc >= 2 && strcmp(argv[1], "autotune") == 0){
+        return autotuneCommand(argc, argv);
+    }
+    if(argc >= 2 && strcmp(argv[1], "fit") == 0){
+        return fitCommand(argc, argv);
+    }
+    if(argc >= 2 && strcmp(argv[1], "traction") == 0){
+        return tractionCommand(argc, argv);
+    }
+    if(argc >= 2 && strcmp(argv[1], "straight") == 0){
+        return straightCommand(argc, argv);
+    }
+    if(argc >= 2 && strcmp(argv[1], "evasion") == 0){
+        return evasionCommand(argc, argv);
+    }
+    usage();
+    return 2;
+}
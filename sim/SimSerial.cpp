@@ -0,0 +1,56 @@
+#include "Arduino.h"
+#include "SimHardware.h"
+
+#include <algorithm>
+#include <cstdio>
+
+static size_t emit(const char * text, size_t length){
+    SimHardware::current().serialWrite(text, length);
+    return length;
+}
+
+int SimSerial::available(){
+    return SimHardware::current().serialAvailable();
+}
+
+int SimSerial::read(){
+    return SimHardware::current().serialRead();
+}
+
+size_t SimSerial::write(uint8_t b){
+    char c = (char)b;
+    return emit(&c, 1);
+}
+
+size_t SimSerial::write(const uint8_t * buffer, size_t size){
+    return emit((const char *)buffer, size);
+}
+
+size_t SimSerial::print(const char * s){ return emit(s, strlen(s)); }
+size_t SimSerial::print(char c){ return emit(&c, 1); }
+size_t SimSerial::print(int value){ return printf("%d", value); }
+size_t SimSerial::print(unsigned int value){ return printf("%u", value); }
+size_t SimSerial::print(long value){ return printf("%ld", value); }
+size_t SimSerial::print(unsigned long value){ return printf("%lu", value); }
+size_t SimSerial::print(double value, int digits){ return printf("%.*f", digits, value); }
+
+size_t SimSerial::println(){ return emit("\r\n", 2); }
+size_t SimSerial::println(const char * s){ return print(s) + println(); }
+size_t SimSerial::println(char c){ return print(c) + println(); }
+size_t SimSerial::println(int value){ return print(value) + println(); }
+size_t SimSerial::println(unsigned int value){ return print(value) + println(); }
+size_t SimSerial::println(long value){ return print(value) + println(); }
+size_t SimSerial::println(unsigned long value){ return print(value) + println(); }
+size_t SimSerial::println(double value, int digits){ return print(value, digits) + println(); }
+
+size_t SimSerial::printf(const char * format, ...){
+    char buffer[256];
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+    if(length < 0){
+        return 0;
+    }
+    return emit(buffer, std::min((size_t)length, sizeof(buffer) - 1));
+}
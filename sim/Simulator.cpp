@@ -0,0 +1,166 @@
+#include "Arduino.h"
+#include "Simulator.h"
+#include "StateMachine.h"
+#include "Tuning.h"
+
+#include <chrono>
+#include <cmath>
+
+#define LINE_LOSS_DEBOUNCE 0.02 // s with no sensor over the tape before a loss is counted
+#define DERAIL_DISTANCE 400     // mm from the centre line at which a run is abandoned
+#define ON_LINE_DARKNESS 128
+#define FALSE_STOP_RANGE 600    // mm from the axle to an obstacle's surface within which a stop for it is genuine
+
+//the control code under test, from src/main.cpp
+void setup();
+void loop();
+
+double SimReport::meanLapTime() const{
+    if(lapTimes.empty()){
+        return 0;
+    }
+    double total = 0;
+    for(double lap : lapTimes){
+        total += lap;
+    }
+    return total/lapTimes.size();
+}
+
+Simulator::Simulator(const Track & track, const SimConfig & config)
+    : _hardware(track, config){
+    _hardware.setObserver(this);
+}
+
+SimReport Simulator::run(){
+    auto hostStart = std::chrono::steady_clock::now();
+    double duration = _hardware.config().duration;
+
+    _hardware.makeCurrent();
+    for(const auto & tunable : _hardware.config().tunables){
+        setTunable(tunable.first.c_str(), tunable.second);
+    }
+    setup();
+    int stopAfterLaps = _hardware.config().stopAfterLaps;
+    while(_hardware.seconds() < duration && !_report.derailed){
+        if(stopAfterLaps > 0 && (int)_report.lapTimes.size() >= stopAfterLaps){
+            break;
+        }
+        loop();
+        _hardware.chargeLoopOverhead();
+
+        // time each obstacle stop until the robot is back to following the line
+        RobotState state = getCurrentState();
+        if(state == STATE_BLOCKED && !_evading){
+            _evading = true;
+            _evasionStart = _hardware.seconds();
+            const SimRobotParams & robot = _hardware.config().robot;
+            _report.stopSpeeds.push_back((_hardware.wheelSpeed(true) + _hardware.wheelSpeed(false))/2*robot.wheelRadius);
+            bool near = false;
+            const SimPose & pose = _hardware.pose();
+            for(const SimObstacle & obstacle : _hardware.config().obstacles){
+                double gap = std::hypot(obstacle.x - pose.x, obstacle.y - pose.y) - obstacle.radius;
+                near = near || (obstacle.presentAt(_evasionStart) && gap < FALSE_STOP_RANGE);
+            }
+            if(!near){
+                _report.falseStops++;
+            }
+        }
+        else if(state != STATE_BLOCKED && _evading){
+            _evading = false;
+            if(state == STATE_NORMAL){
+                _report.evasionTimes.push_back(_hardware.seconds() - _evasionStart);
+            }
+            else{
+                _report.evasionsFailed++;
+            }
+        }
+    }
+    SimHardware::releaseCurrent();
+
+    _report.simulatedSeconds = _hardware.seconds();
+    _report.hostSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - hostStart).count();
+    _report.distance = _progress;
+    _report.wheelSlip = _hardware.wheelSlip();
+    _report.crossTrackRms = _samples > 0 ? std::sqrt(_crossTrackSquares/_samples) : 0;
+    return _report;
+}
+
+void Simulator::onPhysicsStep(const SimHardware & hardware){
+    const Track & track = hardware.track();
+    double dt = hardware.config().physicsStep;
+    double t = hardware.seconds();
+
+    double crossTrack;
+    double s = track.project(hardware.sensorBarCentre(), &crossTrack, &_projectionHint);
+    if(!_started){
+        _started = true;
+        _lastS = s;
+    }
+
+    // unwrap the arc-length position so laps accumulate and reversing subtracts
+    double ds = s - _lastS;
+    if(ds > track.length()/2){
+        ds -= track.length();
+    }
+    else if(ds < -track.length()/2){
+        ds += track.length();
+    }
+    _lastS = s;
+    _progress += ds;
+
+    double lapsDone = _report.lapTimes.size();
+    if(_progress >= (lapsDone + 1)*track.length()){
+        double previous = 0;
+        for(double lap : _report.lapTimes){
+            previous += lap;
+        }
+        _report.lapTimes.push_back(t - previous);
+        _report.lapLineLosses.push_back(_report.lineLosses - _lossesBeforeLap);
+        _lossesBeforeLap = _report.lineLosses;
+    }
+
+    _crossTrackSquares += crossTrack*crossTrack;
+    _samples++;
+    if(crossTrack > _report.crossTrackMax){
+        _report.crossTrackMax = crossTrack;
+    }
+    if(crossTrack > DERAIL_DISTANCE){
+        _report.derailed = true;
+    }
+
+    bool touching = false;
+    const SimPose & pose = hardware.pose();
+    for(const SimObstacle & obstacle : hardware.config().obstacles){
+        double gap = std::hypot(obstacle.x - pose.x, obstacle.y - pose.y) - obstacle.radius;
+        if(obstacle.presentAt(t) && gap < hardware.config().robot.bodyRadius){
+            touching = true;
+        }
+    }
+    if(touching && !_touching){
+        _report.obstacleContacts++;
+    }
+    _touching = touching;
+
+    bool seen = false;
+    for(int i = 0; i < hardware.config().robot.qtrCount; i++){
+        Vec2 p = hardware.sensorPosition(i);
+        if(track.darknessAt(p.x, p.y) >= ON_LINE_DARKNESS){
+            seen = true;
+        }
+    }
+    if(seen){
+        _lineSeen = true;
+        _lossCounted = false;
+    }
+    else{
+        if(_lineSeen){
+            _lineSeen = false;
+            _lineLostSince = t;
+        }
+        _report.timeOffLine += dt;
+        if(!_lossCounted && t - _lineLostSince >= LINE_LOSS_DEBOUNCE){
+            _lossCounted = true;
+            _report.lineLosses++;
+        }
+    }
+}
@@ -0,0 +1,65 @@
+/**
+ * closed-loop host simulation of the robot: runs the unmodified setup()/loop() against
+ * SimHardware on a virtual clock and scores the run
+ */
+#pragma once
+
+#include "SimHardware.h"
+
+#include <vector>
+
+struct SimReport {
+    double simulatedSeconds = 0;
+    double hostSeconds = 0;
+    std::vector<double> lapTimes;   // s, one entry per completed lap
+    std::vector<int> lapLineLosses; // line losses during each completed lap
+    double distance = 0;            // mm of centre-line progress
+    double crossTrackRms = 0;       // mm, QTR bar centre to centre line
+    double crossTrackMax = 0;
+    int lineLosses = 0;             // episodes with no sensor over the tape for LINE_LOSS_DEBOUNCE
+    double timeOffLine = 0;         // s
+    bool derailed = false;          // left the track entirely and the run was cut short
+    std::vector<double> evasionTimes; // s from stopping for an obstacle to following the line again
+    int evasionsFailed = 0;         // obstacle stops that ended in SENSING instead of on the line
+    int obstacleContacts = 0;       // episodes of the robot body touching an obstacle
+    std::vector<double> stopSpeeds; // mm/s the robot was doing when it decided to stop for an obstacle
+    int falseStops = 0;             // stops with no obstacle within FALSE_STOP_RANGE
+    double wheelSlip = 0;           // mm the tyres ran past the floor, see SimRobotParams::traction
+
+    double speedup() const { return hostSeconds > 0 ? simulatedSeconds/hostSeconds : 0; }
+    double meanLapTime() const;
+};
+
+class Simulator : private SimObserver
+{
+  public:
+    Simulator(const Track & track, const SimConfig & config);
+
+    /**
+     * run setup() then loop() until the configured duration elapses or the robot derails.
+     * must be called at most once per instance
+     */
+    SimReport run();
+
+    SimHardware & hardware() { return _hardware; }
+
+  private:
+    void onPhysicsStep(const SimHardware & hardware) override;
+
+    SimHardware _hardware;
+    SimReport _report;
+
+    bool _started = false;
+    double _lastS = 0;
+    double _progress = 0;
+    size_t _projectionHint = 0;
+    double _crossTrackSquares = 0;
+    long _samples = 0;
+    bool _lineSeen = true;
+    double _lineLostSince = 0;
+    bool _lossCounted = false;
+    int _lossesBeforeLap = 0;
+    bool _evading = false;
+    double _evasionStart = 0;
+    bool _touching = false;
+};
@@ -0,0 +1,146 @@
+#include "Sweep.h"
+#include "WorkStealingPool.h"
+#include "Tuning.h"
+
+#include <algorithm>
+#include <cmath>
+#include <mutex>
+#include <numeric>
+#include <random>
+
+#define INCOMPLETE_PENALTY 10.0 // s/m added to the score per unit of missing robustness
+#define LINE_LOSS_WEIGHT 0.25   // relative pace penalty per line loss per lap
+
+static std::vector<std::vector<double>> gridConfigurations(const std::vector<SweepParameter> & parameters){
+    std::vector<std::vector<double>> configurations(1);
+    for(const SweepParameter & parameter : parameters){
+        std::vector<std::vector<double>> expanded;
+        int steps = std::max(1, parameter.steps);
+        for(const auto & partial : configurations){
+            for(int i = 0; i < steps; i++){
+                double value = steps == 1 ? parameter.low
+                    : parameter.low + (parameter.high - parameter.low)*i/(steps - 1);
+                expanded.push_back(partial);
+                expanded.back().push_back(value);
+            }
+        }
+        configurations.swap(expanded);
+    }
+    return configurations;
+}
+
+std::vector<std::vector<double>> sampleConfigurations(const SweepOptions & options){
+    const std::vector<SweepParameter> & parameters = options.parameters;
+    if(options.sampling == SweepSampling::Grid){
+        return gridConfigurations(parameters);
+    }
+
+    std::mt19937 rng(options.samplingSeed);
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+    int samples = std::max(1, options.samples);
+    std::vector<std::vector<double>> configurations(samples, std::vector<double>(parameters.size()));
+
+    for(size_t p = 0; p < parameters.size(); p++){
+        // latin hypercube: one sample in each of `samples` equal strata per dimension, with the
+        // strata shuffled independently per dimension
+        std::vector<int> strata(samples);
+        std::iota(strata.begin(), strata.end(), 0);
+        if(options.sampling == SweepSampling::LatinHypercube){
+            std::shuffle(strata.begin(), strata.end(), rng);
+        }
+        for(int i = 0; i < samples; i++){
+            double u = options.sampling == SweepSampling::LatinHypercube
+                ? (strata[i] + unit(rng))/samples
+                : unit(rng);
+            configurations[i][p] = parameters[p].low + (parameters[p].high - parameters[p].low)*u;
+        }
+    }
+    return configurations;
+}
+
+/**
+ * lower is better: mean pace, inflated by line losses and heavily penalised for runs that never
+ * finished a lap or derailed
+ */
+static double scoreResult(const SweepResult & result){
+    double pace = result.completedRuns > 0 ? result.pace : INCOMPLETE_PENALTY;
+    return pace*(1 + LINE_LOSS_WEIGHT*result.lineLossesPerLap) + (1 - result.robustness)*INCOMPLETE_PENALTY;
+}
+
+std::vector<SweepResult> runSweep(const SweepOptions & options, const std::vector<const Track *> & tracks){
+    std::vector<std::vector<double>> configurations = sampleConfigurations(options);
+    size_t runsPerConfiguration = tracks.size()*std::max(1, options.seeds);
+
+    std::vector<std::vector<SimReport>> reports(configurations.size());
+    std::vector<std::vector<double>> trackLengths(configurations.size());
+    std::mutex reportsMutex;
+
+    {
+        WorkStealingPool pool(options.threads);
+        for(size_t c = 0; c < configurations.size(); c++){
+            for(const Track * track : tracks){
+                for(int seed = 1; seed <= std::max(1, options.seeds); seed++){
+                    pool.submit([&, c, track, seed]{
+                        // the tunables are thread local, so this only affects runs on this worker.
+                        // swept values go after the fixed --set overrides so they win
+                        resetTunables();
+                        SimConfig config = options.base;
+                        for(size_t p = 0; p < options.parameters.size(); p++){
+                            config.tunables.emplace_back(options.parameters[p].name, configurations[c][p]);
+                        }
+                        config.seed = (uint32_t)seed;
+                        config.verbose = false;
+                        Simulator simulator(*track, config);
+                        SimReport report = simulator.run();
+
+                        std::lock_guard<std::mutex> lock(reportsMutex);
+                        reports[c].push_back(report);
+                        trackLengths[c].push_back(track->length());
+                    });
+                }
+            }
+        }
+        pool.wait();
+    }
+
+    std::vector<SweepResult> results;
+    for(size_t c = 0; c < configurations.size(); c++){
+        SweepResult result;
+        result.values = configurations[c];
+        result.runs = (int)runsPerConfiguration;
+
+        std::vector<double> paces;
+        double losses = 0;
+        double laps = 0;
+        double crossTrack = 0;
+        for(size_t r = 0; r < reports[c].size(); r++){
+            const SimReport & report = reports[c][r];
+            crossTrack += report.crossTrackRms;
+            losses += report.lineLosses;
+            laps += std::max(1.0, report.distance/trackLengths[c][r]);
+            if(!report.derailed && !report.lapTimes.empty()){
+                result.completedRuns++;
+                paces.push_back(report.meanLapTime()/(trackLengths[c][r]/1000));
+            }
+        }
+
+        result.robustness = result.runs > 0 ? (double)result.completedRuns/result.runs : 0;
+        result.lineLossesPerLap = laps > 0 ? losses/laps : 0;
+        result.crossTrackRms = reports[c].empty() ? 0 : crossTrack/reports[c].size();
+        if(!paces.empty()){
+            result.pace = std::accumulate(paces.begin(), paces.end(), 0.0)/paces.size();
+            double variance = 0;
+            for(double pace : paces){
+                variance += (pace - result.pace)*(pace - result.pace);
+            }
+            result.paceSpread = std::sqrt(variance/paces.size());
+        }
+        result.score = scoreResult(result);
+        results.push_back(result);
+    }
+
+    std::stable_sort(results.begin(), results.end(), [](const SweepResult & a, const SweepResult & b){
+        return a.score < b.score;
+    });
+    return results;
+}
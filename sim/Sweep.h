@@ -0,0 +1,57 @@
+/**
+ * parameter sweep over the tunables in src/Tuning.h.
+ * every (configuration, track, seed) combination is an independent simulated run scheduled on a
+ * work-stealing pool; robot state is thread local so runs never share control-code globals
+ */
+#pragma once
+
+#include "Simulator.h"
+#include "Track.h"
+
+#include <string>
+#include <vector>
+
+struct SweepParameter {
+    std::string name; // tunable name, e.g. BASE_PWM
+    double low;
+    double high;
+    int steps;        // grid points, used by grid sampling only
+};
+
+enum class SweepSampling {
+    Grid,
+    Random,
+    LatinHypercube
+};
+
+struct SweepOptions {
+    std::vector<SweepParameter> parameters;
+    SweepSampling sampling = SweepSampling::Grid;
+    int samples = 64;        // configurations drawn by random and latin hypercube sampling
+    int seeds = 3;           // noise seeds per configuration and track
+    uint32_t samplingSeed = 1;
+    unsigned threads = 0;    // 0 = all cores
+    SimConfig base;          // duration, lap limit and scenario shared by every run
+};
+
+struct SweepResult {
+    std::vector<double> values;  // one per SweepParameter
+    int runs = 0;
+    int completedRuns = 0;       // finished at least one lap without derailing
+    double robustness = 0;       // completedRuns/runs
+    double pace = 0;             // mean lap time per metre of track over completed runs, s/m
+    double paceSpread = 0;       // standard deviation of pace across runs
+    double lineLossesPerLap = 0;
+    double crossTrackRms = 0;
+    double score = 0;            // lower is better, see scoreResult()
+};
+
+/**
+ * draw the parameter vectors to evaluate
+ */
+std::vector<std::vector<double>> sampleConfigurations(const SweepOptions & options);
+
+/**
+ * evaluate every configuration on every track and return the results ranked best first
+ */
+std::vector<SweepResult> runSweep(const SweepOptions & options, const std::vector<const Track *> & tracks);
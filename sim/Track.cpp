@@ -0,0 +1,234 @@
+#include "Track.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+
+#define RASTER_MARGIN 400 // mm of white floor around the track bounding box
+#define PATH_SPACING 5.0  // mm between centre-line samples of built-in tracks
+
+/**
+ * sample a closed curve given in polar form around the origin
+ */
+static std::vector<Vec2> polarLoop(double (*radius)(double), int samples){
+    std::vector<Vec2> path;
+    for(int i = 0; i < samples; i++){
+        double a = 2*M_PI*i/samples;
+        double r = radius(a);
+        path.push_back({r*cos(a), r*sin(a)});
+    }
+    return path;
+}
+
+static double wavyRadius(double a){
+    return 700 + 120*sin(3*a) + 60*cos(5*a);
+}
+
+static double kidneyRadius(double a){
+    return 650 - 220*cos(2*a)*cos(a) + 40*sin(4*a);
+}
+
+/**
+ * stadium: two straights joined by semicircles, run counter-clockwise
+ */
+static std::vector<Vec2> ovalPath(double straight, double radius){
+    std::vector<Vec2> path;
+    for(double s = 0; s < straight; s += PATH_SPACING){
+        path.push_back({-straight/2 + s, -radius});
+    }
+    for(double a = -M_PI_2; a < M_PI_2; a += PATH_SPACING/radius){
+        path.push_back({straight/2 + radius*cos(a), radius*sin(a)});
+    }
+    for(double s = 0; s < straight; s += PATH_SPACING){
+        path.push_back({straight/2 - s, radius});
+    }
+    for(double a = M_PI_2; a < 3*M_PI_2; a += PATH_SPACING/radius){
+        path.push_back({-straight/2 + radius*cos(a), radius*sin(a)});
+    }
+    return path;
+}
+
+bool Track::load(const std::string & nameOrPath, double lineWidth){
+    _name = nameOrPath;
+    _lineWidth = lineWidth;
+    _path.clear();
+    _branches.clear();
+
+    if(nameOrPath == "oval"){
+        _path = ovalPath(1200, 400);
+    }
+    else if(nameOrPath == "wavy"){
+        _path = polarLoop(wavyRadius, 1200);
+    }
+    else if(nameOrPath == "kidney"){
+        _path = polarLoop(kidneyRadius, 1200);
+    }
+    else{
+        std::ifstream in(nameOrPath);
+        if(!in){
+            return false;
+        }
+        std::string line;
+        while(std::getline(in, line)){
+            if(line.empty() || line[0] == '#'){
+                continue;
+            }
+            std::istringstream fields(line);
+            Vec2 p;
+            if(fields >> p.x >> p.y){
+                _path.push_back(p);
+            }
+        }
+    }
+
+    if(_path.size() < 3){
+        return false;
+    }
+    finishPath();
+    return true;
+}
+
+void Track::addBranch(const std::vector<Vec2> & branch){
+    _branches.push_back(branch);
+    finishPath();
+}
+
+/**
+ * compute arc lengths, size the raster to the bounding box and paint every path into it
+ */
+void Track::finishPath(){
+    _arc.assign(_path.size() + 1, 0);
+    for(size_t i = 0; i < _path.size(); i++){
+        const Vec2 & a = _path[i];
+        const Vec2 & b = _path[(i + 1) % _path.size()];
+        _arc[i + 1] = _arc[i] + std::hypot(b.x - a.x, b.y - a.y);
+    }
+    _length = _arc.back();
+
+    double minX = _path[0].x, maxX = _path[0].x, minY = _path[0].y, maxY = _path[0].y;
+    auto grow = [&](const std::vector<Vec2> & path){
+        for(const Vec2 & p : path){
+            minX = std::min(minX, p.x);
+            maxX = std::max(maxX, p.x);
+            minY = std::min(minY, p.y);
+            maxY = std::max(maxY, p.y);
+        }
+    };
+    grow(_path);
+    for(const auto & branch : _branches){
+        grow(branch);
+    }
+
+    _originX = std::floor(minX) - RASTER_MARGIN;
+    _originY = std::floor(minY) - RASTER_MARGIN;
+    _width = (int)(maxX - minX) + 2*RASTER_MARGIN;
+    _height = (int)(maxY - minY) + 2*RASTER_MARGIN;
+    _raster.assign((size_t)_width*_height, 0);
+
+    rasterise(_path, true);
+    for(const auto & branch : _branches){
+        rasterise(branch, false);
+    }
+}
+
+/**
+ * paint each segment as a capsule of the line width, with a 1 mm anti-aliased edge
+ */
+void Track::rasterise(const std::vector<Vec2> & path, bool closed){
+    double halfWidth = _lineWidth/2;
+    size_t segments = closed ? path.size() : path.size() - 1;
+
+    for(size_t i = 0; i < segments; i++){
+        Vec2 a = path[i];
+        Vec2 b = path[(i + 1) % path.size()];
+        double dx = b.x - a.x;
+        double dy = b.y - a.y;
+        double lengthSquared = dx*dx + dy*dy;
+
+        int x0 = (int)std::floor(std::min(a.x, b.x) - halfWidth - 1 - _originX);
+        int x1 = (int)std::ceil(std::max(a.x, b.x) + halfWidth + 1 - _originX);
+        int y0 = (int)std::floor(std::min(a.y, b.y) - halfWidth - 1 - _originY);
+        int y1 = (int)std::ceil(std::max(a.y, b.y) + halfWidth + 1 - _originY);
+
+        for(int cy = std::max(y0, 0); cy <= std::min(y1, _height - 1); cy++){
+            for(int cx = std::max(x0, 0); cx <= std::min(x1, _width - 1); cx++){
+                double px = cx + 0.5 + _originX;
+                double py = cy + 0.5 + _originY;
+                double t = lengthSquared > 0 ? ((px - a.x)*dx + (py - a.y)*dy)/lengthSquared : 0;
+                t = std::min(1.0, std::max(0.0, t));
+                double d = std::hypot(px - (a.x + t*dx), py - (a.y + t*dy));
+
+                double coverage = std::min(1.0, std::max(0.0, halfWidth + 0.5 - d));
+                uint8_t value = (uint8_t)(coverage*255);
+                uint8_t & cell = _raster[(size_t)cy*_width + cx];
+                cell = std::max(cell, value);
+            }
+        }
+    }
+}
+
+uint8_t Track::darknessAt(double x, double y) const{
+    int cx = (int)std::floor(x - _originX);
+    int cy = (int)std::floor(y - _originY);
+    if(cx < 0 || cy < 0 || cx >= _width || cy >= _height){
+        return 0;
+    }
+    return _raster[(size_t)cy*_width + cx];
+}
+
+double Track::project(Vec2 p, double * distance, size_t * hint) const{
+    size_t count = _path.size();
+    size_t start = 0;
+    size_t span = count;
+    if(hint && *hint < count){
+        // search a window around the last match; the robot cannot move far between samples
+        start = (*hint + count - 8) % count;
+        span = 16;
+    }
+
+    double bestDistance = 1e18;
+    double bestS = 0;
+    size_t bestIndex = 0;
+    for(size_t k = 0; k < span; k++){
+        size_t i = (start + k) % count;
+        Vec2 a = _path[i];
+        Vec2 b = _path[(i + 1) % count];
+        double dx = b.x - a.x;
+        double dy = b.y - a.y;
+        double lengthSquared = dx*dx + dy*dy;
+        double t = lengthSquared > 0 ? ((p.x - a.x)*dx + (p.y - a.y)*dy)/lengthSquared : 0;
+        t = std::min(1.0, std::max(0.0, t));
+        double d = std::hypot(p.x - (a.x + t*dx), p.y - (a.y + t*dy));
+        if(d < bestDistance){
+            bestDistance = d;
+            bestS = _arc[i] + t*std::sqrt(lengthSquared);
+            bestIndex = i;
+        }
+    }
+
+    if(hint){
+        *hint = bestIndex;
+    }
+    if(distance){
+        *distance = bestDistance;
+    }
+    return bestS;
+}
+
+Vec2 Track::pointAt(double s, double * heading) const{
+    s = std::fmod(s, _length);
+    if(s < 0){
+        s += _length;
+    }
+    size_t i = std::upper_bound(_arc.begin(), _arc.end(), s) - _arc.begin() - 1;
+    i = std::min(i, _path.size() - 1);
+    Vec2 a = _path[i];
+    Vec2 b = _path[(i + 1) % _path.size()];
+    double segment = _arc[i + 1] - _arc[i];
+    double t = segment > 0 ? (s - _arc[i])/segment : 0;
+    if(heading){
+        *heading = std::atan2(b.y - a.y, b.x - a.x);
+    }
+    return {a.x + t*(b.x - a.x), a.y + t*(b.y - a.y)};
+}
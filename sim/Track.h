@@ -0,0 +1,72 @@
+/**
+ * 2D track description for the host simulator.
+ * a track is a closed centre-line polyline (used for lap and cross-track metrics) rasterised
+ * into a 1 mm reflectance grid that the simulated QTR sensors sample.
+ */
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+struct Vec2 {
+    double x;
+    double y;
+};
+
+class Track
+{
+  public:
+    /**
+     * build one of the named built-in tracks ("oval", "wavy", "kidney") or load a closed list of
+     * "x y" waypoints in millimetres from a text file. returns false if the name is unknown or the
+     * file could not be read
+     */
+    bool load(const std::string & nameOrPath, double lineWidth = 19.0);
+
+    /**
+     * add an extra branch (spur) that is painted into the raster but not part of the lap path
+     */
+    void addBranch(const std::vector<Vec2> & branch);
+
+    /**
+     * darkness of the surface at a world position in millimetres, 0 = white floor, 255 = tape
+     */
+    uint8_t darknessAt(double x, double y) const;
+
+    /**
+     * project a point onto the centre line. returns the arc-length position and writes the
+     * unsigned distance to the line. hint is the segment index of the previous projection and
+     * keeps the search local
+     */
+    double project(Vec2 p, double * distance, size_t * hint) const;
+
+    /**
+     * position and tangent heading (radians, counter-clockwise from +x) at an arc-length position
+     */
+    Vec2 pointAt(double s, double * heading) const;
+
+    double length() const { return _length; }
+    double lineWidth() const { return _lineWidth; }
+    const std::string & name() const { return _name; }
+
+  private:
+    void finishPath();
+    void rasterise(const std::vector<Vec2> & path, bool closed);
+
+    std::string _name;
+    double _lineWidth = 19.0;
+
+    std::vector<Vec2> _path;
+    std::vector<double> _arc; // cumulative arc length at each path vertex
+    double _length = 0;
+
+    std::vector<std::vector<Vec2>> _branches;
+
+    // raster, 1 mm cells
+    std::vector<uint8_t> _raster;
+    double _originX = 0;
+    double _originY = 0;
+    int _width = 0;
+    int _height = 0;
+};
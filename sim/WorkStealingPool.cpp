@@ -0,0 +1,94 @@
+#include "WorkStealingPool.h"
+
+#include <algorithm>
+
+WorkStealingPool::WorkStealingPool(unsigned threads){
+    if(threads == 0){
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    for(unsigned i = 0; i < threads; i++){
+        _queues.emplace_back(new Worker());
+    }
+    for(unsigned i = 0; i < threads; i++){
+        _workers.emplace_back(&WorkStealingPool::run, this, i);
+    }
+}
+
+WorkStealingPool::~WorkStealingPool(){
+    {
+        std::lock_guard<std::mutex> lock(_stateMutex);
+        _stopping = true;
+    }
+    _workAvailable.notify_all();
+    for(std::thread & worker : _workers){
+        worker.join();
+    }
+}
+
+void WorkStealingPool::submit(std::function<void()> task){
+    unsigned index = _nextQueue.fetch_add(1) % _queues.size();
+    //counted before it is published, a worker that takes it at once must not count it off first
+    {
+        std::lock_guard<std::mutex> lock(_stateMutex);
+        _pending++;
+        _queued++;
+    }
+    {
+        std::lock_guard<std::mutex> lock(_queues[index]->mutex);
+        _queues[index]->tasks.push_back(std::move(task));
+    }
+    _workAvailable.notify_one();
+}
+
+void WorkStealingPool::wait(){
+    std::unique_lock<std::mutex> lock(_stateMutex);
+    _allDone.wait(lock, [this]{ return _pending == 0; });
+}
+
+bool WorkStealingPool::popLocal(unsigned index, std::function<void()> & task){
+    Worker & worker = *_queues[index];
+    std::lock_guard<std::mutex> lock(worker.mutex);
+    if(worker.tasks.empty()){
+        return false;
+    }
+    task = std::move(worker.tasks.back());
+    worker.tasks.pop_back();
+    return true;
+}
+
+bool WorkStealingPool::steal(unsigned thief, std::function<void()> & task){
+    for(size_t offset = 1; offset < _queues.size(); offset++){
+        Worker & victim = *_queues[(thief + offset) % _queues.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if(!victim.tasks.empty()){
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+void WorkStealingPool::run(unsigned index){
+    for(;;){
+        std::function<void()> task;
+        if(popLocal(index, task) || steal(index, task)){
+            {
+                std::lock_guard<std::mutex> lock(_stateMutex);
+                _queued--;
+            }
+            task();
+            std::lock_guard<std::mutex> lock(_stateMutex);
+            if(--_pending == 0){
+                _allDone.notify_all();
+            }
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(_stateMutex);
+        _workAvailable.wait(lock, [this]{ return _stopping || _queued > 0; });
+        if(_stopping && _queued == 0){
+            return;
+        }
+    }
+}
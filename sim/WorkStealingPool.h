@@ -0,0 +1,61 @@
+/**
+ * fixed-size thread pool with one task deque per worker.
+ * a worker pops its own deque from the back and steals from the front of the others when it
+ * runs dry, so long and short simulations balance across cores without a central queue
+ */
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class WorkStealingPool
+{
+  public:
+    /**
+     * threads = 0 uses every hardware thread
+     */
+    explicit WorkStealingPool(unsigned threads = 0);
+    ~WorkStealingPool();
+
+    WorkStealingPool(const WorkStealingPool &) = delete;
+    WorkStealingPool & operator=(const WorkStealingPool &) = delete;
+
+    /**
+     * queue a task. tasks are spread round-robin over the worker deques
+     */
+    void submit(std::function<void()> task);
+
+    /**
+     * block until every submitted task has finished
+     */
+    void wait();
+
+    unsigned size() const { return (unsigned)_workers.size(); }
+
+  private:
+    struct Worker {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    void run(unsigned index);
+    bool popLocal(unsigned index, std::function<void()> & task);
+    bool steal(unsigned thief, std::function<void()> & task);
+
+    std::vector<std::unique_ptr<Worker>> _queues;
+    std::vector<std::thread> _workers;
+    std::atomic<unsigned> _nextQueue{0};
+
+    std::mutex _stateMutex;
+    std::condition_variable _workAvailable;
+    std::condition_variable _allDone;
+    size_t _pending = 0;   // submitted and not yet finished
+    size_t _queued = 0;    // submitted and not yet started
+    bool _stopping = false;
+};
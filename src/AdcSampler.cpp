@@ -0,0 +1,334 @@
+#include <Arduino.h>
+#include "AdcSampler.h"
+#include "Platform.h"
+#include "PinMap.h"
+
+/**
+ * ADC input channel of a pin wired to both ADCs, the same on either, or ADC_NO_SLOT. 24 and 25
+ * (A10, A11) reach only ADC1, where ADC2's channels 1 and 2 are other pads
+ */
+static constexpr uint8_t adcChannel(uint8_t pin){
+    switch(pin){
+        case 14: return 7;
+        case 15: return 8;
+        case 16: return 12;
+        case 17: return 11;
+        case 18: return 6;
+        case 19: return 5;
+        case 20: return 15;
+        case 21: return 0;
+        case 22: return 13;
+        case 23: return 14;
+        default: return ADC_NO_SLOT;//only on one ADC, or not analog at all
+    }
+}
+
+//startMicScan() deals the mics out to the chains of both ADCs
+static_assert(adcChannel(MIC_PIN_0) != ADC_NO_SLOT && adcChannel(MIC_PIN_1) != ADC_NO_SLOT
+    && adcChannel(MIC_PIN_2) != ADC_NO_SLOT, "the mic pins must be wired to ADC1 and ADC2");
+
+bool adcPinScannable(uint8_t pin){
+    return adcChannel(pin) != ADC_NO_SLOT;
+}
+
+/**
+ * fill steps with the pairs of conversions for a scan. returns how many, or -1 if the pins
+ * cannot be scanned
+ */
+int planAdcScan(const uint8_t * pins, uint8_t count, uint8_t samples, AdcStep * steps){
+    int conversions = count*samples;
+    if(count == 0 || count > ADC_MAX_PINS || samples == 0 || conversions > 2*ADC_MAX_STEPS){
+        return -1;
+    }
+    for(int i = 0; i < count; i++){
+        if(!adcPinScannable(pins[i])){
+            return -1;
+        }
+    }
+    int stepCount = (conversions + 1)/2;
+    for(int k = 0; k < 2*stepCount; k++){
+        AdcStep & step = steps[k/2];
+        int adc = k % 2;
+        if(k < conversions){
+            step.pin[adc] = pins[k % count];
+            step.slot[adc] = k % count;
+        }
+        else{
+            //nothing left for ADC2 in the last pair, it converts the same pin and the result is dropped
+            step.pin[adc] = step.pin[0];
+            step.slot[adc] = ADC_NO_SLOT;
+        }
+    }
+    return stepCount;
+}
+
+/**
+ * rounded averages, the same as QTRSensors works out from analogRead
+ */
+static FASTRUN void averageScan(const uint32_t * sums, uint8_t count, uint8_t samples, uint16_t * values){
+    for(int i = 0; i < count; i++){
+        values[i] = (sums[i] + samples/2)/samples;
+    }
+}
+
+#ifdef __IMXRT1062__
+#define ETC_CHAIN_LENGTH 8 // segments in an ADC_ETC trigger chain, one per HC register of the ADC
+#define TRIG0_DONE 0x01    // ADC1's chain finished, in ADC_ETC_DONE0_1_IRQ
+#define TRIG4_DONE 0x10    // ADC2's chain finished
+
+struct AdcScanJob {
+    AdcStep steps[ADC_MAX_STEPS];
+    int stepCount;
+    int nextStep;             // first step of the pass that is running
+    uint8_t count;
+    uint8_t samples;
+    uint32_t sums[ADC_MAX_PINS];
+    uint16_t values[ADC_MAX_PINS];
+    AdcScanDone done;         // nullptr for a blocking scan
+};
+
+ROBOT_STATE AdcScanJob blockingJob;
+ROBOT_STATE AdcScanJob asyncJob;
+ROBOT_STATE AdcScanJob * volatile runningJob; // the job the chains are working through, nullptr when idle
+ROBOT_STATE volatile bool blockingQueued;
+ROBOT_STATE volatile bool blockingBusy;
+ROBOT_STATE volatile bool asyncQueued;
+ROBOT_STATE volatile uint32_t passDone;       // chains of the running pass that have finished
+
+/**
+ * one chain segment: convert channel into HC register hc, straight after the previous segment
+ */
+static uint32_t chainSegment(uint8_t channel, int hc, bool interrupt){
+    return ADC_ETC_TRIG_CHAIN_CSEL0(channel) | ADC_ETC_TRIG_CHAIN_HWTS0(1 << hc) | ADC_ETC_TRIG_CHAIN_B2B0
+        | (interrupt ? ADC_ETC_TRIG_CHAIN_IE0(1) : 0);
+}
+
+/**
+ * program the next pairs of the job into the chains of TRIG0 (ADC1) and TRIG4 (ADC2) and start
+ * both together
+ */
+static FASTRUN void runPass(AdcScanJob * job){
+    int length = min(job->stepCount - job->nextStep, ETC_CHAIN_LENGTH);
+    volatile uint32_t * chains[2] = {&ADC_ETC_TRIG0_CHAIN_1_0, &ADC_ETC_TRIG4_CHAIN_1_0};
+    for(int adc = 0; adc < 2; adc++){
+        for(int segment = 0; segment < length; segment += 2){
+            uint32_t value = 0;
+            for(int half = 0; half < 2 && segment + half < length; half++){
+                const AdcStep & step = job->steps[job->nextStep + segment + half];
+                bool last = segment + half == length - 1;
+                value |= chainSegment(adcChannel(step.pin[adc]), segment + half, last) << (16*half);
+            }
+            chains[adc][segment/2] = value;
+        }
+    }
+    passDone = 0;
+    ADC_ETC_TRIG4_CTRL = ADC_ETC_TRIG_CTRL_TRIG_CHAIN(length - 1);
+    ADC_ETC_TRIG0_CTRL = ADC_ETC_TRIG_CTRL_TRIG_CHAIN(length - 1) | ADC_ETC_TRIG_CTRL_SYNC_MODE;
+    ADC_ETC_TRIG0_CTRL |= ADC_ETC_TRIG_CTRL_SW_TRIG;//TRIG4 follows TRIG0 in sync mode
+}
+
+static FASTRUN void startJob(AdcScanJob * job){
+    job->nextStep = 0;
+    for(int i = 0; i < job->count; i++){
+        job->sums[i] = 0;
+    }
+    runningJob = job;
+    runPass(job);
+}
+
+/**
+ * sum the results the chains hold for the pass that just finished
+ */
+static FASTRUN void collectPass(AdcScanJob * job){
+    int length = min(job->stepCount - job->nextStep, ETC_CHAIN_LENGTH);
+    volatile uint32_t * results[2] = {&ADC_ETC_TRIG0_RESULT_1_0, &ADC_ETC_TRIG4_RESULT_1_0};
+    for(int segment = 0; segment < length; segment++){
+        const AdcStep & step = job->steps[job->nextStep + segment];
+        for(int adc = 0; adc < 2; adc++){
+            if(step.slot[adc] != ADC_NO_SLOT){
+                job->sums[step.slot[adc]] += (results[adc][segment/2] >> (16*(segment % 2))) & 0xfff;
+            }
+        }
+    }
+    job->nextStep += length;
+}
+
+/**
+ * completion interrupt of a chain. once both are in, the next pass or the next job is started
+ */
+static FASTRUN void adcEtcDone(){
+    uint32_t status = ADC_ETC_DONE0_1_IRQ & (TRIG0_DONE | TRIG4_DONE);
+    ADC_ETC_DONE0_1_IRQ = status;//write one to clear
+    passDone = passDone | status;
+    if(passDone != (TRIG0_DONE | TRIG4_DONE) || runningJob == nullptr){
+        return;
+    }
+    AdcScanJob * job = runningJob;
+    collectPass(job);
+    if(job->nextStep < job->stepCount){
+        runPass(job);
+        return;
+    }
+    averageScan(job->sums, job->count, job->samples, job->values);
+    runningJob = nullptr;
+    if(job->done){
+        job->done(job->values);
+    }
+    else{
+        blockingBusy = false;
+    }
+    //a waiting mic round goes first, it is on a sampling clock
+    if(asyncQueued){
+        asyncQueued = false;
+        startJob(&asyncJob);
+    }
+    else if(blockingQueued){
+        blockingQueued = false;
+        startJob(&blockingJob);
+    }
+}
+
+/**
+ * hand both ADCs to ADC_ETC. from here on every conversion goes through the scans, analogRead
+ * no longer works
+ */
+FLASHMEM void initAdcSampler(){
+    analogReadAveraging(1);//the scans average in software, hardware averaging would only multiply the conversions
+    ADC1_CFG |= ADC_CFG_ADTRG;
+    ADC2_CFG |= ADC_CFG_ADTRG;
+    for(int hc = 0; hc < ETC_CHAIN_LENGTH; hc++){
+        (&ADC1_HC0)[hc] = ADC_HC_ADCH(16);//channel from ADC_ETC
+        (&ADC2_HC0)[hc] = ADC_HC_ADCH(16);
+    }
+    ADC_ETC_CTRL &= ~ADC_ETC_CTRL_SOFTRST;
+    ADC_ETC_CTRL |= ADC_ETC_CTRL_TSC_BYPASS | ADC_ETC_CTRL_TRIG_ENABLE(0x11);//TRIG0 and TRIG4
+    runningJob = nullptr;
+    blockingQueued = false;
+    blockingBusy = false;
+    asyncQueued = false;
+    attachInterruptVector(IRQ_ADC_ETC0, adcEtcDone);
+    NVIC_ENABLE_IRQ(IRQ_ADC_ETC0);
+}
+
+/**
+ * convert every pin samples times and store the rounded averages in values, waiting for the
+ * result. false if the pins cannot be scanned
+ */
+bool adcScan(const uint8_t * pins, uint8_t count, uint8_t samples, uint16_t * values){
+    int stepCount = planAdcScan(pins, count, samples, blockingJob.steps);
+    if(stepCount < 0){
+        return false;
+    }
+    blockingJob.stepCount = stepCount;
+    blockingJob.count = count;
+    blockingJob.samples = samples;
+    blockingJob.done = nullptr;
+    blockingBusy = true;
+    noInterrupts();
+    if(runningJob == nullptr){
+        startJob(&blockingJob);
+    }
+    else{
+        blockingQueued = true;
+    }
+    interrupts();
+    while(blockingBusy){
+    }
+    for(int i = 0; i < count; i++){
+        values[i] = blockingJob.values[i];
+    }
+    return true;
+}
+
+/**
+ * convert every pin once without waiting, done gets the results from the completion interrupt.
+ * false if the pins cannot be scanned or the last round has not finished
+ */
+bool adcStartScan(const uint8_t * pins, uint8_t count, AdcScanDone done){
+    noInterrupts();
+    bool busy = asyncQueued || runningJob == &asyncJob;
+    interrupts();
+    if(busy){
+        return false;
+    }
+    int stepCount = planAdcScan(pins, count, 1, asyncJob.steps);
+    if(stepCount < 0){
+        return false;
+    }
+    asyncJob.stepCount = stepCount;
+    asyncJob.count = count;
+    asyncJob.samples = 1;
+    asyncJob.done = done;
+    noInterrupts();
+    if(runningJob == nullptr){
+        startJob(&asyncJob);
+    }
+    else{
+        asyncQueued = true;
+    }
+    interrupts();
+    return true;
+}
+
+/**
+ * host builds only, the Teensy always converts with the ADCs
+ */
+void setAdcConverter(AdcConverter converter){
+    (void)converter;
+}
+#else
+ROBOT_STATE AdcConverter adcConverter; // nullptr for analogRead
+
+static int convertWithAnalogRead(uint8_t adc, uint8_t pin){
+    (void)adc;
+    return analogRead(pin);
+}
+
+FLASHMEM void initAdcSampler(){
+    analogReadAveraging(1);
+    adcConverter = nullptr;
+}
+
+/**
+ * run the scan's conversions in order through the converter
+ */
+static bool runAdcScan(const uint8_t * pins, uint8_t count, uint8_t samples, uint16_t * values){
+    AdcStep steps[ADC_MAX_STEPS];
+    int stepCount = planAdcScan(pins, count, samples, steps);
+    if(stepCount < 0){
+        return false;
+    }
+    AdcConverter convert = adcConverter != nullptr ? adcConverter : convertWithAnalogRead;
+    uint32_t sums[ADC_MAX_PINS] = {};
+    for(int s = 0; s < stepCount; s++){
+        for(int adc = 0; adc < 2; adc++){
+            if(steps[s].slot[adc] != ADC_NO_SLOT){
+                sums[steps[s].slot[adc]] += convert(adc, steps[s].pin[adc]);
+            }
+        }
+    }
+    averageScan(sums, count, samples, values);
+    return true;
+}
+
+bool adcScan(const uint8_t * pins, uint8_t count, uint8_t samples, uint16_t * values){
+    return runAdcScan(pins, count, samples, values);
+}
+
+bool adcStartScan(const uint8_t * pins, uint8_t count, AdcScanDone done){
+    uint16_t values[ADC_MAX_PINS];
+    if(!runAdcScan(pins, count, 1, values)){
+        return false;
+    }
+    done(values);
+    return true;
+}
+
+/**
+ * convert with a stand-in instead of analogRead, e.g. to check the sequencing. nullptr goes back
+ * to analogRead
+ */
+void setAdcConverter(AdcConverter converter){
+    adcConverter = converter;
+}
+#endif
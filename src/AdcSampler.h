@@ -0,0 +1,45 @@
+/**
+ * Header file for sampling analog pins on both ADCs at once
+ *
+ * a scan converts a list of pins a number of times each. the conversions are taken in the order
+ * analogRead would do them, pin by pin and sample by sample, and dealt out alternately to ADC1 and
+ * ADC2. each pair converts at the same time, so a scan takes half as long as reading the pins one
+ * after the other, and with an odd number of pins each pin is averaged over both ADCs.
+ * on the Teensy the pairs are programmed into the ADC_ETC trigger chains of the two ADCs, which run
+ * them back to back without the CPU and hold the results until one completion interrupt sums them.
+ * only pins wired to both ADCs can be scanned. on other platforms the same sequence is run through
+ * a converter function, analogRead by default, so the sequencing can be checked on the host
+ */
+#pragma once
+
+#include <stdint.h>
+
+#define ADC_MAX_PINS 32    // pins in one scan
+#define ADC_MAX_STEPS 64   // pairs of conversions in one scan
+#define ADC_NO_SLOT 0xff
+
+/**
+ * one pair of conversions, index 0 on ADC1 and 1 on ADC2
+ */
+struct AdcStep {
+    uint8_t pin[2];
+    uint8_t slot[2]; // position in the scan's pin list the result belongs to, ADC_NO_SLOT when the ADC idles
+};
+
+typedef void (*AdcScanDone)(const uint16_t * values);
+typedef int (*AdcConverter)(uint8_t adc, uint8_t pin);
+
+/**
+ * function definitions
+ */
+void initAdcSampler();
+
+bool adcPinScannable(uint8_t pin);
+
+int planAdcScan(const uint8_t * pins, uint8_t count, uint8_t samples, AdcStep * steps);
+
+bool adcScan(const uint8_t * pins, uint8_t count, uint8_t samples, uint16_t * values);
+
+bool adcStartScan(const uint8_t * pins, uint8_t count, AdcScanDone done);
+
+void setAdcConverter(AdcConverter converter);
@@ -0,0 +1,276 @@
+#include <Arduino.h>
+#include "AutoTune.h"
+#include "Tuning.h"
+#include "Sensing.h"
+#include "Persist.h"
+
+#define LINE_RELAY_PWM 100            // steering either way while tuning the line loop
+#define LINE_RELAY_HYSTERESIS 80     // line reading units about the target before the steering switches
+#define LINE_WINDOW_US 4000000       // most the line experiment may take
+#define WHEEL_RELAY_PWM 20           // added to and taken from the base PWM of each wheel
+#define WHEEL_RELAY_HYSTERESIS 20    // ticks per second
+#define WHEEL_SETTLE_US 300000       // both wheels held at the base PWM before the relays start, their rates averaged over the second half
+#define WHEEL_WINDOW_US 1500000      // most the wheel experiment may take, the settling included
+#define TUNE_ABORT_DIFFERENCE 950    // the line is that far off the target near the edge of the bar
+#define RELAY_DUTY_MIN 0.3           // least fraction of a cycle on either side, a lopsided swing is not the loop's own
+
+ROBOT_STATE AutoTuneReport tuneReport;
+ROBOT_STATE RelayTrace tuneRelays[2];  // the line, or the left and right wheel
+ROBOT_STATE uint32_t tuneStart;
+ROBOT_STATE bool tuneRelaysStarted;
+ROBOT_STATE double tuneWheelBias;      // PWM the wheels are swung about
+ROBOT_STATE double tuneRateSums[2];    // of the rates while settling
+ROBOT_STATE int tuneRateSamples;
+
+void startRelay(RelayTrace * trace, double amplitude, double hysteresis, uint32_t nowUs){
+    trace->amplitude = amplitude;
+    trace->hysteresis = hysteresis;
+    trace->output = 1;
+    trace->cycleStart = nowUs;
+    trace->switchedDown = nowUs;
+    trace->high = -1e30;
+    trace->low = 1e30;
+    trace->cycles = -1;
+    trace->counted = 0;
+    trace->periodSum = 0;
+    trace->swingSum = 0;
+    trace->dutySum = 0;
+}
+
+/**
+ * the relay's output for an error. a cycle runs from one switch to +1 to the next
+ */
+double stepRelay(RelayTrace * trace, double error, uint32_t nowUs){
+    trace->high = max(trace->high, error);
+    trace->low = min(trace->low, error);
+    int8_t next = error > trace->hysteresis ? 1 : error < -trace->hysteresis ? -1 : trace->output;
+    if(next == -1 && trace->output == 1){
+        trace->switchedDown = nowUs;
+    }
+    else if(next == 1 && trace->output == -1){
+        if(trace->cycles >= RELAY_WARMUP_CYCLES){
+            double period = (nowUs - trace->cycleStart)*1e-6;
+            trace->periodSum += period;
+            trace->swingSum += (trace->high - trace->low)/2;
+            trace->dutySum += (trace->switchedDown - trace->cycleStart)*1e-6/period;
+            trace->counted++;
+        }
+        trace->cycles++;
+        trace->cycleStart = nowUs;
+        trace->high = error;
+        trace->low = error;
+    }
+    trace->output = next;
+    return trace->output*trace->amplitude;
+}
+
+bool relayDone(const RelayTrace * trace){
+    return trace->counted >= RELAY_CYCLES;
+}
+
+/**
+ * the ultimate gain and period of the loop from the cycles counted so far, and the fraction of a
+ * cycle the relay spent at +1. false when there are none or they swing within the hysteresis
+ */
+bool relayResult(const RelayTrace * trace, double * ultimateGain, double * ultimatePeriod, double * duty){
+    if(trace->counted == 0){
+        return false;
+    }
+    double swing = trace->swingSum/trace->counted;
+    if(swing <= trace->hysteresis){
+        return false;
+    }
+    //the hysteresis delays each switch, which the describing function of the relay takes out
+    *ultimateGain = 4*trace->amplitude/(M_PI*sqrt(swing*swing - trace->hysteresis*trace->hysteresis));
+    *ultimatePeriod = trace->periodSum/trace->counted;
+    *duty = trace->dutySum/trace->counted;
+    return true;
+}
+
+/**
+ * PID gains, or PI ones without derivative, from the ultimate gain and period by a rule
+ */
+PidGains gainsFromRelay(double ultimateGain, double ultimatePeriod, int rule, bool derivative){
+    double kp, integralTime, derivativeTime = 0;
+    if(rule == RULE_TYREUS_LUYBEN){
+        kp = ultimateGain/(derivative ? 2.2 : 3.2);
+        integralTime = 2.2*ultimatePeriod;
+        derivativeTime = derivative ? ultimatePeriod/6.3 : 0;
+    }
+    else{
+        kp = ultimateGain*(derivative ? 0.6 : 0.45);
+        integralTime = ultimatePeriod/(derivative ? 2 : 1.2);
+        derivativeTime = derivative ? ultimatePeriod/8 : 0;
+    }
+    return {kp, kp/integralTime, kp*derivativeTime};
+}
+
+FLASHMEM void initAutoTune(){
+    tuneReport.status = AUTOTUNE_IDLE;
+    tuneReport.reason = "";
+}
+
+/**
+ * start an experiment, which waits for the robot to follow the line. false while one is under way
+ */
+bool startAutoTune(AutoTuneLoop loop){
+    if(autoTuneActive()){
+        return false;
+    }
+    tuneReport.loop = loop;
+    tuneReport.status = AUTOTUNE_PENDING;
+    tuneReport.reason = "";
+    for(int i = 0; i < 2; i++){
+        tuneReport.ultimateGain[i] = 0;
+        tuneReport.ultimatePeriod[i] = 0;
+    }
+    return true;
+}
+
+/**
+ * give up an experiment under way, the gains stay as they were. one still waiting to start waits on
+ */
+void abortAutoTune(const char * reason){
+    if(tuneReport.status != AUTOTUNE_RUNNING){
+        return;
+    }
+    tuneReport.status = AUTOTUNE_ABORTED;
+    tuneReport.reason = reason;
+    Serial.printf("%s tune aborted: %s\n", tuneReport.loop == TUNE_LINE ? "line" : "wheel", reason);
+}
+
+bool autoTuneActive(){
+    return tuneReport.status == AUTOTUNE_PENDING || tuneReport.status == AUTOTUNE_RUNNING;
+}
+
+const AutoTuneReport & getAutoTuneReport(){
+    return tuneReport;
+}
+
+/**
+ * set the tunables to gains, only when all of them are within their ranges
+ */
+static bool applyGains(const char * const names[], const double values[], int count){
+    for(int i = 0; i < count; i++){
+        double least, most;
+        if(!getTunableRange(names[i], &least, &most) || !(values[i] >= least && values[i] <= most)){
+            return false;
+        }
+    }
+    for(int i = 0; i < count; i++){
+        setTunable(names[i], values[i]);
+    }
+    return true;
+}
+
+/**
+ * work out the gains of the loop tuned from its relays, and use them
+ */
+static void finishAutoTune(){
+    bool line = tuneReport.loop == TUNE_LINE;
+    int relays = line ? 1 : 2;
+    PidGains gains[2];
+    for(int i = 0; i < relays; i++){
+        double duty;
+        if(!relayResult(&tuneRelays[i], &tuneReport.ultimateGain[i], &tuneReport.ultimatePeriod[i], &duty)){
+            abortAutoTune("no oscillation");
+            return;
+        }
+        if(duty < RELAY_DUTY_MIN || duty > 1 - RELAY_DUTY_MIN){
+            abortAutoTune(line ? "the swing was lopsided, tune on a straight" : "the swing was lopsided");
+            return;
+        }
+        gains[i] = gainsFromRelay(tuneReport.ultimateGain[i], tuneReport.ultimatePeriod[i], AUTOTUNE_RULE, line);
+    }
+
+    bool applied;
+    if(line){
+        const char * const names[] = {"P_WEIGHT", "I_WEIGHT", "D_WEIGHT"};
+        const double values[] = {gains[0].kp, gains[0].ki, gains[0].kd};
+        applied = applyGains(names, values, 3);
+    }
+    else{
+        const char * const names[] = {"WHEEL_LEFT_KP", "WHEEL_LEFT_KI", "WHEEL_RIGHT_KP", "WHEEL_RIGHT_KI"};
+        const double values[] = {gains[0].kp, gains[0].ki, gains[1].kp, gains[1].ki};
+        applied = applyGains(names, values, 4);
+    }
+    if(!applied){
+        abortAutoTune("the gains found are out of range");
+        return;
+    }
+    tuneReport.status = AUTOTUNE_DONE;
+    for(int i = 0; i < relays; i++){
+        Serial.printf("%s tuned: Ku %.4g, Tu %.3f s, kp %.4g, ki %.4g, kd %.4g\n",
+            line ? "line" : i == 0 ? "left wheel" : "right wheel", tuneReport.ultimateGain[i], tuneReport.ultimatePeriod[i],
+            gains[i].kp, gains[i].ki, gains[i].kd);
+    }
+    if(AUTOTUNE_SAVE){
+        beginPersistedSave();//written over the next ticks, see TuningConsole.h
+    }
+}
+
+/**
+ * called by the line follower every tick with the error of the line and the base PWM. while an
+ * experiment runs it sets the wheels' commands and returns true
+ */
+bool autoTuneDrive(int difference, int basePwm, double * pwmLeft, double * pwmRight){
+    if(!autoTuneActive()){
+        return false;
+    }
+    uint32_t now = micros();
+    if(tuneReport.status == AUTOTUNE_PENDING){
+        tuneReport.status = AUTOTUNE_RUNNING;
+        tuneStart = now;
+        tuneRelaysStarted = false;
+        tuneRateSums[0] = tuneRateSums[1] = 0;
+        tuneRateSamples = 0;
+        startRelay(&tuneRelays[0], LINE_RELAY_PWM, LINE_RELAY_HYSTERESIS, now);
+        Serial.printf("tuning the %s\n", tuneReport.loop == TUNE_LINE ? "line loop" : "wheel speed loops");
+    }
+    uint32_t elapsed = now - tuneStart;
+    if(elapsed > (tuneReport.loop == TUNE_LINE ? LINE_WINDOW_US : WHEEL_WINDOW_US)){
+        abortAutoTune("out of time");
+        return false;
+    }
+    if(abs(difference) > TUNE_ABORT_DIFFERENCE){
+        abortAutoTune("the line neared the edge of the bar");
+        return false;
+    }
+
+    if(tuneReport.loop == TUNE_LINE){
+        double turn = stepRelay(&tuneRelays[0], difference, now);
+
+        *pwmLeft = basePwm - turn;
+        *pwmRight = basePwm + turn;
+        if(relayDone(&tuneRelays[0])){
+            finishAutoTune();
+        }
+        return true;
+    }
+
+    double rates[2] = {getWheelTickRate(LEFT), getWheelTickRate(RIGHT)};
+    if(elapsed < WHEEL_SETTLE_US){
+        tuneWheelBias = basePwm;
+        if(elapsed > WHEEL_SETTLE_US/2){
+            tuneRateSums[0] += rates[0];
+            tuneRateSums[1] += rates[1];
+            tuneRateSamples++;
+        }
+        *pwmLeft = tuneWheelBias;
+        *pwmRight = tuneWheelBias;
+        return true;
+    }
+    if(!tuneRelaysStarted){
+        tuneRelaysStarted = true;
+        for(int i = 0; i < 2; i++){
+            startRelay(&tuneRelays[i], WHEEL_RELAY_PWM, WHEEL_RELAY_HYSTERESIS, now);
+            tuneRateSums[i] /= max(tuneRateSamples, 1);//the rate each wheel is swung about
+        }
+    }
+    *pwmLeft = tuneWheelBias + stepRelay(&tuneRelays[0], tuneRateSums[0] - rates[0], now);
+    *pwmRight = tuneWheelBias + stepRelay(&tuneRelays[1], tuneRateSums[1] - rates[1], now);
+    if(relayDone(&tuneRelays[0]) && relayDone(&tuneRelays[1])){
+        finishAutoTune();
+    }
+    return true;
+}
@@ -0,0 +1,104 @@
+/**
+ * Header file for finding the controller gains on the robot by relay experiments
+ *
+ * a relay in place of a controller drives the loop by a fixed amount one way while the error is
+ * above a small hysteresis band and the other way while it is below, and the loop settles into a
+ * steady oscillation at the frequency where it lags by half a cycle. the relay then acts as a gain
+ * of 4h/(pi a) for a swing of a under a relay of h, the ultimate gain Ku at which a proportional
+ * controller alone would oscillate, and the period of the swing is the ultimate period Tu. the
+ * gains follow from those by the rule in AUTOTUNE_RULE: Ziegler-Nichols, or Tyreus-Luyben, which is
+ * slower and overshoots less.
+ *
+ * two experiments, each started from the serial console (tune line, tune wheels, see
+ * TuningConsole.h) and run in place of the steering while the robot follows the line:
+ *   line    the steering swings the robot either way across the line, the error is the line
+ *           position. sets P_WEIGHT, I_WEIGHT and D_WEIGHT. to be run on a straight: on a curve
+ *           the relay spends longer on one side, and a swing that lopsided is refused
+ *   wheels  both wheels are held at the base PWM until their tick rates settle, then each is
+ *           swung by its own relay about its rate. sets the PI gains of WheelSpeed.h per wheel
+ * an experiment is bounded in time and gives up, leaving the gains as they were, once the line
+ * nears the edge of the bar, the robot stops following the line, or the window runs out. the gains
+ * found are stored right away when AUTOTUNE_SAVE is set. the relay and the rules touch nothing of
+ * the hardware and are checked on the host against the simulated drivetrain (sim autotune)
+ */
+#pragma once
+
+#include <stdint.h>
+
+#define RELAY_WARMUP_CYCLES 1 // cycles of a relay left out while the oscillation builds up
+#define RELAY_CYCLES 3        // and cycles averaged after those
+
+enum AutoTuneLoop : uint8_t {
+    TUNE_LINE = 0,
+    TUNE_WHEELS
+};
+
+enum AutoTuneRule : uint8_t {
+    RULE_ZIEGLER_NICHOLS = 0,
+    RULE_TYREUS_LUYBEN
+};
+
+enum AutoTuneStatus : uint8_t {
+    AUTOTUNE_IDLE = 0,
+    AUTOTUNE_PENDING,   // waiting for the robot to follow the line
+    AUTOTUNE_RUNNING,
+    AUTOTUNE_DONE,      // the gains found are in use
+    AUTOTUNE_ABORTED    // the gains were left as they were
+};
+
+/**
+ * one loop under relay control, error and output in the units of the loop
+ */
+struct RelayTrace {
+    double amplitude;     // output either way, h
+    double hysteresis;    // of the error around 0 before the relay switches
+    int8_t output;        // +1 or -1, +1 at the start
+    uint32_t cycleStart;  // us of the last switch to +1
+    uint32_t switchedDown;// us of the switch to -1 after it
+    double high;          // extremes of the error since cycleStart
+    double low;
+    int cycles;           // whole cycles seen, -1 until the first began
+    int counted;          // of those after the warmup
+    double periodSum;     // s
+    double swingSum;      // half the peak to peak error
+    double dutySum;       // fraction of each cycle at +1
+};
+
+struct PidGains {
+    double kp;
+    double ki;  // per second of the integral
+    double kd;  // in seconds
+};
+
+struct AutoTuneReport {
+    AutoTuneLoop loop;
+    AutoTuneStatus status;
+    double ultimateGain[2];   // line, or left and right wheel
+    double ultimatePeriod[2]; // s
+    const char * reason;      // why it was aborted
+};
+
+/**
+ * function definitions
+ */
+void startRelay(RelayTrace * trace, double amplitude, double hysteresis, uint32_t nowUs);
+
+double stepRelay(RelayTrace * trace, double error, uint32_t nowUs);
+
+bool relayDone(const RelayTrace * trace);
+
+bool relayResult(const RelayTrace * trace, double * ultimateGain, double * ultimatePeriod, double * duty);
+
+PidGains gainsFromRelay(double ultimateGain, double ultimatePeriod, int rule, bool derivative);
+
+void initAutoTune();
+
+bool startAutoTune(AutoTuneLoop loop);
+
+void abortAutoTune(const char * reason);
+
+bool autoTuneActive();
+
+bool autoTuneDrive(int difference, int basePwm, double * pwmLeft, double * pwmRight);
+
+const AutoTuneReport & getAutoTuneReport();
@@ -0,0 +1,230 @@
+#include <Arduino.h>
+#include "BumpLocator.h"
+#include "Tuning.h"
+#include "SensorLog.h"
+#include "MicWakeup.h"
+#include "Sensing.h"
+#include "SpscQueue.h"
+
+#define MIC_COUNT 3
+#define MIC_SAMPLE_US 100          // 10 kHz on every mic, the delays across the robot are up to ~4 samples
+#define MIC_BUFFER 128             // samples per mic in the ring, a power of two
+#define PRE_TRIGGER 8              // samples kept from before the onset
+#define WINDOW 48                  // samples correlated per bump
+#define HOLDOFF_SAMPLES 500        // ignore the ring-down for 50 ms after a bump
+#define MAX_LAG 6                  // samples, more than the sound takes between any two mics
+#define MIC_RADIUS_MM 80.0         // centre of the robot to each mic
+#define BODY_RADIUS_MM 100.0       // bumps land on the body outline, this far from the centre
+#define SOUND_MM_PER_US 0.343
+#define MIN_CORRELATION 0.6        // below this on any pair the delays are not trusted
+#define BEARING_STEP_DEG 2         // resolution of the search along the body outline
+
+//in the order of MIC_FRONT_RIGHT, MIC_REAR, MIC_FRONT_LEFT
+const double micBearings[MIC_COUNT] = {-M_PI/4, M_PI, M_PI/4};
+
+enum CaptureState : uint8_t {
+    CAPTURE_IDLE,
+    CAPTURE_ONSET,   // filling the rest of the window after an onset
+    CAPTURE_READY,   // window held for loop(), the ring is not written
+    CAPTURE_HOLDOFF  // ring-down of the last bump
+};
+
+ROBOT_STATE IntervalTimer micTimer;
+ROBOT_STATE volatile uint16_t micRing[MIC_COUNT][MIC_BUFFER];
+ROBOT_STATE volatile uint32_t micHead; // samples written so far
+ROBOT_STATE volatile CaptureState captureState;
+ROBOT_STATE volatile uint32_t captureEnd; // sample count at which the window or the holdoff ends
+ROBOT_STATE SpscQueue<uint32_t, 2> heldWindows; // sample count each window ends at, as the mic interrupt held it
+
+static FASTRUN void micScanDone(const uint16_t * values){
+    pushMicSamples(values[MIC_FRONT_RIGHT], values[MIC_REAR], values[MIC_FRONT_LEFT]);
+}
+
+/**
+ * timer interrupt, starts one sample of every mic. they arrive in micScanDone
+ */
+FASTRUN void sampleMics(){
+    startMicScan(micScanDone);
+}
+
+FLASHMEM void initBumpLocator(){
+    resetBumpLocator();
+    micTimer.begin(sampleMics, MIC_SAMPLE_US);
+}
+
+/**
+ * forget the baselines and any bump being captured, the next samples start them over
+ */
+void resetBumpLocator(){
+    micHead = 0;
+    captureState = CAPTURE_IDLE;
+    heldWindows.clear();
+    initMicWakeup();
+}
+
+/**
+ * add one sample of every mic to the ring and watch for the onset of a bump. called once all
+ * three conversions are in, or directly when feeding recorded or synthetic samples
+ */
+FASTRUN void pushMicSamples(int frontRight, int rear, int frontLeft){
+    if(captureState == CAPTURE_READY){
+        return;
+    }
+    const int values[MIC_COUNT] = {frontRight, rear, frontLeft};
+    uint32_t index = micHead & (MIC_BUFFER - 1);
+    for(int mic = 0; mic < MIC_COUNT; mic++){
+        micRing[mic][index] = values[mic];
+    }
+    micHead = micHead + 1;
+
+    switch(captureState){
+        case CAPTURE_IDLE:
+            //the baselines take a block of samples to settle, by then the ring holds the pre-trigger
+            if(micWakeSample(values)){
+                captureEnd = micHead - MIC_ONSET_SAMPLES - PRE_TRIGGER + WINDOW;
+                captureState = CAPTURE_ONSET;
+            }
+            break;
+        case CAPTURE_ONSET:
+            if(micHead >= captureEnd){
+                captureState = CAPTURE_READY;
+                heldWindows.push((uint32_t)captureEnd);
+            }
+            break;
+        case CAPTURE_HOLDOFF:
+            if(micHead >= captureEnd){
+                rearmMicWakeup();
+                captureState = CAPTURE_IDLE;
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+/**
+ * samples by which b lags a, to a fraction of a sample, and the normalised correlation at that lag
+ */
+static double delayBetween(const float * a, const float * b, double * correlation){
+    double energyA = 0;
+    double energyB = 0;
+    for(int i = 0; i < WINDOW; i++){
+        energyA += a[i]*a[i];
+        energyB += b[i]*b[i];
+    }
+    double sums[2*MAX_LAG + 1];
+    int best = 0;
+    for(int lag = -MAX_LAG; lag <= MAX_LAG; lag++){
+        double sum = 0;
+        for(int i = max(0, -lag); i < WINDOW && i + lag < WINDOW; i++){
+            sum += a[i]*b[i + lag];
+        }
+        sums[lag + MAX_LAG] = sum;
+        if(sum > sums[best]){
+            best = lag + MAX_LAG;
+        }
+    }
+    *correlation = energyA > 0 && energyB > 0 ? sums[best]/sqrt(energyA*energyB) : 0;
+    //parabola through the peak and its neighbours
+    double offset = 0;
+    if(best > 0 && best < 2*MAX_LAG){
+        double curvature = sums[best - 1] - 2*sums[best] + sums[best + 1];
+        if(curvature < 0){
+            offset = (sums[best - 1] - sums[best + 1])/(2*curvature);
+        }
+    }
+    return best - MAX_LAG + offset;
+}
+
+/**
+ * bearing (radians) of the point on the body outline whose sound reaches the mics with the
+ * measured delays, delays[pair] in samples for the pairs (0,1), (0,2) and (1,2)
+ */
+static double bearingFromDelays(const double delays[3]){
+    static const int pairs[3][2] = {{0, 1}, {0, 2}, {1, 2}};
+    double bestBearing = 0;
+    double bestError = -1;
+    for(int step = 0; step < 360/BEARING_STEP_DEG; step++){
+        double bearing = step*BEARING_STEP_DEG*M_PI/180;
+        double arrival[MIC_COUNT];
+        for(int mic = 0; mic < MIC_COUNT; mic++){
+            double dx = BODY_RADIUS_MM*cos(bearing) - MIC_RADIUS_MM*cos(micBearings[mic]);
+            double dy = BODY_RADIUS_MM*sin(bearing) - MIC_RADIUS_MM*sin(micBearings[mic]);
+            arrival[mic] = sqrt(dx*dx + dy*dy)/SOUND_MM_PER_US/MIC_SAMPLE_US;
+        }
+        double error = 0;
+        for(int pair = 0; pair < 3; pair++){
+            double residual = arrival[pairs[pair][1]] - arrival[pairs[pair][0]] - delays[pair];
+            error += residual*residual;
+        }
+        if(bestError < 0 || error < bestError){
+            bestError = error;
+            bestBearing = bearing;
+        }
+    }
+    return bestBearing;
+}
+
+/**
+ * locate the bump held in the ring up to windowEnd and release the ring for the next one
+ */
+static void findBump(uint32_t windowEnd, BumpEvent * event){
+    float samples[MIC_COUNT][WINDOW];
+    uint32_t start = windowEnd - WINDOW;
+    double peak[MIC_COUNT] = {0, 0, 0};
+    for(int mic = 0; mic < MIC_COUNT; mic++){
+        for(int i = 0; i < WINDOW; i++){
+            samples[mic][i] = micRing[mic][(start + i) & (MIC_BUFFER - 1)] - getMicBaseline(mic);
+            peak[mic] = max(peak[mic], (double)samples[mic][i]);
+        }
+    }
+    captureEnd = micHead + HOLDOFF_SAMPLES;
+    captureState = CAPTURE_HOLDOFF;
+
+    double delays[3];
+    double correlation[3];
+    delays[0] = delayBetween(samples[0], samples[1], &correlation[0]);
+    delays[1] = delayBetween(samples[0], samples[2], &correlation[1]);
+    delays[2] = delayBetween(samples[1], samples[2], &correlation[2]);
+    double confidence = min(correlation[0], min(correlation[1], correlation[2]));
+
+    double bearing;
+    if(confidence >= MIN_CORRELATION){
+        bearing = bearingFromDelays(delays);
+    }
+    else{
+        //the loudest mic is nearest the bump
+        double x = 0;
+        double y = 0;
+        for(int mic = 0; mic < MIC_COUNT; mic++){
+            x += peak[mic]*cos(micBearings[mic]);
+            y += peak[mic]*sin(micBearings[mic]);
+        }
+        bearing = atan2(y, x);
+        confidence = 0;
+    }
+    int degrees = (int)lround(bearing*180/M_PI);
+    event->bearing = degrees > 180 ? degrees - 360 : degrees;
+    event->strength = (int)max(peak[0], max(peak[1], peak[2]));
+    event->confidence = (int)(confidence*100);
+}
+
+/**
+ * true with the bump filled in when one was heard since the last call
+ */
+bool locateBump(BumpEvent * event){
+    const SensorLogRecord * replayed = replaySensorRecord(LOG_BUMP);
+    if(replayed){
+        event->bearing = replayed->values[0];
+        event->strength = replayed->values[1];
+        event->confidence = replayed->values[2];
+        return event->strength > 0;
+    }
+    uint32_t windowEnd;
+    bool found = heldWindows.pop(&windowEnd);
+    if(found){
+        findBump(windowEnd, event);
+    }
+    logSensorRecord(LOG_BUMP, found ? event->bearing : 0, found ? event->strength : 0, found ? event->confidence : 0);
+    return found;
+}
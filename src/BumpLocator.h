@@ -0,0 +1,31 @@
+/**
+ * Header file for locating bumps with the three microphones
+ *
+ * the mics are sampled together at MIC_SAMPLE_US from a timer interrupt into a ring buffer (see
+ * AdcSampler.h). when MicWakeup.h decides a bump has started, the samples around the onset are held
+ * and the interrupt queues the window for loop() (see SpscQueue.h). there the channels are
+ * cross-correlated pairwise. the delays between them give the direction the sound came from: the
+ * point on the body outline whose distances to the mics best explain them, the robot being too
+ * small for the sound to arrive as a plane wave. when the channels do not correlate well enough to
+ * trust the delays, the direction is taken from how loud each mic heard the bump instead
+ */
+#pragma once
+
+#include <stdint.h>
+
+struct BumpEvent {
+    int bearing;    // degrees in the robot frame, 0 = straight ahead, counter-clockwise positive
+    int strength;   // peak ADC counts above the baseline on the loudest mic
+    int confidence; // percent, lowest normalised correlation of the mic pairs, 0 when located from loudness
+};
+
+/**
+ * function definitions
+ */
+void initBumpLocator();
+
+void resetBumpLocator();
+
+void pushMicSamples(int frontRight, int rear, int frontLeft);
+
+bool locateBump(BumpEvent * event);
@@ -1,48 +1,98 @@
 #include <Arduino.h>
 #include "Driving.h"
 #include "Sensing.h"
-
-//Enable Pin nD2 not nessecarry to connect if you use a jumper
-#define MotorA_DIR_PIN 10 // Direction Pin
-#define MotorA_PWM_PIN 11 // PWM Pin
-#define MotorB_DIR_PIN 9 // Direction Pin
-#define MotorB_PWM_PIN 8 // PWM Pin make sure the PWM pins actually support that signal
-
-#define LINE_READING_TARGET 1000
-#define P_WEIGHT 0.3
-
-int BASE_PWM = 120;
-int ROTATE_PWM = 90;
-bool movementEnabled;
-int currentTickTarget;
-
-double micVal0MovingAverage;
-double micVal1MovingAverage;
-double micVal2MovingAverage;
-
-double axleWidth = 160;
-double wheelDiameter = 80;
-double wheelCircumference = M_PI_2 * (wheelDiameter/2);
-double vehicleCircumference = M_PI_2 * (axleWidth/2);
-double wheelRotationsPerRevolution = vehicleCircumference/wheelCircumference;
-
-#define TICKS_PER_ENCODER_REV 48
-#define GEAR_RATIO 74.85//this should actually be 74.83 but it works as is so I don't want to fuck with it
-
+#include "Tuning.h"
+#include "TrackMap.h"
+#include "SpeedGovernor.h"
+#include "RangeTracker.h"
+#include "HeadingEstimator.h"
+#include "MotorDriver.h"
+#include "AutoTune.h"
+#include "MotorModel.h"
+#include "TractionMonitor.h"
+#include "StraightDrive.h"
+#include "Odometry.h"
+
+#define BUMP_FULL_STRENGTH 200 // mic counts above the baseline that get the full BUMP_NUDGE_PWM
+#define BUMP_NUDGE_MS 40       // a nudge fades out over this long
+#define CALIBRATION_TICKS 3600 // full turn of the SENSING scan, 10 ticks per degree
+#define SETTLE_POLL_MS 10      // a turn has stopped when the encoders do not count for this long
+#define SETTLE_MAX_MS 500      // and has stopped anyway after this long
+#define COAST_S 0.03           // a turn braked at some heading rate goes on about as far as it would in this long
+#define STEER_GAP_US 50000     // line readings further apart than this start the integral and rate of the steering over
+#define STEER_RATE_FILTER_S 0.01 // time constant of the rate the line moves at, which is noisy from one reading to the next
+#define STEER_INTEGRAL_PWM 60  // most steering the integral may add
+
+ROBOT_STATE bool movementEnabled;
+ROBOT_STATE int currentTickTarget;
+
+//turning on the spot by the estimated heading, see HEADING_ESTIMATOR
+ROBOT_STATE int rotationDirection;      // 1 clockwise, -1 anticlockwise
+ROBOT_STATE double rotationStart;       // getHeading() the turn counts from
+ROBOT_STATE double rotationTarget;      // radians to turn
+
+//steering nudge after a bump, fading out over BUMP_NUDGE_MS
+ROBOT_STATE bool nudgeActive;
+ROBOT_STATE double nudgeForward; // PWM added to both wheels
+ROBOT_STATE double nudgeTurn;    // PWM added to the left wheel and taken from the right
+ROBOT_STATE uint32_t nudgeStart;
+
+//integral and rate of the line position for I_WEIGHT and D_WEIGHT
+ROBOT_STATE bool steerPrimed;
+ROBOT_STATE uint32_t lastSteerUs;
+ROBOT_STATE int lastDifference;
+ROBOT_STATE double steerIntegral; // reading units times seconds
+ROBOT_STATE double steerRate;     // reading units per second
 
 /**
  * setup vars and objects related to driving functions
  */
-void initDriving(){
+FLASHMEM void initDriving(){
     movementEnabled = false;
-    pinMode(MotorA_PWM_PIN, OUTPUT);
-    pinMode(MotorB_PWM_PIN, OUTPUT);
-    pinMode(MotorA_DIR_PIN, OUTPUT);
-    pinMode(MotorB_DIR_PIN, OUTPUT);
+    initMotorDriver();
+    initMotorModel();
+    initTractionMonitor();
     currentTickTarget = 0;
-    micVal0MovingAverage = 200;
-    micVal1MovingAverage = 200;
-    micVal2MovingAverage = 200;
+    rotationDirection = 1;
+    nudgeActive = false;
+    steerPrimed = false;
+    initAutoTune();
+    initHeadingEstimator();
+    initTrackMap();
+    initSpeedGovernor();
+    initRangeTracker();
+}
+
+/**
+ * normalize the range of an input for a PWM controlled pin. any value beyond the bounds of 0-255 will be pulled in to the end of the range
+ */
+double rangePWM(double input){
+    if(input > 255){
+        return 255;
+    }
+    else if(input < 0){
+        return 0;
+    }
+    else{
+        return input;
+    }
+}
+
+/**
+ * brake and wait for the robot to stop turning, so that the estimator counts the ticks it coasts
+ * the way it was turning. the encoders only count, they cannot tell which way the wheels go
+ */
+static void settleRotation(){
+    brakeMotors();
+    uint32_t start = millis();
+    int left = -1;
+    int right = -1;
+    while((getEncoderData(LEFT) != left || getEncoderData(RIGHT) != right) && millis() - start < SETTLE_MAX_MS){
+        left = getEncoderData(LEFT);
+        right = getEncoderData(RIGHT);
+        updateHeadingOdometry(left, right, rotationDirection, tractionLost(), micros());
+        delay(SETTLE_POLL_MS);
+    }
 }
 
 /**
@@ -51,26 +101,20 @@ void initDriving(){
  * continueRotating() must be called continuously after initating a rotate to ensure it completes
  */
 void rotateByDegrees(int degreesToRotate){
+    if(HEADING_ESTIMATOR){
+        settleRotation();
+    }
     resetTickCounts();
-    int ticksToRotate = abs(((TICKS_PER_ENCODER_REV*GEAR_RATIO)/360)*degreesToRotate * wheelRotationsPerRevolution/2);
+    //on the spot each wheel runs along a circle of the axle width
+    int ticksToRotate = abs(degreesToRotate*M_PI/180*AXLE_WIDTH_MM/2/MM_PER_TICK);
 
     currentTickTarget = ticksToRotate;
+    rotationDirection = degreesToRotate < 0 ? -1 : 1;
+    rotationStart = getHeading();
+    rotationTarget = abs(degreesToRotate)*M_PI/180;
 
-    int dirMotorA, dirMotorB;
-    if(degreesToRotate<0){
-        dirMotorA = HIGH;
-        dirMotorB = LOW;
-    }
-    else{
-        dirMotorA = LOW;
-        dirMotorB = HIGH;
-    }
-
-    digitalWrite(MotorA_DIR_PIN, dirMotorA);
-    digitalWrite(MotorB_DIR_PIN, dirMotorB);
-
-    analogWrite(MotorA_PWM_PIN, ROTATE_PWM);
-    analogWrite(MotorB_PWM_PIN, ROTATE_PWM);
+    //clockwise drives the left wheel forwards and the right one backwards
+    setMotors(rotationDirection*ROTATE_PWM, -rotationDirection*ROTATE_PWM);
 }
 
 /**
@@ -79,13 +123,12 @@ void rotateByDegrees(int degreesToRotate){
  * continueRotating() must be called continuously after initating a rotate to ensure it completes
  */
 void rotateForCalibration(){
-    currentTickTarget = 3600;
-
-    digitalWrite(MotorA_DIR_PIN, LOW);
-    digitalWrite(MotorB_DIR_PIN, HIGH);
+    currentTickTarget = CALIBRATION_TICKS;
+    rotationDirection = 1;
+    rotationStart = 0;//a full turn from where the scan started, which reset the heading, also when picked back up
+    rotationTarget = 2*M_PI;
 
-    analogWrite(MotorA_PWM_PIN, ROTATE_PWM);
-    analogWrite(MotorB_PWM_PIN, ROTATE_PWM);
+    setMotors(ROTATE_PWM, -ROTATE_PWM);
 }
 
 /**
@@ -93,25 +136,30 @@ void rotateForCalibration(){
  */
 bool continueRotating(int leftEncoderData, int rightEncoderData){
     int tickDifference = leftEncoderData - rightEncoderData;
-
-    analogWrite(MotorA_PWM_PIN, ROTATE_PWM+tickDifference);
-    analogWrite(MotorB_PWM_PIN, ROTATE_PWM-tickDifference);
-
-    if(leftEncoderData>=currentTickTarget){
-        analogWrite(MotorB_PWM_PIN, 0);
-        digitalWrite(MotorB_DIR_PIN, HIGH);
+    double leftPwm = rotationDirection*rangePWM(ROTATE_PWM-tickDifference);
+    double rightPwm = -rotationDirection*rangePWM(ROTATE_PWM+tickDifference);
+
+    if(HEADING_ESTIMATOR){
+        //done once the estimated heading got there, the wheels turn further than the ticks say
+        updateHeadingOdometry(leftEncoderData, rightEncoderData, rotationDirection, tractionLost(), micros());
+        double target = currentTickTarget == CALIBRATION_TICKS ? getFullTurnHeading() : rotationTarget - rotationDirection*getHeadingRate()*COAST_S;
+        if(rotationDirection*(getHeading() - rotationStart) < target){
+            setMotors(leftPwm, rightPwm);
+            return false;
+        }
+        brakeMotors();
+        currentTickTarget = 0;
+        return true;
     }
 
-    if(rightEncoderData >= currentTickTarget){
-        analogWrite(MotorA_PWM_PIN, 0);
-        digitalWrite(MotorA_DIR_PIN, HIGH);
-
-        //right counter has completed, check if left has also completed to exit
-        if(leftEncoderData >=currentTickTarget){
-            currentTickTarget = 0;
-            return true;//rotation complete
-        }
+    bool leftComplete = leftEncoderData >= currentTickTarget;
+    bool rightComplete = rightEncoderData >= currentTickTarget;
+    if(leftComplete && rightComplete){
+        brakeMotors();
+        currentTickTarget = 0;
+        return true;//rotation complete
     }
+    setMotors(leftComplete ? 0 : leftPwm, rightComplete ? 0 : rightPwm);
 
     return false;//rotation has not completed
 }
@@ -132,85 +180,114 @@ void rotateToAngle(int degreesTarget){
 
 
 /**
- * function to drive a specified distance in millimeters at the current heading.
- * no other logic will be processed until function completes
+ * function to drive a specified distance in millimeters at the current heading, both wheels kept
+ * level and each stopped at the distance (StraightDrive.h). no other logic will be processed until
+ * function completes
  */
 void driveUnchecked(int distance){
     resetTickCounts();
-    //set forward or reverse dependent on sign of ditance parameter
-    if(distance >0){
-        digitalWrite(MotorA_DIR_PIN, HIGH);
-        digitalWrite(MotorB_DIR_PIN, HIGH);
-    }
-    else{
-        digitalWrite(MotorA_DIR_PIN, LOW);
-        digitalWrite(MotorB_DIR_PIN, LOW);
+    StraightDrive drive;
+    double cruise = min(motorRate(LEFT, ROTATE_PWM), motorRate(RIGHT, ROTATE_PWM));
+    startStraightDrive(&drive, distance, 0, cruise, 0, true);
+    Serial.printf("entered an unchecked drive sequence of %i mm\n", distance);
+
+    double direction = distance < 0 ? -1 : 1;
+    bool finished = false;
+    while(!finished){
+        double done[2] = {direction*getEncoderData(LEFT)*MM_PER_TICK, direction*getEncoderData(RIGHT)*MM_PER_TICK};
+        double rates[2] = {getWheelTickRate(LEFT), getWheelTickRate(RIGHT)};
+        double commands[2];
+        finished = stepStraightDrive(&drive, done, rates, micros(), commands);
+        setMotors(commands[0], commands[1]);
+        updateTraction();
+        delay(2);//wait until drive finished
     }
-    
-    analogWrite(MotorA_PWM_PIN, ROTATE_PWM);
-    analogWrite(MotorB_PWM_PIN, ROTATE_PWM);
-    
-    int ticksToDrive = abs((TICKS_PER_ENCODER_REV*GEAR_RATIO)* distance/wheelCircumference);
-    Serial.printf("entered an unchecked drive sequence of %i mm with %i ticks calculated", distance, ticksToDrive);
 
-    while(getEncoderData(LEFT) < ticksToDrive){
-        delay(5);//wait until  drive finished
-    }
+    brakeMotors();
+}
 
-    analogWrite(MotorA_PWM_PIN, 0);
-    analogWrite(MotorB_PWM_PIN, 0);
+/**
+ * set both wheels directly, a negative value drives that wheel backwards
+ * function ignores movementEnabled
+ */
+void driveWheels(int pwmLeft, int pwmRight){
+    setMotors(pwmLeft, pwmRight);
 }
 
 /**
- * normalize the range of an input for a PWM controlled pin. any value beyond the bounds of 0-255 will be pulled in to the end of the range
+ * steering from the integral and the rate of the line position, by I_WEIGHT and D_WEIGHT
  */
-int rangePWM(int input){
-    if(input > 255){
-        return 255;
-    }
-    else if(input < 0){
-        return 0;
+static double steerIntegralAndRate(int difference){
+    uint32_t now = micros();
+    uint32_t elapsed = now - lastSteerUs;
+    if(!steerPrimed || elapsed > STEER_GAP_US){
+        steerPrimed = true;
+        steerIntegral = 0;
+        steerRate = 0;
     }
-    else{
-        return input;
+    else if(elapsed > 0){
+        double dt = elapsed*1e-6;
+        steerIntegral += difference*dt;
+        if(I_WEIGHT > 0){
+            double most = STEER_INTEGRAL_PWM/I_WEIGHT;
+            steerIntegral = max(-most, min(most, steerIntegral));
+        }
+        steerRate += ((difference - lastDifference)/dt - steerRate)*min(1.0, dt/STEER_RATE_FILTER_S);
     }
+    lastSteerUs = now;
+    lastDifference = difference;
+    return steerIntegral*I_WEIGHT + steerRate*D_WEIGHT;
 }
 
 /**
- * function to be called continuously and fed a value from the QTR sensor.
+ * function to be called continuously and fed a value from the QTR sensor, and the bump the mics
+ * located this iteration if any (see BumpLocator.h).
  * logic to update PWM and driver signals contained in this function
  * 
  */
-void setDrivingVars(int lineReading, int micVal0, int micVal1, int micVal2){
+FASTRUN void setDrivingVars(int lineReading, const BumpEvent * bump){
     int difference = LINE_READING_TARGET - lineReading;
+    int basePwm = BASE_PWM;
+    int leftEncoderData = getEncoderData(LEFT);
+    int rightEncoderData = getEncoderData(RIGHT);
+    if(LAP_LEARNING){
+        basePwm = updateTrackMap(lineReading, leftEncoderData, rightEncoderData);
+    }
+    if(SPEED_GOVERNOR){//with both, the learned schedule plans ahead and the governor catches what it missed
+        int governedPwm = updateSpeedGovernor(lineReading, leftEncoderData, rightEncoderData);
+        basePwm = LAP_LEARNING ? min(basePwm, governedPwm) : governedPwm;
+    }
+    basePwm = brakeForObstacle(basePwm, leftEncoderData, rightEncoderData);//slow down ahead of a tracked obstacle
 
-    int pwm_left = BASE_PWM - difference*P_WEIGHT;//when difference is positive this indicates the left side of the vehicle is over the line and need to steer left to correct.
-    int pwm_right = BASE_PWM + difference*P_WEIGHT;
-
-    pwm_left = 0;
-    pwm_right = 0;
-
-    updateMovingAverages(micVal0, micVal1, micVal2);
-    if(micVal0 > (int)micVal0MovingAverage+30){
-        pwm_left -= 150;
-        pwm_right += 150;
-        Serial.println("nudge detected on front right, steering to left");
+    double steering = difference*P_WEIGHT;
+    if(I_WEIGHT != 0 || D_WEIGHT != 0){
+        steering += steerIntegralAndRate(difference);
     }
-    else if(micVal1 > (int)micVal1MovingAverage+30){//detected on rear, bump both speeds up
-        pwm_left += 200;
-        pwm_right += 200;
-        Serial.println("nudge detected on rear, increasing pwm of both motors");
+    double pwm_left = basePwm - steering;//when difference is positive this indicates the left side of the vehicle is over the line and need to steer left to correct.
+    double pwm_right = basePwm + steering;
+    autoTuneDrive(difference, basePwm, &pwm_left, &pwm_right);//a relay experiment steers instead, see AutoTune.h
+
+    if(bump){
+        //give way to the bump: one from behind speeds the robot up, one from the side steers away from it
+        double nudge = BUMP_NUDGE_PWM*min(1.0, (double)bump->strength/BUMP_FULL_STRENGTH);
+        double bearing = bump->bearing*M_PI/180;
+        nudgeForward = -cos(bearing)*nudge;
+        nudgeTurn = sin(bearing)*nudge;
+        nudgeStart = millis();
+        nudgeActive = true;
+        Serial.printf("bump detected from %i degrees, strength %i, nudging\n", bump->bearing, bump->strength);
     }
-    else if(micVal2 > (int)micVal2MovingAverage+30){//detected front left, steer more to right
-        pwm_left += 150;
-        pwm_right -= 150;
-        Serial.println("nudge detected on front left, steering to right");
+    if(nudgeActive){
+        uint32_t since = millis() - nudgeStart;
+        double fade = since < BUMP_NUDGE_MS ? 1 - (double)since/BUMP_NUDGE_MS : 0;
+        nudgeActive = fade > 0;
+        pwm_left += (nudgeForward + nudgeTurn)*fade;
+        pwm_right += (nudgeForward - nudgeTurn)*fade;
     }
 
     //write values
     if(movementEnabled){
-        analogWrite(MotorA_PWM_PIN, rangePWM(pwm_right));
-        analogWrite(MotorB_PWM_PIN, rangePWM(pwm_left));
+        setMotors(rangePWM(pwm_left), rangePWM(pwm_right));
     }
 }
 
@@ -219,29 +296,14 @@ void setDrivingVars(int lineReading, int micVal0, int micVal1, int micVal2){
  */
 void enableMovement(){
     movementEnabled = true;
-    digitalWrite(MotorA_DIR_PIN, HIGH);
-    digitalWrite(MotorB_DIR_PIN, HIGH);
+    steerPrimed = false;
 }
 
 /**
  * sets flag to enable movement low. also sets PWM of both motors to zero
  */
 void disableMovement(){
+    abortAutoTune("the robot stopped following the line");
     movementEnabled = false;
-    digitalWrite(MotorA_PWM_PIN, LOW);
-    digitalWrite(MotorB_PWM_PIN, LOW);
+    brakeMotors();
 }
-
-/**
- * function to update the moving averages for each mic where the weight of the current value is 1/1000 per iteration logarithmically
- */
-void updateMovingAverages(int micVal0, int micVal1, int micVal2){
-    double tempMicval0 = micVal0MovingAverage*999 + micVal0;
-    micVal0MovingAverage = tempMicval0 / 1000;
-
-    double tempMicval1 = micVal1MovingAverage*999 + micVal1;
-    micVal1MovingAverage = tempMicval1 / 1000;
-
-    double tempMicval2 = micVal2MovingAverage*999 + micVal2;
-    micVal2MovingAverage = tempMicval2 / 1000;
-}
\ No newline at end of file
@@ -1,6 +1,7 @@
 /**
  * Header file for Driving related functions
  */
+#include "BumpLocator.h"
 
 /**
  * function definitions
@@ -15,12 +16,12 @@ void rotateForCalibration();
 
 void driveUnchecked(int distance);
 
-void setDrivingVars(int lineReading, int micVal0, int micVal1, int micVal2);
+void driveWheels(int pwmLeft, int pwmRight);
+
+void setDrivingVars(int lineReading, const BumpEvent * bump);
 
 void enableMovement();
 
 void disableMovement();
 
 bool continueRotating(int leftEncoderData, int RightEncoderData);
-
-void updateMovingAverages(int micVal0, int micVal1, int micVal2);
\ No newline at end of file
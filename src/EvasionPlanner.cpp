@@ -0,0 +1,604 @@
+#include <Arduino.h>
+#include "EvasionPlanner.h"
+#include "Driving.h"
+#include "Tuning.h"
+#include "Odometry.h"
+#include "LineFollowing.h"
+#include "Sensing.h"
+#include "MotorModel.h"
+#include "StraightDrive.h"
+
+#define ULTRASONIC_OFFSET_MM 80.0   // axle to ultrasonic transducer
+#define ULTRASONIC_HALF_CONE 0.26   // radians, beam half-angle of the HC-SR04
+#define RANGE_HISTORY 8             // recent ultrasonic readings kept for picking a side
+#define ECHO_RANGE 0.6              // metres, readings closer than this count as echoes off the obstacle
+#define LINE_AVERAGE_RATE 0.02      // weight of the newest line position in its running average
+#define WAIT_MS 400                 // stand still this long before detouring
+#define GIVE_UP_MS 15000            // longest wait for an obstacle no detour can get round, then the robot stops for good
+#define CLEAR_READINGS 2            // consecutive clear readings that count as the obstacle having gone
+#define GUARD_RANGE 0.15            // metres, an echo this close while driving out puts the obstacle on the detour's side
+#define GUARD_READINGS 2            // consecutive echoes that close it takes, a stray echo is not enough
+#define CLEAR_MARGIN 0.1            // metres beyond BLOCKAGE_TOLERANCE a reading has to be to count as clear
+#define TURN_RADIUS_MM 200.0        // radius of every arc in the detour, keeps the inner wheel well out of the motor deadband
+#define OUT_ANGLE 1.05              // radians, steepest heading away from the line
+#define RETURN_ANGLE 0.5            // radians, steepest heading back towards it, shallow so the line follower can take over
+#define MIN_ANGLE 0.17              // radians, shallowest heading the return leg is planned with
+#define ANGLE_STEP 0.087            // radians, step when searching for a return angle that fits
+#define PASS_MM 250.0               // drive this far beyond the obstacle's near face before returning
+#define PASSED_MM 150.0             // beyond this the line may be taken back even before the return leg
+#define SEARCH_MM 600.0             // keep looking for the line this far beyond the planned rejoin point, turning on towards where it ran
+#define CROSS_LIMIT_MM 100.0        // the middle sensor has to find a line an end sensor saw within this far
+#define CAPTURE_TURN 3.14           // radians, longest turn on the spot to bring the line back under the bar
+#define SYNC_GAIN 3.0               // PWM per mm a wheel is behind the other on the current move
+#define MAX_MOVES 4
+#define STRAIGHT_CURVATURE 0.001    // 1/mm, a line curving more than this at the stop is not detoured from
+#define BEND_RATE 0.1               // weight of the newest reading in a bend in bendCurvature
+#define OBSTACLE_RADIUS_MM 60.0     // size of the obstacle the detour is checked against
+#define BODY_RADIUS_MM 100.0        // axle centre to the furthest point of the robot
+#define CLEARANCE_STEP_MM 10.0      // the planned detour is checked for clearance at points this far apart
+
+enum EvasionPhase {
+    PHASE_IDLE,
+    PHASE_WAITING,
+    PHASE_OUT,
+    PHASE_BACK,
+    PHASE_PASS,
+    PHASE_RETURN,
+    PHASE_SEARCH,
+    PHASE_CAPTURE,
+    PHASE_STOPPED
+};
+
+/**
+ * one leg of the detour: the axle centre travels length mm along an arc of the given curvature
+ * (1/mm, positive turns left). 0 is a straight, which holds the heading planned for it
+ */
+struct EvasionMove {
+    double curvature;
+    double length;
+    double heading; // radians in the evasion frame the move ends on
+};
+
+struct RangeSample {
+    double distance;
+    double heading;   // radians, encoder differential
+    double travelled; // mm, encoder mean
+};
+
+ROBOT_STATE RangeSample rangeHistory[RANGE_HISTORY];
+ROBOT_STATE int rangeCount;
+ROBOT_STATE int rangeNext;
+ROBOT_STATE int historyLeftTicks;
+ROBOT_STATE int historyRightTicks;
+ROBOT_STATE double lineOffsetAverage; // positive with the line left of centre
+ROBOT_STATE double bendCurvature; // 1/mm, running average through the bends followed so far, 0 before the first
+
+ROBOT_STATE EvasionPhase evasionPhase;
+ROBOT_STATE int evasionSide; // 1 = detour on the left, -1 = right
+ROBOT_STATE bool detourAllowed; // false to wait for the obstacle to go, until giveUpAt
+ROBOT_STATE double obstacleX; // mm ahead of the start pose to the near face of the obstacle
+ROBOT_STATE uint32_t waitUntil;
+ROBOT_STATE uint32_t giveUpAt;
+ROBOT_STATE int clearReadings;
+ROBOT_STATE int closeReadings;
+
+//pose in the frame of the start of the evasion, x along the line and y to the left
+ROBOT_STATE double evasionX;
+ROBOT_STATE double evasionY;
+ROBOT_STATE double evasionHeading;
+ROBOT_STATE int evasionLeftTicks;
+ROBOT_STATE int evasionRightTicks;
+
+ROBOT_STATE EvasionMove moves[MAX_MOVES];
+ROBOT_STATE int moveCount;
+ROBOT_STATE int moveIndex;
+ROBOT_STATE double leftDone;   // mm each wheel has covered on the current move
+ROBOT_STATE double rightDone;
+ROBOT_STATE int leftCommand;   // last PWM sent, its sign tells which way the encoder counted
+ROBOT_STATE int rightCommand;
+ROBOT_STATE StraightDrive evasionStraight; // of the current move, if it is a straight
+ROBOT_STATE bool straightStarted;
+ROBOT_STATE double crossedAt; // mm into the capture the middle sensor crossed the line, negative before
+ROBOT_STATE bool captureTurning;
+ROBOT_STATE int captureTurn; // 1 to turn left onto the line, -1 right: the end of the bar it was last seen under
+ROBOT_STATE double captureHeading; // evasionHeading the turn onto the line started from
+
+FLASHMEM void initEvasionPlanner(){
+    rangeCount = 0;
+    rangeNext = 0;
+    historyLeftTicks = 0;
+    historyRightTicks = 0;
+    lineOffsetAverage = 0;
+    bendCurvature = 0;
+    evasionPhase = PHASE_IDLE;
+}
+
+/**
+ * called every NORMAL iteration with the line position, to know which way the line was bending
+ */
+void noteLinePosition(int lineReading){
+    lineOffsetAverage += ((LINE_CENTRE - lineReading)*LINE_SENSOR_SPACING_MM/1000 - lineOffsetAverage)*LINE_AVERAGE_RATE;
+}
+
+/**
+ * curvature (1/mm, positive to the left) of the line the robot followed over the range history:
+ * what the wheels turned, plus the pure pursuit curvature towards the line
+ */
+static double lineCurvature(){
+    double pursuit = 2*lineOffsetAverage/(LINE_SENSOR_OFFSET_MM*LINE_SENSOR_OFFSET_MM);
+    if(rangeCount < 2){
+        return pursuit;
+    }
+    int newest = (rangeNext + RANGE_HISTORY - 1) % RANGE_HISTORY;
+    int oldest = rangeCount < RANGE_HISTORY ? 0 : rangeNext;
+    double travelled = rangeHistory[newest].travelled - rangeHistory[oldest].travelled;
+    double turned = rangeHistory[newest].heading - rangeHistory[oldest].heading;
+    return pursuit + (travelled > 0 ? turned/travelled : 0);
+}
+
+/**
+ * called with every ultrasonic reading taken while following the line. the heading is the
+ * encoder differential, which is only meaningful while both wheels drive forward
+ */
+void noteRangeReading(double distance, int leftEncoderData, int rightEncoderData){
+    if(leftEncoderData < historyLeftTicks || rightEncoderData < historyRightTicks){
+        rangeCount = 0;//the counts were reset, the old headings are in another frame
+    }
+    historyLeftTicks = leftEncoderData;
+    historyRightTicks = rightEncoderData;
+    rangeHistory[rangeNext].distance = distance;
+    rangeHistory[rangeNext].heading = (rightEncoderData - leftEncoderData)*MM_PER_TICK/AXLE_WIDTH_MM;
+    rangeHistory[rangeNext].travelled = (rightEncoderData + leftEncoderData)*MM_PER_TICK/2;
+    rangeNext = (rangeNext + 1) % RANGE_HISTORY;
+    if(rangeCount < RANGE_HISTORY){
+        rangeCount++;
+    }
+    double curvature = lineCurvature();
+    if(rangeCount == RANGE_HISTORY && fabs(curvature) >= STRAIGHT_CURVATURE){
+        bendCurvature += (curvature - bendCurvature)*BEND_RATE;
+    }
+}
+
+/**
+ * 1 to detour left, -1 for right. echoes first seen while the robot faced further left than it
+ * does now put the obstacle on the left; a line bending left makes the inside of the bend the
+ * shorter way round. once the robot has been through a bend, always the inside of one like it
+ */
+static int chooseSide(){
+    //a bend like those followed so far can start unseen just past the obstacle. only on its inside
+    //does the line come back to meet the detour, on the outside it runs away from it
+    if(bendCurvature != 0){
+        return bendCurvature > 0 ? 1 : -1;
+    }
+    double heading = (historyRightTicks - historyLeftTicks)*MM_PER_TICK/AXLE_WIDTH_MM;
+    double obstacleBearing = 0;
+    int echoes = 0;
+    for(int i = 0; i < rangeCount; i++){
+        if(rangeHistory[i].distance < ECHO_RANGE){
+            obstacleBearing += rangeHistory[i].heading - heading;
+            echoes++;
+        }
+    }
+    if(echoes > 0){
+        obstacleBearing /= echoes;
+    }
+    double score = lineOffsetAverage/LINE_SENSOR_SPACING_MM - obstacleBearing/ULTRASONIC_HALF_CONE;
+    return score >= 0 ? 1 : -1;
+}
+
+/**
+ * wheel distances of a move, negative drives the wheel backwards
+ */
+static void moveTargets(const EvasionMove & move, double * left, double * right){
+    *left = move.length*(1 - move.curvature*AXLE_WIDTH_MM/2);
+    *right = move.length*(1 + move.curvature*AXLE_WIDTH_MM/2);
+}
+
+static void addArc(double fromHeading, double toHeading){
+    double turn = toHeading - fromHeading;
+    if(fabs(turn) > 1e-3 && moveCount < MAX_MOVES){
+        moves[moveCount++] = {turn > 0 ? 1/TURN_RADIUS_MM : -1/TURN_RADIUS_MM, fabs(turn)*TURN_RADIUS_MM, toHeading};
+    }
+}
+
+static void addStraight(double length, double heading){
+    if(length > 1 && moveCount < MAX_MOVES){
+        moves[moveCount++] = {0, length, heading};
+    }
+}
+
+static void beginMoves(EvasionPhase phase){
+    evasionPhase = phase;
+    moveIndex = 0;
+    leftDone = 0;
+    rightDone = 0;
+    straightStarted = false;
+}
+
+/**
+ * lateral displacement of an arc of TURN_RADIUS_MM between two headings
+ */
+static double arcLateral(double fromHeading, double toHeading){
+    double turn = toHeading - fromHeading;
+    if(fabs(turn) < 1e-6){
+        return 0;
+    }
+    double curvature = turn > 0 ? 1/TURN_RADIUS_MM : -1/TURN_RADIUS_MM;
+    return (cos(fromHeading) - cos(toHeading))/curvature;
+}
+
+/**
+ * leave a pose for a lateral offset of targetY: an arc out to a crossing angle and a
+ * straight, and with level an arc back to the heading along the line. without, the straight ends
+ * at targetY still on the crossing angle. the crossing angle is the steepest up to maxAngle whose
+ * straight comes out non-negative
+ */
+static void planLateralMove(double fromY, double fromHeading, double targetY, double maxAngle, bool level){
+    moveCount = 0;
+    double offset = targetY - fromY;
+    int direction = offset >= 0 ? 1 : -1;
+    double angle = maxAngle;
+    double straight = 0;
+    for(; angle >= MIN_ANGLE; angle -= ANGLE_STEP){
+        double arcs = arcLateral(fromHeading, direction*angle) + (level ? arcLateral(direction*angle, 0) : 0);
+        straight = (offset - arcs)/(direction*sin(angle));
+        if(straight >= 0){
+            break;
+        }
+    }
+    if(angle < MIN_ANGLE){
+        angle = MIN_ANGLE;
+        straight = 0;
+    }
+    addArc(fromHeading, direction*angle);
+    addStraight(straight, direction*angle);
+    if(level){
+        addArc(direction*angle, 0);
+    }
+}
+
+/**
+ * walk the planned moves from a pose, leaving it where they end, and return the closest the axle
+ * centre comes to (pointX, pointY) on the way
+ */
+static double movesClearance(double * x, double * y, double * heading, double pointX, double pointY){
+    double closest = hypot(pointX - *x, pointY - *y);
+    for(int i = 0; i < moveCount; i++){
+        int steps = max(1, (int)ceil(moves[i].length/CLEARANCE_STEP_MM));
+        double step = moves[i].length/steps;
+        for(int k = 0; k < steps; k++){
+            double turn = moves[i].curvature*step;
+            *x += step*cos(*heading + turn/2);
+            *y += step*sin(*heading + turn/2);
+            *heading += turn;
+            closest = min(closest, hypot(pointX - *x, pointY - *y));
+        }
+    }
+    return closest;
+}
+
+/**
+ * closest the detour on side, out, past and back as continueEvasion() plans it from the stop,
+ * brings the axle centre to the centre of an obstacle standing on the line, the line taken to run
+ * on from the stop with curvature. leaves no moves planned
+ */
+static double detourClearance(int side, double curvature){
+    double along = obstacleX + OBSTACLE_RADIUS_MM;
+    double centreX = along;
+    double centreY = 0;
+    if(fabs(curvature) > 1e-9){
+        centreX = sin(curvature*along)/curvature;
+        centreY = (1 - cos(curvature*along))/curvature;
+    }
+    double x = 0;
+    double y = 0;
+    double heading = 0;
+    planLateralMove(0, 0, side*EVASION_OFFSET_MM, OUT_ANGLE, true);
+    double closest = movesClearance(&x, &y, &heading, centreX, centreY);
+    moveCount = 0;
+    addStraight(obstacleX + PASS_MM - x, 0);
+    closest = min(closest, movesClearance(&x, &y, &heading, centreX, centreY));
+    planLateralMove(y, heading, 0, RETURN_ANGLE, false);
+    closest = min(closest, movesClearance(&x, &y, &heading, centreX, centreY));
+    moveCount = 0;
+    return closest;
+}
+
+/**
+ * stop where the robot is and begin the evasion with what was seen on the way in. distance is
+ * the range in metres to the obstacle when the robot decided to stop
+ */
+void startEvasion(double distance, int leftEncoderData, int rightEncoderData){
+    evasionPhase = PHASE_WAITING;
+    waitUntil = millis() + WAIT_MS;
+    giveUpAt = millis() + GIVE_UP_MS;
+    clearReadings = 0;
+    closeReadings = 0;
+    obstacleX = distance*1000 + ULTRASONIC_OFFSET_MM;
+    //the detour has to clear the obstacle on the line running on as it did up to the stop, and
+    //where a bend like those before would have taken it: the beam cannot tell the two apart. in a
+    //bend the robot waits for the obstacle to go instead. so it does where only the outside of the
+    //bends is clear, the line would run away from the detour there
+    double curvature = lineCurvature();
+    int side = chooseSide();
+    evasionSide = side;
+    detourAllowed = false;
+    int sides = bendCurvature != 0 ? 1 : 2;
+    for(int tried = 0; tried < sides && fabs(curvature) < STRAIGHT_CURVATURE && !detourAllowed; tried++, side = -side){
+        double clearance = min(detourClearance(side, curvature), detourClearance(side, bendCurvature));
+        if(clearance >= BODY_RADIUS_MM + OBSTACLE_RADIUS_MM){
+            evasionSide = side;
+            detourAllowed = true;
+        }
+    }
+    evasionX = 0;
+    evasionY = 0;
+    evasionHeading = 0;
+    evasionLeftTicks = leftEncoderData;
+    evasionRightTicks = rightEncoderData;
+    leftCommand = 0;
+    rightCommand = 0;
+    driveWheels(0, 0);
+}
+
+/**
+ * true while the obstacle could still be inside the beam when it is where it was assumed to be
+ */
+static bool obstacleAhead(){
+    return evasionPhase == PHASE_WAITING
+        || (evasionPhase == PHASE_OUT && moveIndex == 0 && fabs(evasionHeading) < ULTRASONIC_HALF_CONE/2);
+}
+
+/**
+ * true while fresh ultrasonic readings are wanted: while they can still tell that the obstacle went
+ * away, and through the first arc, where an echo close by puts it on the side the robot turns to
+ */
+bool evasionWatchingObstacle(){
+    return obstacleAhead() || (evasionPhase == PHASE_OUT && moveIndex == 0);
+}
+
+/**
+ * integrate the encoder counts since the last call into the evasion pose and the current move
+ */
+static void updateEvasionPose(int leftEncoderData, int rightEncoderData){
+    int leftTicks = leftEncoderData - evasionLeftTicks;
+    int rightTicks = rightEncoderData - evasionRightTicks;
+    evasionLeftTicks = leftEncoderData;
+    evasionRightTicks = rightEncoderData;
+    //the encoders count edges in either direction, the direction is the one last commanded
+    double left = max(leftTicks, 0)*MM_PER_TICK*(leftCommand < 0 ? -1 : 1);
+    double right = max(rightTicks, 0)*MM_PER_TICK*(rightCommand < 0 ? -1 : 1);
+    leftDone += left;
+    rightDone += right;
+    double turn = (right - left)/AXLE_WIDTH_MM;
+    double distance = (left + right)/2;
+    evasionX += distance*cos(evasionHeading + turn/2);
+    evasionY += distance*sin(evasionHeading + turn/2);
+    evasionHeading += turn;
+}
+
+/**
+ * drive the straight of the current move on both wheels' speed loops (StraightDrive.h), turning
+ * back onto the heading planned for it on the way and going on into the next move at speed.
+ * returns true once it is done, with the distances it took each wheel
+ */
+static bool continueStraight(const EvasionMove & move, double * leftTarget, double * rightTarget){
+    if(!straightStarted){
+        straightStarted = true;
+        //what one wheel carried over ahead of the other already turned the robot, it is in the heading
+        leftDone = rightDone = (leftDone + rightDone)/2;
+        double cruise = min(motorRate(LEFT, EVASION_PWM), motorRate(RIGHT, EVASION_PWM));
+        double startRate = (getWheelTickRate(LEFT) + getWheelTickRate(RIGHT))/2;
+        startStraightDrive(&evasionStraight, move.length, evasionHeading - move.heading, cruise, startRate, false);
+    }
+    straightDriveTargets(&evasionStraight, leftTarget, rightTarget);
+    double done[2] = {leftDone, rightDone};
+    double rates[2] = {getWheelTickRate(LEFT), getWheelTickRate(RIGHT)};
+    double commands[2];
+    if(stepStraightDrive(&evasionStraight, done, rates, micros(), commands)){
+        return true;
+    }
+    leftCommand = (int)commands[0];
+    rightCommand = (int)commands[1];
+    driveWheels(leftCommand, rightCommand);
+    return false;
+}
+
+/**
+ * drive the current move, keeping both wheels at the same fraction of their distance.
+ * returns true once every move of the phase is done
+ */
+static bool continueMoves(){
+    while(moveIndex < moveCount){
+        double leftTarget, rightTarget;
+        if(moves[moveIndex].curvature == 0){
+            if(!continueStraight(moves[moveIndex], &leftTarget, &rightTarget)){
+                return false;
+            }
+        }
+        else{
+            moveTargets(moves[moveIndex], &leftTarget, &rightTarget);
+            double total = fabs(leftTarget) + fabs(rightTarget);
+            double progress = total > 0 ? (fabs(leftDone) + fabs(rightDone))/total : 1;
+            if(progress < 1){
+                double outer = max(fabs(leftTarget), fabs(rightTarget));
+                leftCommand = (int)(EVASION_PWM*leftTarget/outer + SYNC_GAIN*(progress*leftTarget - leftDone));
+                rightCommand = (int)(EVASION_PWM*rightTarget/outer + SYNC_GAIN*(progress*rightTarget - rightDone));
+                driveWheels(leftCommand, rightCommand);
+                return false;
+            }
+        }
+        //carry the overshoot into the next move
+        leftDone -= leftTarget;
+        rightDone -= rightTarget;
+        moveIndex++;
+        straightStarted = false;
+    }
+    return true;
+}
+
+static bool lineSeen(const std::array<int, 3> & irValues){
+    return irValues[0] > IR_LOWER_THRESHOLD || irValues[1] > IR_LOWER_THRESHOLD || irValues[2] > IR_LOWER_THRESHOLD;
+}
+
+/**
+ * the line was just seen. a line that bent towards the detour is crossed too steeply for the line
+ * follower to hold, so the robot is put on it first: straight on until the axle is over the line,
+ * then round on the spot towards the end of the bar the line went out under, until the middle
+ * sensor finds it again, which is when the robot faces along it
+ */
+static void beginCapture(){
+    moveCount = 0;
+    beginMoves(PHASE_CAPTURE);
+    crossedAt = -1;
+    captureTurning = false;
+    captureTurn = evasionSide;//crossing back from the detour's side the line runs on turned that way
+}
+
+/**
+ * one step of the capture. returns EVASION_REJOINED once the robot faces along the line
+ */
+static EvasionStatus continueCapture(const std::array<int, 3> & irValues){
+    bool left = irValues[0] > IR_LOWER_THRESHOLD;
+    bool middle = irValues[1] > IR_LOWER_THRESHOLD;
+    bool right = irValues[2] > IR_LOWER_THRESHOLD;
+    if(!captureTurning && left != right){
+        captureTurn = left ? 1 : -1;
+    }
+    if(!captureTurning){
+        double travelled = (leftDone + rightDone)/2;
+        if(crossedAt < 0 && (middle || !lineSeen(irValues) || travelled > CROSS_LIMIT_MM)){
+            crossedAt = travelled;
+        }
+        if(crossedAt < 0 || travelled - crossedAt < LINE_SENSOR_OFFSET_MM){
+            leftCommand = EVASION_PWM;
+            rightCommand = EVASION_PWM;
+            driveWheels(leftCommand, rightCommand);
+            return EVASION_RUNNING;
+        }
+        if(middle){
+            return EVASION_REJOINED;//crossed so shallowly that the bar is still over the line
+        }
+        captureTurning = true;
+        captureHeading = evasionHeading;
+    }
+    if(middle){
+        return EVASION_REJOINED;
+    }
+    if(fabs(evasionHeading - captureHeading) > CAPTURE_TURN){
+        return EVASION_FAILED;
+    }
+    leftCommand = -captureTurn*ROTATE_PWM;
+    rightCommand = captureTurn*ROTATE_PWM;
+    driveWheels(leftCommand, rightCommand);
+    return EVASION_RUNNING;
+}
+
+/**
+ * run the evasion for one loop(). distance is the tracked range after a fresh ultrasonic reading
+ * and echo that reading itself, both negative when none was taken this iteration (see
+ * evasionWatchingObstacle())
+ */
+EvasionStatus continueEvasion(int leftEncoderData, int rightEncoderData, std::array<int, 3> irValues, double distance, double echo){
+    updateEvasionPose(leftEncoderData, rightEncoderData);
+    //the track runs on towards the robot once the obstacle is out of the beam, only a real echo says it is close
+    if(echo >= 0){
+        closeReadings = echo < GUARD_RANGE ? closeReadings + 1 : 0;
+    }
+    if(evasionPhase == PHASE_OUT && moveIndex == 0 && closeReadings >= GUARD_READINGS){
+        //turning into it: back out of the arc to where the robot stopped and wait there for it to go
+        detourAllowed = false;
+        moveCount = 0;
+        moves[moveCount++] = {evasionHeading > 0 ? 1/TURN_RADIUS_MM : -1/TURN_RADIUS_MM, -fabs(evasionHeading)*TURN_RADIUS_MM, 0};
+        beginMoves(PHASE_BACK);
+    }
+    if(distance >= 0 && obstacleAhead()){
+        //the tracker lets go of an obstacle that left the beam while turning, the echo says whether it is back
+        clearReadings = min(distance, echo) > BLOCKAGE_TOLERANCE + CLEAR_MARGIN ? clearReadings + 1 : 0;
+        if(clearReadings >= CLEAR_READINGS){
+            if(evasionPhase == PHASE_WAITING){
+                evasionPhase = PHASE_IDLE;
+                return EVASION_CLEARED;
+            }
+            planLateralMove(evasionY, evasionHeading, 0, RETURN_ANGLE, false);//gone while turning away: head straight back to the line
+            beginMoves(PHASE_RETURN);
+        }
+    }
+
+    switch(evasionPhase){
+        case PHASE_WAITING:
+            if(detourAllowed && (int32_t)(millis() - waitUntil) >= 0){
+                planLateralMove(evasionY, evasionHeading, evasionSide*EVASION_OFFSET_MM, OUT_ANGLE, true);
+                beginMoves(PHASE_OUT);
+            }
+            else if(!detourAllowed && (int32_t)(millis() - giveUpAt) >= 0){
+                evasionPhase = PHASE_STOPPED;
+                return EVASION_STOPPED;
+            }
+            return EVASION_RUNNING;
+        case PHASE_CAPTURE:{
+            EvasionStatus status = continueCapture(irValues);
+            if(status == EVASION_FAILED){
+                driveWheels(0, 0);
+            }
+            if(status != EVASION_RUNNING){
+                evasionPhase = PHASE_IDLE;
+            }
+            return status;
+        }
+        case PHASE_STOPPED:
+            return EVASION_RUNNING;
+        case PHASE_BACK:
+            if(continueMoves()){
+                leftCommand = 0;
+                rightCommand = 0;
+                driveWheels(0, 0);
+                clearReadings = 0;
+                evasionPhase = PHASE_WAITING;
+            }
+            return EVASION_RUNNING;
+        case PHASE_OUT:
+            if(evasionX > obstacleX + PASSED_MM && lineSeen(irValues)){
+                beginCapture();
+                return EVASION_RUNNING;
+            }
+            if(continueMoves()){
+                moveCount = 0;
+                addStraight(obstacleX + PASS_MM - evasionX, 0);
+                beginMoves(PHASE_PASS);
+            }
+            return EVASION_RUNNING;
+        case PHASE_PASS:
+            if(evasionX > obstacleX + PASSED_MM && lineSeen(irValues)){//the line bent back under the robot
+                beginCapture();
+                return EVASION_RUNNING;
+            }
+            if(continueMoves()){
+                planLateralMove(evasionY, evasionHeading, 0, RETURN_ANGLE, false);
+                beginMoves(PHASE_RETURN);
+            }
+            return EVASION_RUNNING;
+        case PHASE_RETURN:
+        case PHASE_SEARCH:
+            if(lineSeen(irValues)){
+                beginCapture();
+                return EVASION_RUNNING;
+            }
+            if(continueMoves()){
+                if(evasionPhase == PHASE_SEARCH){
+                    driveWheels(0, 0);
+                    evasionPhase = PHASE_IDLE;
+                    return EVASION_FAILED;
+                }
+                //on across where the line ran and turning further towards it, a line that bent
+                //away from the detour is still ahead
+                double crossing = moveCount > 0 ? moves[moveCount - 1].heading : evasionHeading;
+                moveCount = 0;
+                addArc(crossing, crossing - evasionSide*SEARCH_MM/TURN_RADIUS_MM);
+                beginMoves(PHASE_SEARCH);
+            }
+            return EVASION_RUNNING;
+        default:
+            return EVASION_FAILED;
+    }
+}
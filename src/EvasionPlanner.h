@@ -0,0 +1,49 @@
+/**
+ * Header file for the obstacle evasion planner used in the BLOCKED state
+ *
+ * the robot first waits a moment in case the obstacle moves away. otherwise it detours around it
+ * as a sequence of arcs and straights driven on encoder odometry, in a frame where the line ran
+ * straight ahead when the robot stopped: out to EVASION_OFFSET_MM to one side, past the obstacle,
+ * and back across the course the line ran on, turning on towards it if it is not found there. the
+ * straights run on both wheels' speed loops and hold the heading planned for them (StraightDrive.h),
+ * so a weaker wheel does not bend them. the side is picked from where the recent ultrasonic echoes
+ * came from and which way the line was bending, and once the robot has been through a bend it is
+ * always the inside of one like it. the QTR sensors are watched on the way back; when the line is
+ * seen the robot drives on until its axle is over it and turns on the spot until the middle sensor
+ * finds it, and only then is the line handed back to the line follower. everything runs one step
+ * per loop(), nothing blocks
+ *
+ * the beam cannot tell where across it the echo came from, so a detour is only driven when the
+ * line ran straight up to the stop and the planned path keeps the robot clear of the obstacle both
+ * on the line straight ahead and where a bend like those followed so far would have put it.
+ * otherwise, in a bend or where only the outside of the bends is clear, the robot waits in BLOCKED
+ * for the obstacle to go, for up to GIVE_UP_MS, and then stops for good. an echo close by in the
+ * first arc means the obstacle stands on the side the robot is turning to: it backs out of the arc
+ * and waits as in a bend
+ */
+#pragma once
+
+#include <array>
+
+enum EvasionStatus {
+    EVASION_RUNNING,
+    EVASION_CLEARED,  // the obstacle went away before the robot committed to a detour
+    EVASION_REJOINED, // the line is under the QTR bar again
+    EVASION_FAILED,   // the detour ended without finding the line
+    EVASION_STOPPED   // the obstacle stayed where no detour gets round it, the robot stands still from now on
+};
+
+/**
+ * function definitions
+ */
+void initEvasionPlanner();
+
+void noteLinePosition(int lineReading);
+
+void noteRangeReading(double distance, int leftEncoderData, int rightEncoderData);
+
+void startEvasion(double distance, int leftEncoderData, int rightEncoderData);
+
+bool evasionWatchingObstacle();
+
+EvasionStatus continueEvasion(int leftEncoderData, int rightEncoderData, std::array<int, 3> irValues, double distance, double echo);
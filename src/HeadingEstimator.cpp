@@ -0,0 +1,267 @@
+#include <Arduino.h>
+#include "HeadingEstimator.h"
+#include "Odometry.h"
+#include "Platform.h"
+
+#define STATES 4
+#define HEADING 0 // radians clockwise since resetHeading()
+#define RATE 1    // radians per second clockwise
+#define SCALE 2   // effective axle width over AXLE_WIDTH_MM
+#define ANCHOR 3  // heading of the first line crossed since resetHeading(), while anchored
+
+#define TICK_ANGLE (2*MM_PER_TICK/AXLE_WIDTH_MM) // turn of one tick on each wheel in opposite directions
+#define SLIP_NOISE 0.02           // 1 sigma of the turn the wheels report, as a share of it
+#define TRACTION_LOST_NOISE 0.5   // and while a wheel lost its grip on the floor, see TractionMonitor.h
+#define RATE_NOISE 20.0           // rad/s^2, how quickly the heading rate may change
+#define SCALE_NOISE 0.0005        // 1 sigma drift of the scale per radian turned
+#define SCALE_SIGMA 0.1           // 1 sigma of the scale before any line was seen
+#define RATE_SIGMA 10.0           // rad/s, 1 sigma of the heading rate when the heading is reset
+#define LINE_SIGMA_DEG 1.0        // 1 sigma of the turn between crossings of the same half of a line
+#define HALF_TURN_SIGMA_DEG 4.0   // and of the turn between crossings of its two halves, which is off half a turn by as much as the line misses the axle
+#define CROSSING_REACH_MM 8.0     // a line this close to the middle of the bar is being crossed
+#define CROSSING_MIN_DEG 5.0      // least turn over which a line crossed stays that close to the middle
+#define CROSSING_MAX_DEG 40.0     // and the most
+#define CROSSING_GATE 3.0         // crossings further than this many sigma from a multiple of half a turn after the anchor are other lines
+#define MAX_STEP_US 100000        // longer gaps between updates are taken as this, the robot was not turning
+
+ROBOT_STATE double headingState[STATES];
+ROBOT_STATE double wheelTurnTotal;     // radians the wheels turned the robot since the reset, by the nominal axle
+ROBOT_STATE double headingCovariance[STATES][STATES];
+ROBOT_STATE bool headingAnchored;
+ROBOT_STATE bool lineNear;             // the last reading had a line near the middle of the bar
+ROBOT_STATE bool lineApart;            // a reading since the reset had none, so the next line near the middle came in from the side
+ROBOT_STATE bool crossingOpen;
+ROBOT_STATE double crossingEntry;      // heading at which the line came near the middle
+ROBOT_STATE bool odometryPrimed;
+ROBOT_STATE int headingLeftTicks;
+ROBOT_STATE int headingRightTicks;
+ROBOT_STATE uint32_t headingOdometryTime;
+
+FLASHMEM void initHeadingEstimator(){
+    for(int i = 0; i < STATES; i++){
+        for(int j = 0; j < STATES; j++){
+            headingCovariance[i][j] = 0;
+        }
+    }
+    headingState[SCALE] = 1;
+    headingCovariance[SCALE][SCALE] = SCALE_SIGMA*SCALE_SIGMA;
+    resetHeading();
+}
+
+/**
+ * start counting the heading from where the robot faces now. the scale and what is known of it are kept
+ */
+void resetHeading(){
+    headingState[HEADING] = 0;
+    headingState[RATE] = 0;
+    headingState[ANCHOR] = 0;
+    wheelTurnTotal = 0;
+    for(int i = 0; i < STATES; i++){
+        if(i != SCALE){
+            for(int j = 0; j < STATES; j++){
+                headingCovariance[i][j] = 0;
+                headingCovariance[j][i] = 0;
+            }
+        }
+    }
+    headingCovariance[RATE][RATE] = RATE_SIGMA*RATE_SIGMA;
+    headingAnchored = false;
+    lineNear = false;
+    lineApart = false;
+    crossingOpen = false;
+    odometryPrimed = false;
+}
+
+/**
+ * fold in a scalar measurement with the given row of the measurement Jacobian, innovation (measured
+ * less predicted) and variance
+ */
+static void updateHeadingState(const double * jacobian, double innovation, double variance){
+    double spread[STATES]; // covariance times the Jacobian row
+    double innovationVariance = variance;
+    for(int i = 0; i < STATES; i++){
+        spread[i] = 0;
+        for(int j = 0; j < STATES; j++){
+            spread[i] += headingCovariance[i][j]*jacobian[j];
+        }
+        innovationVariance += jacobian[i]*spread[i];
+    }
+    if(innovationVariance <= 0){
+        return;
+    }
+    for(int i = 0; i < STATES; i++){
+        headingState[i] += spread[i]*innovation/innovationVariance;
+    }
+    for(int i = 0; i < STATES; i++){
+        for(int j = i; j < STATES; j++){
+            headingCovariance[i][j] -= spread[i]*spread[j]/innovationVariance;
+            headingCovariance[j][i] = headingCovariance[i][j];
+        }
+    }
+}
+
+/**
+ * the wheel encoder counts at now (us), counting up whichever way the wheels turn. direction is 1
+ * while turning clockwise on the spot, -1 anticlockwise and 0 while both wheels drive forwards. a
+ * drop in the counts means they were reset. tractionLost says a wheel slipped or stalled over the
+ * step, whose turn is then trusted far less and leaves the heading to the lines
+ */
+void updateHeadingOdometry(int leftEncoderData, int rightEncoderData, int direction, bool tractionLost, uint32_t now){
+    if(!odometryPrimed || leftEncoderData < headingLeftTicks || rightEncoderData < headingRightTicks){
+        headingLeftTicks = odometryPrimed ? 0 : leftEncoderData;
+        headingRightTicks = odometryPrimed ? 0 : rightEncoderData;
+        if(!odometryPrimed){
+            headingOdometryTime = now;
+            odometryPrimed = true;
+            return;
+        }
+    }
+    int leftTicks = leftEncoderData - headingLeftTicks;
+    int rightTicks = rightEncoderData - headingRightTicks;
+    int turnTicks = direction != 0 ? direction*(leftTicks + rightTicks) : leftTicks - rightTicks;
+    double dt = min(now - headingOdometryTime, (uint32_t)MAX_STEP_US)*1e-6;
+    headingLeftTicks = leftEncoderData;
+    headingRightTicks = rightEncoderData;
+    headingOdometryTime = now;
+    if(dt <= 0){
+        return;
+    }
+
+    //predict: the wheels turned the robot by their turn over the scale
+    double wheelTurn = turnTicks*TICK_ANGLE/2;
+    wheelTurnTotal += wheelTurn;
+    double scale = headingState[SCALE];
+    headingState[HEADING] += wheelTurn/scale;
+    double headingByScale = -wheelTurn/(scale*scale);
+    for(int j = 0; j < STATES; j++){
+        headingCovariance[HEADING][j] += headingByScale*headingCovariance[SCALE][j];
+    }
+    for(int i = 0; i < STATES; i++){
+        headingCovariance[i][HEADING] += headingByScale*headingCovariance[i][SCALE];
+    }
+    double slip = (tractionLost ? TRACTION_LOST_NOISE : SLIP_NOISE)*wheelTurn;
+    headingCovariance[HEADING][HEADING] += TICK_ANGLE*TICK_ANGLE/12 + slip*slip;
+    headingCovariance[RATE][RATE] += RATE_NOISE*RATE_NOISE*dt*dt;
+    headingCovariance[SCALE][SCALE] += SCALE_NOISE*SCALE_NOISE*fabs(wheelTurn);
+
+    //measure: the wheels' turn rate is the robot's times the scale. it says nothing of the scale by
+    //itself, which is left to the lines
+    double jacobian[STATES] = {0, scale, 0, 0};
+    double rateNoise = TICK_ANGLE/dt;
+    updateHeadingState(jacobian, wheelTurn/dt - scale*headingState[RATE], rateNoise*rateNoise + (slip/dt)*(slip/dt));
+}
+
+/**
+ * the line under the bar in the last reading, while turning on the spot. a line through the middle
+ * of the robot is crossed where the bar is square over it, halfway between the headings at which it
+ * came within CROSSING_REACH_MM of the middle of the bar and left it again: the positions in between
+ * say little with 3 sensors. the first crossing is where the heading is anchored: a copy of the
+ * heading there joins the state, and every later crossing a whole number of half turns from it
+ * measures the turn in between
+ */
+void observeLineUnderBar(const LineReading & reading){
+    bool near = reading.lineCount == 1 && fabs((reading.position - 1000)*LINE_SENSOR_SPACING_MM/1000) <= CROSSING_REACH_MM;
+    if(near){
+        if(!lineNear && lineApart){
+            crossingEntry = headingState[HEADING];
+            crossingOpen = true;
+        }
+        lineNear = true;
+        return;
+    }
+    lineNear = false;
+    lineApart = true;
+    if(!crossingOpen){
+        return;
+    }
+    crossingOpen = false;
+    double halfSpan = (headingState[HEADING] - crossingEntry)/2;
+    if(fabs(halfSpan) < CROSSING_MIN_DEG*M_PI/180/2 || fabs(halfSpan) > CROSSING_MAX_DEG*M_PI/180/2){
+        return;//a glimpse of tape, or too slow a pass to be a crossing in a turn
+    }
+    double lineVariance = (LINE_SIGMA_DEG*M_PI/180)*(LINE_SIGMA_DEG*M_PI/180);
+    if(!headingAnchored){
+        headingState[ANCHOR] = headingState[HEADING] - halfSpan;
+        for(int i = 0; i < STATES; i++){
+            headingCovariance[ANCHOR][i] = headingCovariance[HEADING][i];
+            headingCovariance[i][ANCHOR] = headingCovariance[i][HEADING];
+        }
+        headingCovariance[ANCHOR][ANCHOR] = headingCovariance[HEADING][HEADING] + lineVariance;
+        headingAnchored = true;
+        return;
+    }
+    double sinceAnchor = headingState[HEADING] - halfSpan - headingState[ANCHOR];
+    double halfTurns = round(sinceAnchor/M_PI);
+    double residual = sinceAnchor - halfTurns*M_PI;
+    if((int)halfTurns % 2 != 0){
+        lineVariance = (HALF_TURN_SIGMA_DEG*M_PI/180)*(HALF_TURN_SIGMA_DEG*M_PI/180);
+    }
+    double spread = headingCovariance[HEADING][HEADING] - 2*headingCovariance[HEADING][ANCHOR] + headingCovariance[ANCHOR][ANCHOR] + lineVariance;
+    if(halfTurns == 0 || residual*residual > CROSSING_GATE*CROSSING_GATE*spread){
+        return;//the anchor's own line again, or another line
+    }
+    double jacobian[STATES] = {1, 0, 0, -1};
+    updateHeadingState(jacobian, -residual, lineVariance);
+}
+
+/**
+ * heading by which a turn from the reset has gone full circle and crossed the first line it
+ * crossed once more, which measures the full turn whether or not the line passes under the axle
+ */
+double getFullTurnHeading(){
+    double fullTurn = 2*M_PI;
+    return headingAnchored ? max(fullTurn, headingState[ANCHOR] + fullTurn + CROSSING_MAX_DEG*M_PI/180/2) : fullTurn;
+}
+
+/**
+ * radians the wheels turned the robot clockwise since resetHeading() if its axle were as wide as
+ * AXLE_WIDTH_MM. what the heading was when the wheels had turned it by less is best had from the
+ * heading and scale now, see getHeadingAt()
+ */
+double getWheelTurn(){
+    return wheelTurnTotal;
+}
+
+/**
+ * the heading when getWheelTurn() was wheelTurn, by the latest estimate of the scale
+ */
+double getHeadingAt(double wheelTurn){
+    return headingState[HEADING] - (wheelTurnTotal - wheelTurn)/headingState[SCALE];
+}
+
+/**
+ * radians turned clockwise since resetHeading()
+ */
+double getHeading(){
+    return headingState[HEADING];
+}
+
+double getHeadingRate(){
+    return headingState[RATE];
+}
+
+/**
+ * how much wider the axle acts than AXLE_WIDTH_MM in a turn on the spot
+ */
+double getWheelBaseScale(){
+    return headingState[SCALE];
+}
+
+/**
+ * variance of the scale, what the turns so far have taught about it
+ */
+double getWheelBaseScaleVariance(){
+    return headingCovariance[SCALE][SCALE];
+}
+
+/**
+ * take up a scale learned before, e.g. stored across a reset, along with how well it is known
+ */
+void restoreWheelBaseScale(double scale, double variance){
+    for(int i = 0; i < STATES; i++){
+        headingCovariance[i][SCALE] = 0;
+        headingCovariance[SCALE][i] = 0;
+    }
+    headingState[SCALE] = scale;
+    headingCovariance[SCALE][SCALE] = variance;
+}
@@ -0,0 +1,43 @@
+/**
+ * Header file for estimating the robot's heading while it turns on the spot
+ *
+ * the encoders alone say how far the wheels went, not how far the robot turned: the wheels scrub
+ * sideways in a turn on the spot, so the robot turns as if its axle were wider than it is. an
+ * extended Kalman filter tracks the heading, the heading rate and that effective axle width as a
+ * scale on the nominal one. the wheel counts drive the heading and measure the rate. a line passing
+ * under the middle of the robot is seen by the QTR bar twice per turn, half a turn apart, and once
+ * more after a full turn: its position along the bar at each crossing says where the line is to
+ * within a degree or two, which corrects the heading and through it the scale. the scale is kept
+ * from one turn to the next. nothing here touches the hardware
+ */
+#pragma once
+
+#include <stdint.h>
+#include "LineFit.h"
+
+/**
+ * function definitions
+ */
+void initHeadingEstimator();
+
+void resetHeading();
+
+void updateHeadingOdometry(int leftEncoderData, int rightEncoderData, int direction, bool tractionLost, uint32_t now);
+
+void observeLineUnderBar(const LineReading & reading);
+
+double getFullTurnHeading();
+
+double getWheelTurn();
+
+double getHeadingAt(double wheelTurn);
+
+double getHeading();
+
+double getHeadingRate();
+
+double getWheelBaseScale();
+
+double getWheelBaseScaleVariance();
+
+void restoreWheelBaseScale(double scale, double variance);
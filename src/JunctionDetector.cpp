@@ -0,0 +1,440 @@
+#include <Arduino.h>
+#include <stdio.h>
+#include "JunctionDetector.h"
+#include "Tuning.h"
+#include "Odometry.h"
+
+#define SCAN_DEGREES 360          // one reading per degree, clockwise from where the scan started
+#define BRANCH_MERGE_DEG 20       // runs of a scan closer than this are one branch
+#define BEHIND_DEG 150            // branches this far round are the way the robot came
+#define STRAIGHT_DEG 25           // a branch within this of straight ahead goes straight on
+#define T_MIN_DEG 60              // two branches without a straight both at least this far off make a T, else a fork
+#define FORK_DEG 30               // nominal angle of the branches of a fork seen while following
+#define SIDE_DEG 45               // and of a branch leaving the line at a shallow angle
+#define BAR_DEG 90                // and of the arms of a bar
+
+#define BAR_CONFIDENCE 90         // a line at least this dark covers its sensors completely
+#define BAR_WIDTH_RATIO 1.6       // tape this many times as wide as the line, reaching an end of the array, runs across
+#define WIDTH_RATE 0.02           // weight of each single line's width in the usual width of the line
+#define BAR_MAX_MM 60.0           // tape across the array for longer than this is not a bar
+#define LOOK_PAST_MM 12.0         // travel past a bar before deciding whether the line goes straight on
+#define STRAIGHT_SHARE 0.25       // a line within this share of the array of its middle past a bar goes straight on
+#define NEAR_SHARE 0.15           // a line within this share of the array of the followed one is still it
+#define CLEAR_MM 50.0             // the chosen branch alone under the array for this long has left the junction
+#define HOLD_MAX_MM 300.0         // give up steering onto a branch after this far
+#define TURN_MIN_DEG 45           // a turn onto an arm ends at the first line seen after this much
+#define TURN_MAX_DEG 150          // and without one after this much
+
+enum LiveState : uint8_t {
+    LIVE_FOLLOWING, // a single line, or the policy leaves junctions to QTRSensors
+    LIVE_BAR,       // tape across the array, or just past it
+    LIVE_HOLD,      // steering onto the chosen one of several lines
+    LIVE_TURN       // turning onto an arm of a bar
+};
+
+ROBOT_STATE int junctionArraySpan;     // line position units between the end sensors
+ROBOT_STATE int scriptStep;
+ROBOT_STATE Junction lastJunction;
+ROBOT_STATE bool junctionSeen;
+
+ROBOT_STATE LiveState liveState;
+ROBOT_STATE bool liveValid;            // encoder counts of the last reading are known
+ROBOT_STATE int liveLeftTicks;
+ROBOT_STATE int liveRightTicks;
+ROBOT_STATE double liveDistance;       // mm travelled since the reset
+ROBOT_STATE double liveHeading;        // radians turned clockwise since the reset
+ROBOT_STATE int followedPosition;      // of the line before the junction
+ROBOT_STATE double lineWidth;          // usual width of a single line under the array, 0 until one was seen
+ROBOT_STATE double stateStart;         // liveDistance when the current state began
+ROBOT_STATE double barEnd;             // liveDistance when the array last saw tape across, -1 on it
+ROBOT_STATE bool barLeft;              // the tape reached the left end of the array
+ROBOT_STATE bool barRight;
+ROBOT_STATE int heldSide;              // -1 follow the leftmost line, 1 the rightmost, 0 the one nearest followedPosition
+ROBOT_STATE double clearSince;         // liveDistance since which a single line has been seen, -1 while several
+ROBOT_STATE double turnStart;          // liveHeading when the turn began
+
+FLASHMEM void initJunctionDetector(int arraySpan){
+    junctionArraySpan = arraySpan;
+    scriptStep = 0;
+    junctionSeen = false;
+    lineWidth = 0;
+    resetJunctionDetector();
+}
+
+/**
+ * forget what was seen while following, e.g. after the robot turned on the spot
+ */
+void resetJunctionDetector(){
+    liveState = LIVE_FOLLOWING;
+    liveValid = false;
+    liveDistance = 0;
+    liveHeading = 0;
+    followedPosition = junctionArraySpan/2;
+}
+
+/**
+ * keep the run of scan readings first to last, in degrees from the start of the scan, as a branch
+ * unless it is behind. branches are kept in order from the left
+ */
+void addBranch(Junction * junction, int first, int last, int peak){
+    int angle = ((first + last)/2) % SCAN_DEGREES;
+    angle = angle <= 180 ? angle : angle - SCAN_DEGREES;
+    if(abs(angle) >= BEHIND_DEG || junction->branchCount == JUNCTION_MAX_BRANCHES){
+        return;
+    }
+    int slot = junction->branchCount;
+    while(slot > 0 && junction->branches[slot - 1] > angle){
+        junction->branches[slot] = junction->branches[slot - 1];
+        junction->strengths[slot] = junction->strengths[slot - 1];
+        slot--;
+    }
+    junction->branches[slot] = angle;
+    junction->strengths[slot] = peak;
+    junction->branchCount++;
+}
+
+/**
+ * the branches in a radial scan of 360 readings, one per degree clockwise from straight ahead.
+ * the sensors cross a line one after the other as the robot turns, so a branch is a run of
+ * readings over IR_PEAK_THRESHOLD rather than a sharp peak. runs closer than BRANCH_MERGE_DEG are
+ * one branch, which points at the middle of the run. runs behind are the way the robot came
+ */
+bool classifyScan(const int * scan, Junction * junction){
+    junction->branchCount = 0;
+    junction->chosen = -1;
+    //start where the scan is below the threshold, so that no run is split by the wrap around
+    int start = 0;
+    while(start < SCAN_DEGREES && scan[start] > IR_PEAK_THRESHOLD){
+        start++;
+    }
+    if(start == SCAN_DEGREES){
+        start = 0;//over the threshold all around, one run that points nowhere in particular
+    }
+    int runStart = -1;
+    int runEnd = -1;
+    int runPeak = 0;
+    for(int step = 0; step <= SCAN_DEGREES; step++){
+        int i = start + step;
+        bool over = step < SCAN_DEGREES && scan[i % SCAN_DEGREES] > IR_PEAK_THRESHOLD;
+        if(over && runStart >= 0 && i - runEnd > BRANCH_MERGE_DEG){
+            addBranch(junction, runStart, runEnd, runPeak);
+            runStart = -1;
+        }
+        if(over){
+            if(runStart < 0){
+                runStart = i;
+                runPeak = 0;
+            }
+            runEnd = i;
+            runPeak = max(runPeak, scan[i % SCAN_DEGREES]);
+        }
+    }
+    if(runStart >= 0){
+        addBranch(junction, runStart, runEnd, runPeak);
+    }
+
+    bool straight = false;
+    bool left = false;
+    bool right = false;
+    for(int k = 0; k < junction->branchCount; k++){
+        straight |= abs(junction->branches[k]) <= STRAIGHT_DEG;
+        left |= junction->branches[k] < -STRAIGHT_DEG;
+        right |= junction->branches[k] > STRAIGHT_DEG;
+    }
+    int count = junction->branchCount;
+    if(count <= 1){
+        junction->kind = JUNCTION_NONE;
+    }
+    else if(straight && left && right){
+        junction->kind = JUNCTION_CROSS;
+    }
+    else if(straight && (left || right)){
+        junction->kind = JUNCTION_SIDE;
+    }
+    else if(left && right && -junction->branches[0] >= T_MIN_DEG && junction->branches[count - 1] >= T_MIN_DEG){
+        junction->kind = JUNCTION_T;
+    }
+    else{
+        junction->kind = JUNCTION_FORK;
+    }
+    lastJunction = *junction;
+    junctionSeen = true;
+    return count > 0;
+}
+
+/**
+ * the branch nearest a heading in degrees, the left one of two as near
+ */
+static int nearestBranch(const Junction * junction, int heading){
+    int nearest = 0;
+    for(int k = 1; k < junction->branchCount; k++){
+        if(abs(junction->branches[k] - heading) < abs(junction->branches[nearest] - heading)){
+            nearest = k;
+        }
+    }
+    return nearest;
+}
+
+/**
+ * the next digit of JUNCTION_SCRIPT, read from the left and starting over after the last
+ */
+static int nextScriptDigit(){
+    char digits[12];
+    int length = snprintf(digits, sizeof(digits), "%d", max(JUNCTION_SCRIPT, 0));
+    return digits[scriptStep++ % length] - '0';
+}
+
+/**
+ * pick the branch to take by JUNCTION_POLICY. a lone branch is taken whatever the policy, and
+ * only junctions use up a digit of the script
+ */
+void chooseBranch(Junction * junction){
+    if(junction->branchCount == 0){
+        junction->chosen = -1;
+    }
+    else if(JUNCTION_POLICY == POLICY_STRONGEST){
+        //the first strongest going clockwise from straight ahead, as getHeadingFromirMAP() took it
+        int best = -1;
+        for(int k = 0; k < junction->branchCount; k++){
+            int index = (junction->branches[k] + SCAN_DEGREES) % SCAN_DEGREES;
+            int bestIndex = best < 0 ? 0 : (junction->branches[best] + SCAN_DEGREES) % SCAN_DEGREES;
+            if(best < 0 || junction->strengths[k] > junction->strengths[best]
+                || (junction->strengths[k] == junction->strengths[best] && index < bestIndex)){
+                best = k;
+            }
+        }
+        junction->chosen = best;
+    }
+    else if(junction->branchCount == 1){
+        junction->chosen = 0;
+    }
+    else{
+        int policy = JUNCTION_POLICY;
+        if(policy == POLICY_SCRIPTED){
+            int digit = nextScriptDigit();
+            policy = digit == 1 ? POLICY_LEFT : digit == 3 ? POLICY_RIGHT : POLICY_STRAIGHT;
+        }
+        if(policy == POLICY_LEFT){
+            junction->chosen = 0;
+        }
+        else if(policy == POLICY_RIGHT){
+            junction->chosen = junction->branchCount - 1;
+        }
+        else{
+            int straight = nearestBranch(junction, 0);
+            junction->chosen = abs(junction->branches[straight]) <= STRAIGHT_DEG ? straight : 0;
+        }
+    }
+    lastJunction = *junction;
+}
+
+/**
+ * the junction classified last, by a scan or while following
+ */
+bool getLastJunction(Junction * junction){
+    *junction = lastJunction;
+    return junctionSeen;
+}
+
+const char * junctionKindName(JunctionKind kind){
+    static const char * const names[JUNCTION_KIND_COUNT] = {"none", "side", "fork", "T", "crossing"};
+    return kind < JUNCTION_KIND_COUNT ? names[kind] : "?";
+}
+
+/**
+ * classify and choose a junction seen while following from its branches, straight first
+ */
+static int decideLive(JunctionKind kind, bool straight, int leftAngle, int rightAngle, int strength){
+    Junction junction;
+    junction.kind = kind;
+    junction.branchCount = 0;
+    if(leftAngle != 0){
+        junction.branches[junction.branchCount] = leftAngle;
+        junction.strengths[junction.branchCount++] = strength;
+    }
+    if(straight){
+        junction.branches[junction.branchCount] = 0;
+        junction.strengths[junction.branchCount++] = strength;
+    }
+    if(rightAngle != 0){
+        junction.branches[junction.branchCount] = rightAngle;
+        junction.strengths[junction.branchCount++] = strength;
+    }
+    chooseBranch(&junction);
+    junctionSeen = true;
+    return junction.chosen < 0 ? 0 : junction.branches[junction.chosen];
+}
+
+/**
+ * tape across the array: saturated, and so much wider than the line usually is, reaching an end,
+ * that it cannot be the line even on a curve. sets which ends it reaches
+ */
+static bool tapeAcross(const LineReading & reading, bool * left, bool * right){
+    if(reading.lineCount != 1 || reading.confidence < BAR_CONFIDENCE || lineWidth <= 0 || reading.width < BAR_WIDTH_RATIO*lineWidth){
+        return false;
+    }
+    *left = reading.position - reading.width/2 <= 0;
+    *right = reading.position + reading.width/2 >= junctionArraySpan;
+    return *left || *right;
+}
+
+static void enterLive(LiveState state){
+    liveState = state;
+    stateStart = liveDistance;
+}
+
+/**
+ * steer onto the lines on the chosen side of a fork or branch until it is alone under the array
+ */
+static int holdBranch(const LineReading & reading){
+    if(reading.lineCount >= 2){
+        clearSince = -1;
+        if(heldSide < 0){
+            followedPosition = reading.lines[0];
+        }
+        else if(heldSide > 0){
+            followedPosition = reading.lines[reading.lineCount - 1];
+        }
+        else{
+            int first = reading.lines[0];
+            int last = reading.lines[reading.lineCount - 1];
+            followedPosition = abs(first - followedPosition) <= abs(last - followedPosition) ? first : last;
+        }
+        return followedPosition;
+    }
+    if(clearSince < 0){
+        clearSince = liveDistance;
+    }
+    if(liveDistance - clearSince >= CLEAR_MM || liveDistance - stateStart >= HOLD_MAX_MM){
+        enterLive(LIVE_FOLLOWING);
+    }
+    return reading.position;
+}
+
+/**
+ * turn onto the chosen arm of a bar by steering as if the line were past that end of the array,
+ * until a line is seen again well into the turn
+ */
+static int continueTurn(const LineReading & reading, bool across){
+    double turned = (liveHeading - turnStart)*heldSide*180/M_PI;
+    if((turned >= TURN_MIN_DEG && reading.lineCount >= 1 && !across) || turned >= TURN_MAX_DEG){
+        enterLive(LIVE_FOLLOWING);
+        return reading.position;
+    }
+    return heldSide < 0 ? 0 : junctionArraySpan;
+}
+
+/**
+ * a fork or branch reached while following: two lines under the array. side says where the tape
+ * ran across on the way in, if it did
+ */
+static int decideSplit(const LineReading & reading, bool sawLeft, bool sawRight){
+    int first = reading.lines[0];
+    int last = reading.lines[reading.lineCount - 1];
+    int near = (int)(NEAR_SHARE*junctionArraySpan);
+    bool firstStays = abs(first - followedPosition) <= near;
+    bool lastStays = abs(last - followedPosition) <= near;
+    int angle;
+    if(firstStays != lastStays || sawLeft != sawRight){
+        //one of them is the line going on, the other leaves it
+        bool toRight = firstStays != lastStays ? firstStays : sawRight;
+        angle = decideLive(JUNCTION_SIDE, true, toRight ? 0 : -SIDE_DEG, toRight ? SIDE_DEG : 0, reading.confidence);
+    }
+    else{
+        angle = decideLive(JUNCTION_FORK, false, -FORK_DEG, FORK_DEG, reading.confidence);
+    }
+    heldSide = angle < 0 ? -1 : angle > 0 ? 1 : 0;
+    clearSince = -1;
+    enterLive(LIVE_HOLD);
+    return holdBranch(reading);
+}
+
+/**
+ * run the live detector on every reading taken while following, with the wheel encoder counts.
+ * returns the line position to steer by: the reading's, a branch being held, or an end of the
+ * array to turn onto an arm. with POLICY_STRONGEST it is always the reading's
+ */
+int followJunctions(const LineReading & reading, int leftEncoderData, int rightEncoderData){
+    if(liveValid && leftEncoderData >= liveLeftTicks && rightEncoderData >= liveRightTicks){
+        double left = (leftEncoderData - liveLeftTicks)*MM_PER_TICK;
+        double right = (rightEncoderData - liveRightTicks)*MM_PER_TICK;
+        liveDistance += (left + right)/2;
+        liveHeading += (left - right)/AXLE_WIDTH_MM;
+    }
+    else if(liveValid){
+        resetJunctionDetector();//the counts were reset, the robot has turned on the spot since
+    }
+    liveValid = true;
+    liveLeftTicks = leftEncoderData;
+    liveRightTicks = rightEncoderData;
+    if(JUNCTION_POLICY == POLICY_STRONGEST){
+        return reading.position;
+    }
+
+    bool acrossLeft = false;
+    bool acrossRight = false;
+    bool across = tapeAcross(reading, &acrossLeft, &acrossRight);
+    switch(liveState){
+    case LIVE_FOLLOWING:
+        if(across){
+            barLeft = acrossLeft;
+            barRight = acrossRight;
+            barEnd = -1;
+            enterLive(LIVE_BAR);
+            return followedPosition;
+        }
+        if(reading.lineCount >= 2){
+            return decideSplit(reading, false, false);
+        }
+        if(reading.lineCount == 1){
+            followedPosition = reading.position;
+            lineWidth = lineWidth > 0 ? lineWidth + (reading.width - lineWidth)*WIDTH_RATE : reading.width;
+        }
+        return reading.position;
+
+    case LIVE_BAR:
+        if(across){
+            barLeft |= acrossLeft;
+            barRight |= acrossRight;
+            barEnd = -1;
+            if(liveDistance - stateStart > BAR_MAX_MM){
+                enterLive(LIVE_FOLLOWING);//a dark patch, not a junction
+                return reading.position;
+            }
+            return followedPosition;
+        }
+        if(barEnd < 0){
+            barEnd = liveDistance;
+        }
+        if(reading.lineCount >= 2){
+            //the line split on the way out of the bar
+            return decideSplit(reading, barLeft && !barRight, barRight && !barLeft);
+        }
+        if(liveDistance - barEnd < LOOK_PAST_MM){
+            return followedPosition;
+        }
+        {
+            //past the bar: whether the line goes on, and which ends the bar reached. a line off to
+            //one side is the bar bending away, as at a sharp corner
+            bool straight = reading.lineCount >= 1 && abs(reading.position - junctionArraySpan/2) <= STRAIGHT_SHARE*junctionArraySpan;
+            int sides = barLeft + barRight;
+            JunctionKind kind = sides == 2 ? (straight ? JUNCTION_CROSS : JUNCTION_T) : straight ? JUNCTION_SIDE : JUNCTION_NONE;
+            int angle = decideLive(kind, straight, barLeft ? -BAR_DEG : 0, barRight ? BAR_DEG : 0, 100);
+            if(angle == 0){
+                enterLive(LIVE_FOLLOWING);
+                return reading.lineCount > 0 ? reading.position : followedPosition;
+            }
+            heldSide = angle < 0 ? -1 : 1;
+            turnStart = liveHeading;
+            enterLive(LIVE_TURN);
+        }
+        return continueTurn(reading, across);
+
+    case LIVE_TURN:
+        return continueTurn(reading, across);
+
+    case LIVE_HOLD:
+        return holdBranch(reading);
+    }
+    return reading.position;
+}
@@ -0,0 +1,62 @@
+/**
+ * Header file for recognising junctions in the line and picking the branch to take at them
+ *
+ * junctions are seen two ways. while following, the QTR array reports every line under it (see
+ * LineFit.h): a fork shows as the line splitting into two, and the bar of a T or a crossing as
+ * tape reaching an end of the array and much wider than the line usually is, with the line going
+ * on straight past it or not. a branch off to one side at right angles covers too little of a
+ * short array to be told from a curve, it is followed past as QTRSensors sees it. after the line was lost, the radial scan of the SENSING state
+ * has the reflectance all around the robot, and the branches are its peaks. either way the branches
+ * are put in degrees from straight ahead, the junction is classified by them and JUNCTION_POLICY
+ * picks one. a branch picked while following is steered onto directly, without stopping for a
+ * scan. nothing here touches the hardware
+ */
+#pragma once
+
+#include <stdint.h>
+#include "LineFit.h"
+
+#define JUNCTION_MAX_BRANCHES 8 // most branches a scan reports, the way the robot came not counted
+
+enum JunctionKind : uint8_t {
+    JUNCTION_NONE = 0, // a single way on, a plain line or a corner
+    JUNCTION_SIDE,     // the line goes straight on with a branch off to one side
+    JUNCTION_FORK,     // two branches, neither straight on, at least one at a shallow angle
+    JUNCTION_T,        // the line ends in a bar going left and right
+    JUNCTION_CROSS,    // straight on, left and right
+    JUNCTION_KIND_COUNT
+};
+
+//values of JUNCTION_POLICY
+enum JunctionPolicy : uint8_t {
+    POLICY_STRONGEST = 0, // the darkest branch of a scan, and the line as QTRSensors sees it while following
+    POLICY_LEFT,          // the leftmost branch
+    POLICY_RIGHT,         // the rightmost branch
+    POLICY_STRAIGHT,      // straight on where there is a straight, else the leftmost
+    POLICY_SCRIPTED       // the digits of JUNCTION_SCRIPT in turn, one per junction: 1 left, 2 straight, 3 right
+};
+
+struct Junction {
+    JunctionKind kind;
+    int branchCount;
+    int branches[JUNCTION_MAX_BRANCHES];  // degrees clockwise from straight ahead, as rotateToAngle() takes them, left first
+    int strengths[JUNCTION_MAX_BRANCHES]; // peak reflectance of each branch in a scan, the line's confidence while following
+    int chosen;                           // index of the branch taken, -1 without any
+};
+
+/**
+ * function definitions
+ */
+void initJunctionDetector(int arraySpan);
+
+void resetJunctionDetector();
+
+bool classifyScan(const int * scan, Junction * junction);
+
+void chooseBranch(Junction * junction);
+
+int followJunctions(const LineReading & reading, int leftEncoderData, int rightEncoderData);
+
+bool getLastJunction(Junction * junction);
+
+const char * junctionKindName(JunctionKind kind);
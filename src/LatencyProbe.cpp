@@ -0,0 +1,106 @@
+#include <Arduino.h>
+#include "LatencyProbe.h"
+#include "Platform.h"
+
+#define PROBE_PERIOD_US 97      // odd, so that the probe drifts across everything loop() does
+#define PROBE_REPORT_MS 1000
+
+ROBOT_STATE IntervalTimer probeTimer;
+ROBOT_STATE uint32_t probePeriod;               // in counter ticks
+ROBOT_STATE volatile bool probePrimed;
+ROBOT_STATE volatile uint32_t probeDue;         // counter value the next run is due at
+ROBOT_STATE volatile int32_t probeEarliest;     // least and most counter ticks a run was late by
+ROBOT_STATE volatile int32_t probeLatest;
+ROBOT_STATE volatile uint32_t probeRuns;
+ROBOT_STATE uint32_t nextProbeReport;
+
+/**
+ * free running counter the probe is timed by, and its ticks per us
+ */
+static inline uint32_t probeCounter(){
+#if defined(__IMXRT1062__)
+    return ARM_DWT_CYCCNT;
+#else
+    return micros();
+#endif
+}
+
+static inline uint32_t probeTicksPerUs(){
+#if defined(__IMXRT1062__)
+    return F_CPU_ACTUAL/1000000;
+#else
+    return 1;
+#endif
+}
+
+/**
+ * timer interrupt. a run held off past the next due time stands for both, the timer only keeps
+ * one pending
+ */
+static FASTRUN void probeLatency(){
+    uint32_t now = probeCounter();
+    if(!probePrimed){
+        probeDue = now;
+        probePrimed = true;
+    }
+    int32_t late = (int32_t)(now - probeDue);
+    if(probeRuns == 0 || late < probeEarliest){
+        probeEarliest = late;
+    }
+    if(probeRuns == 0 || late > probeLatest){
+        probeLatest = late;
+    }
+    probeRuns = probeRuns + 1;
+    probeDue = probeDue + probePeriod*(late > 0 ? (uint32_t)late/probePeriod + 1 : 1);
+}
+
+FLASHMEM void startLatencyProbe(){
+    probePeriod = PROBE_PERIOD_US*probeTicksPerUs();
+    resetLatencyProbe();
+    nextProbeReport = millis() + PROBE_REPORT_MS;
+    //IntervalTimer's default of 128 is the priority of the GPIO interrupts attachInterrupt() sets up
+    //for the encoders. it is not set here, the PIT interrupt is shared with the mic timer
+    probeTimer.begin(probeLatency, PROBE_PERIOD_US);
+}
+
+void stopLatencyProbe(){
+    probeTimer.end();
+}
+
+/**
+ * start the worst case over, the schedule is taken up again from the next run
+ */
+void resetLatencyProbe(){
+    noInterrupts();
+    probePrimed = false;
+    probeRuns = 0;
+    probeEarliest = 0;
+    probeLatest = 0;
+    interrupts();
+}
+
+/**
+ * most a run was held off by, beyond the least any was, since the last reset
+ */
+double getWorstLatencyUs(){
+    noInterrupts();
+    int32_t spread = probeLatest - probeEarliest;
+    interrupts();
+    return (double)spread/probeTicksPerUs();
+}
+
+uint32_t getLatencyProbeRuns(){
+    return probeRuns;
+}
+
+/**
+ * print the worst case of the last second and start over, to be called from loop()
+ */
+void reportLatencyProbe(){
+    if((int32_t)(millis() - nextProbeReport) < 0){
+        return;
+    }
+    nextProbeReport += PROBE_REPORT_MS;
+    Serial.printf("interrupt latency: worst %.2f us over %u runs\n", getWorstLatencyUs(), (unsigned)getLatencyProbeRuns());
+    resetLatencyProbe();
+}
@@ -0,0 +1,34 @@
+/**
+ * Header file for measuring how late interrupts are taken
+ *
+ * an encoder edge is only counted once its interrupt runs, and nothing runs while the code has
+ * interrupts off, e.g. while a QTR read switches and samples its pins. the probe stands in for the
+ * encoder interrupts: a timer at the same priority fires on a fixed schedule, and its interrupt
+ * notes how long after its due time it ran. the spread between the earliest and the latest run is
+ * the latency added by whatever held interrupts off, on top of the fixed cost of entering one. on
+ * the Teensy it is timed by the cycle counter, in the simulator by micros(). build the
+ * teensy40_latency environment to have it reported over Serial every second
+ *
+ * on the Teensy 4 every IntervalTimer shares IRQ_PIT, so the probe runs at the priority of the
+ * mic timer (BumpLocator.h) whatever it is set to, and a probe due while sampleMics() runs waits
+ * for it. the worst case therefore includes the time of the mic interrupt, which does hold off an
+ * encoder edge as well, but is not interrupts being off
+ */
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * function definitions
+ */
+void startLatencyProbe();
+
+void stopLatencyProbe();
+
+void resetLatencyProbe();
+
+double getWorstLatencyUs();
+
+uint32_t getLatencyProbeRuns();
+
+void reportLatencyProbe();
@@ -0,0 +1,165 @@
+#include <Arduino.h>
+#include "LineFit.h"
+#include "Platform.h"
+
+#define LINE_SEEN 200          // contrast at which a sensor sees the line, as QTRSensors' readLine
+#define FLOOR_RATE 0.01        // weight of each reading's brightest sensor in the floor level while it reads darker
+#define CURVATURE_RATE 0.05    // weight of each fitted parabola in the curvature used past the ends
+#define MIN_SPAN 100           // us between floor and timeout needed to tell them apart
+
+ROBOT_STATE uint8_t fitSensors;
+ROBOT_STATE uint16_t fitDark;
+ROBOT_STATE float fitFloor;       // reading of the floor, negative until the first reading
+ROBOT_STATE float fitCurvature;   // contrast lost per sensor pitch squared away from a peak, 0 until one was fitted
+ROBOT_STATE int fitLastPosition;
+
+struct LineSpan {
+    int position;
+    int width;
+    int peak;     // contrast at the position
+    bool pastEnd; // followed past the end of the array
+};
+
+void initLineFit(uint8_t sensorCount, uint16_t darkReading){
+    fitSensors = min(sensorCount, (uint8_t)LINE_MAX_SENSORS);
+    fitDark = darkReading;
+    fitFloor = -1;
+    fitCurvature = 0;
+    fitLastPosition = (fitSensors - 1)*500;
+}
+
+/**
+ * where the contrast falls through half of peak between sensor inside and its neighbour outside,
+ * in sensor pitches. the end of the array when there is no neighbour or it is still over half
+ */
+static double halfCrossing(const int * contrast, int inside, int step, int peak){
+    int i = inside;
+    while(i + step >= 0 && i + step < fitSensors && contrast[i + step]*2 >= peak){
+        i += step;
+    }
+    if(i + step < 0 || i + step >= fitSensors){
+        return i;
+    }
+    double fraction = (contrast[i] - peak/2.0)/(contrast[i] - contrast[i + step]);
+    return i + step*fraction;
+}
+
+/**
+ * locate the line seen by the run of sensors first to last
+ */
+static void fitRun(const int * contrast, int first, int last, LineSpan * span){
+    int strongest = first;
+    for(int i = first + 1; i <= last; i++){
+        if(contrast[i] > contrast[strongest]){
+            strongest = i;
+        }
+    }
+    int plateauEnd = strongest;
+    while(plateauEnd < last && contrast[plateauEnd + 1] == contrast[strongest]){
+        plateauEnd++;
+    }
+    int peak = contrast[strongest];
+    double position = (strongest + plateauEnd)/2.0;
+    span->pastEnd = false;
+
+    bool atStart = strongest == 0;
+    bool atEnd = plateauEnd == fitSensors - 1;
+    if(atStart != atEnd && fitSensors >= 2){
+        //strongest at one end: the line is near it or beyond. the parabola through the end sensor
+        //and its neighbour with the learned curvature says where
+        int end = atStart ? 0 : fitSensors - 1;
+        int inward = atStart ? 1 : fitSensors - 2;
+        position = end;
+        if(fitCurvature > 0){
+            double beyond = (contrast[end] - contrast[inward])/(2*fitCurvature) - 0.5;
+            position = end + (atStart ? -1 : 1)*constrain(beyond, -0.5, LINE_EDGE_REACH/1000.0);
+            span->pastEnd = beyond > 0;
+        }
+    }
+    else if(strongest == plateauEnd && strongest > 0 && strongest < fitSensors - 1){
+        //parabola through the strongest sensor and its neighbours
+        int left = contrast[strongest - 1];
+        int right = contrast[strongest + 1];
+        int secondDifference = left - 2*peak + right;
+        if(secondDifference < 0){
+            double offset = constrain(0.5*(left - right)/secondDifference, -0.5, 0.5);
+            position = strongest + offset;
+            peak = (int)(peak - 0.25*(left - right)*offset);
+            if(contrast[strongest] < 1000){
+                //a saturated sensor flattens the top, only clean parabolas teach the curvature
+                double curvature = -secondDifference/2.0;
+                fitCurvature = fitCurvature > 0 ? fitCurvature + (curvature - fitCurvature)*CURVATURE_RATE : curvature;
+            }
+        }
+    }
+    else if(strongest < plateauEnd){
+        //several sensors fully on the line: its middle, leaning towards the darker side next to it
+        int left = strongest > 0 ? contrast[strongest - 1] : peak;
+        int right = plateauEnd < fitSensors - 1 ? contrast[plateauEnd + 1] : peak;
+        position += constrain(0.5*(right - left)/max(peak, 1), -0.5, 0.5);
+    }
+    span->position = (int)lround(position*1000);
+    span->peak = peak;
+    span->width = (int)lround((halfCrossing(contrast, plateauEnd, 1, peak) - halfCrossing(contrast, strongest, -1, peak))*1000);
+}
+
+/**
+ * find the lines in one reading of every sensor, RC discharge times as QTRSensors reads them
+ */
+void fitLine(const uint16_t * values, LineReading * reading){
+    uint16_t brightest = values[0];
+    for(int i = 1; i < fitSensors; i++){
+        brightest = min(brightest, values[i]);
+    }
+    //the floor follows a brighter reading at once, a darker one only slowly, as all the
+    //sensors can be over tape for a moment at a crossing
+    if(fitFloor < 0 || brightest < fitFloor){
+        fitFloor = brightest;
+    }
+    else{
+        fitFloor += (brightest - fitFloor)*FLOOR_RATE;
+    }
+    float span = fitDark - fitFloor;
+    int contrast[LINE_MAX_SENSORS];
+    for(int i = 0; i < fitSensors; i++){
+        contrast[i] = span < MIN_SPAN ? 0 : constrain((int)((values[i] - fitFloor)*1000/span), 0, 1000);
+    }
+
+    reading->lineCount = 0;
+    LineSpan nearest = {};
+    int nearestDistance = -1;
+    for(int first = 0; first < fitSensors; first++){
+        if(contrast[first] < LINE_SEEN){
+            continue;
+        }
+        int last = first;
+        while(last + 1 < fitSensors && contrast[last + 1] >= LINE_SEEN){
+            last++;
+        }
+        LineSpan line;
+        fitRun(contrast, first, last, &line);
+        if(reading->lineCount < LINE_MAX_LINES){
+            reading->lines[reading->lineCount++] = line.position;
+        }
+        int distance = abs(line.position - fitLastPosition);
+        if(nearestDistance < 0 || distance < nearestDistance){
+            nearestDistance = distance;
+            nearest = line;
+        }
+        first = last;
+    }
+
+    if(reading->lineCount == 0){
+        //lost: held at the end it was last seen nearest, or where it was last followed to past it
+        int end = (fitSensors - 1)*1000;
+        reading->position = fitLastPosition < end/2 ? min(fitLastPosition, 0) : max(fitLastPosition, end);
+        reading->width = 0;
+        reading->confidence = 0;
+        fitLastPosition = reading->position;
+        return;
+    }
+    reading->position = nearest.position;
+    reading->width = nearest.width;
+    reading->confidence = nearest.peak/(nearest.pastEnd ? 20 : 10);
+    fitLastPosition = nearest.position;
+}
@@ -0,0 +1,35 @@
+/**
+ * Header file for finding the line in a reading of the QTR array
+ *
+ * works with any number of RC sensors up to LINE_MAX_SENSORS. each reading is turned into a
+ * contrast from 0 (floor) to 1000 (tape) against the floor level, which is learned from the
+ * brightest sensors, and the RC timeout. a line is a run of neighbouring sensors that see it.
+ * its position is the peak of a parabola through the strongest sensor of the run and the sensors
+ * either side, which resolves it to a fraction of the sensor pitch where a weighted average of the
+ * readings is pulled towards the middle of the array. when the strongest sensor is the one at the
+ * end, the line is followed past it for up to LINE_EDGE_REACH with the curvature of the parabolas
+ * seen so far, instead of snapping to the end. positions are 1000 per sensor pitch from the first
+ * sensor. nothing here touches the hardware
+ */
+#pragma once
+
+#include <stdint.h>
+
+#define LINE_MAX_SENSORS 31 // as many as QTRSensors reads
+#define LINE_MAX_LINES 4    // lines reported at once, e.g. the two branches of a fork
+#define LINE_EDGE_REACH 1000 // furthest past the end sensors a line is followed
+
+struct LineReading {
+    int position;   // the line nearest the last position, or past the end it was last seen at
+    int width;      // of that line where its contrast is half its peak, 0 without a line
+    int confidence; // percent, the line's peak contrast, halved when it is past the end of the array
+    int lineCount;  // lines seen, 0 when the array sees only floor
+    int lines[LINE_MAX_LINES]; // positions of the lines seen, first sensor's side first
+};
+
+/**
+ * function definitions
+ */
+void initLineFit(uint8_t sensorCount, uint16_t darkReading);
+
+void fitLine(const uint16_t * values, LineReading * reading);
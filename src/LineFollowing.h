@@ -0,0 +1,8 @@
+/**
+ * Header file for constants shared by the modules that act while following the line
+ */
+#pragma once
+
+#define LINE_CENTRE 1000       // line position with the line under the middle sensor
+#define FOLLOWING_GAP_MS 100   // longer than this between updates means line following was interrupted
+#define MIN_PWM_FRACTION 0.6   // no speed limit takes the base PWM below this fraction of BASE_PWM
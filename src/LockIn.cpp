@@ -0,0 +1,108 @@
+#include <Arduino.h>
+#include "LockIn.h"
+#include "Tuning.h"
+
+#define LIGHT_SCALE 1e6f   // light of a reading is LIGHT_SCALE over its discharge time in us
+#define MAX_GAP_US 20000   // readings further apart than this are not paired, the robot has moved on
+
+ROBOT_STATE uint8_t lockInChannels;
+ROBOT_STATE uint16_t lockInDark;                   // reading of a sensor that sees no light, the RC timeout
+ROBOT_STATE bool lockInPrimed;                     // there is a reading to pair the next one with
+ROBOT_STATE bool lastEmitterOn;
+ROBOT_STATE uint32_t lastReadingTime;
+ROBOT_STATE float lastLight[LOCKIN_MAX_CHANNELS];
+ROBOT_STATE float differences[LOCKIN_MAX_WINDOW][LOCKIN_MAX_CHANNELS];
+ROBOT_STATE int differenceCount;                   // in the ring since the pairing started over, up to LOCKIN_MAX_WINDOW
+ROBOT_STATE int nextDifference;
+ROBOT_STATE uint16_t lockInValues[LOCKIN_MAX_CHANNELS];
+
+void initLockIn(uint8_t channels, uint16_t darkReading){
+    lockInChannels = min(channels, (uint8_t)LOCKIN_MAX_CHANNELS);
+    lockInDark = darkReading;
+    lockInPrimed = false;
+    differenceCount = 0;
+    nextDifference = 0;
+    for(int i = 0; i < lockInChannels; i++){
+        lockInValues[i] = darkReading;
+    }
+}
+
+static float lightOf(uint16_t reading){
+    return reading >= lockInDark ? 0 : LIGHT_SCALE/max(reading, (uint16_t)1);
+}
+
+/**
+ * whether the emitters should be on for a reading taken at now (us). after a gap the pairing
+ * starts over with them on, that reading alone is taken as if there were no ambient light
+ */
+bool lockInEmitterOn(uint32_t now){
+    if(!lockInPrimed || now - lastReadingTime > MAX_GAP_US){
+        return true;
+    }
+    return !lastEmitterOn;
+}
+
+static void addDifference(const float * light){
+    for(int i = 0; i < lockInChannels; i++){
+        differences[nextDifference][i] = light[i];
+    }
+    nextDifference = (nextDifference + 1) % LOCKIN_MAX_WINDOW;
+    differenceCount = min(differenceCount + 1, LOCKIN_MAX_WINDOW);
+}
+
+/**
+ * the mean of the last differences as discharge times, the dark reading where they show no light
+ */
+static void updateLockInValues(){
+    int window = min(differenceCount, constrain(IR_LOCKIN_WINDOW, 1, LOCKIN_MAX_WINDOW));
+    if(window == 0){
+        return;
+    }
+    for(int i = 0; i < lockInChannels; i++){
+        float sum = 0;
+        for(int k = 1; k <= window; k++){
+            sum += differences[(nextDifference - k + LOCKIN_MAX_WINDOW) % LOCKIN_MAX_WINDOW][i];
+        }
+        float light = sum/window;
+        lockInValues[i] = light*lockInDark <= LIGHT_SCALE ? lockInDark : (uint16_t)(LIGHT_SCALE/light + 0.5f);
+    }
+}
+
+/**
+ * one reading of every channel, taken at now (us) with the emitters on or off
+ */
+void pushLockInReading(const uint16_t * values, bool emitterOn, uint32_t now){
+    float light[LOCKIN_MAX_CHANNELS];
+    for(int i = 0; i < lockInChannels; i++){
+        light[i] = lightOf(values[i]);
+    }
+    if(lockInPrimed && now - lastReadingTime <= MAX_GAP_US && emitterOn != lastEmitterOn){
+        float difference[LOCKIN_MAX_CHANNELS];
+        for(int i = 0; i < lockInChannels; i++){
+            difference[i] = emitterOn ? light[i] - lastLight[i] : lastLight[i] - light[i];
+        }
+        addDifference(difference);
+    }
+    else{
+        differenceCount = 0;
+        if(emitterOn){
+            addDifference(light);
+        }
+    }
+    for(int i = 0; i < lockInChannels; i++){
+        lastLight[i] = light[i];
+    }
+    lastEmitterOn = emitterOn;
+    lastReadingTime = now;
+    lockInPrimed = true;
+    updateLockInValues();
+}
+
+/**
+ * the demodulated readings, what each sensor would read in the dark with the emitters on
+ */
+void getLockInValues(uint16_t * values){
+    for(int i = 0; i < lockInChannels; i++){
+        values[i] = lockInValues[i];
+    }
+}
@@ -0,0 +1,29 @@
+/**
+ * Header file for demodulating line sensor readings taken with the emitters switched on and off
+ *
+ * the emitters alternate from one reading to the next, so each tick still takes a single RC read.
+ * every reading is paired with the one before it, which was taken with the emitters in the other
+ * state, and the difference is what the emitters alone put on the phototransistors: ambient light
+ * is in both and drops out. the output is the mean of the last IR_LOCKIN_WINDOW differences, which
+ * also cancels ambient light that drifts steadily between readings, as the differences alternate in
+ * order (on - off, then on - off with the next off). the arithmetic is done on light, the inverse of
+ * the discharge time, where ambient and emitter light add up, and the result is turned back into
+ * the discharge time the sensor would read in the dark. nothing here touches the hardware
+ */
+#pragma once
+
+#include <stdint.h>
+
+#define LOCKIN_MAX_CHANNELS 31 // as many as QTRSensors reads
+#define LOCKIN_MAX_WINDOW 8 // most differences IR_LOCKIN_WINDOW can average
+
+/**
+ * function definitions
+ */
+void initLockIn(uint8_t channels, uint16_t darkReading);
+
+bool lockInEmitterOn(uint32_t now);
+
+void pushLockInReading(const uint16_t * values, bool emitterOn, uint32_t now);
+
+void getLockInValues(uint16_t * values);
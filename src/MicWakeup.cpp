@@ -0,0 +1,111 @@
+#include <Arduino.h>
+#include "MicWakeup.h"
+#include "Tuning.h"
+
+#define MIC_COUNT 3
+#define BASELINE_BLOCK 64 // quiet samples summed per baseline refresh, 6.4 ms at the sampling rate
+#define MAX_LOUD_SAMPLES 16 // loud samples fed in a row, across the holdoffs between their onsets, that no bump lasts
+
+ROBOT_STATE float wakeBaseline[MIC_COUNT]; // negative until the first block is in
+ROBOT_STATE int wakeThreshold[MIC_COUNT];  // a sample over this is loud
+ROBOT_STATE int32_t quietSum[MIC_COUNT];
+ROBOT_STATE int quietSamples;
+ROBOT_STATE int loudRun; // consecutive loud samples so far
+ROBOT_STATE int loudSamples; // loud samples fed in a row, not restarted by rearmMicWakeup()
+ROBOT_STATE bool baselinesRestored; // restored and not yet confirmed by a block of quiet samples
+
+void initMicWakeup(){
+    for(int mic = 0; mic < MIC_COUNT; mic++){
+        wakeBaseline[mic] = -1;
+        wakeThreshold[mic] = INT32_MAX;//no onsets until there is a baseline to compare against
+    }
+    baselinesRestored = false;
+    loudSamples = 0;
+    rearmMicWakeup();
+}
+
+/**
+ * start over on the onset and the baseline block, e.g. once the ring-down of a bump has passed.
+ * the baselines themselves are kept
+ */
+void rearmMicWakeup(){
+    for(int mic = 0; mic < MIC_COUNT; mic++){
+        quietSum[mic] = 0;
+    }
+    quietSamples = 0;
+    loudRun = 0;
+}
+
+/**
+ * fold a block of quiet samples into the baselines, at MIC_AVERAGE_RATE per sample in it. the first
+ * block replaces a restored baseline outright
+ */
+static void refreshMicBaselines(){
+    float rate = min(1.0f, (float)MIC_AVERAGE_RATE*BASELINE_BLOCK);
+    for(int mic = 0; mic < MIC_COUNT; mic++){
+        float mean = (float)quietSum[mic]/BASELINE_BLOCK;
+        wakeBaseline[mic] = wakeBaseline[mic] < 0 || baselinesRestored ? mean : wakeBaseline[mic] + (mean - wakeBaseline[mic])*rate;
+        wakeThreshold[mic] = (int)(wakeBaseline[mic] + MIC_BUMP_THRESHOLD);
+        quietSum[mic] = 0;
+    }
+    quietSamples = 0;
+    baselinesRestored = false;
+}
+
+/**
+ * one sample of every mic, in the order of MIC_FRONT_RIGHT, MIC_REAR, MIC_FRONT_LEFT. true when
+ * it completes the onset of a bump
+ */
+bool micWakeSample(const int values[3]){
+    bool loud = values[0] > wakeThreshold[0] || values[1] > wakeThreshold[1] || values[2] > wakeThreshold[2];
+    if(loud){
+        //a bump must not drag the baselines up, loud samples are left out of them. but a bump has rung
+        //down by the end of its holdoff: loud on every sample across several holdoffs is the quiet
+        //level having risen past the threshold, or a stale restored baseline, and would never
+        //be measured again. start over on the baselines, which takes the next block as they are
+        if(++loudSamples >= MAX_LOUD_SAMPLES){
+            initMicWakeup();
+            return false;
+        }
+        loudRun++;
+        return loudRun == MIC_ONSET_SAMPLES;
+    }
+    loudRun = 0;
+    loudSamples = 0;
+    for(int mic = 0; mic < MIC_COUNT; mic++){
+        quietSum[mic] += values[mic];
+    }
+    if(++quietSamples == BASELINE_BLOCK){
+        refreshMicBaselines();
+    }
+    return false;
+}
+
+/**
+ * quiet level of a mic in ADC counts
+ */
+float getMicBaseline(int mic){
+    return wakeBaseline[mic];
+}
+
+/**
+ * ADC counts over which a sample of the mic is loud
+ */
+int getMicThreshold(int mic){
+    return wakeThreshold[mic];
+}
+
+/**
+ * start from baselines measured before, e.g. stored across a reset, so that onsets are caught
+ * before the first block is in. a negative baseline is left to be measured. they only stand in
+ * until that block, which replaces them rather than being averaged in
+ */
+void restoreMicBaselines(const float baselines[3]){
+    for(int mic = 0; mic < MIC_COUNT; mic++){
+        if(baselines[mic] >= 0){
+            wakeBaseline[mic] = baselines[mic];
+            wakeThreshold[mic] = (int)(wakeBaseline[mic] + MIC_BUMP_THRESHOLD);
+            baselinesRestored = true;
+        }
+    }
+}
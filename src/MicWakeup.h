@@ -0,0 +1,29 @@
+/**
+ * Header file for deciding when the mics have heard a bump
+ *
+ * fed one sample of every mic at a time from the ADC completion interrupt. a bump has started when
+ * any channel is over its threshold, MIC_BUMP_THRESHOLD above the channel's baseline, on
+ * MIC_ONSET_SAMPLES consecutive samples. the thresholds are kept as ADC counts, so each sample costs
+ * one integer compare per channel. the baselines follow the quiet samples at a low rate: the
+ * samples are only summed, and the baselines and thresholds refreshed once per block of them.
+ * a level that stays over the threshold for longer than any bump, across the holdoffs between
+ * its onsets, has the baselines measured afresh. nothing here touches the hardware
+ */
+#pragma once
+
+#define MIC_ONSET_SAMPLES 2 // consecutive samples over the threshold that make an onset, one is as likely noise
+
+/**
+ * function definitions
+ */
+void initMicWakeup();
+
+void rearmMicWakeup();
+
+bool micWakeSample(const int values[3]);
+
+float getMicBaseline(int mic);
+
+int getMicThreshold(int mic);
+
+void restoreMicBaselines(const float baselines[3]);
@@ -0,0 +1,122 @@
+#include <Arduino.h>
+#include "MotorDriver.h"
+#include "Tuning.h"
+#include "PinMap.h"
+#include "Sensing.h"
+#include "TractionMonitor.h"
+
+#define MOTOR_PWM_FREQUENCY 36621.09 // Hz, the highest the Teensy 4 PWM timers reach at 12 bits, well above hearing
+#define MAX_SLEW_GAP_US 20000        // longer gaps between commands are slewed as if they were this long
+
+ROBOT_STATE MotorOutput leftOutput;  // as last written to the pins
+ROBOT_STATE MotorOutput rightOutput;
+ROBOT_STATE double motorLeftCommand;  // slewed commands of the last call
+ROBOT_STATE double motorRightCommand;
+ROBOT_STATE uint32_t lastMotorUpdate;
+
+/**
+ * write both wheels' pins with interrupts held off, the ones that changed only. a direction only
+ * changes while the duty is zero, see nextMotorOutput()
+ */
+static FASTRUN void writeMotorOutputs(MotorOutput left, MotorOutput right){
+    noInterrupts();
+    if(right.forward != rightOutput.forward){
+        pinWriteFast(MotorA_DIR_PIN, right.forward ? HIGH : LOW);
+    }
+    if(left.forward != leftOutput.forward){
+        pinWriteFast(MotorB_DIR_PIN, left.forward ? HIGH : LOW);
+    }
+    if(right.duty != rightOutput.duty){
+        analogWrite(MotorA_PWM_PIN, right.duty);
+    }
+    if(left.duty != leftOutput.duty){
+        analogWrite(MotorB_PWM_PIN, left.duty);
+    }
+    interrupts();
+    leftOutput = left;
+    rightOutput = right;
+}
+
+/**
+ * setup the PWM and stop both wheels
+ */
+FLASHMEM void initMotorDriver(){
+    pinMode(MotorA_PWM_PIN, OUTPUT);
+    pinMode(MotorB_PWM_PIN, OUTPUT);
+    pinMode(MotorA_DIR_PIN, OUTPUT);
+    pinMode(MotorB_DIR_PIN, OUTPUT);
+    analogWriteResolution(MOTOR_PWM_BITS);
+    analogWriteFrequency(MotorA_PWM_PIN, MOTOR_PWM_FREQUENCY);
+    analogWriteFrequency(MotorB_PWM_PIN, MOTOR_PWM_FREQUENCY);
+
+    //write every pin once, whatever state they were left in
+    digitalWrite(MotorA_DIR_PIN, HIGH);
+    digitalWrite(MotorB_DIR_PIN, HIGH);
+    analogWrite(MotorA_PWM_PIN, 0);
+    analogWrite(MotorB_PWM_PIN, 0);
+    leftOutput = {0, true};
+    rightOutput = {0, true};
+    motorLeftCommand = 0;
+    motorRightCommand = 0;
+    lastMotorUpdate = micros();
+}
+
+/**
+ * the command moved from current towards target by at most maxStep, or all the way without a limit
+ */
+double slewCommand(double current, double target, double maxStep){
+    if(maxStep <= 0){
+        return target;
+    }
+    return constrain(target, current - maxStep, current + maxStep);
+}
+
+/**
+ * the output for a command, given the output applied last. a command of zero keeps the direction,
+ * and one the other way from a running wheel brings it to zero duty first
+ */
+MotorOutput nextMotorOutput(const MotorOutput & applied, double command){
+    MotorOutput output;
+    output.forward = command == 0 ? applied.forward : command > 0;
+    if(output.forward != applied.forward && applied.duty != 0){
+        output.forward = applied.forward;
+        output.duty = 0;
+        return output;
+    }
+    double magnitude = min(fabs(command), MOTOR_FULL_SCALE);
+    output.duty = (uint16_t)(magnitude/MOTOR_FULL_SCALE*MOTOR_DUTY_MAX + 0.5);
+    return output;
+}
+
+/**
+ * drive both wheels, a negative command drives that wheel backwards. to be called every tick
+ * while the wheels are to follow a command, so that the slew gets them there
+ */
+FASTRUN void setMotors(double leftCommand, double rightCommand){
+    uint32_t now = micros();
+    double maxStep = MOTOR_SLEW*min(now - lastMotorUpdate, (uint32_t)MAX_SLEW_GAP_US)/1000.0;
+    lastMotorUpdate = now;
+    leftCommand = limitTraction(LEFT, constrain(leftCommand, -MOTOR_FULL_SCALE, MOTOR_FULL_SCALE));
+    rightCommand = limitTraction(RIGHT, constrain(rightCommand, -MOTOR_FULL_SCALE, MOTOR_FULL_SCALE));
+    motorLeftCommand = slewCommand(motorLeftCommand, leftCommand, maxStep);
+    motorRightCommand = slewCommand(motorRightCommand, rightCommand, maxStep);
+    writeMotorOutputs(nextMotorOutput(leftOutput, motorLeftCommand), nextMotorOutput(rightOutput, motorRightCommand));
+}
+
+/**
+ * short both motors now, without waiting on the slew
+ */
+void brakeMotors(){
+    motorLeftCommand = 0;
+    motorRightCommand = 0;
+    lastMotorUpdate = micros();
+    writeMotorOutputs({0, leftOutput.forward}, {0, rightOutput.forward});
+}
+
+/**
+ * what the pins were last set to
+ */
+void getMotorOutputs(MotorOutput * left, MotorOutput * right){
+    *left = leftOutput;
+    *right = rightOutput;
+}
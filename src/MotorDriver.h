@@ -0,0 +1,42 @@
+/**
+ * Header file for the motor output stage
+ *
+ * both wheels are set from one call, each by a signed command on the scale the rest of the code
+ * is tuned in: MOTOR_FULL_SCALE is full duty forwards and its negative full duty backwards. the
+ * PWM runs above hearing with MOTOR_PWM_BITS of resolution, so a command keeps its fraction
+ * instead of being cut to a whole step of 255. a command may change by at most MOTOR_SLEW per ms
+ * (see Tuning.h), and a wheel only changes direction from zero duty: one told to go the other way
+ * is held at zero for that call and turned around on the next, so the driver never sees its
+ * direction pin flip under a running duty. the pins of both wheels are written together with
+ * interrupts held off. zero duty shorts the motor on this driver, which is the active brake that
+ * brakeMotors() applies at once, whatever the slew. a wheel that lost its grip on the floor is held
+ * under the ceiling TractionMonitor.h sets it. the slew, brake and sign logic touch nothing of the
+ * hardware
+ */
+#pragma once
+
+#include <stdint.h>
+
+#define MOTOR_FULL_SCALE 255.0 // command of full duty
+#define MOTOR_PWM_BITS 12
+#define MOTOR_DUTY_MAX ((1 << MOTOR_PWM_BITS) - 1)
+
+struct MotorOutput {
+    uint16_t duty;  // 0 to MOTOR_DUTY_MAX
+    bool forward;   // level of the direction pin, HIGH drives the wheel forwards
+};
+
+/**
+ * function definitions
+ */
+void initMotorDriver();
+
+double slewCommand(double current, double target, double maxStep);
+
+MotorOutput nextMotorOutput(const MotorOutput & applied, double command);
+
+void setMotors(double leftCommand, double rightCommand);
+
+void brakeMotors();
+
+void getMotorOutputs(MotorOutput * left, MotorOutput * right);
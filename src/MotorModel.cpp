@@ -0,0 +1,248 @@
+#include <Arduino.h>
+#include "MotorModel.h"
+#include "Sensing.h"
+#include "SensorLog.h"
+#include "MotorDriver.h"
+#include "TractionMonitor.h"
+
+#define FIT_REST_US 300000      // a wheel is braked at least this long between steps
+#define FIT_REST_MAX_US 1000000 // and starts the next step after this long even if it still creeps
+#define FIT_MIN_RATE 50         // ticks per second a step has to settle at to count as turning the wheel
+
+//each wheel is stepped from rest to these in turn
+const double fitCommands[FIT_COMMAND_COUNT] = {70, 120, 170, 220};
+
+//the drivetrain the simulator models: 15 rad/s at full duty, 6 % deadband, 1796 ticks a wheel turn
+const MotorModel defaultMotorModel = {17.89, 0.06, 0, 15.3};
+
+ROBOT_STATE MotorModel motorModels[2];  // left, right
+ROBOT_STATE bool motorModelsFitted;
+ROBOT_STATE bool fitRunning;
+ROBOT_STATE int fitWheel;               // 0 left, 1 right
+ROBOT_STATE int fitCommand;             // into fitCommands
+ROBOT_STATE bool fitResting;
+ROBOT_STATE uint32_t fitPhaseStart;
+ROBOT_STATE uint32_t fitNextSample;
+ROBOT_STATE StepResponse fitStep;
+ROBOT_STATE WheelFit fitWheels[2];
+
+FLASHMEM void initMotorModel(){
+    motorModels[0] = defaultMotorModel;
+    motorModels[1] = defaultMotorModel;
+    motorModelsFitted = false;
+    fitRunning = false;
+}
+
+const MotorModel & getMotorModel(int encoderID){
+    return motorModels[encoderID == LEFT ? 0 : 1];
+}
+
+bool motorModelFitted(){
+    return motorModelsFitted;
+}
+
+void restoreMotorModels(const MotorModel models[2], bool fitted){
+    motorModels[0] = models[0];
+    motorModels[1] = models[1];
+    motorModelsFitted = fitted;
+}
+
+/**
+ * the command that holds a wheel at a tick rate once it settled, 0 for a wheel at rest
+ */
+double motorFeedforward(int encoderID, double rate){
+    if(rate <= 0){
+        return 0;
+    }
+    const MotorModel & model = getMotorModel(encoderID);
+    return model.deadband + rate/model.gain;
+}
+
+/**
+ * the tick rate a command settles a wheel at, the model run forwards. negative backwards
+ */
+double motorRate(int encoderID, double command){
+    const MotorModel & model = getMotorModel(encoderID);
+    double magnitude = fabs(command);
+    double rate = magnitude > model.deadband ? model.gain*(magnitude - model.deadband) : 0;
+    return command < 0 ? -rate : rate;
+}
+
+void beginStepResponse(StepResponse * step, double command, uint32_t nowUs){
+    step->command = command;
+    step->startUs = nowUs;
+    step->count = 0;
+}
+
+/**
+ * keep a rate sample in the slot of the time it was taken. a slot skipped holds the sample before
+ * it, a second sample in a slot and those past the last slot are dropped
+ */
+void addStepSample(StepResponse * step, double rate, uint32_t nowUs){
+    uint32_t slot = (nowUs - step->startUs)/FIT_SAMPLE_US;
+    if(slot >= FIT_STEP_SAMPLES || (int)slot < step->count){
+        return;
+    }
+    float held = step->count > 0 ? step->rates[step->count - 1] : 0;
+    while(step->count < (int)slot){
+        step->rates[step->count++] = held;
+    }
+    step->rates[step->count++] = rate;
+}
+
+void resetWheelFit(WheelFit * fit){
+    memset(fit, 0, sizeof(*fit));
+}
+
+/**
+ * seconds from the start of a step to the first sample at or past level, between two samples
+ */
+static double crossingTime(const StepResponse * step, double level){
+    for(int i = 0; i < step->count; i++){
+        if(step->rates[i] >= level){
+            double before = i > 0 ? step->rates[i - 1] : 0;
+            double fraction = step->rates[i] > before ? (level - before)/(step->rates[i] - before) : 1;
+            return (i - 1 + fraction)*FIT_SAMPLE_US*1e-6;
+        }
+    }
+    return step->count*FIT_SAMPLE_US*1e-6;
+}
+
+/**
+ * reduce a step from rest to its settled rate, over the last fifth of its samples, and the time
+ * constant and dead time of its rise. false when the wheel did not turn
+ */
+bool addStepToFit(const StepResponse * step, WheelFit * fit){
+    int tail = step->count/5;
+    if(tail == 0){
+        return false;
+    }
+    double settled = 0;
+    for(int i = step->count - tail; i < step->count; i++){
+        settled += step->rates[i];
+    }
+    settled /= tail;
+    if(settled < FIT_MIN_RATE){
+        return false;
+    }
+    double early = crossingTime(step, 0.283*settled);
+    double late = crossingTime(step, 0.632*settled);
+    double timeConstant = 1.5*(late - early);
+    fit->steps++;
+    fit->sumCommand += step->command;
+    fit->sumRate += settled;
+    fit->sumCommandSquared += step->command*step->command;
+    fit->sumCommandRate += step->command*settled;
+    fit->sumTimeConstant += timeConstant;
+    fit->sumDeadTime += max(0.0, late - timeConstant);
+    return true;
+}
+
+/**
+ * the model of a wheel from the steps that turned it, at least two at different commands
+ */
+bool finishWheelFit(const WheelFit * fit, MotorModel * model){
+    double spread = fit->steps*fit->sumCommandSquared - fit->sumCommand*fit->sumCommand;
+    if(fit->steps < 2 || spread <= 0){
+        return false;
+    }
+    double gain = (fit->steps*fit->sumCommandRate - fit->sumCommand*fit->sumRate)/spread;
+    double offset = (fit->sumRate - gain*fit->sumCommand)/fit->steps;
+    if(gain <= 0){
+        return false;
+    }
+    model->gain = gain;
+    model->deadband = max(0.0, -offset/gain);
+    model->timeConstant = fit->sumTimeConstant/fit->steps;
+    model->deadTime = fit->sumDeadTime/fit->steps;
+    return true;
+}
+
+/**
+ * start a fit of both wheels, run by continueMotorFit(). false while one is under way
+ */
+bool startMotorFit(){
+    if(fitRunning){
+        return false;
+    }
+    fitRunning = true;
+    resetTraction();//the steps are the drive's own answer, not cut short by a limit left from before
+    fitWheel = 0;
+    fitCommand = 0;
+    fitResting = true;
+    fitPhaseStart = micros();
+    fitNextSample = fitPhaseStart;
+    resetWheelFit(&fitWheels[0]);
+    resetWheelFit(&fitWheels[1]);
+    return true;
+}
+
+static void finishMotorFit(){
+    fitRunning = false;
+    brakeMotors();
+    MotorModel models[2];
+    for(int wheel = 0; wheel < 2; wheel++){
+        if(!finishWheelFit(&fitWheels[wheel], &models[wheel])){
+            Serial.printf("drivetrain fit failed: the %s wheel did not turn at two of the commands\n", wheel == 0 ? "left" : "right");
+            return;
+        }
+    }
+    restoreMotorModels(models, true);
+    for(int wheel = 0; wheel < 2; wheel++){
+        Serial.printf("%s wheel: gain %.4g ticks/s per command, time constant %.3f s, dead time %.4f s, deadband %.1f\n",
+            wheel == 0 ? "left" : "right", models[wheel].gain, models[wheel].timeConstant, models[wheel].deadTime, models[wheel].deadband);
+    }
+    Serial.printf("right to left gain %.3f, save to keep the fit\n", models[1].gain/models[0].gain);
+}
+
+/**
+ * called once per loop() in place of the state machine. waits for and runs the next sample of a
+ * fit under way and returns true, false when there is none
+ */
+bool continueMotorFit(){
+    if(!fitRunning){
+        return false;
+    }
+    //one sample per tick, the loop has nothing else to run meanwhile and a tick of its own per wait
+    //would only fill the log
+    int32_t early = (int32_t)(fitNextSample - micros());
+    if(early > 0){
+        delayMicroseconds(early);
+    }
+    uint32_t now = micros();
+    fitNextSample += FIT_SAMPLE_US;
+    int encoder = fitWheel == 0 ? LEFT : RIGHT;
+    double rate = getWheelTickRate(encoder);
+
+    if(fitResting){
+        brakeMotors();
+        uint32_t rested = now - fitPhaseStart;
+        if(rested < FIT_REST_US || (rate > 0 && rested < FIT_REST_MAX_US)){
+            return true;
+        }
+        fitResting = false;
+        double command = fitCommands[fitCommand];
+        logSensorRecord(LOG_MOTOR_STEP, fitWheel, (int32_t)(command*1e3));
+        beginStepResponse(&fitStep, command, now);
+        fitNextSample = now + FIT_SAMPLE_US;
+        rate = 0;//at rest
+    }
+    addStepSample(&fitStep, rate, now);
+    if(fitStep.count < FIT_STEP_SAMPLES){
+        setMotors(fitWheel == 0 ? fitStep.command : 0, fitWheel == 1 ? fitStep.command : 0);
+        return true;
+    }
+
+    addStepToFit(&fitStep, &fitWheels[fitWheel]);
+    fitResting = true;
+    fitPhaseStart = now;
+    brakeMotors();
+    if(++fitCommand == FIT_COMMAND_COUNT){
+        fitCommand = 0;
+        if(++fitWheel == 2){
+            finishMotorFit();
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,87 @@
+/**
+ * Header file for the model of each wheel's drive and fitting it from step responses
+ *
+ * each wheel is taken as first order plus dead time: a command c above the deadband d drives the
+ * wheel towards gain*(c - d) ticks per second, which it follows after the dead time with the time
+ * constant, and below the deadband it does not turn. the two wheels are fitted apart, the ratio of
+ * their gains is the asymmetry the steering otherwise has to take out. motorFeedforward() inverts
+ * the model, the command that holds a wheel at a tick rate, e.g. for WheelSpeed.h, and motorRate()
+ * runs it forwards. until a fit the model is that of the drivetrain the simulator models, a fit is
+ * stored with save (Persist.h).
+ *
+ * fit motors on the serial console (TuningConsole.h) runs the fit in place of the state machine:
+ * with the other wheel braked, each wheel in turn is stepped from rest to each of FIT_COMMANDS
+ * and its tick rate sampled every FIT_SAMPLE_US. the robot turns about the braked wheel, so give
+ * it room or lift it. each step is reduced to its settled rate and the times it took to 28.3 and
+ * 63.2 percent of it, which give the time constant and the dead time (two point method). gain and
+ * deadband are the line through the settled rates against the commands. only one step's samples
+ * are kept, so memory is bounded however many steps are run. the fit writes LOG_MOTOR_STEP at
+ * each step and the rates as LOG_WHEEL_RATE_*, and the same functions fit a recorded log on the
+ * host (sim fit)
+ */
+#pragma once
+
+#include <stdint.h>
+
+#define FIT_SAMPLE_US 2500     // between rate samples of a step
+#define FIT_STEP_SAMPLES 200   // of a step, 0.5 s
+#define FIT_COMMAND_COUNT 4
+
+struct MotorModel {
+    double gain;          // ticks per second per command above the deadband
+    double timeConstant;  // s
+    double deadTime;      // s
+    double deadband;      // command below which the wheel does not turn
+};
+
+/**
+ * the samples of one step, from the moment the command was written
+ */
+struct StepResponse {
+    double command;
+    uint32_t startUs;
+    int count;                        // samples taken, a gap holds the one before
+    float rates[FIT_STEP_SAMPLES];    // ticks per second
+};
+
+/**
+ * what the steps of one wheel came to so far
+ */
+struct WheelFit {
+    int steps;                 // that turned the wheel
+    double sumCommand;         // of those, for the line through the settled rates
+    double sumRate;
+    double sumCommandSquared;
+    double sumCommandRate;
+    double sumTimeConstant;
+    double sumDeadTime;
+};
+
+/**
+ * function definitions
+ */
+void initMotorModel();
+
+const MotorModel & getMotorModel(int encoderID);
+
+bool motorModelFitted();
+
+void restoreMotorModels(const MotorModel models[2], bool fitted);
+
+double motorFeedforward(int encoderID, double rate);
+
+double motorRate(int encoderID, double command);
+
+void beginStepResponse(StepResponse * step, double command, uint32_t nowUs);
+
+void addStepSample(StepResponse * step, double rate, uint32_t nowUs);
+
+void resetWheelFit(WheelFit * fit);
+
+bool addStepToFit(const StepResponse * step, WheelFit * fit);
+
+bool finishWheelFit(const WheelFit * fit, MotorModel * model);
+
+bool startMotorFit();
+
+bool continueMotorFit();
@@ -0,0 +1,15 @@
+/**
+ * Header file for robot geometry shared by the odometry users
+ */
+#pragma once
+
+#include <math.h>
+
+#define AXLE_WIDTH_MM 160.0
+#define WHEEL_DIAMETER_MM 80.0
+#define LINE_SENSOR_OFFSET_MM 70.0   // axle to QTR bar
+#define LINE_SENSOR_SPACING_MM 19.05 // between the used QTR channels, 1000 counts of line position
+
+//the ISRs in Sensing.cpp count rising edges on both channels of the 12 CPR motor encoder: 24 per motor rev, 74.83:1 gearbox
+#define ENCODER_TICKS_PER_WHEEL_REV (24*74.83)
+#define MM_PER_TICK (M_PI*WHEEL_DIAMETER_MM/ENCODER_TICKS_PER_WHEEL_REV)
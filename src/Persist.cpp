@@ -0,0 +1,275 @@
+#include <Arduino.h>
+#include <EEPROM.h>
+#include "Persist.h"
+#include "Tuning.h"
+#include "HeadingEstimator.h"
+#include "MicWakeup.h"
+#include "MotorModel.h"
+#include "Sensing.h"
+
+#define PERSIST_MAGIC 0x5453524C   // "LRST"
+#define PERSIST_SCALE_STEP 0.002   // the stored wheel base scale is only rewritten once it moved this much, to spare the flash
+
+struct PersistHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t length;        // bytes of the whole image, CRC included
+    uint32_t tunableLayout; // getTunableLayout() of the build that wrote it
+};
+
+struct PersistCalibration {
+    double wheelBaseScale;
+    double wheelBaseVariance;
+    float micBaselines[3];  // negative when not measured yet
+    uint32_t reserved;
+};
+
+struct PersistDrivetrain {
+    MotorModel wheels[2];   // left, right
+    uint32_t fitted;        // 0 while they are the defaults
+    uint32_t reserved;
+};
+
+static_assert(sizeof(PersistHeader) == 12, "the image layout is stored, bump PERSIST_VERSION on any change");
+static_assert(sizeof(PersistCalibration) == 32, "the image layout is stored, bump PERSIST_VERSION on any change");
+static_assert(sizeof(PersistDrivetrain) == 72, "the image layout is stored, bump PERSIST_VERSION on any change");
+
+ROBOT_STATE uint8_t storedImage[PERSIST_IMAGE_MAX]; // as last restored or saved, packed at boot when nothing was restored
+ROBOT_STATE int storedLength;                       // 0 when the EEPROM holds no valid image
+ROBOT_STATE int keptLength;                         // of storedImage, 0 before restorePersistedState()
+ROBOT_STATE uint8_t savingImage[PERSIST_IMAGE_MAX]; // being written by continuePersistedSave()
+ROBOT_STATE int savingLength;                       // 0 when no save is under way
+ROBOT_STATE int savingAt;                           // bytes of it checked so far
+
+/**
+ * bytes of the image for the tunables of this build
+ */
+static int persistedLength(){
+    return sizeof(PersistHeader) + sizeof(PersistCalibration) + sizeof(PersistDrivetrain) + getTunableCount()*sizeof(double) + sizeof(uint32_t);
+}
+
+/**
+ * CRC-32 as zlib computes it, bit by bit as the image is only checked once per boot
+ */
+uint32_t persistCrc32(const uint8_t * data, int length){
+    uint32_t crc = 0xffffffff;
+    for(int i = 0; i < length; i++){
+        crc ^= data[i];
+        for(int bit = 0; bit < 8; bit++){
+            crc = (crc >> 1) ^ (0xedb88320 & (0 - (crc & 1)));
+        }
+    }
+    return ~crc;
+}
+
+/**
+ * what the robot learned by itself: the wheel base scale and the mic baselines
+ */
+static void packCalibration(PersistCalibration * calibration){
+    memset(calibration, 0, sizeof(*calibration));
+    calibration->wheelBaseScale = getWheelBaseScale();
+    calibration->wheelBaseVariance = getWheelBaseScaleVariance();
+    for(int mic = 0; mic < 3; mic++){
+        calibration->micBaselines[mic] = getMicBaseline(mic);
+    }
+}
+
+/**
+ * write the image of the current state into image. returns its length, 0 when size is too small
+ */
+int packPersistedState(uint8_t * image, int size){
+    int length = persistedLength();
+    if(length > size){
+        return 0;
+    }
+    PersistHeader header = {PERSIST_MAGIC, PERSIST_VERSION, (uint16_t)length, getTunableLayout()};
+    PersistCalibration calibration;
+    packCalibration(&calibration);
+    PersistDrivetrain drivetrain;
+    memset(&drivetrain, 0, sizeof(drivetrain));
+    drivetrain.wheels[0] = getMotorModel(LEFT);
+    drivetrain.wheels[1] = getMotorModel(RIGHT);
+    drivetrain.fitted = motorModelFitted();
+    uint8_t * at = image;
+    memcpy(at, &header, sizeof(header));
+    at += sizeof(header);
+    memcpy(at, &calibration, sizeof(calibration));
+    at += sizeof(calibration);
+    memcpy(at, &drivetrain, sizeof(drivetrain));
+    at += sizeof(drivetrain);
+    for(int i = 0; i < getTunableCount(); i++){
+        double value = 0;
+        getTunable(getTunableName(i), &value);
+        memcpy(at, &value, sizeof(value));
+        at += sizeof(value);
+    }
+    uint32_t crc = persistCrc32(image, at - image);
+    memcpy(at, &crc, sizeof(crc));
+    return length;
+}
+
+/**
+ * check an image and, only when it is whole and of this build, restore the state it holds
+ */
+PersistStatus unpackPersistedState(const uint8_t * image, int size){
+    PersistHeader header;
+    if(size < (int)sizeof(header)){
+        return PERSIST_MISSING;
+    }
+    memcpy(&header, image, sizeof(header));
+    if(header.magic != PERSIST_MAGIC){
+        return PERSIST_MISSING;
+    }
+    if(header.length > size || header.length < sizeof(header) + sizeof(uint32_t)){
+        return PERSIST_CORRUPT;
+    }
+    uint32_t crc;
+    memcpy(&crc, image + header.length - sizeof(crc), sizeof(crc));
+    if(crc != persistCrc32(image, header.length - sizeof(crc))){
+        return PERSIST_CORRUPT;
+    }
+    if(header.version != PERSIST_VERSION || header.tunableLayout != getTunableLayout() || header.length != persistedLength()){
+        return PERSIST_STALE;
+    }
+
+    const uint8_t * at = image + sizeof(header);
+    PersistCalibration calibration;
+    memcpy(&calibration, at, sizeof(calibration));
+    at += sizeof(calibration);
+    PersistDrivetrain drivetrain;
+    memcpy(&drivetrain, at, sizeof(drivetrain));
+    at += sizeof(drivetrain);
+    for(int i = 0; i < getTunableCount(); i++){
+        double value;
+        memcpy(&value, at, sizeof(value));
+        at += sizeof(value);
+        setTunable(getTunableName(i), value);
+    }
+    restoreWheelBaseScale(calibration.wheelBaseScale, calibration.wheelBaseVariance);
+    restoreMicBaselines(calibration.micBaselines);
+    restoreMotorModels(drivetrain.wheels, drivetrain.fitted != 0);
+    return PERSIST_OK;
+}
+
+const char * persistStatusName(PersistStatus status){
+    switch(status){
+        case PERSIST_OK: return "restored";
+        case PERSIST_MISSING: return "missing";
+        case PERSIST_STALE: return "stale";
+        case PERSIST_CORRUPT: return "corrupt";
+    }
+    return "?";
+}
+
+/**
+ * read the image from EEPROM and restore what it holds. to be called once the modules it restores
+ * into are initialised, the mic interrupt may already be running
+ */
+FLASHMEM PersistStatus restorePersistedState(){
+    int size = min(PERSIST_IMAGE_MAX, EEPROM.length());
+    for(int i = 0; i < size; i++){
+        storedImage[i] = EEPROM.read(i);
+    }
+    noInterrupts();//the mic baselines are read by the mic interrupt
+    PersistStatus status = unpackPersistedState(storedImage, size);
+    interrupts();
+    storedLength = status == PERSIST_OK ? persistedLength() : 0;
+    keptLength = status == PERSIST_OK ? storedLength : packPersistedState(storedImage, PERSIST_IMAGE_MAX);//the defaults
+    savingLength = 0;
+    return status;
+}
+
+/**
+ * write the length bytes packed into savingImage, unless the EEPROM holds them already
+ */
+static bool startSave(int length){
+    savingLength = 0;
+    if(length == 0){
+        return false;
+    }
+    if(storedLength == length){
+        PersistCalibration stored;
+        memcpy(&stored, storedImage + sizeof(PersistHeader), sizeof(stored));
+        int restAt = sizeof(PersistHeader) + sizeof(PersistCalibration);//the drivetrain and the tunables
+        bool restSame = memcmp(savingImage + restAt, storedImage + restAt, length - restAt - sizeof(uint32_t)) == 0;
+        if(restSame && fabs(getWheelBaseScale() - stored.wheelBaseScale) < PERSIST_SCALE_STEP){
+            return false;
+        }
+    }
+    savingLength = length;
+    savingAt = 0;
+    return true;
+}
+
+/**
+ * start storing the current state when it differs from what the EEPROM holds by more than the
+ * drift of the mic baselines and the wheel base scale. the image is taken now and written by
+ * continuePersistedSave(), a save under way starts over with it. true when there is anything to write
+ */
+bool beginPersistedSave(){
+    return startSave(packPersistedState(savingImage, min(PERSIST_IMAGE_MAX, EEPROM.length())));
+}
+
+/**
+ * like beginPersistedSave(), but only the wheel base scale and the mic baselines are taken now.
+ * the drivetrain and the tunables stay as last restored or saved, or at their defaults, so that a
+ * tunable set or a motor fit made over Serial is only kept by save
+ */
+bool beginCalibrationSave(){
+    int length = keptLength <= min(PERSIST_IMAGE_MAX, EEPROM.length()) ? keptLength : 0;
+    if(length > 0){
+        memcpy(savingImage, storedImage, length);
+        PersistCalibration calibration;
+        packCalibration(&calibration);
+        memcpy(savingImage + sizeof(PersistHeader), &calibration, sizeof(calibration));
+        uint32_t crc = persistCrc32(savingImage, length - sizeof(crc));
+        memcpy(savingImage + length - sizeof(crc), &crc, sizeof(crc));
+    }
+    return startSave(length);
+}
+
+/**
+ * write at most maxWrites more bytes of the save begun, skipping those the EEPROM already holds.
+ * a byte takes tens of us of flash programming, so the control loop writes a few per tick. true
+ * while the save is under way, a reset before it is done leaves an image that fails the CRC
+ */
+bool continuePersistedSave(int maxWrites){
+    while(savingAt < savingLength && maxWrites > 0){
+        if(EEPROM.read(savingAt) != savingImage[savingAt]){
+            EEPROM.write(savingAt, savingImage[savingAt]);
+            maxWrites--;
+        }
+        savingAt++;
+    }
+    if(savingLength > 0 && savingAt == savingLength){
+        memcpy(storedImage, savingImage, savingLength);
+        storedLength = savingLength;
+        keptLength = savingLength;
+        savingLength = 0;
+    }
+    return savingLength > 0;
+}
+
+/**
+ * store the current state at once, see beginPersistedSave(). true when anything was written
+ */
+bool savePersistedState(){
+    if(!beginPersistedSave()){
+        return false;
+    }
+    while(continuePersistedSave(PERSIST_IMAGE_MAX)){
+    }
+    return true;
+}
+
+/**
+ * store the calibration at once, see beginCalibrationSave(). true when anything was written
+ */
+bool saveCalibration(){
+    if(!beginCalibrationSave()){
+        return false;
+    }
+    while(continuePersistedSave(PERSIST_IMAGE_MAX)){
+    }
+    return true;
+}
@@ -0,0 +1,50 @@
+/**
+ * Header file for keeping what the robot learned and how it is tuned across resets
+ *
+ * one image in EEPROM holds the wheel base scale the heading estimator learned and how well it is
+ * known, the mic baselines, the model of each wheel's drive (MotorModel.h), and every tunable. it
+ * starts with a magic number, the layout version and the layout of TUNABLE_LIST (see
+ * getTunableLayout()), and ends with a CRC-32 of the rest. an erased or foreign image is missing,
+ * one of another version or another build's tunables is stale, one that fails the CRC is corrupt,
+ * and none of them is restored: the robot then calibrates as if new. packing and unpacking work on
+ * a byte buffer and can be checked on the host (sim boot), only restoring and saving touch the
+ * EEPROM. a save can be spread over ticks of the control loop, see continuePersistedSave(). the
+ * robot saves what it calibrated by itself with the drivetrain and tunables as they were last
+ * kept, see beginCalibrationSave(), everything else is only saved on request
+ */
+#pragma once
+
+#include <stdint.h>
+
+#define PERSIST_VERSION 2        // of the layout below the header, bump on any change to it
+#define PERSIST_IMAGE_MAX 512    // bytes of EEPROM the image may take, from address 0
+
+enum PersistStatus : uint8_t {
+    PERSIST_OK = 0,
+    PERSIST_MISSING,   // no image, e.g. a new board
+    PERSIST_STALE,     // written by a build with another layout or other tunables
+    PERSIST_CORRUPT    // the CRC does not match, e.g. a write cut short by a reset
+};
+
+/**
+ * function definitions
+ */
+uint32_t persistCrc32(const uint8_t * data, int length);
+
+int packPersistedState(uint8_t * image, int size);
+
+PersistStatus unpackPersistedState(const uint8_t * image, int size);
+
+const char * persistStatusName(PersistStatus status);
+
+PersistStatus restorePersistedState();
+
+bool beginPersistedSave();
+
+bool beginCalibrationSave();
+
+bool continuePersistedSave(int maxWrites);
+
+bool savePersistedState();
+
+bool saveCalibration();
@@ -0,0 +1,49 @@
+/**
+ * Header file for the pins the robot is wired to, and fast access to the digital ones
+ *
+ * every pin is named here, see the PINS list in main.cpp for what is free. on the Teensy 4 the
+ * core names each pin's GPIO registers after its number, and pinWriteFast() and pinReadFast()
+ * paste the number into those names at compile time: a write is one store to the port's set or
+ * clear register and a read one load, where digitalWrite() and digitalRead() look the pin up in
+ * a table first. the pin has to be one of the numbers below, not a variable. in the simulator they
+ * are digitalWrite() and digitalRead()
+ */
+#pragma once
+
+#include <Arduino.h>
+
+//motor driver, MotorA drives the right wheel and MotorB the left
+#define MotorA_DIR_PIN 10 // Direction Pin
+#define MotorA_PWM_PIN 11 // PWM Pin
+#define MotorB_DIR_PIN 9 // Direction Pin
+#define MotorB_PWM_PIN 8 // PWM Pin make sure the PWM pins actually support that signal
+
+//quadrature encoders, both channels of each count
+#define ENCODER_LEFT_PIN_A 1
+#define ENCODER_LEFT_PIN_B 2
+#define ENCODER_RIGHT_PIN_A 4
+#define ENCODER_RIGHT_PIN_B 5
+
+#define TRIGGER_PIN 13
+#define ECHO_PIN 14
+
+#define MIC_PIN_0 15
+#define MIC_PIN_1 16
+#define MIC_PIN_2 17
+
+//QTR board, every other channel. 18 to 20 are all on one GPIO port, so a poll of them is one load
+#define IR_PIN_1 18
+#define IR_PIN_3 19
+#define IR_PIN_5 20
+#define IR_EMITTER_PIN 12
+
+#if defined(__IMXRT1062__)
+#define PIN_REGISTER(pin, name) PIN_REGISTER_PASTE(pin, name) // expands pin to its number first
+#define PIN_REGISTER_PASTE(pin, name) CORE_PIN##pin##_##name
+#define pinWriteFast(pin, level) ((level) ? (void)(PIN_REGISTER(pin, PORTSET) = PIN_REGISTER(pin, BITMASK)) \
+                                          : (void)(PIN_REGISTER(pin, PORTCLEAR) = PIN_REGISTER(pin, BITMASK)))
+#define pinReadFast(pin) ((PIN_REGISTER(pin, PINREG) & PIN_REGISTER(pin, BITMASK)) ? HIGH : LOW)
+#else
+#define pinWriteFast(pin, level) digitalWrite(pin, level)
+#define pinReadFast(pin) digitalRead(pin)
+#endif
@@ -0,0 +1,16 @@
+/**
+ * build platform helpers shared by all modules
+ */
+#pragma once
+
+/**
+ * storage class for mutable robot state (file-scope globals of the control code).
+ * on the Teensy there is one robot and this expands to nothing. in the native simulator build
+ * every worker thread hosts its own robot, so the state is made thread local and each simulated
+ * run is fully isolated from runs on other threads
+ */
+#ifdef NATIVE_SIM
+#define ROBOT_STATE thread_local
+#else
+#define ROBOT_STATE
+#endif
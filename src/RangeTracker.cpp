@@ -0,0 +1,187 @@
+#include <Arduino.h>
+#include "RangeTracker.h"
+#include "Sensing.h"
+#include "Tuning.h"
+#include "Odometry.h"
+#include "LineFollowing.h"
+#include "SpeedPerPwm.h"
+
+#define RANGE_ALPHA 0.6             // share of a reading's residual taken into the range
+#define RANGE_BETA 0.26             // share taken into the range rate, critically damped for RANGE_ALPHA
+#define RANGE_GATE 0.05             // m, a reading further than this from the prediction is held back
+#define RANGE_GATE_GROWTH 0.3       // m/s, the gate widens with the time since the last accepted reading
+#define MAX_RANGE_RATE 0.8          // m/s, fastest an obstacle is expected to close or recede
+#define MAX_MISSES 3                // readings without an echo before the track is dropped
+#define CONFIRM_READINGS 4          // readings in a new track before it is believed
+#define MAX_PREDICT_MS 300          // never extrapolate the range further than this
+#define BRAKE_MARGIN 0.02           // m, come to rest this far before BLOCKAGE_TOLERANCE
+#define BRAKE_LATENCY_S 0.06        // s the motors take to respond to a lower PWM
+#define BRAKE_CREEP_SPEED 60.0      // mm/s the last of the braking curve is driven at, well out of the deadband
+
+ROBOT_STATE bool trackValid;
+ROBOT_STATE double trackRange; // m at trackTime
+ROBOT_STATE double trackRate;  // m/s, negative while the obstacle closes in
+ROBOT_STATE uint32_t trackTime;
+ROBOT_STATE int trackMisses;
+ROBOT_STATE int trackReadings;
+
+//a reading that did not fit the track, kept until the next reading confirms or replaces it
+ROBOT_STATE bool candidateValid;
+ROBOT_STATE double candidateRange;
+ROBOT_STATE uint32_t candidateTime;
+ROBOT_STATE int candidateReadings;
+
+ROBOT_STATE bool brakeValid;
+ROBOT_STATE int brakeLeftTicks;
+ROBOT_STATE int brakeRightTicks;
+ROBOT_STATE uint32_t brakeLastUs;
+ROBOT_STATE SpeedPerPwm brakeSpeed;
+ROBOT_STATE int brakedPwm;           // base PWM returned last, what the wheels are running at
+
+FLASHMEM void initRangeTracker(){
+    trackValid = false;
+    candidateValid = false;
+    brakeValid = false;
+    resetSpeedPerPwm(&brakeSpeed);
+    brakedPwm = BASE_PWM;
+}
+
+/**
+ * forget the obstacle, e.g. after driving around it. the speed measurement is kept
+ */
+void dropRangeTrack(){
+    trackValid = false;
+    candidateValid = false;
+}
+
+/**
+ * feed one ultrasonic reading in metres, taken at now (ms). returns false if the reading was held
+ * back as a possible spurious echo, true if it was taken into the track or reported no echo
+ */
+bool updateRangeTracker(double distance, uint32_t now){
+    if(distance >= NO_ECHO_DISTANCE){
+        candidateValid = false;
+        if(trackValid && ++trackMisses > MAX_MISSES){
+            trackValid = false;
+        }
+        return true;
+    }
+
+    if(trackValid){
+        double dt = (now - trackTime)*1e-3;
+        double predicted = trackRange + trackRate*dt;
+        double residual = distance - predicted;
+        if(fabs(residual) <= RANGE_GATE + RANGE_GATE_GROWTH*dt){
+            trackRange = predicted + RANGE_ALPHA*residual;
+            if(dt > 0){
+                trackRate = constrain(trackRate + RANGE_BETA*residual/dt, -MAX_RANGE_RATE, MAX_RANGE_RATE);
+            }
+            trackTime = now;
+            trackMisses = 0;
+            trackReadings++;
+            candidateValid = false;
+            return true;
+        }
+    }
+
+    //no track, or the reading does not fit it: readings that agree with each other start a new one.
+    //two are enough on a clear path, replacing a believed track takes as many as believing it did
+    if(candidateValid){
+        double dt = (now - candidateTime)*1e-3;
+        if(fabs(distance - candidateRange) <= RANGE_GATE + MAX_RANGE_RATE*dt){
+            candidateReadings++;
+            candidateRange = distance;
+            candidateTime = now;
+            if(candidateReadings >= (rangeTracked() ? CONFIRM_READINGS : 2)){
+                trackValid = true;
+                trackRange = distance;
+                trackRate = 0;//the filter picks the rate up within a few readings, a difference of two noisy ones is no better
+                trackTime = now;
+                trackMisses = 0;
+                trackReadings = candidateReadings;
+                candidateValid = false;
+                return true;
+            }
+            return false;
+        }
+    }
+    candidateValid = true;
+    candidateReadings = 1;
+    candidateRange = distance;
+    candidateTime = now;
+    return false;
+}
+
+/**
+ * true once enough readings agree that there is an obstacle ahead
+ */
+bool rangeTracked(){
+    return trackValid && trackReadings >= CONFIRM_READINGS;
+}
+
+/**
+ * range to the tracked obstacle extrapolated to now (ms), NO_ECHO_DISTANCE without a track
+ */
+double predictRange(uint32_t now){
+    if(!rangeTracked()){
+        return NO_ECHO_DISTANCE;
+    }
+    uint32_t elapsed = min(now - trackTime, (uint32_t)MAX_PREDICT_MS);
+    return max(0.0, trackRange + trackRate*elapsed*1e-3);
+}
+
+/**
+ * m/s at which the tracked obstacle comes closer, negative while it moves away
+ */
+double getClosingSpeed(){
+    return rangeTracked() ? -trackRate : 0;
+}
+
+/**
+ * nearest range (m) the robot may have to stop short of: the tracked one, also while the track
+ * still waits for CONFIRM_READINGS. an obstacle first seen just past a bend is already close and
+ * the two agreeing readings that start a track leave more room to brake than the four that
+ * confirm it. a lone spurious echo never starts a track, so it does not slow the robot
+ */
+static double brakingRange(uint32_t now){
+    return trackValid && !rangeTracked() ? trackRange : predictRange(now);
+}
+
+/**
+ * limit the base PWM so the robot can still stop at BLOCKAGE_TOLERANCE from the nearest range.
+ * must be called every iteration while following the line
+ */
+int brakeForObstacle(int basePwm, int leftEncoderData, int rightEncoderData){
+    uint32_t now = micros();
+    double distance = 0;
+    if(!brakeValid || now - brakeLastUs > FOLLOWING_GAP_MS*1000
+        || leftEncoderData < brakeLeftTicks || rightEncoderData < brakeRightTicks){
+        brakeValid = true;
+        restartSpeedWindow(&brakeSpeed, now);
+    }
+    else{
+        distance = (leftEncoderData - brakeLeftTicks + rightEncoderData - brakeRightTicks)*MM_PER_TICK/2;
+    }
+    brakeLeftTicks = leftEncoderData;
+    brakeRightTicks = rightEncoderData;
+    brakeLastUs = now;
+
+    //speed per PWM at the current operating point, for turning a speed limit into a PWM limit
+    double speedPerPwm = updateSpeedPerPwm(&brakeSpeed, distance, brakedPwm, now);
+
+    brakedPwm = basePwm;
+    double range = brakingRange(millis());
+    if(range >= NO_ECHO_DISTANCE || speedPerPwm <= 0 || OBSTACLE_BRAKE_ACCEL <= 0){
+        return brakedPwm;
+    }
+    //fastest speed from which the robot, reacting after BRAKE_LATENCY_S, stops within the gap
+    double gap = max(0.0, (range - BLOCKAGE_TOLERANCE - BRAKE_MARGIN)*1000);
+    double reaction = OBSTACLE_BRAKE_ACCEL*BRAKE_LATENCY_S;
+    double allowed = sqrt(reaction*reaction + 2*OBSTACLE_BRAKE_ACCEL*gap) - reaction;
+    //the curve runs down to a crawl rather than the MIN_PWM_FRACTION floor of the other limits, so
+    //the stop at BLOCKAGE_TOLERANCE is from walking pace and the robot still gets there. the crawl
+    //never asks for more than that floor, the ratio reads low while the robot is still spinning up
+    double limit = max(allowed/speedPerPwm, min(BRAKE_CREEP_SPEED/speedPerPwm, BASE_PWM*MIN_PWM_FRACTION));
+    brakedPwm = min(basePwm, (int)limit);
+    return brakedPwm;
+}
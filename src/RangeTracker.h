@@ -0,0 +1,33 @@
+/**
+ * Header file for the ultrasonic range tracker and obstacle braking
+ *
+ * the ultrasonic readings are run through an alpha-beta filter that tracks the range to the
+ * obstacle ahead and how fast it is closing. a reading far from the predicted range is held back
+ * until the next one confirms it, so a single spurious echo neither moves the track nor starts a
+ * new one, and missing echoes are bridged on the prediction for a few readings before the track
+ * is dropped. between readings the range is extrapolated, which lets the line follower limit its
+ * speed so that it can brake at OBSTACLE_BRAKE_ACCEL and come to rest at BLOCKAGE_TOLERANCE.
+ * braking starts on the second agreeing reading, before the track is believed. the transducer
+ * only sees straight ahead, so an obstacle just past a bend can first show up inside
+ * BLOCKAGE_TOLERANCE: the robot then stops as soon as the track is believed, closer than that
+ */
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * function definitions
+ */
+void initRangeTracker();
+
+void dropRangeTrack();
+
+bool updateRangeTracker(double distance, uint32_t now);
+
+bool rangeTracked();
+
+double predictRange(uint32_t now);
+
+double getClosingSpeed();
+
+int brakeForObstacle(int basePwm, int leftEncoderData, int rightEncoderData);
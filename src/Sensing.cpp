@@ -1,26 +1,50 @@
 #include "Arduino.h"
 #include "Sensing.h"
+#include "Tuning.h"
+#include "SensorLog.h"
+#include "AdcSampler.h"
+#include "LockIn.h"
+#include "LineFit.h"
+#include "Odometry.h"
+#include "PinMap.h"
+#include "SpscQueue.h"
 #include <QTRSensors.h> //for line following sensor
 
-#define TRIGGER_PIN 13
-#define ECHO_PIN 14
+#define ULTRASONIC_TIMEOUT_US 4000 // stop listening for the echo after this, ~0.8 m of range
+#define ENCODER_EDGE_QUEUE 64      // edges of both wheels in flight to loop(), a power of two
+#define ENCODER_STALL_US 100000    // a wheel without an edge for this long is taken to stand still
 
-#define MIC_PIN_0 15
-#define MIC_PIN_1 16
-#define MIC_PIN_2 17
+#define IR_PITCH_MM LINE_SENSOR_SPACING_MM // between neighbouring sensors in irPins, every other channel of the board
 
-#define IR_PIN_1 18
-#define IR_PIN_3 19
-#define IR_PIN_5 20
+//left to right. up to QTRMaxSensors, on as few GPIO ports as possible as each is sampled once per poll of a read
+const uint8_t irPins[] = {IR_PIN_1, IR_PIN_3, IR_PIN_5};
+#define IR_SENSOR_COUNT (int)(sizeof(irPins)/sizeof(irPins[0]))
 
 //declare private/helper functions
 void calcPos(void);
 
-QTRSensors qtr;
-uint16_t sensorValues[3];
+ROBOT_STATE QTRSensors qtr;
+ROBOT_STATE uint16_t sensorValues[IR_SENSOR_COUNT];
+ROBOT_STATE LineReading lastLine; // in the units of getLinePosition()
+ROBOT_STATE bool unscannableReported;
 
-volatile int countMotorLeft;
-volatile int countMotorRight;
+ROBOT_STATE volatile int countMotorLeft;
+ROBOT_STATE volatile int countMotorRight;
+
+/**
+ * an encoder edge as its interrupt saw it
+ */
+struct EncoderEdge {
+    uint32_t time; // micros()
+    int wheel;     // LEFT or RIGHT
+};
+
+//the encoder interrupts all come in through the one GPIO vector, so they are one producer
+ROBOT_STATE SpscQueue<EncoderEdge, ENCODER_EDGE_QUEUE> encoderEdges;
+ROBOT_STATE volatile uint32_t droppedEncoderEdges; // by the interrupts while the queue was full
+ROBOT_STATE uint32_t lastDroppedEdges;
+ROBOT_STATE uint32_t edgeTimes[2][2]; // last two edges of each wheel as drained from the queue, 0 until seen
+ROBOT_STATE uint32_t edgeSpan[2];     // us over the last two edges of each wheel, 0 until there are three
 
 
 //number of highs and lows per rotation of the motor shaft (PRE GEARBOX)
@@ -31,21 +55,44 @@ const double PERIOD_IN_MINUTES = PERIOD / 60000000;
 
 const double rpmConvert =  74.83;  // --taken from pololu reference data. TA says to just use 75
 
-double IRVal1MovingAverage;
-double IRVal3MovingAverage;
-double IRVal5MovingAverage;
+ROBOT_STATE double IRVal1MovingAverage;
+ROBOT_STATE double IRVal3MovingAverage;
+ROBOT_STATE double IRVal5MovingAverage;
 
 /**
  * interrupt functions for tick increments
  */
-void incrementLeftCount(){
+FASTRUN void incrementLeftCount(){
     countMotorLeft++;
+    if(!encoderEdges.push({micros(), LEFT})){
+        droppedEncoderEdges = droppedEncoderEdges + 1;
+    }
 }
-void incrementRightCount(){
+FASTRUN void incrementRightCount(){
     countMotorRight++;
+    if(!encoderEdges.push({micros(), RIGHT})){
+        droppedEncoderEdges = droppedEncoderEdges + 1;
+    }
+}
+
+/**
+ * converts the line sensors for QTRSensors should they be switched to analog. the library reads
+ * pins a scan cannot take with analogRead, which never returns once initAdcSampler() has handed
+ * the ADCs to ADC_ETC, so such pins are reported instead and read as white
+ */
+static bool scanLineSensors(const uint8_t * pins, uint8_t count, uint8_t samples, uint16_t * values){
+    if(adcScan(pins, count, samples, values)){
+        return true;
+    }
+    if(!unscannableReported){
+        unscannableReported = true;
+        Serial.println("error: the analog line sensors are not all on pins of both ADCs, see AdcSampler.h");
+    }
+    memset(values, 0, count*sizeof(values[0]));
+    return true;
 }
 
-void initSensing(){
+FLASHMEM void initSensing(){
     pinMode(TRIGGER_PIN, OUTPUT);
     pinMode(ECHO_PIN, INPUT);
 
@@ -53,26 +100,39 @@ void initSensing(){
     pinMode(MIC_PIN_1, INPUT);
     pinMode(MIC_PIN_2, INPUT);
 
-    pinMode(IR_PIN_1, INPUT);
-    pinMode(IR_PIN_3, INPUT);
-    pinMode(IR_PIN_5, INPUT);
+    for(int i = 0; i < IR_SENSOR_COUNT; i++){
+        pinMode(irPins[i], INPUT);
+    }
+    initAdcSampler();
     qtr.setTypeRC();
-    qtr.setSensorPins((const uint8_t[]){IR_PIN_1, IR_PIN_3, IR_PIN_5}, 3);
+    qtr.setSensorPins(irPins, IR_SENSOR_COUNT);
+    unscannableReported = false;
+    qtr.setAnalogScan(scanLineSensors);//converts both ADCs at once should the sensors be switched to analog
+    qtr.setEmitterPin(IR_EMITTER_PIN);
+    qtr.setNonDimmable();//dimmable emitters are switched off and on again for every emittersOn()
+    qtr.emittersOn();
+    initLockIn(IR_SENSOR_COUNT, qtr.getTimeout());
+    initLineFit(IR_SENSOR_COUNT, qtr.getTimeout());
+    memset(sensorValues, 0, sizeof(sensorValues));
 
     countMotorLeft = 0;
     countMotorRight = 0;
+    encoderEdges.clear();
+    memset(edgeTimes, 0, sizeof(edgeTimes));
+    memset(edgeSpan, 0, sizeof(edgeSpan));
+    lastDroppedEdges = droppedEncoderEdges;
 
-    pinMode(1, INPUT_PULLUP);
-    pinMode(2, INPUT_PULLUP);
-    pinMode(4, INPUT_PULLUP);
-    pinMode(5, INPUT_PULLUP);
+    pinMode(ENCODER_LEFT_PIN_A, INPUT_PULLUP);
+    pinMode(ENCODER_LEFT_PIN_B, INPUT_PULLUP);
+    pinMode(ENCODER_RIGHT_PIN_A, INPUT_PULLUP);
+    pinMode(ENCODER_RIGHT_PIN_B, INPUT_PULLUP);
 
 
-    attachInterrupt(digitalPinToInterrupt(1), incrementLeftCount, RISING);
-    attachInterrupt(digitalPinToInterrupt(2), incrementLeftCount, RISING);
+    attachInterrupt(digitalPinToInterrupt(ENCODER_LEFT_PIN_A), incrementLeftCount, RISING);
+    attachInterrupt(digitalPinToInterrupt(ENCODER_LEFT_PIN_B), incrementLeftCount, RISING);
 
-    attachInterrupt(digitalPinToInterrupt(4), incrementRightCount, RISING);
-    attachInterrupt(digitalPinToInterrupt(5), incrementRightCount, RISING);
+    attachInterrupt(digitalPinToInterrupt(ENCODER_RIGHT_PIN_A), incrementRightCount, RISING);
+    attachInterrupt(digitalPinToInterrupt(ENCODER_RIGHT_PIN_B), incrementRightCount, RISING);
 
     IRVal1MovingAverage = 1500;
     IRVal3MovingAverage = 1500;
@@ -92,52 +152,198 @@ void resetTickCounts(){
  * this function shouldn't need to be public or specified in header?
  */
 double getDistanceValue(){
-    digitalWrite(TRIGGER_PIN, HIGH);
-    delay(10);
-    digitalWrite(TRIGGER_PIN, LOW);
-    double the_time = pulseIn(ECHO_PIN, HIGH);
-    return the_time*0.0002 + 0.0069;//calculate a distance in meters and return
+    const SensorLogRecord * replayed = replaySensorRecord(LOG_DISTANCE);
+    if(replayed){
+        return replayed->values[0]*1e-6;
+    }
+    pinWriteFast(TRIGGER_PIN, HIGH);
+    delayMicroseconds(10);//the HC-SR04 needs a 10 us trigger pulse
+    pinWriteFast(TRIGGER_PIN, LOW);
+    double the_time = pulseIn(ECHO_PIN, HIGH, ULTRASONIC_TIMEOUT_US);
+    if(the_time == 0){
+        the_time = ULTRASONIC_TIMEOUT_US;//no echo in time, report the longest range measured
+    }
+    double distance = the_time*0.0002 + 0.0069;//calculate a distance in meters and return
+    logSensorRecord(LOG_DISTANCE, (int32_t)(distance*1e6));
+    return distance;
 }
 
-std::array<int, 3> getMicValues(){
-    std::array<int, 3> micValsArray = {analogRead(MIC_PIN_0), analogRead(MIC_PIN_1), analogRead(MIC_PIN_2)};
-    return micValsArray;
+/**
+ * start converting every mic at once, unlogged. done gets the samples in the order of
+ * MIC_FRONT_RIGHT, MIC_REAR, MIC_FRONT_LEFT. for the sampling interrupt in BumpLocator.cpp
+ */
+bool startMicScan(AdcScanDone done){
+    static const uint8_t micPins[3] = {MIC_PIN_0, MIC_PIN_1, MIC_PIN_2};
+    return adcStartScan(micPins, 3, done);
 }
 
-int getLinePosition(){
-    return (int) qtr.readLineBlack(sensorValues);;//1000 corresponds to middle sensor
+/**
+ * take one reading of the line sensors into sensorValues. with IR_LOCKIN the emitters alternate
+ * from one reading to the next and sensorValues gets the demodulated readings, see LockIn.h
+ */
+static void readLineSensors(){
+    if(!IR_LOCKIN){
+        qtr.emittersOn();//only waits for the emitters if they were left off
+        qtr.read(sensorValues, QTRReadMode::Manual);
+        return;
+    }
+    uint32_t now = micros();
+    bool emitterOn = lockInEmitterOn(now);
+    if(emitterOn){
+        qtr.emittersOn();
+    }
+    else{
+        qtr.emittersOff();
+    }
+    uint16_t readings[IR_SENSOR_COUNT];
+    qtr.read(readings, QTRReadMode::Manual);
+    pushLockInReading(readings, emitterOn, now);
+    getLockInValues(sensorValues);
+    //switch for the next reading now, so the emitters have settled by then without waiting
+    if(emitterOn){
+        qtr.emittersOff(QTREmitters::All, false);
+    }
+    else{
+        qtr.emittersOn(QTREmitters::All, false);
+    }
 }
 
+/**
+ * a position along the array as LineFit.h gives it in the units of getLinePosition()
+ */
+static int barUnits(int fitted, bool offset){
+    double centre = offset ? (IR_SENSOR_COUNT - 1)*500.0 : 0;
+    return (int)lround((offset ? 1000 : 0) + (fitted - centre)*IR_PITCH_MM/LINE_SENSOR_SPACING_MM);
+}
+
+/**
+ * where the line is under the array, from the readings getIRValues() took last. 1000 at the middle
+ * of the array and 1000 per LINE_SENSOR_SPACING_MM, lower to the left. the position is LineFit.h's
+ * with LINE_INTERPOLATION, else QTRSensors' weighted average. the rest of the fit is kept for
+ * getLineReading() either way
+ */
+FASTRUN int getLinePosition(){
+    const SensorLogRecord * replayed = replaySensorRecord(LOG_LINE_POSITION);
+    if(replayed){
+        lastLine.position = replayed->values[0];
+        lastLine.width = replayed->values[1];
+        lastLine.confidence = replayed->values[2];
+        const SensorLogRecord * lines = replaySensorRecord(LOG_LINES);
+        lastLine.lineCount = lines ? min((int)lines->values[0], LINE_MAX_LINES) : 1;
+        for(int i = 0; i < lastLine.lineCount; i++){
+            //only the outermost lines are logged
+            lastLine.lines[i] = lines ? lines->values[i == 0 ? 1 : 2] : lastLine.position;
+        }
+        return lastLine.position;
+    }
+    LineReading fitted;
+    fitLine(sensorValues, &fitted);
+    if(!LINE_INTERPOLATION){
+        fitted.position = qtr.readLineBlack(sensorValues);//uncalibrated, it averages the raw readings
+    }
+    lastLine.position = barUnits(fitted.position, true);
+    lastLine.width = barUnits(fitted.width, false);
+    lastLine.confidence = fitted.confidence;
+    lastLine.lineCount = fitted.lineCount;
+    for(int i = 0; i < fitted.lineCount; i++){
+        lastLine.lines[i] = barUnits(fitted.lines[i], true);
+    }
+    logSensorRecord(LOG_LINE_POSITION, lastLine.position, lastLine.width, lastLine.confidence);
+    logSensorRecord(LOG_LINES, lastLine.lineCount, lastLine.lineCount > 0 ? lastLine.lines[0] : 0,
+        lastLine.lineCount > 0 ? lastLine.lines[lastLine.lineCount - 1] : 0);
+    return lastLine.position;
+}
+
+/**
+ * the whole fit behind the last getLinePosition(): width, confidence and every line seen, e.g. both
+ * branches of a fork, in the same units
+ */
+const LineReading & getLineReading(){
+    return lastLine;
+}
 
 /**
  * function to return an array pointer of the raw IR sensor values
  */
 std::array<int, 3> getIRValues(){
-    qtr.read(sensorValues);//TODO: check if calling this is strictly necessary, values should be updated by readLineBlack but do not appear to be
-    std::array<int, 3> sensorValsArray = {sensorValues[0], sensorValues[1], sensorValues[2]};
+    const SensorLogRecord * replayed = replaySensorRecord(LOG_IR_VALUES);
+    if(replayed){
+        return {replayed->values[0], replayed->values[1], replayed->values[2]};
+    }
+    readLineSensors();//TODO: check if calling this is strictly necessary, values should be updated by readLineBlack but do not appear to be
+    //the two ends and the middle of the array
+    std::array<int, 3> sensorValsArray = {sensorValues[0], sensorValues[IR_SENSOR_COUNT/2], sensorValues[IR_SENSOR_COUNT - 1]};
+    logSensorRecord(LOG_IR_VALUES, sensorValsArray[0], sensorValsArray[1], sensorValsArray[2]);
     return sensorValsArray;
 }
 
 int getEncoderData(int encoderID){
+    uint8_t kind = encoderID == LEFT ? LOG_ENCODER_LEFT : LOG_ENCODER_RIGHT;
+    const SensorLogRecord * replayed = replaySensorRecord(kind);
+    if(replayed){
+        return replayed->values[0];
+    }
+    int count = 0;
     if(encoderID == LEFT){
-        return countMotorLeft;
+        count = countMotorLeft;
     }
     else if(encoderID == RIGHT){
-        return countMotorRight;
+        count = countMotorRight;
     }
-    return 0;
+    logSensorRecord(kind, count);
+    return count;
 }
 
+/**
+ * take the edges the interrupts queued since the last call. a wheel's speed is only trusted over
+ * edges that were all queued, it starts over when any were dropped
+ */
+static void drainEncoderEdges(){
+    uint32_t dropped = droppedEncoderEdges;
+    if(dropped != lastDroppedEdges){
+        lastDroppedEdges = dropped;
+        encoderEdges.clear();
+        memset(edgeTimes, 0, sizeof(edgeTimes));
+        memset(edgeSpan, 0, sizeof(edgeSpan));
+        return;
+    }
+    EncoderEdge edge;
+    while(encoderEdges.pop(&edge)){
+        uint32_t * times = edgeTimes[edge.wheel == LEFT ? 0 : 1];
+        edgeSpan[edge.wheel == LEFT ? 0 : 1] = times[1] != 0 ? edge.time - times[1] : 0;
+        times[1] = times[0];
+        times[0] = edge.time;
+    }
+}
 
-bool irValOffroad(int irVal1, int irVal3, int irVal5){
-    double tempIRval1 = IRVal1MovingAverage*999 + irVal1;
-    IRVal1MovingAverage = tempIRval1 / 1000;
-
-    double tempIRval3 = IRVal3MovingAverage*999 + irVal3;
-    IRVal3MovingAverage = tempIRval3 / 1000;
+/**
+ * encoder ticks per second of one wheel from the time over its last two edges, unsigned as the
+ * encoders count either way. the rising edges of the two channels are a quarter cycle apart, so
+ * only every second one is a whole cycle after another. it follows a change of speed within a
+ * tick, where counts taken over a window lag by half the window. 0 while the wheel stands still
+ */
+double getWheelTickRate(int encoderID){
+    uint8_t kind = encoderID == LEFT ? LOG_WHEEL_RATE_LEFT : LOG_WHEEL_RATE_RIGHT;
+    const SensorLogRecord * replayed = replaySensorRecord(kind);
+    if(replayed){
+        return replayed->values[0]*1e-3;
+    }
+    drainEncoderEdges();
+    int index = encoderID == LEFT ? 0 : 1;
+    uint32_t sinceEdge = micros() - edgeTimes[index][0];
+    double rate = 0;
+    //a wheel overdue for its next edge by more than the last cycle is slower than that already
+    if(edgeSpan[index] != 0 && sinceEdge <= ENCODER_STALL_US){
+        rate = 2e6/max(edgeSpan[index], sinceEdge);
+    }
+    logSensorRecord(kind, (int32_t)(rate*1e3));
+    return rate;
+}
 
-    double tempIRval5 = IRVal5MovingAverage*999 + irVal5;
-    IRVal5MovingAverage = tempIRval5 / 1000;
+bool irValOffroad(int irVal1, int irVal3, int irVal5){
+    IRVal1MovingAverage += (irVal1 - IRVal1MovingAverage)*IR_AVERAGE_RATE;
+    IRVal3MovingAverage += (irVal3 - IRVal3MovingAverage)*IR_AVERAGE_RATE;
+    IRVal5MovingAverage += (irVal5 - IRVal5MovingAverage)*IR_AVERAGE_RATE;
 
     return (irVal1 + 100 < IRVal1MovingAverage && irVal3 + 100 < IRVal3MovingAverage && irVal5 + 100 < IRVal5MovingAverage);
 }
\ No newline at end of file
@@ -2,6 +2,8 @@
  * Header file for Sensing related functions
  */
 #include <array>//include array to return sensor values
+#include "AdcSampler.h"
+#include "LineFit.h"
 
 //define constants for left and right encoders
 const int LEFT = 20;
@@ -10,6 +12,8 @@ const int RIGHT = 30;
 const int MIC_FRONT_RIGHT = 0;
 const int MIC_REAR = 1;
 const int MIC_FRONT_LEFT = 2;
+//getDistanceValue() reads at least this many metres when no echo came back in time
+const double NO_ECHO_DISTANCE = 0.8;
 
 /**
  * function definitions
@@ -20,12 +24,16 @@ void resetTickCounts();
 
 double getDistanceValue();
 
-std::array<int, 3> getMicValues();
+bool startMicScan(AdcScanDone done);
 
 int getLinePosition();
 
+const LineReading & getLineReading();
+
 std::array<int, 3> getIRValues();
 
 int getEncoderData(int encoderID);
 
+double getWheelTickRate(int encoderID);
+
 bool irValOffroad(int irVal1, int irVal3, int irVal5);
\ No newline at end of file
@@ -0,0 +1,63 @@
+#include <Arduino.h>
+#include "SensorLog.h"
+
+ROBOT_STATE SensorLogSink logSink;
+ROBOT_STATE SensorReplaySource replaySource;
+
+/**
+ * set the function every logged record is passed to. nullptr disables logging
+ */
+void setSensorLogSink(SensorLogSink sink){
+    logSink = sink;
+}
+
+/**
+ * set the function the sensing API asks for recorded values before reading the hardware.
+ * only installed by the host replay tool
+ */
+void setSensorReplaySource(SensorReplaySource source){
+    replaySource = source;
+}
+
+/**
+ * write a record to Serial as sync bytes, the raw record and an additive checksum so that a
+ * capture can be split back into records around any text the robot prints
+ */
+static void serialSink(const SensorLogRecord & record){
+    const uint8_t * bytes = (const uint8_t *)&record;
+    uint8_t checksum = 0;
+    for(unsigned i = 0; i < sizeof(record); i++){
+        checksum += bytes[i];
+    }
+    Serial.write(SENSOR_LOG_SYNC_0);
+    Serial.write(SENSOR_LOG_SYNC_1);
+    Serial.write(bytes, sizeof(record));
+    Serial.write(checksum);
+}
+
+void enableSerialSensorLog(){
+    setSensorLogSink(serialSink);
+}
+
+void logSensorRecord(uint8_t kind, int32_t value0, int32_t value1, int32_t value2){
+    if(logSink == nullptr){
+        return;
+    }
+    SensorLogRecord record = {};
+    record.timeUs = micros();
+    record.kind = kind;
+    record.values[0] = value0;
+    record.values[1] = value1;
+    record.values[2] = value2;
+    logSink(record);
+}
+
+/**
+ * recorded record of the given kind for this call, or nullptr to read the hardware as normal
+ */
+const SensorLogRecord * replaySensorRecord(uint8_t kind){
+    if(replaySource == nullptr){
+        return nullptr;
+    }
+    return replaySource(kind);
+}
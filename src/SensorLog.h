@@ -0,0 +1,68 @@
+/**
+ * Header file for the sensor log used to record runs and replay them on the host
+ *
+ * a log is a SensorLogHeader followed by fixed-size little-endian SensorLogRecords, so it can be
+ * appended to while recording and memory mapped for replay. every value returned by the sensing
+ * API is logged along with a marker at the start of each loop() and every state change
+ */
+#pragma once
+
+#include <stdint.h>
+#include "Platform.h"
+
+#define SENSOR_LOG_MAGIC 0x474F4C53 // "SLOG"
+#define SENSOR_LOG_VERSION 2
+
+//framing used when records are streamed over Serial between text output
+#define SENSOR_LOG_SYNC_0 0xA5
+#define SENSOR_LOG_SYNC_1 0x5A
+
+enum SensorLogKind : uint8_t {
+    LOG_TICK = 1,       // start of loop(), values[0] = current state
+    LOG_LINE_POSITION,  // values[0] = getLinePosition(), values[1..2] = width and confidence of the line
+    LOG_IR_VALUES,      // values[0..2] = getIRValues()
+    LOG_ENCODER_LEFT,   // values[0] = getEncoderData(LEFT)
+    LOG_ENCODER_RIGHT,  // values[0] = getEncoderData(RIGHT)
+    LOG_DISTANCE,       // values[0] = getDistanceValue() in micrometres
+    LOG_STATE,          // values[0] = new state, values[1] = previous state
+    LOG_BUMP,           // values[0..2] = locateBump() bearing, strength, confidence, strength 0 when none
+    LOG_LINES,          // values[0] = lines seen by the last getLinePosition(), values[1..2] = the outermost ones
+    LOG_SERIAL_INPUT,   // values[0] = bytes read from Serial in one poll of the console, up to 8, values[1..2] = the bytes, first in the lowest
+    LOG_WHEEL_RATE_LEFT,  // values[0] = getWheelTickRate(LEFT) in thousandths of a tick per second
+    LOG_WHEEL_RATE_RIGHT, // values[0] = getWheelTickRate(RIGHT) in thousandths of a tick per second
+    LOG_MOTOR_STEP,     // values[0] = wheel stepped by a drivetrain fit, 0 left 1 right, values[1] = its command in thousandths, see MotorModel.h
+    LOG_TRACTION,       // values[0] = wheel whose grip changed, 0 left 1 right, values[1] = its TractionState, values[2] = its command ceiling in thousandths, see TractionMonitor.h
+    LOG_KIND_COUNT
+};
+
+struct SensorLogHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t recordSize;
+};
+
+struct SensorLogRecord {
+    uint32_t timeUs;
+    uint8_t kind;
+    uint8_t reserved[3];
+    int32_t values[3];
+};
+
+static_assert(sizeof(SensorLogHeader) == 8, "log header layout is part of the file format");
+static_assert(sizeof(SensorLogRecord) == 20, "log record layout is part of the file format");
+
+typedef void (*SensorLogSink)(const SensorLogRecord & record);
+typedef const SensorLogRecord * (*SensorReplaySource)(uint8_t kind);
+
+/**
+ * function definitions
+ */
+void setSensorLogSink(SensorLogSink sink);
+
+void setSensorReplaySource(SensorReplaySource source);
+
+void enableSerialSensorLog();
+
+void logSensorRecord(uint8_t kind, int32_t value0, int32_t value1 = 0, int32_t value2 = 0);
+
+const SensorLogRecord * replaySensorRecord(uint8_t kind);
@@ -0,0 +1,123 @@
+#include <Arduino.h>
+#include "SpeedGovernor.h"
+#include "Tuning.h"
+#include "Odometry.h"
+#include "LineFollowing.h"
+#include "SpeedPerPwm.h"
+
+#define CURVATURE_FILTER_MM 60.0   // distance constant of the turn and line offset filters
+#define VARIANCE_FILTER_MM 150.0   // distance constant of the line offset variance
+#define LINE_LEAD_WEIGHT 0.5       // share of the curvature needed to steer back onto the line that counts as track curvature
+#define VARIANCE_REFERENCE 16.0    // mm^2 of line offset variance that halves the speed
+#define EDGE_START 500             // line error (counts) beyond which the robot slows for the window edge
+#define EDGE_MIN_FACTOR 0.5        // speed factor with the line under an outer sensor
+#define FALL_TIME_S 0.03           // time constant of a falling limit
+#define RISE_PWM_PER_S 200.0       // a rising limit recovers at this rate
+
+ROBOT_STATE bool governorValid;
+ROBOT_STATE int governorLeftTicks;
+ROBOT_STATE int governorRightTicks;
+ROBOT_STATE uint32_t governorLastUs;
+
+//distance weighted sums, their ratio is the recent path curvature
+ROBOT_STATE double turnSum;
+ROBOT_STATE double distanceSum;
+ROBOT_STATE double offsetMean;     // mm, positive with the line left of centre
+ROBOT_STATE double offsetVariance; // mm^2
+
+ROBOT_STATE SpeedPerPwm governorSpeed;
+
+ROBOT_STATE double governedPwm;
+
+FLASHMEM void initSpeedGovernor(){
+    governorValid = false;
+    resetSpeedPerPwm(&governorSpeed);
+    governedPwm = BASE_PWM;
+}
+
+/**
+ * forget the line history, e.g. after a manoeuvre away from the line
+ */
+static void restartSpeedGovernor(int leftEncoderData, int rightEncoderData, uint32_t now){
+    governorValid = true;
+    governorLeftTicks = leftEncoderData;
+    governorRightTicks = rightEncoderData;
+    governorLastUs = now;
+    turnSum = 0;
+    distanceSum = 0;
+    offsetMean = 0;
+    offsetVariance = 0;
+    restartSpeedWindow(&governorSpeed, now);
+    governedPwm = BASE_PWM;
+}
+
+/**
+ * curvature (1/mm) the robot has to be ready for: what the wheels have been turning, plus part of
+ * the pure pursuit curvature towards the line point under the QTR bar. the second term moves
+ * as soon as the line starts to bend away, before the steering has responded
+ */
+static double estimateCurvature(){
+    double pathCurvature = distanceSum > 0 ? turnSum/distanceSum : 0;
+    double pursuitCurvature = 2*offsetMean/(LINE_SENSOR_OFFSET_MM*LINE_SENSOR_OFFSET_MM);
+    return fabs(pathCurvature + LINE_LEAD_WEIGHT*pursuitCurvature);
+}
+
+/**
+ * feed the latest line position and encoder counts and return the base PWM limit for this
+ * iteration. must be called every iteration while following the line
+ */
+int updateSpeedGovernor(int lineReading, int leftEncoderData, int rightEncoderData){
+    uint32_t now = micros();
+    if(!governorValid || now - governorLastUs > FOLLOWING_GAP_MS*1000
+        || leftEncoderData < governorLeftTicks || rightEncoderData < governorRightTicks){
+        restartSpeedGovernor(leftEncoderData, rightEncoderData, now);
+        return (int)governedPwm;
+    }
+    double dt = (now - governorLastUs)*1e-6;
+    governorLastUs = now;
+
+    double left = (leftEncoderData - governorLeftTicks)*MM_PER_TICK;
+    double right = (rightEncoderData - governorRightTicks)*MM_PER_TICK;
+    governorLeftTicks = leftEncoderData;
+    governorRightTicks = rightEncoderData;
+    double distance = (left + right)/2;
+    double offset = (LINE_CENTRE - lineReading)*LINE_SENSOR_SPACING_MM/1000;
+
+    //filters run over distance driven, so a curve reads the same at any speed
+    if(distance > 0){
+        double weight = min(1.0, distance/CURVATURE_FILTER_MM);
+        turnSum = turnSum*(1 - weight) + (right - left)/AXLE_WIDTH_MM;
+        distanceSum = distanceSum*(1 - weight) + distance;
+        offsetMean += (offset - offsetMean)*weight;
+        double deviation = offset - offsetMean;
+        offsetVariance += (deviation*deviation - offsetVariance)*min(1.0, distance/VARIANCE_FILTER_MM);
+    }
+
+    //speed per PWM at the current operating point, for turning a speed limit into a PWM limit
+    double speedPerPwm = updateSpeedPerPwm(&governorSpeed, distance, governedPwm, now);
+    if(speedPerPwm <= 0){
+        return (int)governedPwm;
+    }
+
+    double target = GOVERNOR_MAX_PWM;
+    double curvature = estimateCurvature();
+    if(curvature > 0){
+        target = min(target, sqrt(GOVERNOR_LATERAL_ACCEL/curvature)/speedPerPwm);
+    }
+    //keep the line inside the sensor window: the closer it gets to an outer sensor and the more it swings, the slower
+    int error = abs(lineReading - LINE_CENTRE);
+    if(error > EDGE_START){
+        target *= 1 - (1 - EDGE_MIN_FACTOR)*min(1.0, (double)(error - EDGE_START)/(LINE_CENTRE - EDGE_START));
+    }
+    target /= 1 + offsetVariance/VARIANCE_REFERENCE;
+    target = max(target, BASE_PWM*MIN_PWM_FRACTION);
+
+    //brake promptly, accelerate gently
+    if(target < governedPwm){
+        governedPwm += (target - governedPwm)*min(1.0, dt/FALL_TIME_S);
+    }
+    else{
+        governedPwm = min(target, governedPwm + RISE_PWM_PER_S*dt);
+    }
+    return (int)governedPwm;
+}
@@ -0,0 +1,17 @@
+/**
+ * Header file for the curvature adaptive speed governor
+ *
+ * without any knowledge of the track, the governor estimates how hard the robot is turning from
+ * the recent history of the line position and the wheel speed differential, and limits the base
+ * PWM so that the lateral acceleration stays under GOVERNOR_LATERAL_ACCEL. a line drifting towards
+ * the edge of the three sensor window, or a line position that swings a lot, slows the robot down
+ * further, since the line is about to be lost. the limit falls quickly and recovers gradually
+ */
+#pragma once
+
+/**
+ * function definitions
+ */
+void initSpeedGovernor();
+
+int updateSpeedGovernor(int lineReading, int leftEncoderData, int rightEncoderData);
@@ -0,0 +1,37 @@
+#include "SpeedPerPwm.h"
+
+#define SPEED_WINDOW_US 20000  // wheel speed is measured over windows of at least this long
+#define SPEED_RATIO_RATE 0.05  // weight of each new speed window in the estimate
+
+/**
+ * forget the measurement, e.g. at start up
+ */
+void resetSpeedPerPwm(SpeedPerPwm * estimate){
+    estimate->windowDistance = 0;
+    estimate->windowStartUs = 0;
+    estimate->ratio = 0;
+}
+
+/**
+ * start a new window at nowUs, e.g. after line following was interrupted. the estimate is kept
+ */
+void restartSpeedWindow(SpeedPerPwm * estimate, uint32_t nowUs){
+    estimate->windowDistance = 0;
+    estimate->windowStartUs = nowUs;
+}
+
+/**
+ * add the distance (mm) covered since the previous update while running at pwm, and return the
+ * estimate, 0 until the first window is complete
+ */
+double updateSpeedPerPwm(SpeedPerPwm * estimate, double distance, double pwm, uint32_t nowUs){
+    estimate->windowDistance += distance;
+    if(nowUs - estimate->windowStartUs >= SPEED_WINDOW_US){
+        if(pwm > 0){
+            double ratio = estimate->windowDistance/((nowUs - estimate->windowStartUs)*1e-6)/pwm;
+            estimate->ratio = estimate->ratio > 0 ? estimate->ratio + (ratio - estimate->ratio)*SPEED_RATIO_RATE : ratio;
+        }
+        restartSpeedWindow(estimate, nowUs);
+    }
+    return estimate->ratio;
+}
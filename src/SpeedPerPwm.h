@@ -0,0 +1,27 @@
+/**
+ * Header file for measuring wheel speed per unit of base PWM
+ *
+ * the speed governor and the obstacle braking both work out a speed limit and have to turn it into
+ * a base PWM limit. the ratio of the two is measured at the current operating point: the distance
+ * the wheels cover over a window of at least SPEED_WINDOW_US, divided by the base PWM they ran at,
+ * is blended into a running estimate. the caller counts the distance and says which PWM it ran.
+ * touches nothing of the hardware
+ */
+#pragma once
+
+#include <stdint.h>
+
+struct SpeedPerPwm {
+    double windowDistance; // mm covered since windowStartUs
+    uint32_t windowStartUs;
+    double ratio;          // mm/s per unit of base PWM, 0 until measured
+};
+
+/**
+ * function definitions
+ */
+void resetSpeedPerPwm(SpeedPerPwm * estimate);
+
+void restartSpeedWindow(SpeedPerPwm * estimate, uint32_t nowUs);
+
+double updateSpeedPerPwm(SpeedPerPwm * estimate, double distance, double pwm, uint32_t nowUs);
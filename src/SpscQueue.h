@@ -0,0 +1,75 @@
+/**
+ * Header file for passing events from an interrupt to loop() without locks
+ *
+ * a ring of Capacity slots, a power of two, with one producer (an interrupt, or a thread on the
+ * host) and one consumer (loop()). the producer only writes the head and the consumer only the
+ * tail, so neither needs interrupts off: the head is published with release ordering after the slot
+ * is written, and read with acquire ordering before the slot is, and the same the other way for the
+ * tail. on the Cortex-M7 those are a DMB around the plain 32 bit load or store, which keeps the
+ * slot from being read before the head says it is written even through the write buffer. the
+ * counters run freely and wrap, their difference is the number of queued events. a full queue
+ * refuses the event rather than overwrite one the consumer may be reading.
+ * interrupts of one priority cannot preempt each other and count as one producer, those of
+ * different priorities need a queue each
+ */
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+
+template <typename T, uint32_t Capacity>
+class SpscQueue
+{
+    static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "the capacity must be a power of two");
+
+  public:
+    /**
+     * producer only. false, leaving the queue as it was, when it is full
+     */
+    bool push(const T & item){
+        uint32_t head = _head.load(std::memory_order_relaxed);
+        if(head - _tail.load(std::memory_order_acquire) == Capacity){
+            return false;
+        }
+        _slots[head & (Capacity - 1)] = item;
+        _head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * consumer only. false when there is nothing queued
+     */
+    bool pop(T * item){
+        uint32_t tail = _tail.load(std::memory_order_relaxed);
+        if(_head.load(std::memory_order_acquire) == tail){
+            return false;
+        }
+        *item = _slots[tail & (Capacity - 1)];
+        _tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * consumer only. drop everything queued so far
+     */
+    void clear(){
+        _tail.store(_head.load(std::memory_order_acquire), std::memory_order_release);
+    }
+
+    /**
+     * events queued. exact for the consumer, a lower bound for the producer
+     */
+    uint32_t size() const{
+        return _head.load(std::memory_order_acquire) - _tail.load(std::memory_order_acquire);
+    }
+
+    static constexpr uint32_t capacity(){
+        return Capacity;
+    }
+
+  private:
+    //on their own 32 byte cache lines, so that the two sides do not share one on a multicore host
+    alignas(32) std::atomic<uint32_t> _head{0}; // events pushed so far
+    alignas(32) std::atomic<uint32_t> _tail{0}; // events popped so far
+    alignas(32) T _slots[Capacity];
+};
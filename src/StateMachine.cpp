@@ -0,0 +1,306 @@
+#include "StateMachine.h"
+#include "SensorLog.h"
+
+struct StateTable {
+    RobotState initial;
+    RobotState parent[STATE_COUNT];
+    Transition transitions[STATE_COUNT][EVENT_COUNT];
+};
+
+/**
+ * the robot's states as written: each transition is declared on the state that owns it, and
+ * NORMAL and SENSING inherit the obstacle handling of ON_COURSE
+ */
+static constexpr StateTable declareStates(){
+    StateTable table = {};
+    table.initial = STATE_NORMAL;
+    table.parent[STATE_NORMAL] = STATE_ON_COURSE;
+    table.parent[STATE_SENSING] = STATE_ON_COURSE;
+
+    table.transitions[STATE_NORMAL][EVENT_LINE_LOST] = Transition{TRANSITION_GOTO, STATE_SENSING};
+    table.transitions[STATE_SENSING][EVENT_HEADING_FOUND] = Transition{TRANSITION_GOTO, STATE_NORMAL};
+    table.transitions[STATE_ON_COURSE][EVENT_OBSTACLE] = Transition{TRANSITION_PUSH, STATE_BLOCKED};
+    table.transitions[STATE_BLOCKED][EVENT_PATH_CLEAR] = Transition{TRANSITION_POP, STATE_NONE};
+    table.transitions[STATE_BLOCKED][EVENT_LINE_FOUND] = Transition{TRANSITION_POP, STATE_NORMAL};
+    table.transitions[STATE_BLOCKED][EVENT_LINE_LOST] = Transition{TRANSITION_POP, STATE_SENSING};
+    return table;
+}
+
+/**
+ * copy every transition a state inherits into its own row, so dispatch never walks the parents
+ */
+static constexpr StateTable flattenStates(const StateTable declared){
+    StateTable table = declared;
+    for(int state = 0; state < STATE_COUNT; state++){
+        for(int event = 0; event < EVENT_COUNT; event++){
+            int owner = state;
+            for(int depth = 0; depth < STATE_COUNT && declared.transitions[owner][event].kind == TRANSITION_NONE
+                && declared.parent[owner] != STATE_NONE; depth++){
+                owner = declared.parent[owner];
+            }
+            table.transitions[state][event] = declared.transitions[owner][event];
+        }
+    }
+    return table;
+}
+
+constexpr StateTable stateTable = flattenStates(declareStates());
+
+/**
+ * compile time checks of the table
+ */
+static constexpr bool parentsTerminate(const StateTable & table){
+    for(int state = 0; state < STATE_COUNT; state++){
+        int ancestor = state;
+        int depth = 0;
+        while(table.parent[ancestor] != STATE_NONE){
+            ancestor = table.parent[ancestor];
+            if(++depth >= STATE_COUNT){
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+static constexpr bool isComposite(const StateTable & table, int state){
+    for(int child = 0; child < STATE_COUNT; child++){
+        if(table.parent[child] == state){
+            return true;
+        }
+    }
+    return false;
+}
+
+//GOTO and PUSH lead to a state that can be active by itself, a POP may name one, NONE names none
+static constexpr bool targetsValid(const StateTable & table){
+    if(table.initial == STATE_NONE || isComposite(table, table.initial)){
+        return false;
+    }
+    for(int state = 0; state < STATE_COUNT; state++){
+        for(int event = 0; event < EVENT_COUNT; event++){
+            Transition transition = table.transitions[state][event];
+            bool needsTarget = transition.kind == TRANSITION_GOTO || transition.kind == TRANSITION_PUSH;
+            bool hasTarget = transition.target != STATE_NONE;
+            if((needsTarget && !hasTarget) || (transition.kind == TRANSITION_NONE && hasTarget)){
+                return false;
+            }
+            if(hasTarget && (transition.target >= STATE_COUNT || isComposite(table, transition.target))){
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/**
+ * stack depth each state can be active at, starting from the initial state. a state that pops
+ * must never be active at the bottom of the stack, and no state may be pushed past the stack
+ */
+static constexpr bool nestingValid(const StateTable & table){
+    const int unreached = STATE_STACK_DEPTH + 2;
+    int shallowest[STATE_COUNT] = {};
+    int deepest[STATE_COUNT] = {};
+    for(int state = 0; state < STATE_COUNT; state++){
+        shallowest[state] = unreached;
+    }
+    shallowest[table.initial] = 1;
+    deepest[table.initial] = 1;
+    for(int round = 0; round < STATE_COUNT*(STATE_STACK_DEPTH + 2); round++){
+        for(int state = 0; state < STATE_COUNT; state++){
+            if(deepest[state] == 0){
+                continue;
+            }
+            for(int event = 0; event < EVENT_COUNT; event++){
+                Transition transition = table.transitions[state][event];
+                int step = transition.kind == TRANSITION_PUSH ? 1 : transition.kind == TRANSITION_POP ? -1 : 0;
+                if(transition.target == STATE_NONE){
+                    continue;
+                }
+                int low = shallowest[state] + step;
+                int high = deepest[state] + step;
+                if(low < 1){
+                    continue;//a pop from the bottom, reported below
+                }
+                if(low < shallowest[transition.target]){
+                    shallowest[transition.target] = low;
+                }
+                if(high > deepest[transition.target]){
+                    deepest[transition.target] = high > unreached ? unreached : high;
+                }
+            }
+        }
+    }
+    for(int state = 0; state < STATE_COUNT; state++){
+        if(deepest[state] > STATE_STACK_DEPTH){
+            return false;
+        }
+        for(int event = 0; event < EVENT_COUNT; event++){
+            if(table.transitions[state][event].kind == TRANSITION_POP && shallowest[state] < 2){
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+static_assert(parentsTerminate(declareStates()), "state parents must not form a cycle");
+static_assert(targetsValid(stateTable), "transitions must lead to states that can be active");
+static_assert(nestingValid(stateTable), "pushes must fit STATE_STACK_DEPTH and pops must have a state to return to");
+
+ROBOT_STATE const StateHandlers * stateHandlers;
+ROBOT_STATE RobotState stateStack[STATE_STACK_DEPTH];
+ROBOT_STATE int stateDepth;
+
+/**
+ * the deepest state that contains both states, STATE_NONE if they only share the root
+ */
+static RobotState commonAncestor(RobotState first, RobotState second){
+    for(RobotState a = first; a != STATE_NONE; a = stateTable.parent[a]){
+        for(RobotState b = second; b != STATE_NONE; b = stateTable.parent[b]){
+            if(a == b){
+                return a;
+            }
+        }
+    }
+    return STATE_NONE;
+}
+
+/**
+ * exit handlers from the state outwards, stopping below the given ancestor
+ */
+static void exitStates(RobotState state, RobotState ancestor){
+    for(; state != ancestor && state != STATE_NONE; state = stateTable.parent[state]){
+        if(stateHandlers && stateHandlers[state].exit){
+            stateHandlers[state].exit();
+        }
+    }
+}
+
+/**
+ * entry handlers from just below the given ancestor inwards to the state
+ */
+static void enterStates(RobotState state, RobotState ancestor){
+    RobotState path[STATE_COUNT];
+    int count = 0;
+    for(; state != ancestor && state != STATE_NONE; state = stateTable.parent[state]){
+        path[count++] = state;
+    }
+    while(count > 0){
+        RobotState entered = path[--count];
+        if(stateHandlers && stateHandlers[entered].entry){
+            stateHandlers[entered].entry();
+        }
+    }
+}
+
+/**
+ * start in the initial state, running its entry handlers. handlers is indexed by RobotState and
+ * may be nullptr to run the bare tables
+ */
+void initStateMachine(const StateHandlers * handlers){
+    stateHandlers = handlers;
+    stateDepth = 1;
+    stateStack[0] = stateTable.initial;
+    enterStates(stateTable.initial, STATE_NONE);
+}
+
+/**
+ * run the current state for one loop() and act on the event its guards raised
+ */
+void tickStateMachine(){
+    RobotState current = getCurrentState();
+    if(stateHandlers && stateHandlers[current].tick){
+        dispatchEvent(stateHandlers[current].tick());
+    }
+}
+
+/**
+ * take the current state's transition for the event. returns false if the event was ignored
+ */
+bool dispatchEvent(RobotEvent event){
+    if(event == EVENT_NONE || event >= EVENT_COUNT || stateDepth == 0){
+        return false;
+    }
+    RobotState current = stateStack[stateDepth - 1];
+    Transition transition = stateTable.transitions[current][event];
+    switch(transition.kind){
+        case TRANSITION_GOTO:
+            exitStates(current, commonAncestor(current, transition.target));
+            stateStack[stateDepth - 1] = transition.target;
+            enterStates(transition.target, commonAncestor(current, transition.target));
+            break;
+        case TRANSITION_PUSH:
+            if(stateDepth >= STATE_STACK_DEPTH){
+                return false;
+            }
+            stateStack[stateDepth++] = transition.target;
+            enterStates(transition.target, commonAncestor(current, transition.target));
+            break;
+        case TRANSITION_POP:{
+            if(stateDepth < 2){
+                return false;
+            }
+            RobotState resumed = stateStack[stateDepth - 2];
+            exitStates(current, commonAncestor(current, resumed));
+            stateDepth--;
+            if(transition.target != STATE_NONE && transition.target != resumed){
+                //the state below is left for the target without being resumed
+                exitStates(resumed, commonAncestor(resumed, transition.target));
+                stateStack[stateDepth - 1] = transition.target;
+                enterStates(transition.target, commonAncestor(resumed, transition.target));
+            }
+            else if(stateHandlers && stateHandlers[resumed].resume){
+                stateHandlers[resumed].resume();
+            }
+            break;
+        }
+        default:
+            return false;
+    }
+    logSensorRecord(LOG_STATE, getCurrentState(), current);
+    return true;
+}
+
+RobotState getCurrentState(){
+    return stateDepth > 0 ? stateStack[stateDepth - 1] : STATE_NONE;
+}
+
+int getStateDepth(){
+    return stateDepth;
+}
+
+/**
+ * state at the given stack index, 0 being the bottom
+ */
+RobotState getStackedState(int index){
+    return index >= 0 && index < stateDepth ? stateStack[index] : STATE_NONE;
+}
+
+RobotState getInitialState(){
+    return stateTable.initial;
+}
+
+RobotState getParentState(RobotState state){
+    return state < STATE_COUNT ? stateTable.parent[state] : STATE_NONE;
+}
+
+/**
+ * flattened transition, including the ones inherited from parents
+ */
+Transition getTransition(RobotState state, RobotEvent event){
+    if(state >= STATE_COUNT || event >= EVENT_COUNT){
+        return Transition{TRANSITION_NONE, STATE_NONE};
+    }
+    return stateTable.transitions[state][event];
+}
+
+const char * getStateName(RobotState state){
+    static const char * const names[STATE_COUNT] = {"NONE", "NORMAL", "SENSING", "BLOCKED", "ON_COURSE"};
+    return state < STATE_COUNT ? names[state] : "?";
+}
+
+const char * getEventName(RobotEvent event){
+    static const char * const names[EVENT_COUNT] = {"NONE", "LINE_LOST", "HEADING_FOUND", "OBSTACLE", "PATH_CLEAR", "LINE_FOUND"};
+    return event < EVENT_COUNT ? names[event] : "?";
+}
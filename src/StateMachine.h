@@ -0,0 +1,84 @@
+/**
+ * Header file for the hierarchical robot state machine
+ *
+ * the states, their parents and the transition each state takes on each event are fixed at
+ * compile time in StateMachine.cpp. an event a state does not handle falls through to its parent,
+ * and the table is flattened at compile time so dispatching an event is a single lookup.
+ * active states are kept on a bounded stack: a pushed state (BLOCKED) suspends the one below it
+ * (NORMAL or SENSING) and popping it resumes that state where it left off.
+ * the entry, exit, resume and tick handlers are passed in by the caller, so the tables and the
+ * stack can be exercised on the host without any hardware (sim states)
+ */
+#pragma once
+
+#include <stdint.h>
+
+//values are logged as LOG_STATE and LOG_TICK, keep them stable
+enum RobotState : uint8_t {
+    STATE_NONE = 0,
+    STATE_NORMAL = 1,     // following the line
+    STATE_SENSING = 2,    // rotating on the spot to find the line again
+    STATE_BLOCKED = 3,    // stopped in front of an obstacle
+    STATE_ON_COURSE = 4,  // parent of NORMAL and SENSING, never active by itself
+    STATE_COUNT
+};
+
+enum RobotEvent : uint8_t {
+    EVENT_NONE = 0,
+    EVENT_LINE_LOST,
+    EVENT_HEADING_FOUND,
+    EVENT_OBSTACLE,
+    EVENT_PATH_CLEAR,
+    EVENT_LINE_FOUND,
+    EVENT_COUNT
+};
+
+enum TransitionKind : uint8_t {
+    TRANSITION_NONE = 0, // event ignored
+    TRANSITION_GOTO,     // replace the current state
+    TRANSITION_PUSH,     // suspend the current state under the target
+    TRANSITION_POP       // leave the current state and resume the one below, or replace it with the target
+};
+
+struct Transition {
+    TransitionKind kind;
+    RobotState target;
+};
+
+/**
+ * what a state does, any handler may be nullptr. tick runs the state for one loop() and returns
+ * the event raised by its guards, which are evaluated once from the readings taken for that tick
+ */
+struct StateHandlers {
+    void (*entry)();
+    void (*exit)();
+    void (*resume)();
+    RobotEvent (*tick)();
+};
+
+#define STATE_STACK_DEPTH 4 // deepest nesting of pushed states, checked against the table at compile time
+
+/**
+ * function definitions
+ */
+void initStateMachine(const StateHandlers * handlers);
+
+void tickStateMachine();
+
+bool dispatchEvent(RobotEvent event);
+
+RobotState getCurrentState();
+
+int getStateDepth();
+
+RobotState getStackedState(int index);
+
+RobotState getInitialState();
+
+RobotState getParentState(RobotState state);
+
+Transition getTransition(RobotState state, RobotEvent event);
+
+const char * getStateName(RobotState state);
+
+const char * getEventName(RobotEvent event);
@@ -0,0 +1,78 @@
+#include <Arduino.h>
+#include "StraightDrive.h"
+#include "MotorModel.h"
+#include "Odometry.h"
+#include "Sensing.h"
+
+#define STRAIGHT_GAP_US 50000 // updates further apart than this are taken as this, the drive was held up
+
+/**
+ * begin a drive of length mm. headingError is how far anticlockwise of the heading to hold the
+ * robot starts, in radians, and startRate the tick rate the wheels are at already
+ */
+void startStraightDrive(StraightDrive * drive, double length, double headingError, double cruiseRate, double startRate, bool stop){
+    drive->length = length;
+    //a turn back larger than the drive would run a wheel backwards
+    drive->offset = max(-fabs(length), min(fabs(length), headingError*AXLE_WIDTH_MM));
+    drive->cruiseRate = cruiseRate;
+    drive->leadRate = min(startRate, cruiseRate);
+    drive->stop = stop;
+    drive->braked[0] = false;
+    drive->braked[1] = false;
+    drive->syncIntegral = 0;
+    resetWheelSpeedLoop(&drive->loops[0]);
+    resetWheelSpeedLoop(&drive->loops[1]);
+    drive->lastUs = 0;
+    drive->primed = false;
+}
+
+/**
+ * mm each wheel is to cover
+ */
+void straightDriveTargets(const StraightDrive * drive, double * left, double * right){
+    *left = drive->length + drive->offset/2;
+    *right = drive->length - drive->offset/2;
+}
+
+/**
+ * the commands for both wheels, on the scale of setMotors(), from the mm each covered since the
+ * start and the rates they turn at. returns true once the drive is done
+ */
+bool stepStraightDrive(StraightDrive * drive, const double done[2], const double rates[2], uint32_t nowUs, double commands[2]){
+    double dt = drive->primed ? min(nowUs - drive->lastUs, (uint32_t)STRAIGHT_GAP_US)*1e-6 : 0;
+    drive->primed = true;
+    drive->lastUs = nowUs;
+    double direction = drive->length < 0 ? -1 : 1;
+    double targets[2];
+    straightDriveTargets(drive, &targets[0], &targets[1]);
+    double remaining[2] = {direction*(targets[0] - done[0]), direction*(targets[1] - done[1])};
+
+    //mm the left wheel is ahead of where it should be against the right
+    double along = direction*(done[0] + done[1])/2;
+    double reach = min(fabs(drive->length), STRAIGHT_HOLD_MM);
+    double turned = reach > 0 ? drive->offset*max(0.0, min(1.0, along/reach)) : drive->offset;
+    double ahead = direction*(done[0] - done[1] - turned);
+    drive->syncIntegral += ahead*dt;
+    double correction = (STRAIGHT_SYNC_KP*ahead + STRAIGHT_SYNC_KI*drive->syncIntegral)/MM_PER_TICK;
+    drive->leadRate = min(drive->cruiseRate, drive->leadRate + STRAIGHT_ACCEL_MM/MM_PER_TICK*dt);
+
+    bool atRest = true;
+    for(int i = 0; i < 2; i++){
+        if(drive->stop && (drive->braked[i] || remaining[i] <= rates[i]*MM_PER_TICK*STRAIGHT_COAST_S)){
+            drive->braked[i] = true;
+            commands[i] = 0;
+            atRest = atRest && rates[i] < STRAIGHT_REST_RATE;
+            continue;
+        }
+        atRest = false;
+        double rate = drive->leadRate + (i == 0 ? -correction : correction)/2;
+        if(drive->stop){
+            rate = min(rate, sqrt(2*STRAIGHT_DECEL_MM*max(0.0, remaining[i]))/MM_PER_TICK);
+        }
+        rate = max(rate, STRAIGHT_CREEP_MM/MM_PER_TICK);
+        int encoderID = i == 0 ? LEFT : RIGHT;
+        double command = updateWheelSpeedLoop(&drive->loops[i], encoderID, rate, rates[i], motorFeedforward(encoderID, rate), nowUs);
+        commands[i] = direction*command;
+    }
+    return drive->stop ? atRest : remaining[0] + remaining[1] <= 0;
+}
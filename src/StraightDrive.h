@@ -0,0 +1,53 @@
+/**
+ * Header file for driving a straight on both encoders and stopping each wheel at its distance
+ *
+ * both wheels are held at a tick rate by their speed loops (WheelSpeed.h) with the model's
+ * feedforward (MotorModel.h), so a weaker wheel gets the command it needs instead of the other's.
+ * the rate ramps up by STRAIGHT_ACCEL_MM and, for a drive that stops, down again so that each
+ * wheel could still stop in what it has left at STRAIGHT_DECEL_MM, but not below
+ * STRAIGHT_CREEP_MM. the wheels are kept level by a cross-coupled loop on the difference of their
+ * distances: a wheel ahead of the other is slowed by half the correction and the other sped up by
+ * half, so neither runs ahead of the heading whatever the rate they are at. a drive may start off
+ * the heading it is to hold: the left wheel is then to end that far ahead of the right that turns
+ * the robot back onto it, taken up over the first STRAIGHT_HOLD_MM. each wheel is braked on its
+ * own once what it has left is what it coasts braked (STRAIGHT_COAST_S), and the drive is done
+ * once both are at rest. a drive that goes on into another move does not slow down and is done
+ * once the wheels covered their distances between them. distances are in mm, negative backwards,
+ * rates in ticks per second and unsigned as the encoders only count. touches nothing of the
+ * hardware, the caller passes in the distances and rates and applies the commands
+ */
+#pragma once
+
+#include <stdint.h>
+#include "WheelSpeed.h"
+
+#define STRAIGHT_ACCEL_MM 1500.0   // mm/s^2 the rate ramps up by
+#define STRAIGHT_DECEL_MM 1000.0   // mm/s^2 each wheel is planned to slow down by before its stop
+#define STRAIGHT_CREEP_MM 60.0     // mm/s the last of a stop is driven at, well out of the deadband
+#define STRAIGHT_COAST_S 0.03      // a wheel braked at some rate goes on about as far as it would in this long
+#define STRAIGHT_REST_RATE 100     // ticks per second below which a braked wheel is at rest
+#define STRAIGHT_HOLD_MM 100.0     // a heading the drive started off is taken up over this far
+#define STRAIGHT_SYNC_KP 8.0       // mm/s of correction per mm one wheel is ahead of the other
+#define STRAIGHT_SYNC_KI 20.0      // and per mm it was ahead for a second
+
+struct StraightDrive {
+    double length;        // mm, negative backwards
+    double offset;        // mm the left wheel is to end ahead of the right, turns back onto the heading held
+    double cruiseRate;    // ticks per second
+    double leadRate;      // of the ramp, before the stop and the correction
+    bool stop;            // slow down and brake at the end, else go on at the cruise rate
+    bool braked[2];       // left, right
+    double syncIntegral;  // mm the left wheel was ahead over time, in mm s
+    WheelSpeedLoop loops[2];
+    uint32_t lastUs;
+    bool primed;
+};
+
+/**
+ * function definitions
+ */
+void startStraightDrive(StraightDrive * drive, double length, double headingError, double cruiseRate, double startRate, bool stop);
+
+void straightDriveTargets(const StraightDrive * drive, double * left, double * right);
+
+bool stepStraightDrive(StraightDrive * drive, const double done[2], const double rates[2], uint32_t nowUs, double commands[2]);
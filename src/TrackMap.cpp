@@ -0,0 +1,435 @@
+#include <Arduino.h>
+#include "TrackMap.h"
+#include "Tuning.h"
+#include "Odometry.h"
+#include "LineFollowing.h"
+
+#define SEGMENT_LENGTH_MM 50.0
+#define MAX_SEGMENTS 256       // 12.8 m of track
+#define MIN_LAP_MM 1500        // a full turn in less than this is a spin, not a lap
+#define CLOSURE_TOLERANCE 0.3  // radians short of a full turn at which the lap is taken to be nearly closed
+#define CLOSURE_SEARCH 8       // segments either side of the heading closure searched for the true lap length
+#define CLOSURE_OVERLAP 16     // segments recorded past the latest candidate lap end before matching
+#define SYNC_WINDOW 8          // most recent segments matched against the map
+#define SYNC_STEP_MM 25.0      // resolution of the alignment search
+#define SYNC_SEARCH 8          // steps either side of the odometry position searched while racing
+#define SYNC_MIN_RANGE 1500    // curvature spread (1/km) a window needs before it says anything about position
+#define SYNC_MAX_ERROR 900     // mean curvature mismatch (1/km) per segment still accepted as a match
+#define SYNC_FAILURES_LOST 3   // consecutive distinctive windows matching nowhere before the position is dropped
+#define RELOCATE_MARGIN 0.6    // a relocation match must beat every other alignment by this factor
+#define LOOKAHEAD_S 0.15       // the schedule is read this far ahead to cover the motor lag
+#define LINE_SMOOTHING_MM 120.0 // distance constant of the line point filter
+
+ROBOT_STATE TrackMapMode mapMode;
+ROBOT_STATE int16_t segmentCurvature[MAX_SEGMENTS]; // 1/km, positive turning left
+ROBOT_STATE uint8_t segmentPwm[MAX_SEGMENTS];
+ROBOT_STATE int segmentCount;
+ROBOT_STATE double segmentLength; // mm, the learned lap spread evenly over segmentCount
+
+ROBOT_STATE bool odometryValid;
+ROBOT_STATE int lastLeftTicks;
+ROBOT_STATE int lastRightTicks;
+ROBOT_STATE uint32_t lastUpdateMs;
+ROBOT_STATE uint32_t segmentStartMs;
+ROBOT_STATE double speedEstimate; // mm/s over the last segment
+
+//odometry pose and the point of the line under the QTR bar, in the frame the robot started following in
+ROBOT_STATE double poseX;
+ROBOT_STATE double poseY;
+ROBOT_STATE double poseHeading;
+ROBOT_STATE double lineX;
+ROBOT_STATE double lineY;
+ROBOT_STATE double smoothLineX;
+ROBOT_STATE double smoothLineY;
+ROBOT_STATE double anchorX; // line point at the end of the last segment
+ROBOT_STATE double anchorY;
+ROBOT_STATE double anchorHeading; // direction of the last segment's chord
+ROBOT_STATE bool anchorHeadingValid;
+
+ROBOT_STATE double mapPosition; // mm of line since the lap start
+ROBOT_STATE double lapHeading;
+ROBOT_STATE int closureSegment;     // segments recorded when the heading closed, 0 while still turning
+ROBOT_STATE uint32_t lapStartMs;
+
+ROBOT_STATE int16_t recentCurvature[SYNC_WINDOW]; // ring buffer of the latest segments
+ROBOT_STATE int recentCount;
+ROBOT_STATE int syncFailures;
+
+/**
+ * start a fresh learning lap at the current position
+ */
+static void restartLearning(uint32_t now){
+    mapMode = TRACK_MAP_LEARNING;
+    segmentCount = 0;
+    segmentLength = SEGMENT_LENGTH_MM;
+    mapPosition = 0;
+    lapHeading = 0;
+    closureSegment = 0;
+    lapStartMs = now;
+}
+
+/**
+ * drop the line history, e.g. after a manoeuvre away from the line
+ */
+static void restartOdometry(int lineReading, uint32_t now){
+    poseX = 0;
+    poseY = 0;
+    poseHeading = 0;
+    lineX = LINE_SENSOR_OFFSET_MM;
+    lineY = (LINE_CENTRE - lineReading)*LINE_SENSOR_SPACING_MM/1000;
+    smoothLineX = lineX;
+    smoothLineY = lineY;
+    anchorX = lineX;
+    anchorY = lineY;
+    anchorHeadingValid = false;
+    segmentStartMs = now;
+    recentCount = 0;
+}
+
+FLASHMEM void initTrackMap(){
+    odometryValid = false;
+    speedEstimate = 0;
+    syncFailures = 0;
+    recentCount = 0;
+    restartLearning(millis());
+}
+
+TrackMapMode getTrackMapMode(){
+    return mapMode;
+}
+
+/**
+ * wrap a segment index onto the closed lap
+ */
+static int wrapSegment(int index){
+    index %= segmentCount;
+    return index < 0 ? index + segmentCount : index;
+}
+
+/**
+ * wrap a position onto the closed lap
+ */
+static double wrapPosition(double position){
+    double lapLength = segmentCount*segmentLength;
+    while(position >= lapLength){
+        position -= lapLength;
+    }
+    while(position < 0){
+        position += lapLength;
+    }
+    return position;
+}
+
+/**
+ * map curvature at a position, interpolated between segment centres
+ */
+static double curvatureAt(double position){
+    double index = wrapPosition(position)/segmentLength - 0.5;
+    int below = (int)floor(index);
+    double fraction = index - below;
+    return (1 - fraction)*segmentCurvature[wrapSegment(below)] + fraction*segmentCurvature[wrapSegment(below + 1)];
+}
+
+/**
+ * summed mismatch between the recent window and the map, with the newest segment ending at end
+ */
+static double windowError(double end){
+    double error = 0;
+    for(int k = 0; k < SYNC_WINDOW; k++){
+        int live = recentCurvature[(recentCount + k) % SYNC_WINDOW];//oldest first
+        error += fabs(live - curvatureAt(end - (SYNC_WINDOW - k - 0.5)*SEGMENT_LENGTH_MM));
+    }
+    return error;
+}
+
+/**
+ * vertex of the parabola through three evenly spaced error samples, as an offset from the middle one
+ */
+static double refineMinimum(double before, double at, double after){
+    double curvature = before - 2*at + after;
+    return curvature > 0 ? constrain((before - after)/(2*curvature), -0.5, 0.5) : 0;
+}
+
+/**
+ * turn the learned curvature into a PWM per segment. each segment gets the speed at which its
+ * sharpest neighbourhood stays under LAP_LATERAL_ACCEL, then a backward pass around the closed
+ * lap (twice, so the ramp carries over the start line) limits every segment to what can be shed
+ * at LAP_BRAKE_ACCEL before the next one. speeds map to PWM in proportion to the speed measured
+ * at BASE_PWM on the learning lap
+ */
+static void buildSchedule(double baseSpeed){
+    double maxSpeed = baseSpeed*LAP_MAX_PWM/BASE_PWM;
+    float speeds[MAX_SEGMENTS];
+    for(int i = 0; i < segmentCount; i++){
+        int sharpest = max(abs(segmentCurvature[i]), max(abs(segmentCurvature[wrapSegment(i - 1)]), abs(segmentCurvature[wrapSegment(i + 1)])));
+        double curvature = sharpest*1e-6;//1/mm
+        speeds[i] = curvature > 0 ? min(maxSpeed, sqrt(LAP_LATERAL_ACCEL/curvature)) : maxSpeed;
+    }
+    for(int pass = 0; pass < 2; pass++){
+        for(int i = segmentCount - 1; i >= 0; i--){
+            double next = speeds[wrapSegment(i + 1)];
+            speeds[i] = min((double)speeds[i], sqrt(next*next + 2*LAP_BRAKE_ACCEL*segmentLength));
+        }
+    }
+    for(int i = 0; i < segmentCount; i++){
+        double pwm = max(BASE_PWM*speeds[i]/baseSpeed, BASE_PWM*MIN_PWM_FRACTION);
+        segmentPwm[i] = (uint8_t)constrain((int)pwm, 0, LAP_MAX_PWM);
+    }
+}
+
+/**
+ * mean curvature mismatch between the start of the recording and the same stretch lapSegments on
+ */
+static long closureError(int lapSegments){
+    int overlap = segmentCount - lapSegments;
+    long error = 0;
+    for(int i = 0; i < overlap; i++){
+        error += abs(segmentCurvature[i] - segmentCurvature[i + lapSegments]);
+    }
+    return error/overlap;
+}
+
+/**
+ * the heading closes a full turn only roughly where the lap ends, and on a straight it can sit
+ * just short of it for a long way. the recording is kept running past that point and the lap
+ * length is taken where the newest segments best repeat the start of the map. returns false if
+ * the overlap is still featureless and recording should go on
+ */
+static bool finishLearning(uint32_t now){
+    int lowest = 0;
+    int highest = 0;
+    for(int i = 0; i < segmentCount - closureSegment - CLOSURE_SEARCH; i++){
+        lowest = min(lowest, (int)segmentCurvature[i]);
+        highest = max(highest, (int)segmentCurvature[i]);
+    }
+    bool distinctive = highest - lowest >= SYNC_MIN_RANGE
+        && segmentCount >= closureSegment + CLOSURE_SEARCH + SYNC_WINDOW;
+    if(!distinctive && segmentCount < MAX_SEGMENTS){
+        return false;
+    }
+
+    double lapSegments = closureSegment;
+    if(distinctive){
+        long errors[2*CLOSURE_SEARCH + 1];
+        int best = 0;
+        for(int offset = -CLOSURE_SEARCH; offset <= CLOSURE_SEARCH; offset++){
+            errors[offset + CLOSURE_SEARCH] = closureError(closureSegment + offset);
+            if(errors[offset + CLOSURE_SEARCH] < errors[best + CLOSURE_SEARCH]){
+                best = offset;
+            }
+        }
+        lapSegments = closureSegment + best;
+        if(best > -CLOSURE_SEARCH && best < CLOSURE_SEARCH){
+            lapSegments += refineMinimum(errors[best + CLOSURE_SEARCH - 1], errors[best + CLOSURE_SEARCH], errors[best + CLOSURE_SEARCH + 1]);
+        }
+    }
+
+    int recorded = segmentCount;
+    double baseSpeed = mapPosition/((now - lapStartMs)*1e-3);
+    segmentCount = (int)(lapSegments + 0.5);
+    segmentLength = lapSegments*SEGMENT_LENGTH_MM/segmentCount;
+
+    //the overlap is the start of the next lap: average it into the map and keep it as the recent window
+    for(int k = 0; k < SYNC_WINDOW; k++){
+        recentCurvature[k] = segmentCurvature[recorded - SYNC_WINDOW + k];
+    }
+    recentCount = SYNC_WINDOW;
+    for(int i = 0; i + segmentCount < recorded; i++){
+        segmentCurvature[i] = (segmentCurvature[i] + segmentCurvature[i + segmentCount])/2;
+    }
+    buildSchedule(baseSpeed);
+    Serial.printf("track map learned: %i segments over %i mm\n", segmentCount, (int)(segmentCount*segmentLength));
+
+    mapMode = TRACK_MAP_RACING;
+    mapPosition = wrapPosition(mapPosition - segmentCount*segmentLength);
+    syncFailures = 0;
+    return true;
+}
+
+/**
+ * match the recent window against the map near the odometry position and pull the position
+ * onto the best alignment. returns false if a distinctive window matched nowhere nearby
+ */
+static bool syncRacing(){
+    double errors[2*SYNC_SEARCH + 1];
+    int best = 0;
+    for(int step = -SYNC_SEARCH; step <= SYNC_SEARCH; step++){
+        errors[step + SYNC_SEARCH] = windowError(mapPosition + step*SYNC_STEP_MM);
+        if(errors[step + SYNC_SEARCH] < errors[best + SYNC_SEARCH]){
+            best = step;
+        }
+    }
+    if(errors[best + SYNC_SEARCH] > SYNC_MAX_ERROR*SYNC_WINDOW){
+        return false;
+    }
+    double shift = best;
+    if(best > -SYNC_SEARCH && best < SYNC_SEARCH){
+        shift += refineMinimum(errors[best + SYNC_SEARCH - 1], errors[best + SYNC_SEARCH], errors[best + SYNC_SEARCH + 1]);
+    }
+    mapPosition = wrapPosition(mapPosition + shift*SYNC_STEP_MM);
+    return true;
+}
+
+/**
+ * search the whole map for the recent window. only a clear winner is accepted, since a wrong
+ * match would schedule straight-line speed into a curve
+ */
+static bool syncRelocating(){
+    int steps = (int)(segmentCount*segmentLength/SYNC_STEP_MM);
+    double bestError = -1;
+    int best = 0;
+    for(int step = 0; step < steps; step++){
+        double error = windowError(step*SYNC_STEP_MM);
+        if(bestError < 0 || error < bestError){
+            bestError = error;
+            best = step;
+        }
+    }
+    if(bestError > SYNC_MAX_ERROR*SYNC_WINDOW){
+        return false;
+    }
+    for(int step = 0; step < steps; step++){
+        int apart = abs(step - best);
+        if(min(apart, steps - apart)*SYNC_STEP_MM > SEGMENT_LENGTH_MM && windowError(step*SYNC_STEP_MM)*RELOCATE_MARGIN < bestError){
+            return false;//ambiguous
+        }
+    }
+    mapPosition = best*SYNC_STEP_MM;
+    return true;
+}
+
+/**
+ * the line point has moved another SEGMENT_LENGTH_MM from the last anchor: record the turn
+ * between this chord and the previous one and, once a lap is learned, check the position
+ * against the map
+ */
+static void recordSegment(uint32_t now){
+    double chord = hypot(smoothLineX - anchorX, smoothLineY - anchorY);
+    double heading = atan2(smoothLineY - anchorY, smoothLineX - anchorX);
+    double turn = remainder(heading - anchorHeading, 2*M_PI);
+    bool turnValid = anchorHeadingValid;
+    anchorX = smoothLineX;
+    anchorY = smoothLineY;
+    anchorHeading = heading;
+    anchorHeadingValid = true;
+    if(now > segmentStartMs){
+        speedEstimate = chord/((now - segmentStartMs)*1e-3);
+    }
+    segmentStartMs = now;
+    if(!turnValid){
+        return;
+    }
+    int16_t curvature = (int16_t)constrain(turn/chord*1e6, -32767.0, 32767.0);
+
+    if(mapMode == TRACK_MAP_LEARNING){
+        lapHeading += turn;
+        if(closureSegment == 0 && fabs(lapHeading) >= 2*M_PI - CLOSURE_TOLERANCE && mapPosition >= MIN_LAP_MM){
+            closureSegment = segmentCount;
+        }
+        if(segmentCount == MAX_SEGMENTS){
+            if(closureSegment == 0 || !finishLearning(now)){
+                restartLearning(now);//longer than the map can hold, keep driving at BASE_PWM
+            }
+            return;
+        }
+        segmentCurvature[segmentCount++] = curvature;
+        if(closureSegment > 0 && segmentCount >= closureSegment + CLOSURE_SEARCH + CLOSURE_OVERLAP){
+            finishLearning(now);
+        }
+        return;
+    }
+
+    recentCurvature[recentCount % SYNC_WINDOW] = curvature;
+    recentCount++;
+    if(recentCount < SYNC_WINDOW){
+        return;
+    }
+    int16_t lowest = recentCurvature[0];
+    int16_t highest = recentCurvature[0];
+    for(int k = 1; k < SYNC_WINDOW; k++){
+        lowest = min(lowest, recentCurvature[k]);
+        highest = max(highest, recentCurvature[k]);
+    }
+    if(highest - lowest < SYNC_MIN_RANGE){
+        return;//a straight or a constant curve fits anywhere along itself
+    }
+
+    if(mapMode == TRACK_MAP_RACING){
+        if(syncRacing()){
+            syncFailures = 0;
+        }
+        else if(++syncFailures >= SYNC_FAILURES_LOST){
+            mapMode = TRACK_MAP_RELOCATING;
+        }
+    }
+    else if(syncRelocating()){
+        mapMode = TRACK_MAP_RACING;
+        syncFailures = 0;
+    }
+}
+
+/**
+ * advance the map by the encoder counts since the last call and return the base PWM to drive
+ * with. must be called every iteration while following the line
+ */
+int updateTrackMap(int lineReading, int leftEncoderData, int rightEncoderData){
+    uint32_t now = millis();
+    if(!odometryValid || now - lastUpdateMs > FOLLOWING_GAP_MS
+        || leftEncoderData < lastLeftTicks || rightEncoderData < lastRightTicks){
+        //counts were reset or the robot manoeuvred in between, so the position is unknown
+        odometryValid = true;
+        lastLeftTicks = leftEncoderData;
+        lastRightTicks = rightEncoderData;
+        lastUpdateMs = now;
+        restartOdometry(lineReading, now);
+        if(mapMode == TRACK_MAP_LEARNING){
+            restartLearning(now);
+        }
+        else{
+            mapMode = TRACK_MAP_RELOCATING;
+        }
+        return BASE_PWM;
+    }
+
+    double left = (leftEncoderData - lastLeftTicks)*MM_PER_TICK;
+    double right = (rightEncoderData - lastRightTicks)*MM_PER_TICK;
+    lastLeftTicks = leftEncoderData;
+    lastRightTicks = rightEncoderData;
+    lastUpdateMs = now;
+
+    //dead reckon the robot, then place the line point from the QTR bar position and line reading
+    double turn = (right - left)/AXLE_WIDTH_MM;
+    double midHeading = poseHeading + turn/2;
+    poseX += (left + right)/2*cos(midHeading);
+    poseY += (left + right)/2*sin(midHeading);
+    poseHeading += turn;
+    double offset = (LINE_CENTRE - lineReading)*LINE_SENSOR_SPACING_MM/1000;//positive when the line is left of centre
+    double nextLineX = poseX + LINE_SENSOR_OFFSET_MM*cos(poseHeading) - offset*sin(poseHeading);
+    double nextLineY = poseY + LINE_SENSOR_OFFSET_MM*sin(poseHeading) + offset*cos(poseHeading);
+    //progress along the line; the sideways jitter of the line point is left out
+    double progress = (nextLineX - lineX)*cos(poseHeading) + (nextLineY - lineY)*sin(poseHeading);
+    lineX = nextLineX;
+    lineY = nextLineY;
+    //smoothed over distance rather than time, so the lag it adds is the same at every speed
+    double smoothing = min(1.0, fabs(progress)/LINE_SMOOTHING_MM);
+    smoothLineX += (lineX - smoothLineX)*smoothing;
+    smoothLineY += (lineY - smoothLineY)*smoothing;
+
+    if(mapMode == TRACK_MAP_LEARNING){
+        mapPosition += progress;
+    }
+    else{
+        mapPosition = wrapPosition(mapPosition + progress);
+    }
+    if(hypot(smoothLineX - anchorX, smoothLineY - anchorY) >= SEGMENT_LENGTH_MM){
+        recordSegment(now);
+    }
+
+    if(mapMode != TRACK_MAP_RACING){
+        return BASE_PWM;
+    }
+    //the slower of here and where the robot will be once the motors have responded
+    int here = wrapSegment((int)(mapPosition/segmentLength));
+    int ahead = wrapSegment((int)(wrapPosition(mapPosition + speedEstimate*LOOKAHEAD_S)/segmentLength));
+    return min(segmentPwm[here], segmentPwm[ahead]);
+}
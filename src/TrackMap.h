@@ -0,0 +1,32 @@
+/**
+ * Header file for lap learning and the per-segment speed schedule
+ *
+ * the first lap followed in NORMAL is recorded as the curvature of the line itself per fixed
+ * length: the robot is dead reckoned on its encoders and the line under the QTR bar placed from
+ * the line position, so the map does not depend on how the robot happened to steer along it.
+ * once the heading has closed a full turn the lap length is pinned down by matching the start of
+ * the map against the track after it, and a speed schedule is built: as fast as LAP_LATERAL_ACCEL
+ * allows through each segment, capped at LAP_MAX_PWM on straights, with a braking ramp of
+ * LAP_BRAKE_ACCEL ahead of every curve.
+ * later laps localise along the map by odometry and correct drift by matching the most recent
+ * segments' curvature against the map. any gap in line following (SENSING, BLOCKED) drops the
+ * position and the robot drives at BASE_PWM until a distinctive stretch of track is recognised again
+ */
+#pragma once
+
+#include <stdint.h>
+
+enum TrackMapMode {
+    TRACK_MAP_LEARNING,
+    TRACK_MAP_RACING,
+    TRACK_MAP_RELOCATING
+};
+
+/**
+ * function definitions
+ */
+void initTrackMap();
+
+int updateTrackMap(int lineReading, int leftEncoderData, int rightEncoderData);
+
+TrackMapMode getTrackMapMode();
@@ -0,0 +1,154 @@
+#include <Arduino.h>
+#include "TractionMonitor.h"
+#include "MotorModel.h"
+#include "MotorDriver.h"
+#include "Sensing.h"
+#include "SensorLog.h"
+#include "Tuning.h"
+
+#define TRACTION_GAP_US 20000 // longer gaps between updates are taken as this, the wheels were not being driven
+
+ROBOT_STATE WheelTraction tractionWheels[2]; // left, right
+ROBOT_STATE uint32_t lastTractionUs;
+
+FLASHMEM void initTractionMonitor(){
+    resetTraction();
+}
+
+/**
+ * forget what was seen of the wheels and lift any limit, for a drivetrain at rest
+ */
+void resetTraction(){
+    memset(tractionWheels, 0, sizeof(tractionWheels));
+    lastTractionUs = micros();
+}
+
+/**
+ * the command a ceiling leaves, of the same sign
+ */
+static double clampToCeiling(double command, double ceiling){
+    return command < 0 ? -min(-command, ceiling) : min(command, ceiling);
+}
+
+/**
+ * run each wheel's model on the commands applied over the elapsed time and judge its measured
+ * rate against it, unsigned as the encoders count either way. moves the ceiling of a limited wheel
+ */
+void stepTraction(WheelTraction wheels[2], const double commands[2], const double rates[2], uint32_t elapsedUs){
+    double dt = elapsedUs*1e-6;
+    double expected[2], excess[2];
+    bool driven[2];
+    for(int i = 0; i < 2; i++){
+        const MotorModel & model = getMotorModel(i == 0 ? LEFT : RIGHT);
+        double target = motorRate(i == 0 ? LEFT : RIGHT, commands[i]);
+        wheels[i].modelRate += (target - wheels[i].modelRate)*min(1.0, dt/model.timeConstant);
+        expected[i] = fabs(wheels[i].modelRate);
+        driven[i] = fabs(target) > TRACTION_MIN_RATE && expected[i] > TRACTION_MIN_RATE;
+        excess[i] = expected[i] > TRACTION_MIN_RATE ? rates[i]/expected[i] - 1 : 0;
+    }
+
+    for(int i = 0; i < 2; i++){
+        WheelTraction & wheel = wheels[i];
+        //a wheel whose model the other one bears out needs to run only half as far above its own
+        double share = driven[0] && driven[1] && fabs(excess[1 - i]) < TRACTION_SLIP_SHARE/4 ? TRACTION_SLIP_SHARE/2 : TRACTION_SLIP_SHARE;
+        bool over = rates[i] > expected[i]*(1 + share) + TRACTION_SLIP_FLOOR;
+        bool under = driven[i] && rates[i] < expected[i]*TRACTION_STALL_SHARE;
+        wheel.overSamples = over ? min(wheel.overSamples + 1, 255) : 0;
+        wheel.underUs = under ? wheel.underUs + elapsedUs : 0;
+        TractionState seen = wheel.overSamples >= TRACTION_SLIP_SAMPLES ? TRACTION_SLIP
+            : wheel.underUs >= TRACTION_STALL_US ? TRACTION_STALL : TRACTION_GRIP;
+
+        if(seen != TRACTION_GRIP){
+            if(seen != wheel.state){
+                //cut back to what holds the wheel at the rate it would have with grip, or at the rate of a stalled one
+                wheel.slips += seen == TRACTION_SLIP;
+                wheel.stalls += seen == TRACTION_STALL;
+                wheel.ceiling = motorFeedforward(i == 0 ? LEFT : RIGHT, min(expected[i], rates[i]));
+                wheel.limited = true;
+            }
+            wheel.state = seen;
+            wheel.clearUs = 0;
+        }
+        else if(wheel.state != TRACTION_GRIP){
+            wheel.clearUs = over || under ? 0 : wheel.clearUs + elapsedUs;
+            if(wheel.clearUs >= TRACTION_REGRIP_US){
+                wheel.state = TRACTION_GRIP;
+            }
+        }
+
+        //with the grip back the ceiling rises until the command asked for is under it
+        if(wheel.limited && wheel.state == TRACTION_GRIP){
+            wheel.ceiling += TRACTION_SLEW*elapsedUs*1e-3;
+            wheel.limited = wheel.ceiling < wheel.requested;
+        }
+    }
+}
+
+/**
+ * called once per loop(), and by the loops that drive the wheels without returning to it. judges
+ * both wheels against what was applied to them since the last call, logs and reports a wheel
+ * losing or getting back its grip
+ */
+FASTRUN void updateTraction(){
+    uint32_t now = micros();
+    uint32_t elapsed = min(now - lastTractionUs, (uint32_t)TRACTION_GAP_US);
+    lastTractionUs = now;
+    MotorOutput outputs[2];
+    getMotorOutputs(&outputs[0], &outputs[1]);
+    double commands[2];
+    bool idle = true;
+    for(int i = 0; i < 2; i++){
+        double magnitude = (double)outputs[i].duty/MOTOR_DUTY_MAX*MOTOR_FULL_SCALE;
+        commands[i] = outputs[i].forward ? magnitude : -magnitude;
+        const WheelTraction & wheel = tractionWheels[i];
+        idle = idle && magnitude == 0 && fabs(wheel.modelRate) < TRACTION_MIN_RATE && wheel.state == TRACTION_GRIP && !wheel.limited;
+    }
+    if(idle){
+        tractionWheels[0].modelRate = 0;
+        tractionWheels[1].modelRate = 0;
+        return;//braked and nothing to judge, the rates are left unread
+    }
+
+    double rates[2] = {getWheelTickRate(LEFT), getWheelTickRate(RIGHT)};
+    TractionState before[2] = {tractionWheels[0].state, tractionWheels[1].state};
+    stepTraction(tractionWheels, commands, rates, elapsed);
+    for(int i = 0; i < 2; i++){
+        const WheelTraction & wheel = tractionWheels[i];
+        if(wheel.state == before[i]){
+            continue;
+        }
+        logSensorRecord(LOG_TRACTION, i, wheel.state, (int32_t)(wheel.ceiling*1e3));
+        if(wheel.state != TRACTION_GRIP){
+            Serial.printf("%s wheel %s at %.0f ticks/s against %.0f, command limited to %.1f\n", i == 0 ? "left" : "right",
+                wheel.state == TRACTION_SLIP ? "slipping" : "stalled", rates[i], fabs(wheel.modelRate), wheel.ceiling);
+        }
+    }
+}
+
+/**
+ * the command setMotors() may apply to a wheel, the one asked for under the ceiling of a wheel
+ * that lost its grip
+ */
+double limitTraction(int encoderID, double command){
+    WheelTraction & wheel = tractionWheels[encoderID == LEFT ? 0 : 1];
+    wheel.requested = fabs(command);
+    if(!TRACTION_CONTROL || !motorModelFitted() || !wheel.limited){//the default model is no measure of this drivetrain
+        return command;
+    }
+    return clampToCeiling(command, wheel.ceiling);
+}
+
+/**
+ * whether either wheel is slipping or stalled, or was within TRACTION_REGRIP_US
+ */
+bool tractionLost(){
+    return tractionWheels[0].state != TRACTION_GRIP || tractionWheels[1].state != TRACTION_GRIP;
+}
+
+bool tractionLost(int encoderID){
+    return tractionWheels[encoderID == LEFT ? 0 : 1].state != TRACTION_GRIP;
+}
+
+const WheelTraction & getWheelTraction(int encoderID){
+    return tractionWheels[encoderID == LEFT ? 0 : 1];
+}
@@ -0,0 +1,76 @@
+/**
+ * Header file for telling when a wheel lost its grip on the floor, and limiting its command until
+ * it has it back
+ *
+ * a wheel that grips carries its share of the robot, so it answers its command no quicker than
+ * the model of its drive says (MotorModel.h). a steep step, the nudge away from a bump from behind
+ * or the start of a turn at full duty, may ask more of the floor than it gives: the tyre spins, and
+ * rid of the robot's weight the wheel runs ahead of its model. a wheel held by something, or
+ * pushing the robot against something, stays well behind it instead. each wheel's model is run on
+ * the commands actually applied and held against its measured tick rate:
+ *   slip   the wheel runs more than TRACTION_SLIP_SHARE above its model for
+ *          TRACTION_SLIP_SAMPLES updates in a row, or more than half that while both wheels are
+ *          driven and the other runs within a quarter of it of its own model, which says the model
+ *          holds and the difference is the floor's
+ *   stall  the wheel is driven to more than TRACTION_MIN_RATE but turns at less than
+ *          TRACTION_STALL_SHARE of its model for TRACTION_STALL_US
+ * while either holds, and for TRACTION_REGRIP_US after, the samples of that wheel are marked
+ * (tractionLost()) so the heading estimator takes its turn with a wide margin and the SENSING scan
+ * skips the readings, and the changes are logged as LOG_TRACTION. with TRACTION_CONTROL, once fit
+ * motors has found the model of this drivetrain (motorModelFitted()), the command of a wheel that
+ * lost its grip is cut back at once to what holds it at the rate its model gives it, the most a
+ * wheel that grips could have, or at the rate a stalled one turns at. once the grip is back it may
+ * only rise by TRACTION_SLEW per ms until it catches up with what the driving code asks for
+ * (setMotors() applies the ceiling). the default model says nothing about how fast this robot's
+ * wheels turn, so without a fit nothing is limited. the detection touches nothing of the hardware
+ * and is checked on the host against a drivetrain with a friction model (sim traction)
+ */
+#pragma once
+
+#include <stdint.h>
+
+#define TRACTION_MIN_RATE 300       // ticks per second of model below which a wheel is not judged
+#define TRACTION_SLIP_SHARE 0.25    // of the model a wheel may run above it
+#define TRACTION_SLIP_FLOOR 150     // ticks per second it may run above it in any case, for the edge timing
+#define TRACTION_SLIP_SAMPLES 2
+#define TRACTION_STALL_SHARE 0.25
+#define TRACTION_STALL_US 100000
+#define TRACTION_REGRIP_US 20000    // a wheel has its grip back after this long without either
+
+enum TractionState : uint8_t {
+    TRACTION_GRIP = 0,
+    TRACTION_SLIP,
+    TRACTION_STALL
+};
+
+struct WheelTraction {
+    TractionState state;
+    double modelRate;     // ticks per second, signed, the model's answer to the commands applied
+    double requested;     // size of the command the driving code asked for last
+    double ceiling;       // most command while limited
+    bool limited;
+    uint8_t overSamples;  // updates in a row above the model
+    uint32_t underUs;     // that it has been well below the model
+    uint32_t clearUs;     // that neither has held, while not gripping
+    uint16_t slips;       // episodes since the monitor was reset
+    uint16_t stalls;
+};
+
+/**
+ * function definitions
+ */
+void initTractionMonitor();
+
+void resetTraction();
+
+void stepTraction(WheelTraction wheels[2], const double commands[2], const double rates[2], uint32_t elapsedUs);
+
+void updateTraction();
+
+double limitTraction(int encoderID, double command);
+
+bool tractionLost();
+
+bool tractionLost(int encoderID);
+
+const WheelTraction & getWheelTraction(int encoderID);
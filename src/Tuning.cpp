@@ -0,0 +1,136 @@
+#include <string.h>
+#include "Tuning.h"
+
+#define DEFINE_TUNABLE(type, name, defaultValue, least, most) ROBOT_STATE type name = defaultValue;
+TUNABLE_LIST(DEFINE_TUNABLE)
+#undef DEFINE_TUNABLE
+
+enum TunableType { TUNABLE_int, TUNABLE_double };
+
+struct Tunable {
+    const char * name;
+    TunableType type;
+    void * (*address)(); // thread local storage has no constant address, so resolve it per call
+    double defaultValue;
+    double least;        // the range setTunable() accepts, ends included
+    double most;
+};
+
+#define TABLE_ENTRY(type, name, defaultValue, least, most) \
+    {#name, TUNABLE_##type, []() -> void * { return &name; }, defaultValue, least, most},
+static const Tunable tunables[] = {
+    TUNABLE_LIST(TABLE_ENTRY)
+};
+#undef TABLE_ENTRY
+
+static const int TUNABLE_COUNT = sizeof(tunables)/sizeof(tunables[0]);
+
+static const Tunable * findTunable(const char * name){
+    for(int i = 0; i < TUNABLE_COUNT; i++){
+        if(strcmp(tunables[i].name, name) == 0){
+            return &tunables[i];
+        }
+    }
+    return nullptr;
+}
+
+static void writeTunable(const Tunable & tunable, double value){
+    if(tunable.type == TUNABLE_int){
+        *(int *)tunable.address() = (int)(value < 0 ? value - 0.5 : value + 0.5);
+    }
+    else{
+        *(double *)tunable.address() = value;
+    }
+}
+
+/**
+ * restore every tunable to its default value
+ */
+void resetTunables(){
+    for(int i = 0; i < TUNABLE_COUNT; i++){
+        writeTunable(tunables[i], tunables[i].defaultValue);
+    }
+}
+
+/**
+ * set a tunable by name. returns false, leaving it as it was, if no tunable has that name or the
+ * value is outside its range
+ */
+bool setTunable(const char * name, double value){
+    const Tunable * tunable = findTunable(name);
+    if(tunable == nullptr || !(value >= tunable->least && value <= tunable->most)){
+        return false;
+    }
+    writeTunable(*tunable, value);
+    return true;
+}
+
+/**
+ * read a tunable by name. returns false if no tunable has that name
+ */
+bool getTunable(const char * name, double * value){
+    const Tunable * tunable = findTunable(name);
+    if(tunable == nullptr){
+        return false;
+    }
+    if(tunable->type == TUNABLE_int){
+        *value = *(int *)tunable->address();
+    }
+    else{
+        *value = *(double *)tunable->address();
+    }
+    return true;
+}
+
+/**
+ * the least and most value a tunable takes. returns false if no tunable has that name
+ */
+bool getTunableRange(const char * name, double * least, double * most){
+    const Tunable * tunable = findTunable(name);
+    if(tunable == nullptr){
+        return false;
+    }
+    *least = tunable->least;
+    *most = tunable->most;
+    return true;
+}
+
+/**
+ * true for the tunables held as int, false for the doubles and unknown names
+ */
+bool tunableIsInteger(const char * name){
+    const Tunable * tunable = findTunable(name);
+    return tunable != nullptr && tunable->type == TUNABLE_int;
+}
+
+int getTunableCount(){
+    return TUNABLE_COUNT;
+}
+
+/**
+ * name of the tunable at a place in TUNABLE_LIST, nullptr past the end
+ */
+const char * getTunableName(int index){
+    return index >= 0 && index < TUNABLE_COUNT ? tunables[index].name : nullptr;
+}
+
+/**
+ * FNV-1a hash of every tunable's name, type, default and range in order. it changes with any change to
+ * TUNABLE_LIST, so values stored by one build are not taken for another's
+ */
+uint32_t getTunableLayout(){
+    uint32_t hash = 2166136261u;
+    auto mix = [&hash](const void * data, size_t length){
+        for(size_t i = 0; i < length; i++){
+            hash = (hash ^ ((const uint8_t *)data)[i])*16777619u;
+        }
+    };
+    for(int i = 0; i < TUNABLE_COUNT; i++){
+        mix(tunables[i].name, strlen(tunables[i].name) + 1);
+        mix(&tunables[i].type, sizeof(tunables[i].type));
+        mix(&tunables[i].defaultValue, sizeof(tunables[i].defaultValue));
+        mix(&tunables[i].least, sizeof(tunables[i].least));
+        mix(&tunables[i].most, sizeof(tunables[i].most));
+    }
+    return hash;
+}
@@ -0,0 +1,75 @@
+/**
+ * Header file for tunable control parameters
+ */
+#pragma once
+
+#include <stdint.h>
+#include "Platform.h"
+
+/**
+ * every tunable as (type, name, default, least, most). the control code reads them as plain
+ * globals, a load like any other variable; the table below lets the serial console (see
+ * TuningConsole.h) and tools such as the simulator's parameter sweep set them by name, within range
+ */
+#define TUNABLE_LIST(X) \
+    X(int, BASE_PWM, 120, 0, 255) \
+    X(int, ROTATE_PWM, 90, 0, 255) \
+    X(int, HEADING_ESTIMATOR, 0, 0, 1) /* 1 = turn on the spot and map the SENSING scan by the heading estimated from the encoders and the lines crossed, 0 = by encoder ticks alone, see HeadingEstimator.h */ \
+    X(double, P_WEIGHT, 0.3, 0, 5) \
+    X(double, I_WEIGHT, 0, 0, 50) /* PWM of steering per line reading unit held for a second */ \
+    X(double, D_WEIGHT, 0, 0, 1) /* PWM of steering per line reading unit per second the line moves */ \
+    X(int, LINE_READING_TARGET, 1000, 0, 2000) /* line position the steering holds, 1000 is the middle of the bar */ \
+    X(double, MOTOR_SLEW, 0, 0, 255) /* most a wheel's command may change per ms, of 255 full duty, 0 = at once, see MotorDriver.h */ \
+    X(int, LINE_INTERPOLATION, 0, 0, 1) /* 1 = line position from a parabola through the strongest sensor, 0 = QTRSensors' weighted average, which suits the 3 sparse sensors better, see LineFit.h */ \
+    X(int, IR_LOWER_THRESHOLD, 1250, 0, 5000) /* raw QTR reading above which one of the getIRValues() sensors is over the line, the evasion watches for it to find the line again */ \
+    X(int, IR_PEAK_THRESHOLD, 1500, 0, 5000) /* irMAP readings above this are on a branch, see classifyScan() */ \
+    X(int, JUNCTION_POLICY, 0, 0, 4) /* branch taken at forks and junctions: 0 = strongest in a scan, 1 = left, 2 = right, 3 = straight, 4 = JUNCTION_SCRIPT, see JunctionDetector.h */ \
+    X(int, JUNCTION_SCRIPT, 2, 0, 333333333) /* branches for JUNCTION_POLICY 4, one digit per junction in turn: 1 = left, 2 = straight, 3 = right */ \
+    X(int, MIC_BUMP_THRESHOLD, 30, 1, 4095) /* counts above the mic baseline that count as a bump */ \
+    X(double, MIC_AVERAGE_RATE, 0.0001, 0, 1) /* weight of each quiet mic sample in the baselines, the mics are sampled at 10 kHz */ \
+    X(int, BUMP_NUDGE_PWM, 200, 0, 255) /* PWM pushed away from a hard bump, scaled down for lighter ones, see BumpLocator.h */ \
+    X(double, IR_AVERAGE_RATE, 0.001, 0, 1) \
+    X(int, IR_LOCKIN, 0, 0, 1) /* 1 = alternate the QTR emitters between readings and demodulate them to cancel ambient light, see LockIn.h. needs the emitter CTRL wired to pin 12 */ \
+    X(int, IR_LOCKIN_WINDOW, 2, 1, 8) /* on-minus-off differences averaged per demodulated reading */ \
+    X(int, LAP_LEARNING, 0, 0, 1) /* 1 = learn the track on the first lap and schedule speed from it, see TrackMap.h */ \
+    X(int, LAP_MAX_PWM, 240, 0, 255) /* scheduled base PWM on straights, at most full duty */ \
+    X(double, LAP_LATERAL_ACCEL, 275, 0, 5000) /* mm/s^2 the line follower holds the line at through curves */ \
+    X(double, LAP_BRAKE_ACCEL, 1250, 0, 10000) /* mm/s^2 of deceleration planned ahead of curves */ \
+    X(int, SPEED_GOVERNOR, 0, 0, 1) /* 1 = limit the base PWM by the curvature seen online, see SpeedGovernor.h */ \
+    X(int, GOVERNOR_MAX_PWM, 255, 0, 255) /* governed base PWM on straights, at most the full duty rangePWM() clamps a wheel to */ \
+    X(double, GOVERNOR_LATERAL_ACCEL, 600, 0, 5000) /* mm/s^2 allowed through curves */ \
+    X(double, BLOCKAGE_TOLERANCE, 0.25, 0, 1) /* metres of ultrasonic range below which the path is blocked */ \
+    X(double, OBSTACLE_BRAKE_ACCEL, 800, 0, 10000) /* mm/s^2 of braking planned ahead of a tracked obstacle, 0 = only stop at BLOCKAGE_TOLERANCE, see RangeTracker.h */ \
+    X(int, EVASION_PWM, 150, 0, 255) /* outer wheel PWM while detouring around an obstacle */ \
+    X(double, EVASION_OFFSET_MM, 220, 0, 1000) /* how far to the side of the line the detour passes the obstacle */ \
+    X(double, WHEEL_LEFT_KP, 0.45, 0, 5) /* speed loop of the left wheel, PWM per tick per second it is off the target, as tune wheels found in the sim, see WheelSpeed.h */ \
+    X(double, WHEEL_LEFT_KI, 22, 0, 1000) /* and PWM per tick it fell behind or ran ahead */ \
+    X(double, WHEEL_RIGHT_KP, 0.47, 0, 5) \
+    X(double, WHEEL_RIGHT_KI, 24, 0, 1000) \
+    X(int, AUTOTUNE_RULE, 0, 0, 1) /* gains from a relay experiment by 0 = Ziegler-Nichols, 1 = Tyreus-Luyben, which is slower and overshoots less, see AutoTune.h */ \
+    X(int, AUTOTUNE_SAVE, 0, 0, 1) /* 1 = store the gains an experiment found in EEPROM at once */ \
+    X(int, TRACTION_CONTROL, 1, 0, 1) /* 1 = cut back the command of a wheel found slipping or stalled once the drivetrain model is fitted, 0 = only mark its samples, see TractionMonitor.h */ \
+    X(double, TRACTION_SLEW, 0.8, 0, 255) /* most the command of such a wheel rises per ms once it grips again, of 255 full duty */
+
+#define DECLARE_TUNABLE(type, name, defaultValue, least, most) extern ROBOT_STATE type name;
+TUNABLE_LIST(DECLARE_TUNABLE)
+#undef DECLARE_TUNABLE
+
+/**
+ * function definitions
+ */
+void resetTunables();
+
+bool setTunable(const char * name, double value);
+
+bool getTunable(const char * name, double * value);
+
+bool getTunableRange(const char * name, double * least, double * most);
+
+bool tunableIsInteger(const char * name);
+
+int getTunableCount();
+
+const char * getTunableName(int index);
+
+uint32_t getTunableLayout();
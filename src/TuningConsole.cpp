@@ -0,0 +1,188 @@
+#include <Arduino.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "TuningConsole.h"
+#include "Tuning.h"
+#include "Persist.h"
+#include "SensorLog.h"
+#include "AutoTune.h"
+#include "MotorModel.h"
+
+#define CONSOLE_REPLY_MAX 96     // characters of the longest reply, a list line of the longest name included
+#define CONSOLE_SAVE_WRITES 1    // EEPROM bytes a poll writes of a save, each takes tens of us
+
+ROBOT_STATE char consoleLine[CONSOLE_LINE_MAX + 1];
+ROBOT_STATE int consoleLength;
+ROBOT_STATE bool consoleOverflow;   // the line being read is too long and is dropped at its end
+ROBOT_STATE int consoleListed;      // tunables of a list printed so far
+ROBOT_STATE int consoleListCount;   // and in all
+ROBOT_STATE bool consoleSaving;     // a save is being written
+
+/**
+ * a tunable's value as the console prints it, without a fraction for the int ones
+ */
+static void formatValue(const char * name, double value, char * text, int size){
+    if(tunableIsInteger(name)){
+        snprintf(text, size, "%d", (int)value);
+    }
+    else{
+        snprintf(text, size, "%g", value);
+    }
+}
+
+/**
+ * the line list prints for the tunable at a place in TUNABLE_LIST. returns its length, 0 past the end
+ */
+int formatTunable(int index, char * reply, int size){
+    const char * name = getTunableName(index);
+    if(name == nullptr){
+        return 0;
+    }
+    double value = 0, least = 0, most = 0;
+    getTunable(name, &value);
+    getTunableRange(name, &least, &most);
+    char text[24];
+    formatValue(name, value, text, sizeof(text));
+    return snprintf(reply, size, "%s = %s (%.10g..%.10g)", name, text, least, most);
+}
+
+/**
+ * run one command line and write what it has to say into reply, empty for a blank line. returns
+ * how many tunables are to be listed after the reply, see formatTunable()
+ */
+FLASHMEM int runTuningCommand(const char * line, char * reply, int size){
+    char command[8], name[32], valueText[24], extra;
+    reply[0] = '\0';
+    int fields = sscanf(line, "%7s %31s %23s %c", command, name, valueText, &extra);
+    if(fields <= 0){
+        return 0;
+    }
+
+    if(strcmp(command, "list") == 0 && fields == 1){
+        snprintf(reply, size, "%d tunables", getTunableCount());
+        return getTunableCount();
+    }
+    if(strcmp(command, "save") == 0 && fields == 1){
+        snprintf(reply, size, beginPersistedSave() ? "saving" : "already saved");
+        return 0;
+    }
+    if(strcmp(command, "tune") == 0 && fields == 2 && (strcmp(name, "line") == 0 || strcmp(name, "wheels") == 0)){
+        bool line = strcmp(name, "line") == 0;
+        snprintf(reply, size, !startAutoTune(line ? TUNE_LINE : TUNE_WHEELS) ? "error: already tuning"
+            : line ? "will tune the line loop once following the line" : "will tune the wheel speed loops once following the line");
+        return 0;
+    }
+    if(strcmp(command, "fit") == 0 && fields == 2 && strcmp(name, "motors") == 0){
+        snprintf(reply, size, startMotorFit() ? "fitting the drivetrain, the robot turns about each wheel in turn" : "error: already fitting");
+        return 0;
+    }
+    bool get = strcmp(command, "get") == 0 && fields == 2;
+    bool set = strcmp(command, "set") == 0 && fields == 3;
+    if(!get && !set){
+        snprintf(reply, size, "error: expected get NAME, set NAME VALUE, list, save, tune line|wheels or fit motors");
+        return 0;
+    }
+
+    double value, least, most;
+    if(!getTunableRange(name, &least, &most)){
+        snprintf(reply, size, "error: no tunable %s", name);
+        return 0;
+    }
+    if(set){
+        char * end;
+        value = strtod(valueText, &end);
+        if(end == valueText || *end != '\0'){
+            snprintf(reply, size, "error: %s is not a number", valueText);
+            return 0;
+        }
+        if(!(value >= least && value <= most)){
+            snprintf(reply, size, "error: %s takes %.10g..%.10g", name, least, most);
+            return 0;
+        }
+        if(tunableIsInteger(name) && value != (double)(long)value){
+            snprintf(reply, size, "error: %s takes whole numbers", name);
+            return 0;
+        }
+        setTunable(name, value);
+    }
+    getTunable(name, &value);
+    char text[24];
+    formatValue(name, value, text, sizeof(text));
+    snprintf(reply, size, "%s = %s", name, text);
+    return 0;
+}
+
+FLASHMEM void initTuningConsole(){
+    consoleLength = 0;
+    consoleOverflow = false;
+    consoleListed = 0;
+    consoleListCount = 0;
+    consoleSaving = false;
+}
+
+/**
+ * called once per loop(). writes the next bytes of a save or prints the next line of a list, or
+ * else reads what Serial holds up to the end of a line or CONSOLE_BYTES_PER_POLL bytes and runs
+ * the command that line ends
+ */
+FASTRUN void pollTuningConsole(){
+    char reply[CONSOLE_REPLY_MAX];
+    if(consoleSaving || continuePersistedSave(0)){//begun by save or by a tune with AUTOTUNE_SAVE
+        consoleSaving = continuePersistedSave(CONSOLE_SAVE_WRITES);
+        if(!consoleSaving){
+            Serial.println("saved");
+        }
+        return;
+    }
+    if(consoleListed < consoleListCount){
+        formatTunable(consoleListed++, reply, sizeof(reply));
+        Serial.println(reply);
+        return;
+    }
+    if(Serial.available() <= 0){
+        return;
+    }
+
+    uint8_t bytes[CONSOLE_BYTES_PER_POLL];
+    int count = 0;
+    bool lineEnded = false;
+    while(count < CONSOLE_BYTES_PER_POLL && !lineEnded){
+        int c = Serial.read();
+        if(c < 0){
+            break;
+        }
+        bytes[count++] = (uint8_t)c;
+        lineEnded = c == '\n' || c == '\r';
+    }
+    int32_t packed[2] = {0, 0};
+    for(int i = 0; i < count; i++){
+        packed[i/4] |= (int32_t)((uint32_t)bytes[i] << (8*(i % 4)));
+    }
+    logSensorRecord(LOG_SERIAL_INPUT, count, packed[0], packed[1]);
+
+    for(int i = 0; i < count; i++){
+        char c = (char)bytes[i];
+        if(c != '\n' && c != '\r'){
+            if(consoleLength < CONSOLE_LINE_MAX){
+                consoleLine[consoleLength++] = c;
+            }
+            else{
+                consoleOverflow = true;
+            }
+            continue;
+        }
+        if(consoleOverflow){
+            Serial.printf("error: lines take at most %d characters\n", CONSOLE_LINE_MAX);
+        }
+        else if(consoleLength > 0){
+            consoleLine[consoleLength] = '\0';
+            consoleListCount = runTuningCommand(consoleLine, reply, sizeof(reply));
+            consoleListed = 0;
+            if(reply[0] != '\0'){
+                Serial.println(reply);
+            }
+        }
+        consoleLength = 0;
+        consoleOverflow = false;
+    }
+}
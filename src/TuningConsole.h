@@ -0,0 +1,33 @@
+/**
+ * Header file for tuning the robot over Serial while it runs
+ *
+ * a line based console on the tunables of Tuning.h, one command per line:
+ *   get NAME          the value of a tunable
+ *   set NAME VALUE    change it, refused outside its range or as a fraction for an int
+ *   list              every tunable with its value and range
+ *   save              store the tunables in EEPROM for the next boot, see Persist.h
+ *   tune line|wheels  find the gains of the steering or the wheel speed loops, see AutoTune.h
+ *   fit motors        fit the model of each wheel's drive from steps, see MotorModel.h
+ * loop() polls the console once per tick. a poll reads at most a few bytes and runs at most one
+ * command, prints at most one line of a list or writes at most one byte of a save, so typing at
+ * the robot does not stall the control loop, and as the console runs between ticks a tunable
+ * never changes halfway through one. the
+ * control code keeps reading the tunables as plain globals. every byte read is logged, so a replay
+ * sees the same commands at the same ticks (see sim/Replay.h). runTuningCommand() touches nothing
+ * of the hardware but the EEPROM on save and is checked on the host (sim tuning)
+ */
+#pragma once
+
+#define CONSOLE_LINE_MAX 64      // characters of the longest command, longer lines are refused whole
+#define CONSOLE_BYTES_PER_POLL 8 // most bytes read from Serial per poll, those of a LOG_SERIAL_INPUT record
+
+/**
+ * function definitions
+ */
+int runTuningCommand(const char * line, char * reply, int size);
+
+int formatTunable(int index, char * reply, int size);
+
+void initTuningConsole();
+
+void pollTuningConsole();
@@ -0,0 +1,42 @@
+#include "WheelSpeed.h"
+#include "Tuning.h"
+#include "Sensing.h"
+#include "MotorDriver.h"
+
+#define WHEEL_SPEED_GAP_US 50000 // updates further apart than this start the integral over
+
+void resetWheelSpeedLoop(WheelSpeedLoop * loop){
+    loop->integral = 0;
+    loop->lastUs = 0;
+    loop->primed = false;
+}
+
+/**
+ * the command that brings the wheel from measuredRate to targetRate, in ticks per second, between
+ * 0 and MOTOR_FULL_SCALE
+ */
+double updateWheelSpeedLoop(WheelSpeedLoop * loop, int encoderID, double targetRate, double measuredRate, double feedforward, uint32_t nowUs){
+    double kp = encoderID == LEFT ? WHEEL_LEFT_KP : WHEEL_RIGHT_KP;
+    double ki = encoderID == LEFT ? WHEEL_LEFT_KI : WHEEL_RIGHT_KI;
+    double error = targetRate - measuredRate;
+    uint32_t elapsed = nowUs - loop->lastUs;
+    if(!loop->primed || elapsed > WHEEL_SPEED_GAP_US){
+        loop->integral = 0;
+        elapsed = 0;
+        loop->primed = true;
+    }
+    loop->lastUs = nowUs;
+
+    double step = error*elapsed*1e-6;
+    double command = feedforward + kp*error + ki*(loop->integral + step);
+    if(command > MOTOR_FULL_SCALE){
+        command = MOTOR_FULL_SCALE;
+        step = step > 0 ? 0 : step;//held at the limit, only let the integral come back from it
+    }
+    else if(command < 0){
+        command = 0;
+        step = step < 0 ? 0 : step;
+    }
+    loop->integral += step;
+    return command;
+}
@@ -0,0 +1,27 @@
+/**
+ * Header file for holding a wheel at a tick rate
+ *
+ * a PI loop per wheel from the tick rate of its encoder edges (getWheelTickRate()) to its command
+ * on the scale of setMotors(), added to a feedforward the caller passes in, e.g. the command that
+ * drove the wheel at about that rate before. the gains are WHEEL_LEFT_KP, WHEEL_LEFT_KI and those
+ * of the right wheel, found for the drivetrain at hand by tune wheels (see AutoTune.h). the
+ * integral stops growing while the command is held at its limit, so a wheel that cannot keep up
+ * does not overshoot once it can. the rates are unsigned as the encoders only count, the loop
+ * drives forwards. touches nothing of the hardware
+ */
+#pragma once
+
+#include <stdint.h>
+
+struct WheelSpeedLoop {
+    double integral;  // tick rate error over time, in ticks
+    uint32_t lastUs;  // of the last update
+    bool primed;      // false until the first update after a reset
+};
+
+/**
+ * function definitions
+ */
+void resetWheelSpeedLoop(WheelSpeedLoop * loop);
+
+double updateWheelSpeedLoop(WheelSpeedLoop * loop, int encoderID, double targetRate, double measuredRate, double feedforward, uint32_t nowUs);
@@ -1,202 +1,305 @@
 #include <Arduino.h>
 #include "Sensing.h"
 #include "Driving.h"
+#include "Tuning.h"
+#include "SensorLog.h"
+#include "StateMachine.h"
+#include "EvasionPlanner.h"
+#include "RangeTracker.h"
+#include "JunctionDetector.h"
+#include "HeadingEstimator.h"
+#include "LatencyProbe.h"
+#include "Persist.h"
+#include "TuningConsole.h"
+#include "MotorModel.h"
+#include "TractionMonitor.h"
+
+#define IR_SCAN_DEGREES 720 // most the wheels turn the robot in a scan, by the nominal axle, to close the circle with the estimator
+#define BOOT_LINE_TIMEOUT_MS 250 // how long setup() looks for the line under the bar before it has the robot scan for it
 
 /**
- * PINS:
+ * PINS, named in PinMap.h:
  * 1,2,3,4,5,7 used by QuadDecoder.h
  * 8, 9, 10, 11 used by motor driver
  * 13, 14 used by Ultrasonic
  * 15, 16, 17 used by mics
  * 18, 19, 20 used by IR signal return
- * 
+ * 12 used by IR emitter control (CTRL on the QTR board)
  * 
  * 21, 22, 23 analog still open
- * 6, 12 digital/PWM still open
+ * 6 digital/PWM still open
  */
 
 //declare subroutines
-void continueRampage();
-void initRampage(int offendingSensor);
-void handleBlockade(double distanceVal);
-void updateState(int NEW_STATE);
-void revertState();
+void enterNormal();
+void resumeNormal();
+RobotEvent tickNormal();
+void enterSensing();
+void resumeSensing();
+RobotEvent tickSensing();
+void enterBlocked();
+RobotEvent tickBlocked();
 void pollIRValueRadially();
 int getHeadingFromirMAP();
 void idleWhileRotating();
-
-
-const int NORMAL = 1;
-const int SENSING = 2;
-const int BLOCKED = 3;
-int CURRENT_STATE, LAST_STATE;
-
-uint32_t nextSoundPollTime;
-#define BLOCKAGE_TOLERANCE 0.15
-
-uint32_t offroadTimer;
-bool offRoadTimerActive;
-int irMAP[360];
-#define IR_LOWER_THRESHOLD 1250 //threshold of 1000 for 
-
-void setup(){
+bool waitForLine(uint32_t timeoutMs);
+
+//what each state does, indexed by RobotState. the transitions between them live in StateMachine.cpp
+const StateHandlers stateHandlers[STATE_COUNT] = {
+  /* STATE_NONE */      {nullptr, nullptr, nullptr, nullptr},
+  /* STATE_NORMAL */    {enterNormal, nullptr, resumeNormal, tickNormal},
+  /* STATE_SENSING */   {enterSensing, nullptr, resumeSensing, tickSensing},
+  /* STATE_BLOCKED */   {enterBlocked, nullptr, nullptr, tickBlocked},
+  /* STATE_ON_COURSE */ {nullptr, nullptr, nullptr, nullptr},
+};
+
+ROBOT_STATE uint32_t nextSoundPollTime;
+
+ROBOT_STATE uint32_t offroadTimer;
+ROBOT_STATE bool offRoadTimerActive;
+//the scans are only touched while turning on the spot, they go in the slower RAM2 with the bulk buffers
+DMAMEM ROBOT_STATE int irMAP[360];
+DMAMEM ROBOT_STATE int irScan[IR_SCAN_DEGREES];//by degree the wheels turned the robot, mapped onto irMAP once the scan is done, see HEADING_ESTIMATOR
+ROBOT_STATE PersistStatus bootStatus;
+ROBOT_STATE bool firstTickReported;
+
+FLASHMEM void setup(){
   Serial.begin(9600);
+#ifdef SENSOR_LOG_SERIAL
+  enableSerialSensorLog();//stream every sensor reading for host replay, see sim/Replay.h
+#endif
   initSensing();
   initDriving();
+  initEvasionPlanner();
+  initBumpLocator();
+  initJunctionDetector(2000);//getLinePosition() runs from 0 to 2000 over the array
+  initTuningConsole();
   
   nextSoundPollTime = millis();
   offroadTimer = millis();
 
   offRoadTimerActive = false;
-
-  CURRENT_STATE = NORMAL;
-  LAST_STATE = 0;//set to invalid state if unused
-  enableMovement();
-  // Serial.println("waiting for input to continue...");
-  // while(!Serial.available()){
-  //   Serial.println(getDistanceValue());
-  //   delay(100);
-  // }
-  delay(2000);
+  memset(irMAP, 0, sizeof(irMAP));//DMAMEM is not cleared at startup
+  memset(irScan, 0, sizeof(irScan));
+
+  //the encoders and mics run off their interrupts from their init on, what is restored here and
+  //the wait for the line below overlap with their first samples
+  bootStatus = restorePersistedState();
+  Serial.printf("stored calibration %s\n", persistStatusName(bootStatus));
+  bool lineSeen = waitForLine(BOOT_LINE_TIMEOUT_MS);
+
+  initStateMachine(stateHandlers);//enters NORMAL, which enables movement
+  //without a stored wheel base scale the estimator learns it in a full scan, the one that finds the line
+  if(!lineSeen || (bootStatus != PERSIST_OK && HEADING_ESTIMATOR)){
+    dispatchEvent(EVENT_LINE_LOST);
+  }
+  firstTickReported = false;
+#ifdef LATENCY_PROBE
+  startLatencyProbe();//how late interrupts are taken while the robot runs, see LatencyProbe.h
+#endif
   Serial.println("beginning program.");
 }
 
-void loop(){
+FASTRUN void loop(){
   /**
-   * state machine. may be in normal mode, blocked, or sensing. 
+   * state machine. may be in normal mode, blocked, or sensing, see StateMachine.h
    */
-  if(CURRENT_STATE == NORMAL){
-    int linePosition = getLinePosition();
-    std::array<int, 3> irValues = getIRValues();
+  logSensorRecord(LOG_TICK, getCurrentState());
+  if(!continueMotorFit()){//a drivetrain fit has the wheels to itself while it runs, see MotorModel.h
+    tickStateMachine();
+    updateTraction();//whether the wheels kept their grip on what the tick applied, see TractionMonitor.h
+  }
+  pollTuningConsole();//get, set, list and save tunables over Serial, see TuningConsole.h
+  if(!firstTickReported){
+    firstTickReported = true;
+    Serial.printf("first control tick %u ms after reset\n", (unsigned)millis());
+  }
+#ifdef LATENCY_PROBE
+  reportLatencyProbe();
+#endif
+}
+
+/**
+ * NORMAL: follow the line
+ */
+void enterNormal(){
+  enableMovement();
+  resetJunctionDetector();//the robot turned or detoured since it last followed the line
+  dropRangeTrack();//whatever was tracked before the line was lost is out of date
+}
+
+/**
+ * back from a blockade that cleared by itself, the obstacle is still tracked in case it did not go far
+ */
+void resumeNormal(){
+  enableMovement();
+}
+
+FASTRUN RobotEvent tickNormal(){
+  int linePosition = getLinePosition();
+  getIRValues();//reads the array for the next getLinePosition() and logs it, the values are not needed here
 
-    //determine if vehicle has lost sight of the line and make corrections accordingly
+  //determine if vehicle has lost sight of the line and make corrections accordingly
+  //guards only use the readings taken above, the state machine handles the transition
 
 /*
-    if(irValOffroad(irValues[0], irValues[1], irValues[2])){
-      if(offRoadTimerActive){
-        if(linePosition >850 && linePosition < 1150 ){//all three sensors read low, and sensor was not at an edge recently
-          if(offroadTimer < millis()){//any buffer time from exit of last sensing mode has expired
-            irValues = getIRValues();
-            if(irValues[0] < IR_LOWER_THRESHOLD && irValues[1] < IR_LOWER_THRESHOLD && irValues[2] < IR_LOWER_THRESHOLD){
-                Serial.print("have an expired timer... ");
-                Serial.println(" and it expired recently with the low condition, indicating a current fault");
-                Serial.printf("IR values: %i, %i, %i\n", irValues[0], irValues[1], irValues[2]);
-                Serial.printf("readLine value: %i", linePosition);
-                Serial.println("off course detected, initiating sensing mode");
-                updateState(SENSING);
-                disableMovement();
-                resetTickCounts();
-                rotateForCalibration();
-            }
-          }
+  if(irValOffroad(irValues[0], irValues[1], irValues[2])){
+    if(offRoadTimerActive){
+      if(linePosition >850 && linePosition < 1150 ){//all three sensors read low, and sensor was not at an edge recently
+        if(offroadTimer < millis()){//any buffer time from exit of last sensing mode has expired
+          Serial.printf("IR values: %i, %i, %i\n", irValues[0], irValues[1], irValues[2]);
+          Serial.printf("readLine value: %i", linePosition);
+          Serial.println("off course detected, initiating sensing mode");
+          return EVENT_LINE_LOST;
         }
       }
-      else{
-        offRoadTimerActive = true;
-        offroadTimer = millis()+100;
-      }
     }
+    else{
+      offRoadTimerActive = true;
+      offroadTimer = millis()+100;
+    }
+  }
 */
 
-
-    //update driving vars with IR readLine data and mic values for bump compensation
-    std::array<int, 3> micValues = getMicValues();
-    setDrivingVars(linePosition, micValues[MIC_FRONT_RIGHT],  micValues[MIC_REAR], micValues[MIC_FRONT_LEFT]);
-
-    //every ~100 ms:
-    //read ultrasonic range sensor. called less often that other inputs due to 10 ms delay on each ultrasonic reading
-    // uint32_t current_time = millis();
-    // if(nextSoundPollTime < current_time){
-    //   nextSoundPollTime = current_time + 100;//update the time to be 100 ms later
-      
-    //   double distanceVal = getDistanceValue();//ultrasonic sensor and mics should be polled significantly less often than the IR reflectance sensor.
-    //   // handleBlockade(distanceVal);
-    // }
+  //update driving vars with IR readLine data and the located bump for bump compensation
+  BumpEvent bump;
+  bool bumped = locateBump(&bump);
+  //the policy may steer onto a branch of a junction instead, the encoders are only read when it can
+  int steerPosition = JUNCTION_POLICY == POLICY_STRONGEST ? linePosition
+    : followJunctions(getLineReading(), getEncoderData(LEFT), getEncoderData(RIGHT));
+  setDrivingVars(steerPosition, bumped ? &bump : nullptr);
+
+  noteLinePosition(linePosition);
+
+  //every ~50 ms:
+  //read ultrasonic range sensor. called less often that other inputs as each reading waits for the echo
+  uint32_t current_time = millis();
+  if(nextSoundPollTime < current_time){
+    nextSoundPollTime = current_time + 50;//update the time to be 50 ms later
+    
+    double distanceVal = getDistanceValue();//ultrasonic sensor should be polled significantly less often than the IR reflectance sensor.
+    bool accepted = updateRangeTracker(distanceVal, current_time);//a lone spurious echo is held back by the tracker
+    noteRangeReading(accepted ? distanceVal : NO_ECHO_DISTANCE, getEncoderData(LEFT), getEncoderData(RIGHT));
   }
-  else if(CURRENT_STATE == SENSING){
-    //Serial.println("currently sensing due to lack of line to follow");
-    //360 degree rotation started in NORMAL state last iteration
-    bool finishedRotating = continueRotating(getEncoderData(LEFT), getEncoderData(RIGHT));
-    pollIRValueRadially();
-    if(finishedRotating){
-      int newHeading = getHeadingFromirMAP();
-      // Serial.print("New calculated heading is: ");
-      // Serial.println(newHeading);
-      // Serial.println("sensed and turned toward new trajectory. exiting sensing state");
-
-      //resetTickCounts();
-      rotateToAngle(newHeading);
-      idleWhileRotating();
-      enableMovement();
-      updateState(NORMAL);
-    }
-  }
-  else if(CURRENT_STATE == BLOCKED){
-    Serial.println("blockade detected. call offroad functions to handle this");
+
+  //the tracked range is extrapolated between readings, see RangeTracker.h
+  if(rangeTracked() && predictRange(current_time) < BLOCKAGE_TOLERANCE){
+    Serial.println("Blockade detected, executing evasion maneuver");
+    return EVENT_OBSTACLE;
   }
+  return EVENT_NONE;
+}
 
+/**
+ * SENSING: the line was lost, rotate a full turn recording IR reflectance and head for the strongest line
+ */
+void enterSensing(){
+  disableMovement();
+  resetTickCounts();
+  if(HEADING_ESTIMATOR){
+    resetHeading();//the scan is mapped from where the robot faces now
+    memset(irScan, 0, sizeof(irScan));
+  }
+  rotateForCalibration();
 }
 
 /**
- * hold in a loop until rotation has completed.
- * prevents logic from executing while rotating
+ * picks the calibration rotation back up after a blockade, the tick counts were kept
  */
-void idleWhileRotating(){
-  while(!continueRotating(getEncoderData(LEFT), getEncoderData(RIGHT))){
-    delay(5);//hold in non-sensing state until rotation is complete
+void resumeSensing(){
+  rotateForCalibration();
+}
+
+RobotEvent tickSensing(){
+  bool finishedRotating = continueRotating(getEncoderData(LEFT), getEncoderData(RIGHT));
+  pollIRValueRadially();
+  if(!finishedRotating){
+    return EVENT_NONE;
   }
+  int newHeading = getHeadingFromirMAP();
+  // Serial.print("New calculated heading is: ");
+  // Serial.println(newHeading);
+  // Serial.println("sensed and turned toward new trajectory. exiting sensing state");
+
+  if(HEADING_ESTIMATOR){
+    //the turn ended a little past the full circle, by the estimate
+    newHeading = ((newHeading - (int)lround(getHeading()*180/M_PI)) % 360 + 360) % 360;
+  }
+  //resetTickCounts();
+  rotateToAngle(newHeading);
+  idleWhileRotating();
+  //the scan taught the estimator the wheel base scale, keep it for the next boot while standing still.
+  //tunables set over Serial since are left to save
+  if(HEADING_ESTIMATOR || bootStatus != PERSIST_OK){
+    saveCalibration();
+  }
+  return EVENT_HEADING_FOUND;
 }
 
 /**
- * function to be called continuously and given the distance value from the ultrasonic sensor
- * handles locking and unlocking movement as needed given the input data
- * function may be called while in a state other than normal, and uses last_state to return to the correct state after blockade removed. this logic may turn out to be super shitty
- * maybe have a dynamic array and push/pop so that index 0 is the current state
+ * BLOCKED: pushed over NORMAL or SENSING when the ultrasonic sensor sees an obstacle. waits for it to
+ * clear, otherwise detours around it and hands back to the line follower, see EvasionPlanner.h
  */
-void handleBlockade(double distanceVal){
- if(CURRENT_STATE == BLOCKED){
-    if(distanceVal > BLOCKAGE_TOLERANCE){
-      Serial.println("Blockade removed, reverting to normal state");
-      enableMovement();
-      revertState();
-    }
+void enterBlocked(){
+  disableMovement();
+  startEvasion(predictRange(millis()), getEncoderData(LEFT), getEncoderData(RIGHT));
+  nextSoundPollTime = millis();
+}
+
+RobotEvent tickBlocked(){
+  double distanceVal = -1;//negative when the range was not polled this iteration
+  double echo = -1;
+  uint32_t current_time = millis();
+  if(evasionWatchingObstacle() && nextSoundPollTime <= current_time){
+    nextSoundPollTime = current_time + 50;
+    echo = getDistanceValue();
+    updateRangeTracker(echo, current_time);
+    distanceVal = predictRange(current_time);//only reads clear once the tracker has let go of the obstacle, not on a missed echo
   }
-  else{
-    if(distanceVal < BLOCKAGE_TOLERANCE){
-      Serial.println("Blockade detected, executing evasion maneuver");
-      disableMovement();
-      updateState(BLOCKED);
-      // rotateByDegrees(95);
-      // idleWhileRotating();
-      // driveUnchecked(30);
-      // rotateToAngle(-90);
-      // idleWhileRotating();
-      // driveUnchecked(60);
-      // rotateByDegrees(-90);
-      // idleWhileRotating();
-      // driveUnchecked(30);
-      // rotateByDegrees(90);
-      // idleWhileRotating();
-    }
+  EvasionStatus status = continueEvasion(getEncoderData(LEFT), getEncoderData(RIGHT), getIRValues(), distanceVal, echo);
+  if(status == EVASION_CLEARED){
+    Serial.println("Blockade removed, resuming");
+    return EVENT_PATH_CLEAR;
+  }
+  if(status == EVASION_REJOINED){
+    Serial.println("evasion finished, line found");
+    dropRangeTrack();//the obstacle is beside or behind the robot now
+    return EVENT_LINE_FOUND;
+  }
+  if(status == EVASION_STOPPED){
+    Serial.println("obstacle did not go and cannot be detoured, stopping");
+  }
+  if(status == EVASION_FAILED){
+    Serial.println("evasion finished without finding the line, initiating sensing mode");
+    dropRangeTrack();
+    return EVENT_LINE_LOST;
   }
+  return EVENT_NONE;
 }
 
 /**
- * function to store the value of the current state and update it to the new input value
+ * read the line sensors until they see a line, or for timeoutMs. true when they did
  */
-void updateState(int NEW_STATE){
-  LAST_STATE = CURRENT_STATE;
-  CURRENT_STATE = NEW_STATE;
+FLASHMEM bool waitForLine(uint32_t timeoutMs){
+  uint32_t start = millis();
+  do{
+    getIRValues();
+    getLinePosition();
+    if(getLineReading().lineCount > 0){
+      return true;
+    }
+  }while(millis() - start < timeoutMs);
+  return false;
 }
 
 /**
- * function to revert to last known state. in the edge case where two states took over and we lost touch on normal, just set to normal
+ * hold in a loop until rotation has completed.
+ * prevents logic from executing while rotating
  */
-void revertState(){
-  CURRENT_STATE = LAST_STATE;
-  LAST_STATE = 0;
-  if(CURRENT_STATE == 0){
-    CURRENT_STATE = NORMAL;
+void idleWhileRotating(){
+  while(!continueRotating(getEncoderData(LEFT), getEncoderData(RIGHT))){
+    delay(5);//hold in non-sensing state until rotation is complete
+    updateTraction();
   }
 }
 
@@ -204,6 +307,18 @@ void revertState(){
  * function to record IR reflectance values for each degree of rotation and store in the irMAP array
  */
 void pollIRValueRadially(){
+  if(HEADING_ESTIMATOR){
+    //each degree the wheels turned, the lines crossed under the bar tell the estimator how far the robot did
+    std::array<int, 3> irValues = getIRValues();
+    getLinePosition();
+    observeLineUnderBar(getLineReading());
+    int degree = (int)floor(getWheelTurn()*180/M_PI);
+    //a wheel that slipped or stalled turned the robot by other than the wheels say, its readings would land off their degree
+    if(degree >= 0 && degree < IR_SCAN_DEGREES && !tractionLost()){
+      irScan[degree] = (irValues[0] +irValues[1] + irValues[2])/3;
+    }
+    return;
+  }
   int encoderCountLeft = getEncoderData(LEFT);
   if(encoderCountLeft % 10 == 0){
     std::array<int, 3> irValues = getIRValues();
@@ -215,55 +330,28 @@ void pollIRValueRadially(){
  * calculate and return the most likely direction of continued travel based on date in the irMAP
  */
 int getHeadingFromirMAP(){
-  int peaksCounter = 0;
-  int highestIndex = 180;
-  int highestValue = 0;
-
-  std::array<int, 360> peakValues;//shouldn't ever have more than a couple peakValues, bumping this up a lot just to prevent a crash
-  peakValues.fill(180);//fill with the backwards direction as this will be lowest priority but is logically a safe bet.
-
-  // for(int i = 5; i<354; i++){
-  //   Serial.printf("%i, %i\n", i, irMAP[i]);
-  // }
-  for(int i = 0; i<360; i++){
-    //Serial.printf("for irMAP index %i\n", i);
-    //generate map indicies
-    int mapIndices[11];
-    for(int j = -5; j < 6; j++){
-      int absoluteIndex = i+j;
-      if(absoluteIndex < 0){
-        mapIndices[j+5] = 360+absoluteIndex;//360-negative = less than 360
-      }
-      else if(absoluteIndex > 359){
-        mapIndices[j+5] = absoluteIndex - 360;//over 360 - 360 = low value
-      }
-      else{
-        mapIndices[j+5] = i+j;//normal
-      }
-      //Serial.printf("mapIndices index %i gets value%i\n", i, mapIndices[j+5]);
-    }
-
-    int lowAve = (irMAP[mapIndices[0]]+irMAP[mapIndices[1]]+irMAP[mapIndices[2]]+irMAP[mapIndices[3]]+irMAP[mapIndices[4]])/5;
-    int highAve = (irMAP[mapIndices[6]]+irMAP[mapIndices[7]]+irMAP[mapIndices[8]]+irMAP[mapIndices[9]]+irMAP[mapIndices[10]])/5;
-
-    if(irMAP[i] > lowAve && irMAP[i] >highAve){//if current value is greater than the average of the 10 values around it then it should be considered a peak
-      if(irMAP[i] >1500){//only count a potential peak if it is over 1500
-        Serial.printf("During irMAP evaluation found a peak of %i at %i\n", irMAP[i], i);
-        peakValues[peaksCounter] = i;
-        peaksCounter++;
+  if(HEADING_ESTIMATOR){
+    //each reading at the heading it was taken at by what the whole scan taught the estimator, the last of the turn where it went past full circle
+    memset(irMAP, 0, sizeof(irMAP));
+    for(int i = 0; i < IR_SCAN_DEGREES; i++){
+      if(irScan[i] > 0){
+        int degree = (int)floor(getHeadingAt(i*M_PI/180)*180/M_PI);
+        irMAP[(degree % 360 + 360) % 360] = irScan[i];
       }
     }
+  }
+  for(int i = 0; i<360; i++){
     Serial.printf("%i, %i\n", i, irMAP[i]);
   }
-  //TODO: test and adjust. peak detection and filtering seems to be working pretty well now.
-
-  for(int i = 0; i < 360; i++){
-    if(peakValues[i] < 150 || peakValues[i] > 210){//only proceed if not roughly behind, default highestValue of 180 covers situation where there are no peak values outside of this range
-      if(irMAP[peakValues[i]] > highestValue){
-        highestValue = irMAP[peakValues[i]];//update the reflectance value
-        highestIndex = peakValues[i];//update the index where the reflectance value was measured
-      }
-    }
+  //the branches are the stretches over IR_PEAK_THRESHOLD not roughly behind, JUNCTION_POLICY picks one of them
+  Junction junction;
+  classifyScan(irMAP, &junction);
+  chooseBranch(&junction);
+  int highestIndex = 180;//the backwards direction when there is no branch, logically a safe bet
+  if(junction.chosen >= 0){
+    highestIndex = (junction.branches[junction.chosen] + 360) % 360;
+    Serial.printf("During irMAP evaluation found a %s with %i branches, heading for %i\n",
+      junctionKindName(junction.kind), junction.branchCount, highestIndex);
   }
 
   offroadTimer = millis() + 1000;//give it  a second upon entering normal mode to get back on track